@@ -98,7 +98,7 @@ try:
 			masterversion = (1,4,0)
 		elif length==60:
 			masterversion = (1,5,0)
-		elif length==68:
+		elif length==68 or length==88:
 			masterversion = struct.unpack(">HBB",data[:4])
 except Exception:
 	print "Content-Type: text/html; charset=UTF-8"
@@ -186,6 +186,9 @@ else:
 		"CC":"Server Charts"
 	}
 	sectionorder=["IN","CS","HD","EX","MS","MO","QU","MC","CC"];
+if masterversion>=(1,6,21):
+	sectiondef["LA"]="Latency"
+	sectionorder.insert(sectionorder.index("MC"),"LA")
 
 print "Content-Type: text/html; charset=UTF-8"
 print
@@ -245,7 +248,10 @@ if "IN" in sectionset:
 		out = []
 		s = socket.socket()
 		s.connect((masterhost,masterport))
-		mysend(s,struct.pack(">LL",510,0))
+		if masterversion>=(1,6,21):
+			mysend(s,struct.pack(">LLB",510,1,1))
+		else:
+			mysend(s,struct.pack(">LL",510,0))
 		header = myrecv(s,8)
 		cmd,length = struct.unpack(">LL",header)
 		if cmd==511 and length==52:
@@ -308,9 +314,9 @@ if "IN" in sectionset:
 			out.append("""	<td align="right">%u</td>""" % tdcopies)
 			out.append("""</tr>""")
 			out.append("""</table>""")
-		elif cmd==511 and length==68:
+		elif cmd==511 and (length==68 or length==88):
 			data = myrecv(s,length)
-			v1,v2,v3,total,avail,trspace,trfiles,respace,refiles,nodes,dirs,files,chunks,allcopies,tdcopies = struct.unpack(">HBBQQQLQLLLLLLL",data)
+			v1,v2,v3,total,avail,trspace,trfiles,respace,refiles,nodes,dirs,files,chunks,allcopies,tdcopies = struct.unpack(">HBBQQQLQLLLLLLL",data[:68])
 			out.append("""<table class="FR" cellspacing="0">""")
 			out.append("""<tr><th colspan="13">Info</th></tr>""")
 			out.append("""<tr>""")
@@ -348,6 +354,25 @@ if "IN" in sectionset:
 			out.append("""	<td align="right">%u</td>""" % tdcopies)
 			out.append("""</tr>""")
 			out.append("""</table>""")
+			if length==88:
+				dcentries,dchits,dcmisses,dcinvalidated,dcexpired = struct.unpack(">LLLLL",data[68:])
+				out.append("""<table class="FR" cellspacing="0">""")
+				out.append("""<tr><th colspan="5">Data cache</th></tr>""")
+				out.append("""<tr>""")
+				out.append("""	<th><a style="cursor:default" title="(file,session) pairs allowed to keep data in client cache">entries</a></th>""")
+				out.append("""	<th><a style="cursor:default" title="opens with cached data kept">hits</a></th>""")
+				out.append("""	<th><a style="cursor:default" title="opens with cached data dropped">misses</a></th>""")
+				out.append("""	<th><a style="cursor:default" title="entries removed because file was modified by other session">invalidated</a></th>""")
+				out.append("""	<th><a style="cursor:default" title="entries removed because they were not used for a long time">expired</a></th>""")
+				out.append("""</tr>""")
+				out.append("""<tr>""")
+				out.append("""	<td align="right">%u</td>""" % dcentries)
+				out.append("""	<td align="right">%u</td>""" % dchits)
+				out.append("""	<td align="right">%u</td>""" % dcmisses)
+				out.append("""	<td align="right">%u</td>""" % dcinvalidated)
+				out.append("""	<td align="right">%u</td>""" % dcexpired)
+				out.append("""</tr>""")
+				out.append("""</table>""")
 		else:
 			out.append("""<table class="FR" cellspacing="0">""")
 			out.append("""<tr><td align="left">""")
@@ -958,12 +983,15 @@ if "HD" in sectionset:
 									sf = 0
 							else:
 								sf = 0
-							hdd.append((sf,path,flags,errchunkid,errtime,used,total,chunkscnt,0,0,0,0,0,0,0,0,0,0,0,0))
+							hdd.append((sf,path,flags,errchunkid,errtime,used,total,chunkscnt,0,0,0,0,0,0,0,0,0,0,0,0,None,None))
 					s.close()
 				else:
 					s = socket.socket()
 					s.connect((hostip,port))
-					mysend(s,struct.pack(">LL",600,0))
+					if (v1,v2,v3)>=(1,6,21):
+						mysend(s,struct.pack(">LLB",600,1,1))
+					else:
+						mysend(s,struct.pack(">LL",600,0))
 					header = myrecv(s,8)
 					cmd,length = struct.unpack(">LL",header)
 					if cmd==601:
@@ -981,6 +1009,17 @@ if "HD" in sectionset:
 								path = "%s:%u:%s" % (hostip,port,entry[1:plen+1])
 							flags,errchunkid,errtime,used,total,chunkscnt = struct.unpack(">BQLQQL",entry[plen+1:plen+34])
 							rbytes,wbytes,usecreadsum,usecwritesum,usecfsyncsum,rops,wops,fsyncops,usecreadmax,usecwritemax,usecfsyncmax = (0,0,0,0,0,0,0,0,0,0,0)
+							jqueued,jwait = (None,None)
+							fpolicy,fchunks = (None,None)
+							if entrysize>=plen+34+209:
+								fpolicy,fchunks = struct.unpack(">BL",entry[plen+34+204:plen+34+209])
+							if entrysize>=plen+34+204:
+								jqueued,jwaitavg,jwaitmax = struct.unpack(">LLL",entry[plen+34+192:plen+34+204])
+								if HDtime==1:
+									jwait = jwaitavg
+								else:
+									jwait = jwaitmax
+								entrysize = plen+34+192
 							if entrysize==plen+34+144:
 								if HDperiod==0:
 									rbytes,wbytes,usecreadsum,usecwritesum,rops,wops,usecreadmax,usecwritemax = struct.unpack(">QQQQLLLL",entry[plen+34:plen+34+48])
@@ -1044,6 +1083,10 @@ if "HD" in sectionset:
 								sf = wops
 							elif HDorder==12:
 								sf = fsyncops
+							elif HDorder==13:
+								sf = jqueued
+							elif HDorder==14:
+								sf = jwait
 							elif HDorder==20:
 								sf = used
 							elif HDorder==21:
@@ -1055,12 +1098,12 @@ if "HD" in sectionset:
 									sf = 0
 							else:
 								sf = 0
-							hdd.append((sf,path,flags,errchunkid,errtime,used,total,chunkscnt,rbw,wbw,rtime,wtime,fsynctime,rops,wops,fsyncops,rbytes,wbytes,usecreadsum,usecwritesum))
+							hdd.append((sf,path,flags,errchunkid,errtime,used,total,chunkscnt,rbw,wbw,rtime,wtime,fsynctime,rops,wops,fsyncops,rbytes,wbytes,usecreadsum,usecwritesum,jqueued,jwait,fpolicy,fchunks))
 					s.close()
 
 		if len(hdd)>0:
 			out.append("""<table class="FR" cellspacing="0">""")
-			out.append("""	<tr><th colspan="16">Disks</th></tr>""")
+			out.append("""	<tr><th colspan="18">Disks</th></tr>""")
 			out.append("""	<tr>""")
 			out.append("""		<th rowspan="3">#</th>""")
 			out.append("""		<th colspan="4" rowspan="2">info</th>""")
@@ -1070,6 +1113,7 @@ if "HD" in sectionset:
 				out.append("""		<th colspan="8">I/O stats last hour (switch to <a href="%s" class="VISIBLELINK">min</a>,<a href="%s" class="VISIBLELINK">day</a>)</th>""" % (createlink({"HDperiod":"0"}),createlink({"HDperiod":"2"})))
 			else:
 				out.append("""		<th colspan="8">I/O stats last min (switch to <a href="%s" class="VISIBLELINK">hour</a>,<a href="%s" class="VISIBLELINK">day</a>)</th>""" % (createlink({"HDperiod":"1"}),createlink({"HDperiod":"2"})))
+			out.append("""		<th colspan="2" rowspan="2"><a style="cursor:default" title="background jobs of this disk waiting for its workers">queue</a></th>""")
 			out.append("""		<th colspan="3" rowspan="2">space</th>""")
 			out.append("""	</tr>""")
 			out.append("""	<tr>""")
@@ -1132,6 +1176,18 @@ if "HD" in sectionset:
 				out.append("""		<th><a href="%s">fsync</a></th>""" % (createlink({"HDrev":"1"})))
 			else:
 				out.append("""		<th><a href="%s">fsync</a></th>""" % (createlink({"HDorder":"12","HDrev":"0"})))
+			if HDorder==13 and HDrev==0:
+				out.append("""		<th><a href="%s">jobs</a></th>""" % (createlink({"HDrev":"1"})))
+			else:
+				out.append("""		<th><a href="%s">jobs</a></th>""" % (createlink({"HDorder":"13","HDrev":"0"})))
+			if HDtime==1:
+				wtitle = "average time of waiting in queue (last minute)"
+			else:
+				wtitle = "max time of waiting in queue (last minute)"
+			if HDorder==14 and HDrev==0:
+				out.append("""		<th><a href="%s" title="%s">wait</a></th>""" % (createlink({"HDrev":"1"}),wtitle))
+			else:
+				out.append("""		<th><a href="%s" title="%s">wait</a></th>""" % (createlink({"HDorder":"14","HDrev":"0"}),wtitle))
 			if HDorder==20 and HDrev==0:
 				out.append("""		<th><a href="%s">used</a></th>""" % (createlink({"HDrev":"1"})))
 			else:
@@ -1149,7 +1205,7 @@ if "HD" in sectionset:
 			if HDrev:
 				hdd.reverse()
 			i = 1
-			for sf,path,flags,errchunkid,errtime,used,total,chunkscnt,rbw,wbw,rtime,wtime,fsynctime,rops,wops,fsyncops,rbytes,wbytes,rsum,wsum in hdd:
+			for sf,path,flags,errchunkid,errtime,used,total,chunkscnt,rbw,wbw,rtime,wtime,fsynctime,rops,wops,fsyncops,rbytes,wbytes,rsum,wsum,jqueued,jwait,fpolicy,fchunks in hdd:
 				if flags==1:
 					if masterversion>=(1,6,10):
 						status = 'marked for removal'
@@ -1183,7 +1239,15 @@ if "HD" in sectionset:
 					else:
 						wbsize = 0
 					out.append("""	<td align="right"><a style="cursor:default" title="%s B/s">%sB/s</a></td><td align="right"><a style="cursor:default" title="%s B">%sB/s</a></td>""" % (decimal_number(rbw),humanize_number(rbw,"&nbsp;"),decimal_number(wbw),humanize_number(wbw,"&nbsp;")))
-					out.append("""	<td align="right">%u us</td><td align="right">%u us</td><td align="right">%u us</td><td align="right"><a style="cursor:default" title="average block size: %u B">%u</a></td><td align="right"><a style="cursor:default" title="average block size: %u B">%u</a></td><td align="right">%u</td>""" % (rtime,wtime,fsynctime,rbsize,rops,wbsize,wops,fsyncops))
+					if fpolicy==None:
+						fsynctitle = ""
+					else:
+						fsynctitle = "fsync policy: %s, synced chunks: %u" % ({0:"immediate",1:"group",2:"deferred"}.get(fpolicy,"unknown"),fchunks)
+					out.append("""	<td align="right">%u us</td><td align="right">%u us</td><td align="right">%u us</td><td align="right"><a style="cursor:default" title="average block size: %u B">%u</a></td><td align="right"><a style="cursor:default" title="average block size: %u B">%u</a></td><td align="right"><a style="cursor:default" title="%s">%u</a></td>""" % (rtime,wtime,fsynctime,rbsize,rops,wbsize,wops,fsynctitle,fsyncops))
+				if jqueued==None:
+					out.append("""	<td>-</td><td>-</td>""")
+				else:
+					out.append("""	<td align="right">%u</td><td align="right">%u us</td>""" % (jqueued,jwait))
 				out.append("""	<td align="right"><a style="cursor:default" title="%s B">%sB</a></td><td align="right"><a style="cursor:default" title="%s B">%sB</a></td>""" % (decimal_number(used),humanize_number(used,"&nbsp;"),decimal_number(total),humanize_number(total,"&nbsp;")))
 #				out.append("""	<td align="right"><a style="cursor:default" title="%s B">%sB</a></td>""" % (decimal_number(total),humanize_number(total,"&nbsp;")))
 				if (total>0):
@@ -2226,6 +2290,176 @@ if "QU" in sectionset:
 
 	print """<br/>"""
 
+if "LA" in sectionset:
+	out = []
+
+	try:
+		LAorder = int(fields.getvalue("LAorder"))
+	except Exception:
+		LAorder = 0
+	try:
+		LArev = int(fields.getvalue("LArev"))
+	except Exception:
+		LArev = 0
+
+	def latency_str(usec):
+		if usec<1000:
+			return "%u&nbsp;us" % usec
+		elif usec<1000000:
+			return "%.1f&nbsp;ms" % (usec/1000.0)
+		else:
+			return "%.2f&nbsp;s" % (usec/1000000.0)
+
+	# upper bound of bucket containing given fraction of all events
+	def latency_percentile(buckets,count,fraction):
+		limit = count*fraction
+		acc = 0
+		for b,bcnt in enumerate(buckets):
+			acc += bcnt
+			if acc>=limit:
+				return (2<<b)-1
+		return (2<<(len(buckets)-1))-1
+
+	groups = {0:"main loop",1:"timer",2:"client message",3:"poll serve",4:"each loop"}
+
+	try:
+		out.append("""<table class="FR" cellspacing="0">""")
+		out.append("""<tr><th colspan="10">Master latency (since start, percentiles are upper bounds of log2 buckets)</th></tr>""")
+		out.append("""	<tr>""")
+		out.append("""		<th>#</th>""")
+		for col,name in ((1,"type"),(2,"name"),(3,"count"),(4,"total&nbsp;time"),(5,"avg"),(6,"p50"),(7,"p90"),(8,"p99"),(9,"max")):
+			if LAorder==col and LArev==0:
+				out.append("""		<th><a href="%s">%s</a></th>""" % (createlink({"LArev":"1"}),name))
+			else:
+				out.append("""		<th><a href="%s">%s</a></th>""" % (createlink({"LAorder":str(col),"LArev":"0"}),name))
+		out.append("""	</tr>""")
+
+		s = socket.socket()
+		s.connect((masterhost,masterport))
+		mysend(s,struct.pack(">LL",524,0))
+		header = myrecv(s,8)
+		cmd,length = struct.unpack(">LL",header)
+		if cmd==525 and length>=1:
+			data = myrecv(s,length)
+			bcnt = ord(data[0])
+			pos = 1
+			hists = []
+			while pos<length:
+				group,nleng = struct.unpack(">BB",data[pos:pos+2])
+				pos+=2
+				name = data[pos:pos+nleng]
+				pos+=nleng
+				count,total,maxusec = struct.unpack(">QQL",data[pos:pos+20])
+				pos+=20
+				buckets = struct.unpack(">"+"Q"*bcnt,data[pos:pos+8*bcnt])
+				pos+=8*bcnt
+				if count==0:
+					continue
+				avg = total/count
+				p50 = latency_percentile(buckets,count,0.5)
+				p90 = latency_percentile(buckets,count,0.9)
+				p99 = latency_percentile(buckets,count,0.99)
+				if LAorder==1:
+					sf = (group,name)
+				elif LAorder==2:
+					sf = name
+				elif LAorder==3:
+					sf = count
+				elif LAorder==5:
+					sf = avg
+				elif LAorder==6:
+					sf = p50
+				elif LAorder==7:
+					sf = p90
+				elif LAorder==8:
+					sf = p99
+				elif LAorder==9:
+					sf = maxusec
+				else:
+					sf = total
+				hists.append((sf,groups.get(group,"other"),name,count,total,avg,p50,p90,p99,maxusec))
+			hists.sort()
+			if (LAorder==0 or LAorder>=3)!=(LArev!=0):
+				hists.reverse()
+			i = 1
+			for sf,group,name,count,total,avg,p50,p90,p99,maxusec in hists:
+				out.append("""<tr class="C%u">""" % (((i-1)%2)+1))
+				out.append("""	<td align="right">%u</td>""" % i)
+				out.append("""	<td align="left">%s</td>""" % group)
+				out.append("""	<td align="left">%s</td>""" % htmlentities(name))
+				out.append("""	<td align="right">%s</td>""" % decimal_number(count))
+				out.append("""	<td align="right">%s</td>""" % latency_str(total))
+				out.append("""	<td align="right">%s</td>""" % latency_str(avg))
+				out.append("""	<td align="right">%s</td>""" % latency_str(p50))
+				out.append("""	<td align="right">%s</td>""" % latency_str(p90))
+				out.append("""	<td align="right">%s</td>""" % latency_str(p99))
+				out.append("""	<td align="right">%s</td>""" % latency_str(maxusec))
+				out.append("""</tr>""")
+				i+=1
+		out.append("""</table>""")
+		s.close()
+
+		s = socket.socket()
+		s.connect((masterhost,masterport))
+		mysend(s,struct.pack(">LL",526,0))
+		header = myrecv(s,8)
+		cmd,length = struct.unpack(">LL",header)
+		if cmd==527 and length>=4:
+			data = myrecv(s,length)
+			threshold = struct.unpack(">L",data[:4])[0]
+			pos = 4
+			out.append("""<br/>""")
+			out.append("""<table class="FR" cellspacing="0">""")
+			if threshold>0:
+				out.append("""<tr><th colspan="6">Main loop stalls (callbacks longer than %s, newest first)</th></tr>""" % latency_str(threshold))
+			else:
+				out.append("""<tr><th colspan="6">Main loop stalls (detector disabled)</th></tr>""")
+			out.append("""	<tr>""")
+			out.append("""		<th>#</th>""")
+			out.append("""		<th>time</th>""")
+			out.append("""		<th>type</th>""")
+			out.append("""		<th>name</th>""")
+			out.append("""		<th>duration</th>""")
+			out.append("""		<th>backtrace</th>""")
+			out.append("""	</tr>""")
+			i = 1
+			while pos<length:
+				stime,usec,group,nleng = struct.unpack(">LLBB",data[pos:pos+10])
+				pos+=10
+				name = data[pos:pos+nleng]
+				pos+=nleng
+				frames = ord(data[pos])
+				pos+=1
+				bt = []
+				for f in xrange(frames):
+					fleng = ord(data[pos])
+					pos+=1
+					bt.append(htmlentities(data[pos:pos+fleng]))
+					pos+=fleng
+				out.append("""<tr class="C%u">""" % (((i-1)%2)+1))
+				out.append("""	<td align="right">%u</td>""" % i)
+				out.append("""	<td align="center">%s</td>""" % time.asctime(time.localtime(stime)))
+				out.append("""	<td align="left">%s</td>""" % groups.get(group,"other"))
+				out.append("""	<td align="left">%s</td>""" % htmlentities(name))
+				out.append("""	<td align="right">%s</td>""" % latency_str(usec))
+				if bt:
+					out.append("""	<td align="left"><pre>%s</pre></td>""" % "\n".join(bt))
+				else:
+					out.append("""	<td align="center">-</td>""")
+				out.append("""</tr>""")
+				i+=1
+			out.append("""</table>""")
+		s.close()
+		print "\n".join(out)
+	except Exception:
+		print """<table class="FR" cellspacing="0">"""
+		print """<tr><td align="left"><pre>"""
+		traceback.print_exc(file=sys.stdout)
+		print """</pre></td></tr>"""
+		print """</table>"""
+
+	print """<br/>"""
+
 if "MC" in sectionset:
 	out = []
 
@@ -2436,6 +2670,9 @@ if "CC" in sectionset:
 				(20,'repl','number of chunk replications per minute'),
 				(21,'create','number of chunk creations per minute'),
 				(22,'delete','number of chunk deletions per minute'),
+				(108,'bcache','block cache - hits/misses (per minute)'),
+				(32,'crcbuffs','number of crc tables in use (opened chunks)'),
+				(33,'blockbuffs','number of preserved block buffers in use'),
 			)
 
 			out.append("""<script type="text/javascript">""")
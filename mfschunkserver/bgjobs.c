@@ -28,6 +28,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/time.h>
 
 #include "pcqueue.h"
 #include "datapack.h"
@@ -52,6 +53,7 @@ enum {
 	OP_OPEN,
 	OP_CLOSE,
 	OP_READ,
+	OP_READBLOCKS,
 	OP_WRITE,
 	OP_REPLICATE
 };
@@ -78,6 +80,23 @@ typedef struct _chunk_rd_args {
 	uint8_t *crcbuff;
 } chunk_rd_args;
 
+// for OP_READBLOCKS
+typedef struct _chunk_rb_args {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+	uint16_t blocks;
+	uint8_t *buffers[HDD_READ_MAXBLOCKS];
+	uint8_t *crcbuffs[HDD_READ_MAXBLOCKS];
+	int *sfd;
+	uint16_t *sblocks;
+	uint64_t *soffset;
+#ifdef HAVE_IO_URING
+	struct _jobpool *jp;	// for reads done by io_uring
+	uint32_t jobid;
+#endif
+} chunk_rb_args;
+
 // for OP_WRITE
 typedef struct _chunk_wr_args {
 	uint64_t chunkid;
@@ -100,21 +119,40 @@ typedef struct _job {
 	void *extra;
 	void *args;
 	uint8_t jstate;
+	uint64_t qtime;		// when queued (usec) - for folder queue wait stats
 	struct _job *next;
 } job;
 
-typedef struct _jobpool {
-	int rpipe,wpipe;
+struct _jobpool;
+
+// job queue with its own workers - one common (jobs not bound to any folder) and one per data folder
+typedef struct _jobqueue {
+	struct _jobpool *jp;
+	int32_t fid;		// -1 for common queue
 	uint8_t workers;
 	pthread_t *workerthreads;
+	void *jobqueue;
+} jobqueue;
+
+typedef struct _jobpool {
+	int rpipe,wpipe;
 	pthread_mutex_t pipelock;
 	pthread_mutex_t jobslock;
-	void *jobqueue;
+	jobqueue common;
+	jobqueue *folders;
+	uint32_t folderscnt;
 	void *statusqueue;
 	job* jobhash[JHASHSIZE];
 	uint32_t nextjobid;
+	uint32_t asyncjobs;	// jobs being done outside of workers (io_uring) - protected by jobslock
 } jobpool;
 
+static inline uint64_t job_usectime(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
+}
+
 static inline void job_send_status(jobpool *jp,uint32_t jobid,uint8_t status) {
 	eassert(pthread_mutex_lock(&(jp->pipelock))==0);
 	if (queue_isempty(jp->statusqueue)) {	// first status
@@ -142,20 +180,27 @@ static inline int job_receive_status(jobpool *jp,uint32_t *jobid,uint8_t *status
 #define opargs ((chunk_op_args*)(jptr->args))
 #define ocargs ((chunk_oc_args*)(jptr->args))
 #define rdargs ((chunk_rd_args*)(jptr->args))
+#define rbargs ((chunk_rb_args*)(jptr->args))
 #define wrargs ((chunk_wr_args*)(jptr->args))
 #define rpargs ((chunk_rp_args*)(jptr->args))
 void* job_worker(void *th_arg) {
-	jobpool *jp = (jobpool*)th_arg;
+	jobqueue *jq = (jobqueue*)th_arg;
+	jobpool *jp = jq->jp;
 	job *jptr;
 	uint8_t *jptrarg;
 	uint8_t status,jstate;
 	uint32_t jobid;
 	uint32_t op;
+	uint64_t waittime;
 
-//	syslog(LOG_NOTICE,"worker %p started (jobqueue: %p ; jptr:%p ; jptrarg:%p ; status:%p )",(void*)pthread_self(),jp->jobqueue,(void*)&jptr,(void*)&jptrarg,(void*)&status);
+//	syslog(LOG_NOTICE,"worker %p started (jobqueue: %p ; jptr:%p ; jptrarg:%p ; status:%p )",(void*)pthread_self(),jq->jobqueue,(void*)&jptr,(void*)&jptrarg,(void*)&status);
 	for (;;) {
-		queue_get(jp->jobqueue,&jobid,&op,&jptrarg,NULL);
+		queue_get(jq->jobqueue,&jobid,&op,&jptrarg,NULL);
 		jptr = (job*)jptrarg;
+		if (jptr!=NULL && jq->fid>=0) {
+			waittime = job_usectime()-jptr->qtime;
+			hdd_folder_job_started(jq->fid,(waittime>0xFFFFFFFF)?0xFFFFFFFF:waittime);
+		}
 		eassert(pthread_mutex_lock(&(jp->jobslock))==0);
 		if (jptr!=NULL) {
 			jstate=jptr->jstate;
@@ -190,6 +235,13 @@ void* job_worker(void *th_arg) {
 					status = hdd_read(rdargs->chunkid,rdargs->version,rdargs->blocknum,rdargs->buffer,rdargs->offset,rdargs->size,rdargs->crcbuff);
 				}
 				break;
+			case OP_READBLOCKS:
+				if (jstate==JSTATE_DISABLED) {
+					status = ERROR_NOTDONE;
+				} else {
+					status = hdd_read_blocks(rbargs->chunkid,rbargs->version,rbargs->blocknum,rbargs->blocks,rbargs->buffers,rbargs->crcbuffs,rbargs->sfd,rbargs->sblocks,rbargs->soffset);
+				}
+				break;
 			case OP_WRITE:
 				if (jstate==JSTATE_DISABLED) {
 					status = ERROR_NOTDONE;
@@ -205,15 +257,14 @@ void* job_worker(void *th_arg) {
 				}
 				break;
 			default: // OP_EXIT
-//				syslog(LOG_NOTICE,"worker %p exiting (jobqueue: %p)",(void*)pthread_self(),jp->jobqueue);
+//				syslog(LOG_NOTICE,"worker %p exiting (jobqueue: %p)",(void*)pthread_self(),jq->jobqueue);
 				return NULL;
 		}
 		job_send_status(jp,jobid,status);
 	}
 }
 
-static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callback)(uint8_t status,void *extra),void *extra) {
-//	jobpool* jp = (jobpool*)jpool;
+static inline job* job_register(jobpool *jp,void *args,void (*callback)(uint8_t status,void *extra),void *extra) {
 	uint32_t jobid = jp->nextjobid;
 	uint32_t jhpos = JHASHPOS(jobid);
 	job *jptr;
@@ -224,21 +275,94 @@ static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callbac
 	jptr->extra = extra;
 	jptr->args = args;
 	jptr->jstate = JSTATE_ENABLED;
+	jptr->qtime = 0;
 	jptr->next = jp->jobhash[jhpos];
 	jp->jobhash[jhpos] = jptr;
-	queue_put(jp->jobqueue,jobid,op,(uint8_t*)jptr,1);
 	jp->nextjobid++;
 	if (jp->nextjobid==0) {
 		jp->nextjobid=1;
 	}
-	return jobid;
+	return jptr;
+}
+
+// chunkid==0 - job not bound to any chunk (goes to common queue)
+static inline void job_enqueue(jobpool *jp,job *jptr,uint32_t op,uint64_t chunkid) {
+	uint32_t jobid = jptr->jobid;
+	int32_t fid;
+	fid = (chunkid>0 && jp->folderscnt>0)?hdd_chunk_folder(chunkid):-1;
+	if (fid>=0 && (uint32_t)fid<jp->folderscnt) {
+		jptr->qtime = job_usectime();
+		hdd_folder_job_queued(fid);
+		if (queue_tryput(jp->folders[fid].jobqueue,jobid,op,(uint8_t*)jptr,1)<0) {
+			// folder queue is full (slow or dead disk) - do not block other disks, finish job immediately
+			hdd_folder_job_rejected(fid);
+			if (op==OP_CLOSE) {	// close can't be dropped
+				queue_put(jp->common.jobqueue,jobid,op,(uint8_t*)jptr,1);
+			} else {
+				jptr->jstate = JSTATE_DISABLED;
+				job_send_status(jp,jobid,ERROR_NOTDONE);
+			}
+		}
+	} else {
+		queue_put(jp->common.jobqueue,jobid,op,(uint8_t*)jptr,1);
+	}
 }
 
+static inline uint32_t job_new(jobpool *jp,uint32_t op,void *args,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
+	job *jptr;
+	jptr = job_register(jp,args,callback,extra);
+	job_enqueue(jp,jptr,op,chunkid);
+	return jptr->jobid;
+}
+
+#ifdef HAVE_IO_URING
+// called by folder's io_uring reaper thread
+static void job_async_finished(uint8_t status,void *arg) {
+	chunk_rb_args *args = (chunk_rb_args*)arg;
+	jobpool *jp = args->jp;
+	uint32_t jobid = args->jobid;
+	// args are freed by main thread after receiving status
+	job_send_status(jp,jobid,status);
+	eassert(pthread_mutex_lock(&(jp->jobslock))==0);
+	jp->asyncjobs--;
+	eassert(pthread_mutex_unlock(&(jp->jobslock))==0);
+}
+#endif
+
 /* interface */
 
+static void job_queue_start(jobpool *jp,jobqueue *jq,int32_t fid,uint8_t workers,uint32_t jobs,pthread_attr_t *thattr) {
+	uint32_t i;
+	jq->jp = jp;
+	jq->fid = fid;
+	jq->workers = workers;
+	jq->workerthreads = malloc(sizeof(pthread_t)*workers);
+	passert(jq->workerthreads);
+	jq->jobqueue = queue_new(jobs);
+//	syslog(LOG_WARNING,"new jobqueue: %p",jq->jobqueue);
+	for (i=0 ; i<workers ; i++) {
+		eassert(pthread_create(jq->workerthreads+i,thattr,job_worker,jq)==0);
+	}
+}
+
+static void job_queue_stop(jobqueue *jq) {
+	uint32_t i;
+	for (i=0 ; i<jq->workers ; i++) {
+		queue_put(jq->jobqueue,0,OP_EXIT,NULL,1);
+	}
+	for (i=0 ; i<jq->workers ; i++) {
+		eassert(pthread_join(jq->workerthreads[i],NULL)==0);
+	}
+	sassert(queue_isempty(jq->jobqueue));
+//	syslog(LOG_NOTICE,"deleting jobqueue: %p",jq->jobqueue);
+	queue_delete(jq->jobqueue);
+	free(jq->workerthreads);
+}
+
 void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc) {
 	int fd[2];
-	uint32_t i;
+	uint32_t i,folderjobs;
+	uint8_t folderworkers;
 	pthread_attr_t thattr;
 	jobpool* jp;
 
@@ -251,23 +375,30 @@ void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc) {
 	*wakeupdesc = fd[0];
 	jp->rpipe = fd[0];
 	jp->wpipe = fd[1];
-	jp->workers = workers;
-	jp->workerthreads = malloc(sizeof(pthread_t)*workers);
-	passert(jp->workerthreads);
 	eassert(pthread_mutex_init(&(jp->pipelock),NULL)==0);
 	eassert(pthread_mutex_init(&(jp->jobslock),NULL)==0);
-	jp->jobqueue = queue_new(jobs);
-//	syslog(LOG_WARNING,"new jobqueue: %p",jp->jobqueue);
 	jp->statusqueue = queue_new(0);
 	for (i=0 ; i<JHASHSIZE ; i++) {
 		jp->jobhash[i]=NULL;
 	}
 	jp->nextjobid = 1;
+	jp->asyncjobs = 0;
 	eassert(pthread_attr_init(&thattr)==0);
 	eassert(pthread_attr_setstacksize(&thattr,0x100000)==0);
 	eassert(pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_JOINABLE)==0);
-	for (i=0 ; i<workers ; i++) {
-		eassert(pthread_create(jp->workerthreads+i,&thattr,job_worker,jp)==0);
+	job_queue_start(jp,&(jp->common),-1,workers,jobs,&thattr);
+	jp->folderscnt = hdd_folder_queues(&folderworkers,&folderjobs);
+	if (folderworkers==0) {	// per folder queues disabled
+		jp->folderscnt = 0;
+	}
+	if (jp->folderscnt>0) {
+		jp->folders = malloc(sizeof(jobqueue)*jp->folderscnt);
+		passert(jp->folders);
+		for (i=0 ; i<jp->folderscnt ; i++) {
+			job_queue_start(jp,jp->folders+i,i,folderworkers,folderjobs,&thattr);
+		}
+	} else {
+		jp->folders = NULL;
 	}
 	eassert(pthread_attr_destroy(&thattr)==0);
 	return jp;
@@ -275,7 +406,12 @@ void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc) {
 
 uint32_t job_pool_jobs_count(void *jpool) {
 	jobpool* jp = (jobpool*)jpool;
-	return queue_elements(jp->jobqueue);
+	uint32_t i,cnt;
+	cnt = queue_elements(jp->common.jobqueue);
+	for (i=0 ; i<jp->folderscnt ; i++) {
+		cnt += queue_elements(jp->folders[i].jobqueue);
+	}
+	return cnt;
 }
 
 void job_pool_disable_and_change_callback_all(void *jpool,void (*callback)(uint8_t status,void *extra)) {
@@ -352,24 +488,29 @@ void job_pool_check_jobs(void *jpool) {
 
 void job_pool_delete(void *jpool) {
 	jobpool* jp = (jobpool*)jpool;
-	uint32_t i;
-//	syslog(LOG_WARNING,"deleting pool of workers (%p:%"PRIu8")",(void*)jp,jp->workers);
-	for (i=0 ; i<jp->workers ; i++) {
-		queue_put(jp->jobqueue,0,OP_EXIT,NULL,1);
-	}
-	for (i=0 ; i<jp->workers ; i++) {
-		eassert(pthread_join(jp->workerthreads[i],NULL)==0);
+	uint32_t i,asyncjobs;
+//	syslog(LOG_WARNING,"deleting pool of workers (%p)",(void*)jp);
+	do {	// wait for reads done by io_uring
+		eassert(pthread_mutex_lock(&(jp->jobslock))==0);
+		asyncjobs = jp->asyncjobs;
+		eassert(pthread_mutex_unlock(&(jp->jobslock))==0);
+		if (asyncjobs>0) {
+			usleep(10000);
+		}
+	} while (asyncjobs>0);
+	for (i=0 ; i<jp->folderscnt ; i++) {
+		job_queue_stop(jp->folders+i);
 	}
-	sassert(queue_isempty(jp->jobqueue));
+	job_queue_stop(&(jp->common));
 	if (!queue_isempty(jp->statusqueue)) {
 		job_pool_check_jobs(jp);
 	}
-//	syslog(LOG_NOTICE,"deleting jobqueue: %p",jp->jobqueue);
-	queue_delete(jp->jobqueue);
 	queue_delete(jp->statusqueue);
 	eassert(pthread_mutex_destroy(&(jp->pipelock))==0);
 	eassert(pthread_mutex_destroy(&(jp->jobslock))==0);
-	free(jp->workerthreads);
+	if (jp->folders) {
+		free(jp->folders);
+	}
 	close(jp->rpipe);
 	close(jp->wpipe);
 	free(jp);
@@ -377,7 +518,7 @@ void job_pool_delete(void *jpool) {
 
 uint32_t job_inval(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra) {
 	jobpool* jp = (jobpool*)jpool;
-	return job_new(jp,OP_INVAL,NULL,callback,extra);
+	return job_new(jp,OP_INVAL,NULL,callback,extra,0);
 }
 
 uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t copychunkid,uint32_t copyversion,uint32_t length) {
@@ -391,7 +532,7 @@ uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),vo
 	args->copychunkid = copychunkid;
 	args->copyversion = copyversion;
 	args->length = length;
-	return job_new(jp,OP_CHUNKOP,args,callback,extra);
+	return job_new(jp,OP_CHUNKOP,args,callback,extra,chunkid);
 }
 
 uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
@@ -400,7 +541,7 @@ uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args = malloc(sizeof(chunk_oc_args));
 	passert(args);
 	args->chunkid = chunkid;
-	return job_new(jp,OP_OPEN,args,callback,extra);
+	return job_new(jp,OP_OPEN,args,callback,extra,chunkid);
 }
 
 uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid) {
@@ -409,7 +550,7 @@ uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args = malloc(sizeof(chunk_oc_args));
 	passert(args);
 	args->chunkid = chunkid;
-	return job_new(jp,OP_CLOSE,args,callback,extra);
+	return job_new(jp,OP_CLOSE,args,callback,extra,chunkid);
 }
 
 uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff) {
@@ -424,7 +565,48 @@ uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args->offset = offset;
 	args->size = size;
 	args->crcbuff = crcbuff;
-	return job_new(jp,OP_READ,args,callback,extra);
+	return job_new(jp,OP_READ,args,callback,extra,chunkid);
+}
+
+uint32_t job_read_blocks(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,int *sfd,uint16_t *sblocks,uint64_t *soffset) {
+	jobpool* jp = (jobpool*)jpool;
+	chunk_rb_args *args;
+	uint16_t i;
+	if (blocks==0 || blocks>HDD_READ_MAXBLOCKS) {
+		return job_inval(jpool,callback,extra);
+	}
+	args = malloc(sizeof(chunk_rb_args));
+	passert(args);
+	args->chunkid = chunkid;
+	args->version = version;
+	args->blocknum = blocknum;
+	args->blocks = blocks;
+	args->sfd = sfd;
+	args->sblocks = sblocks;
+	args->soffset = soffset;
+	for (i=0 ; i<blocks ; i++) {
+		args->buffers[i] = buffers[i];
+		args->crcbuffs[i] = crcbuffs[i];
+	}
+#ifdef HAVE_IO_URING
+	if (sfd==NULL) {	// data has to be read into buffers - try folder's io_uring first
+		job *jptr;
+		jptr = job_register(jp,args,callback,extra);
+		args->jp = jp;
+		args->jobid = jptr->jobid;
+		eassert(pthread_mutex_lock(&(jp->jobslock))==0);
+		jp->asyncjobs++;
+		eassert(pthread_mutex_unlock(&(jp->jobslock))==0);
+		if (hdd_read_blocks_async(chunkid,version,blocknum,blocks,args->buffers,args->crcbuffs,job_async_finished,args)==0) {
+			eassert(pthread_mutex_lock(&(jp->jobslock))==0);
+			jp->asyncjobs--;
+			eassert(pthread_mutex_unlock(&(jp->jobslock))==0);
+			job_enqueue(jp,jptr,OP_READBLOCKS,chunkid);
+		}
+		return jptr->jobid;
+	}
+#endif
+	return job_new(jp,OP_READBLOCKS,args,callback,extra,chunkid);
 }
 
 uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff) {
@@ -439,7 +621,7 @@ uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void
 	args->offset = offset;
 	args->size = size;
 	args->crcbuff = crcbuff;
-	return job_new(jp,OP_WRITE,args,callback,extra);
+	return job_new(jp,OP_WRITE,args,callback,extra,chunkid);
 }
 
 uint32_t job_replicate(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint8_t srccnt,const uint8_t *srcs) {
@@ -454,7 +636,7 @@ uint32_t job_replicate(void *jpool,void (*callback)(uint8_t status,void *extra),
 	args->version = version;
 	args->srccnt = srccnt;
 	memcpy(ptr,srcs,srccnt*18);
-	return job_new(jp,OP_REPLICATE,args,callback,extra);
+	return job_new(jp,OP_REPLICATE,args,callback,extra,0);
 }
 
 uint32_t job_replicate_simple(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint32_t ip,uint16_t port) {
@@ -472,5 +654,5 @@ uint32_t job_replicate_simple(void *jpool,void (*callback)(uint8_t status,void *
 	put32bit(&ptr,version);
 	put32bit(&ptr,ip);
 	put16bit(&ptr,port);
-	return job_new(jp,OP_REPLICATE,args,callback,extra);
+	return job_new(jp,OP_REPLICATE,args,callback,extra,0);
 }
@@ -21,6 +21,7 @@
 
 #include <inttypes.h>
 
+/* workers/jobs - common queue; chunk jobs go to queue of chunk's folder (workers and size from hdd_folder_queues) */
 void* job_pool_new(uint8_t workers,uint32_t jobs,int *wakeupdesc);
 uint32_t job_pool_jobs_count(void *jpool);
 void job_pool_disable_and_change_callback_all(void *jpool,void (*callback)(uint8_t status,void *extra));
@@ -44,6 +45,8 @@ uint32_t job_chunkop(void *jpool,void (*callback)(uint8_t status,void *extra),vo
 uint32_t job_open(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid);
 uint32_t job_close(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid);
 uint32_t job_read(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff);
+/* whole blocks: buffers[i] and crcbuffs[i] receive block blocknum+i (blocks <= HDD_READ_MAXBLOCKS), sfd/sblocks/soffset as in hdd_read_blocks */
+uint32_t job_read_blocks(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,int *sfd,uint16_t *sblocks,uint64_t *soffset);
 uint32_t job_write(void *jpool,void (*callback)(uint8_t status,void *extra),void *extra,uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff);
 
 /* srcs: srccnt * (chunkid:64 version:32 ip:32 port:16) */
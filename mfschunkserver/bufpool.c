@@ -0,0 +1,231 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <errno.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "massert.h"
+
+#define TCACHE_MAX 32
+#define TCACHE_BATCH 16
+
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+
+typedef struct _freebuff {
+	struct _freebuff *next;
+} freebuff;
+
+typedef struct _slab {
+	void *mem;
+	struct _slab *next;
+} slab;
+
+struct _bufpool;
+
+typedef struct _tcache {
+	struct _bufpool *pool;
+	uint32_t cnt;
+	void *buffs[TCACHE_MAX];
+	struct _tcache *next,**prev;
+} tcache;
+
+typedef struct _bufpool {
+	uint32_t bsize;
+	uint32_t perslab;
+	uint32_t total;
+	uint32_t freecnt;
+	freebuff *freehead;
+	slab *slabs;
+	tcache *tcaches;
+	pthread_key_t tckey;
+	pthread_mutex_t lock;
+} bufpool;
+
+// lock must be held
+static int bufpool_addslab(bufpool *p) {
+	slab *s;
+	uint8_t *mem;
+	freebuff *fb;
+	uint32_t i;
+	mem = mmap(NULL,(size_t)(p->bsize)*(p->perslab),PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
+	if (mem==MAP_FAILED) {
+		return -1;
+	}
+	s = (slab*)malloc(sizeof(slab));
+	passert(s);
+	s->mem = mem;
+	s->next = p->slabs;
+	p->slabs = s;
+	for (i=p->perslab ; i>0 ; i--) {
+		fb = (freebuff*)(mem+(size_t)(p->bsize)*(i-1));
+		fb->next = p->freehead;
+		p->freehead = fb;
+	}
+	p->freecnt += p->perslab;
+	p->total += p->perslab;
+	return 0;
+}
+
+// lock must be held
+static void bufpool_release(bufpool *p,tcache *tc,uint32_t cnt) {
+	freebuff *fb;
+	while (cnt>0 && tc->cnt>0) {
+		tc->cnt--;
+		fb = (freebuff*)(tc->buffs[tc->cnt]);
+		fb->next = p->freehead;
+		p->freehead = fb;
+		p->freecnt++;
+		cnt--;
+	}
+}
+
+static void bufpool_tcache_free(void *arg) {
+	tcache *tc = (tcache*)arg;
+	bufpool *p = tc->pool;
+	eassert(pthread_mutex_lock(&(p->lock))==0);
+	bufpool_release(p,tc,TCACHE_MAX);
+	*(tc->prev) = tc->next;
+	if (tc->next) {
+		tc->next->prev = tc->prev;
+	}
+	eassert(pthread_mutex_unlock(&(p->lock))==0);
+	free(tc);
+}
+
+static inline tcache* bufpool_tcache(bufpool *p) {
+	tcache *tc;
+	tc = pthread_getspecific(p->tckey);
+	if (tc==NULL) {
+		tc = (tcache*)malloc(sizeof(tcache));
+		passert(tc);
+		tc->pool = p;
+		tc->cnt = 0;
+		eassert(pthread_mutex_lock(&(p->lock))==0);
+		tc->next = p->tcaches;
+		if (tc->next) {
+			tc->next->prev = &(tc->next);
+		}
+		tc->prev = &(p->tcaches);
+		p->tcaches = tc;
+		eassert(pthread_mutex_unlock(&(p->lock))==0);
+		eassert(pthread_setspecific(p->tckey,tc)==0);
+	}
+	return tc;
+}
+
+void* bufpool_new(uint32_t bsize,uint32_t perslab,uint32_t preallocslabs) {
+	bufpool *p;
+	p = (bufpool*)malloc(sizeof(bufpool));
+	passert(p);
+	p->bsize = (bsize<sizeof(freebuff))?sizeof(freebuff):bsize;
+	p->perslab = perslab;
+	p->total = 0;
+	p->freecnt = 0;
+	p->freehead = NULL;
+	p->slabs = NULL;
+	p->tcaches = NULL;
+	eassert(pthread_key_create(&(p->tckey),bufpool_tcache_free)==0);
+	eassert(pthread_mutex_init(&(p->lock),NULL)==0);
+	while (preallocslabs>0) {
+		if (bufpool_addslab(p)<0) {
+			syslog(LOG_WARNING,"bufpool: can't preallocate slab (%"PRIu32" x %"PRIu32" bytes)",perslab,bsize);
+			break;
+		}
+		preallocslabs--;
+	}
+	return p;
+}
+
+// all threads using pool have to be finished (or not touch pool any more)
+void bufpool_delete(void *bp) {
+	bufpool *p = (bufpool*)bp;
+	slab *s,*sn;
+	tcache *tc,*tcn;
+	for (tc=p->tcaches ; tc ; tc=tcn) {
+		tcn = tc->next;
+		free(tc);
+	}
+	for (s=p->slabs ; s ; s=sn) {
+		sn = s->next;
+		munmap(s->mem,(size_t)(p->bsize)*(p->perslab));
+		free(s);
+	}
+	pthread_setspecific(p->tckey,NULL);
+	pthread_key_delete(p->tckey);
+	pthread_mutex_destroy(&(p->lock));
+	free(p);
+}
+
+void* bufpool_alloc(void *bp) {
+	bufpool *p = (bufpool*)bp;
+	tcache *tc;
+	freebuff *fb;
+	tc = bufpool_tcache(p);
+	if (tc->cnt==0) {
+		eassert(pthread_mutex_lock(&(p->lock))==0);
+		if (p->freehead==NULL && bufpool_addslab(p)<0) {
+			syslog(LOG_ERR,"bufpool: can't allocate slab (%"PRIu32" x %"PRIu32" bytes)",p->perslab,p->bsize);
+			abort();
+		}
+		while (tc->cnt<TCACHE_BATCH && p->freehead!=NULL) {
+			fb = p->freehead;
+			p->freehead = fb->next;
+			p->freecnt--;
+			tc->buffs[tc->cnt++] = fb;
+		}
+		eassert(pthread_mutex_unlock(&(p->lock))==0);
+	}
+	tc->cnt--;
+	return tc->buffs[tc->cnt];
+}
+
+void bufpool_free(void *bp,void *buff) {
+	bufpool *p = (bufpool*)bp;
+	tcache *tc;
+	tc = bufpool_tcache(p);
+	if (tc->cnt==TCACHE_MAX) {
+		eassert(pthread_mutex_lock(&(p->lock))==0);
+		bufpool_release(p,tc,TCACHE_BATCH);
+		eassert(pthread_mutex_unlock(&(p->lock))==0);
+	}
+	tc->buffs[tc->cnt++] = buff;
+}
+
+// used - buffers given to callers (buffers kept in per-thread caches are counted as free)
+void bufpool_stats(void *bp,uint32_t *total,uint32_t *used) {
+	bufpool *p = (bufpool*)bp;
+	tcache *tc;
+	uint32_t cached;
+	eassert(pthread_mutex_lock(&(p->lock))==0);
+	cached = 0;
+	for (tc=p->tcaches ; tc ; tc=tc->next) {
+		cached += tc->cnt;	// not locked - approximate value is good enough for stats
+	}
+	*total = p->total;
+	*used = p->total - p->freecnt - cached;
+	eassert(pthread_mutex_unlock(&(p->lock))==0);
+}
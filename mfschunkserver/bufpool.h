@@ -0,0 +1,31 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include <inttypes.h>
+
+// fixed size buffers carved from big slabs (one mapping per slab instead of one per buffer), with small per-thread caches
+void* bufpool_new(uint32_t bsize,uint32_t perslab,uint32_t preallocslabs);
+void bufpool_delete(void *bp);
+void* bufpool_alloc(void *bp);
+void bufpool_free(void *bp,void *buff);
+void bufpool_stats(void *bp,uint32_t *total,uint32_t *used);
+
+#endif
@@ -69,8 +69,12 @@
 #define CHARTS_TEST 27
 #define CHARTS_CHUNKIOJOBS 28
 #define CHARTS_CHUNKOPJOBS 29
+#define CHARTS_BCACHEHIT 30
+#define CHARTS_BCACHEMISS 31
+#define CHARTS_CRCBUFFS 32
+#define CHARTS_BLOCKBUFFS 33
 
-#define CHARTS 30
+#define CHARTS 34
 
 /* name , join mode , percent , scale , multiplier , divisor */
 #define STATDEFS { \
@@ -104,6 +108,10 @@
 	{"test"         ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{"chunkiojobs"  ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{"chunkopjobs"  ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"bcachehit"    ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"bcachemiss"   ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"crcbuffs"     ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{"blockbuffs"   ,CHARTS_MODE_MAX,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{NULL           ,0              ,0,0                 ,   0, 0}  \
 };
 
@@ -121,6 +129,7 @@
 	{CHARTS_DIRECT(CHARTS_LLOPR)       ,CHARTS_DIRECT(CHARTS_DATALLOPR)   ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{CHARTS_DIRECT(CHARTS_LLOPW)       ,CHARTS_DIRECT(CHARTS_DATALLOPW)   ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{CHARTS_DIRECT(CHARTS_CHUNKOPJOBS) ,CHARTS_DIRECT(CHARTS_CHUNKIOJOBS) ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
+	{CHARTS_DIRECT(CHARTS_BCACHEHIT)   ,CHARTS_DIRECT(CHARTS_BCACHEMISS)  ,CHARTS_NONE                       ,CHARTS_MODE_ADD,0,CHARTS_SCALE_NONE ,   1, 1}, \
 	{CHARTS_NONE                       ,CHARTS_NONE                       ,CHARTS_NONE                       ,0              ,0,0                 ,   0, 0}  \
 };
 
@@ -233,6 +242,12 @@ void chartsdata_refresh(void) {
 	data[CHARTS_TRUNCATE]=op_tr;
 	data[CHARTS_DUPTRUNC]=op_dt;
 	data[CHARTS_TEST]=op_te;
+	hdd_bcache_stats(&bin,&bout);
+	data[CHARTS_BCACHEHIT]=bin;
+	data[CHARTS_BCACHEMISS]=bout;
+	hdd_bufpool_stats(&bin,&bout);
+	data[CHARTS_CRCBUFFS]=bin;
+	data[CHARTS_BLOCKBUFFS]=bout;
 
 	charts_add(data,main_time()-60);
 }
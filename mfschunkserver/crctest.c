@@ -0,0 +1,193 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// crc self-test ("make check") - checks every mycrc32 / mycrc32_combine variant (slice-by-16 and PCLMUL when cpu has it) against plain bitwise crc
+// usage: mfscrctest [-b] (-b - also measure speed of each variant)
+
+// crc.c is included to switch variants (crc_pclmul) without exporting anything from it
+#include "crc.c"
+#include "crc.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define BLOCKSIZE 0x10000
+#define BUFFSIZE (BLOCKSIZE*4+256)
+
+static uint32_t ref_table[256];
+static const uint8_t zeros[BLOCKSIZE];
+
+static void ref_init(void) {
+	uint32_t crc,i,j;
+	for (i=0 ; i<256 ; i++) {
+		crc=i;
+		for (j=0 ; j<8 ; j++) {
+			if (crc & 1) {
+				crc = (crc >> 1) ^ CRC_POLY;
+			} else {
+				crc >>= 1;
+			}
+		}
+		ref_table[i] = crc;
+	}
+}
+
+static uint32_t ref_crc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
+	crc^=0xFFFFFFFF;
+	while (leng>0) {
+		crc = (crc>>8) ^ ref_table[(crc^(*block++)) & 0xFF];
+		leng--;
+	}
+	return crc^0xFFFFFFFF;
+}
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void) {
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 16) ^ (rnd_state << 16);
+}
+
+static uint32_t errors = 0;
+
+static void check(const char *what,const char *variant,uint32_t got,uint32_t expected,uint32_t a,uint32_t b) {
+	if (got!=expected) {
+		errors++;
+		if (errors<=10) {
+			printf("%s (%s) mismatch: %08"PRIX32" != %08"PRIX32" (args: %"PRIu32",%"PRIu32")\n",what,variant,got,expected,a,b);
+		}
+	}
+}
+
+static void test_variant(const char *variant,const uint8_t *buff) {
+	uint32_t i,off,leng,leng2,seed,crc1,crc2,crc12;
+
+	// every short length at every alignment (head, sixteen-byte and tail loops)
+	for (off=0 ; off<16 ; off++) {
+		for (leng=0 ; leng<=300 ; leng++) {
+			seed = rnd();
+			check("mycrc32",variant,mycrc32(seed,buff+off,leng),ref_crc32(seed,buff+off,leng),off,leng);
+		}
+	}
+	// whole blocks and random long ranges
+	for (off=0 ; off<4 ; off++) {
+		check("mycrc32",variant,mycrc32(0,buff+off,BLOCKSIZE),ref_crc32(0,buff+off,BLOCKSIZE),off,BLOCKSIZE);
+	}
+	for (i=0 ; i<200 ; i++) {
+		off = rnd()%256;
+		leng = rnd()%(BUFFSIZE-256);
+		seed = rnd();
+		check("mycrc32",variant,mycrc32(seed,buff+off,leng),ref_crc32(seed,buff+off,leng),off,leng);
+	}
+	// combine: crc(A|B) from crc(A) and crc(B)
+	for (i=0 ; i<2000 ; i++) {
+		leng = rnd()%2000;
+		leng2 = (i&1)?(rnd()%(BUFFSIZE-4096)):(rnd()%2000);
+		crc1 = ref_crc32(0,buff,leng);
+		crc2 = ref_crc32(0,buff+leng,leng2);
+		crc12 = ref_crc32(0,buff,leng+leng2);
+		check("mycrc32_combine",variant,mycrc32_combine(crc1,crc2,leng2),crc12,leng,leng2);
+	}
+	// appending zeros (used for sparse blocks)
+	for (i=0 ; i<100 ; i++) {
+		leng = rnd()%1000;
+		leng2 = rnd()%BLOCKSIZE;
+		crc1 = ref_crc32(0,buff,leng);
+		crc12 = ref_crc32(crc1,zeros,leng2);
+		check("mycrc32_zeroblock",variant,mycrc32_zeroblock(crc1,leng2),crc12,leng,leng2);
+	}
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+static void bench_variant(const char *variant,const uint8_t *buff) {
+	uint32_t i,crc;
+	double st,t;
+
+	crc = 0;
+	st = now();
+	for (i=0 ; i<8192 ; i++) {
+		crc ^= mycrc32(0,buff+(i&3)*BLOCKSIZE,BLOCKSIZE);
+	}
+	t = now()-st;
+	printf("%s: mycrc32 (64KiB blocks): %.1lf MB/s",variant,(8192.0*BLOCKSIZE)/(t*1000000.0));
+	st = now();
+	for (i=0 ; i<1000000 ; i++) {
+		crc = mycrc32_combine(crc,i,(i*2654435761U)>>8);
+	}
+	t = now()-st;
+	printf(" ; mycrc32_combine: %.0lf/s (%08"PRIX32")\n",1000000.0/t,crc);
+}
+
+int main(int argc,char **argv) {
+	uint8_t *buff;
+	uint32_t i;
+	int ch,bench;
+
+	bench = 0;
+	while ((ch = getopt(argc,argv,"b")) != -1) {
+		switch (ch) {
+			case 'b':
+				bench = 1;
+				break;
+			default:
+				fprintf(stderr,"usage: %s [-b]\n",argv[0]);
+				return 1;
+		}
+	}
+
+	buff = malloc(BUFFSIZE);
+	if (buff==NULL) {
+		printf("out of memory\n");
+		return 1;
+	}
+	for (i=0 ; i<BUFFSIZE ; i++) {
+		buff[i] = rnd()>>24;
+	}
+	ref_init();
+	mycrc32_init();
+
+#ifdef HAVE_PCLMUL
+	if (crc_pclmul) {
+		test_variant("pclmul",buff);
+		if (bench) {
+			bench_variant("pclmul",buff);
+		}
+		crc_pclmul = 0;
+	} else {
+		printf("cpu without PCLMULQDQ - only table variant tested\n");
+	}
+#endif
+	test_variant("tables",buff);
+	if (bench) {
+		bench_variant("tables",buff);
+	}
+
+	free(buff);
+	if (errors) {
+		printf("crc self-test: %"PRIu32" errors\n",errors);
+		return 1;
+	}
+	printf("crc self-test: ok\n");
+	return 0;
+}
@@ -23,7 +23,11 @@
 
 #include <time.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -56,6 +60,13 @@
 
 #define MaxPacketSize 100000
 
+// max number of packets sent with one writev
+#define CSSERV_IOVMAX 32
+
+#if defined(HAVE_SYS_SENDFILE_H) && defined(HAVE_SENDFILE)
+#define CSSERV_SENDFILE 1
+#endif
+
 //csserventry.mode
 enum {HEADER,DATA};
 //csserventry.state
@@ -68,11 +79,20 @@ typedef struct writestatus {
 } writestatus;
 #endif
 
+// chunk file descriptor shared by packets which data is sent directly from file
+typedef struct sendsrc {
+	int fd;
+	uint32_t refs;
+} sendsrc;
+
 typedef struct packetstruct {
 	struct packetstruct *next;
 	uint8_t *startptr;
 	uint32_t bytesleft;
 	uint8_t *packet;
+	sendsrc *src;			// after 'packet' send 'srcleft' bytes from 'src' file at 'srcoffset'
+	uint64_t srcoffset;
+	uint32_t srcleft;
 } packetstruct;
 
 typedef struct csserventry {
@@ -108,10 +128,16 @@ typedef struct csserventry {
 	/* read */
 	uint32_t rjobid;
 	uint8_t todocnt;		// R (read finished + send finished)
+	uint8_t rpacketcnt;		// R (number of packets filled by current read job)
 
 	/* common for read and write but meaning is different !!! */
-	void *rpacket;
+	void *rpackets[HDD_READ_MAXBLOCKS];
 	void *wpacket;
+
+	/* zero-copy read (filled by current read job) */
+	int rsfd;
+	uint16_t rsblocks;
+	uint64_t rsoffset;
 #endif
 
 	uint8_t chunkisopen;
@@ -155,6 +181,9 @@ static uint32_t stats_maxjobscnt=0;
 // from config
 static char *ListenHost;
 static char *ListenPort;
+#ifdef CSSERV_SENDFILE
+static uint8_t SendFile;
+#endif
 
 void csserv_stats(uint32_t *bin,uint32_t *bout,uint32_t *hlopr,uint32_t *hlopw,uint32_t *maxjobscnt) {
 	*bin = stats_bytesin;
@@ -184,6 +213,9 @@ void* csserv_create_detached_packet(uint32_t type,uint32_t size) {
 	put32bit(&ptr,type);
 	put32bit(&ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->src = NULL;
+	outpacket->srcoffset = 0;
+	outpacket->srcleft = 0;
 	outpacket->next = NULL;
 	return outpacket;
 }
@@ -195,7 +227,16 @@ uint8_t* csserv_get_packet_data(void *packet) {
 
 void csserv_delete_packet(void *packet) {
 	packetstruct *outpacket = (packetstruct*)packet;
-	free(outpacket->packet);
+	if (outpacket->src) {
+		outpacket->src->refs--;
+		if (outpacket->src->refs==0) {
+			close(outpacket->src->fd);
+			free(outpacket->src);
+		}
+	}
+	if (outpacket->packet) {
+		free(outpacket->packet);
+	}
 	free(outpacket);
 }
 
@@ -233,6 +274,9 @@ uint8_t* csserv_create_attached_packet(csserventry *eptr,uint32_t type,uint32_t
 	put32bit(&ptr,type);
 	put32bit(&ptr,size);
 	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->src = NULL;
+	outpacket->srcoffset = 0;
+	outpacket->srcleft = 0;
 	outpacket->next = NULL;
 	*(eptr->outputtail) = outpacket;
 	eptr->outputtail = &(outpacket->next);
@@ -341,20 +385,53 @@ void csserv_delayed_close(uint8_t status,void *e) {
 
 void csserv_read_continue(csserventry *eptr);
 
+// blocks verified in chunk file - keep only packet headers and send data from file
+void csserv_attach_sendsrc(csserventry *eptr) {
+	packetstruct *pack;
+	sendsrc *src;
+	uint16_t i;
+
+	src = malloc(sizeof(sendsrc));
+	passert(src);
+	src->fd = eptr->rsfd;
+	src->refs = 0;
+	for (i=0 ; i<eptr->rsblocks && i<eptr->rpacketcnt ; i++) {
+		pack = (packetstruct*)(eptr->rpackets[i]);
+		pack->bytesleft = 8+8+2+2+4+4;
+		pack->packet = realloc(pack->packet,pack->bytesleft);
+		passert(pack->packet);
+		pack->startptr = pack->packet;
+		pack->src = src;
+		pack->srcoffset = eptr->rsoffset+(((uint32_t)i)<<16);
+		pack->srcleft = 0x10000;
+		src->refs++;
+	}
+	if (src->refs==0) {
+		close(src->fd);
+		free(src);
+	}
+	eptr->rsfd = -1;
+	eptr->rsblocks = 0;
+}
+
 void csserv_read_finished(uint8_t status,void *e) {
 	csserventry *eptr = (csserventry*)e;
 	uint8_t *ptr;
+	uint8_t i;
 	eptr->rjobid=0;
 	if (status==STATUS_OK) {
+		if (eptr->rsfd>=0) {
+			csserv_attach_sendsrc(eptr);
+		}
 		eptr->todocnt--;
 		if (eptr->todocnt==0) {
 			csserv_read_continue(eptr);
 		}
 	} else {
-		if (eptr->rpacket) {
-			csserv_delete_packet(eptr->rpacket);
-			eptr->rpacket = NULL;
+		for (i=0 ; i<eptr->rpacketcnt ; i++) {
+			csserv_delete_packet(eptr->rpackets[i]);
 		}
+		eptr->rpacketcnt = 0;
 		ptr = csserv_create_attached_packet(eptr,CSTOCU_READ_STATUS,8+1);
 		put64bit(&ptr,eptr->chunkid);
 		put8bit(&ptr,status);
@@ -374,14 +451,17 @@ void csserv_send_finished(csserventry *eptr) {
 void csserv_read_continue(csserventry *eptr) {
 	uint16_t blocknum;
 	uint16_t blockoffset;
+	uint16_t blocks,i;
 	uint32_t size;
 	uint8_t *ptr;
+	uint8_t *buffers[HDD_READ_MAXBLOCKS];
+	uint8_t *crcbuffs[HDD_READ_MAXBLOCKS];
 
-	if (eptr->rpacket) {
-		csserv_attach_packet(eptr,eptr->rpacket);
-		eptr->rpacket=NULL;
+	for (i=0 ; i<eptr->rpacketcnt ; i++) {
+		csserv_attach_packet(eptr,eptr->rpackets[i]);
 		eptr->todocnt++;
 	}
+	eptr->rpacketcnt = 0;
 	if (eptr->size==0) {	// everything have been read
 		ptr = csserv_create_attached_packet(eptr,CSTOCU_READ_STATUS,8+1);
 		put64bit(&ptr,eptr->chunkid);
@@ -392,18 +472,44 @@ void csserv_read_continue(csserventry *eptr) {
 	} else {
 		blocknum = (eptr->offset)>>16;
 		blockoffset = (eptr->offset)&0xFFFF;
-		if (((eptr->offset+eptr->size-1)>>16) == blocknum) {	// last block
-			size = eptr->size;
+		blocks = (blockoffset==0)?((eptr->size)>>16):0;	// whole blocks left
+		if (blocks>HDD_READ_MAXBLOCKS) {
+			blocks = HDD_READ_MAXBLOCKS;
+		}
+		if (blocks>=2) {	// run of whole blocks - one vectored read, one packet per block (as before)
+			for (i=0 ; i<blocks ; i++) {
+				eptr->rpackets[i] = csserv_create_detached_packet(CSTOCU_READ_DATA,8+2+2+4+4+0x10000);
+				ptr = csserv_get_packet_data(eptr->rpackets[i]);
+				put64bit(&ptr,eptr->chunkid);
+				put16bit(&ptr,blocknum+i);
+				put16bit(&ptr,0);
+				put32bit(&ptr,0x10000);
+				crcbuffs[i] = ptr;
+				buffers[i] = ptr+4;
+			}
+			eptr->rpacketcnt = blocks;
+			size = ((uint32_t)blocks)<<16;
+#ifdef CSSERV_SENDFILE
+			if (SendFile) {
+				eptr->rjobid = job_read_blocks(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,blocks,buffers,crcbuffs,&(eptr->rsfd),&(eptr->rsblocks),&(eptr->rsoffset));
+			} else
+#endif
+			eptr->rjobid = job_read_blocks(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,blocks,buffers,crcbuffs,NULL,NULL,NULL);
 		} else {
-			size = 0x10000-blockoffset;
+			if (((eptr->offset+eptr->size-1)>>16) == blocknum) {	// last block
+				size = eptr->size;
+			} else {
+				size = 0x10000-blockoffset;
+			}
+			eptr->rpackets[0] = csserv_create_detached_packet(CSTOCU_READ_DATA,8+2+2+4+4+size);
+			ptr = csserv_get_packet_data(eptr->rpackets[0]);
+			put64bit(&ptr,eptr->chunkid);
+			put16bit(&ptr,blocknum);
+			put16bit(&ptr,blockoffset);
+			put32bit(&ptr,size);
+			eptr->rpacketcnt = 1;
+			eptr->rjobid = job_read(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,ptr+4,blockoffset,size,ptr);
 		}
-		eptr->rpacket = csserv_create_detached_packet(CSTOCU_READ_DATA,8+2+2+4+4+size);
-		ptr = csserv_get_packet_data(eptr->rpacket);
-		put64bit(&ptr,eptr->chunkid);
-		put16bit(&ptr,blocknum);
-		put16bit(&ptr,blockoffset);
-		put32bit(&ptr,size);
-		eptr->rjobid = job_read(jpool,csserv_read_finished,eptr,eptr->chunkid,eptr->version,blocknum,ptr+4,blockoffset,size,ptr);
 		if (eptr->rjobid==0) {
 			eptr->state = CLOSE;
 			return;
@@ -1050,16 +1156,17 @@ void csserv_hdd_list_v1(csserventry *eptr,const uint8_t *data,uint32_t length) {
 void csserv_hdd_list_v2(csserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint32_t l;
 	uint8_t *ptr;
+	uint8_t listver;
 
-	(void)data;
-	if (length!=0) {
-		syslog(LOG_NOTICE,"CUTOCS_HDD_LIST(2) - wrong size (%"PRIu32"/0)",length);
+	if (length!=0 && length!=1) {
+		syslog(LOG_NOTICE,"CUTOCS_HDD_LIST(2) - wrong size (%"PRIu32"/0|1)",length);
 		eptr->state = CLOSE;
 		return;
 	}
-	l = hdd_diskinfo_v2_size();	// lock
+	listver = (length==1)?get8bit(&data):0;	// extended entries only on request - older cgi accepts only exact entry sizes
+	l = hdd_diskinfo_v2_size(listver);	// lock
 	ptr = csserv_create_attached_packet(eptr,CSTOCU_HDD_LIST_V2,l);
-	hdd_diskinfo_v2_data(ptr);	// unlock
+	hdd_diskinfo_v2_data(ptr,listver);	// unlock
 }
 
 void csserv_chart(csserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -1250,15 +1357,15 @@ void csserv_term(void) {
 			wptr = wptr->next;
 			free(waptr);
 		}
+		if (eptr->rsfd>=0) {
+			close(eptr->rsfd);
+		}
 #endif
 		pptr = eptr->outputhead;
 		while (pptr) {
-			if (pptr->packet) {
-				free(pptr->packet);
-			}
 			paptr = pptr;
 			pptr = pptr->next;
-			free(paptr);
+			csserv_delete_packet(paptr);
 		}
 		eaptr = eptr;
 		eptr = eptr->next;
@@ -1623,12 +1730,77 @@ void csserv_read(csserventry *eptr) {
 void csserv_write(csserventry *eptr) {
 	packetstruct *pack;
 	int32_t i;
+#ifdef HAVE_WRITEV
+	struct iovec iov[CSSERV_IOVMAX];
+	uint32_t n;
+	uint8_t more;
+#endif
+#ifdef CSSERV_SENDFILE
+	off_t soff;
+#ifdef MSG_MORE
+	struct msghdr msg;
+#endif
+#endif
 	for (;;) {
 		pack = eptr->outputhead;
 		if (pack==NULL) {
 			return;
 		}
+#ifdef CSSERV_SENDFILE
+		if (pack->bytesleft==0 && pack->srcleft>0) {	// header already sent - data goes directly from chunk file
+			soff = pack->srcoffset;
+			i=sendfile(eptr->sock,pack->src->fd,&soff,pack->srcleft);
+			if (i<0) {
+				if (errno!=EAGAIN) {
+					mfs_errlog_silent(LOG_NOTICE,"(write) sendfile error");
+					eptr->state = CLOSE;
+				}
+				return;
+			}
+			if (i==0) {	// file truncated meanwhile
+				syslog(LOG_NOTICE,"(write) sendfile: unexpected end of file");
+				eptr->state = CLOSE;
+				return;
+			}
+			stats_bytesout+=i;
+			pack->srcoffset+=i;
+			pack->srcleft-=i;
+			if (pack->srcleft>0) {
+				return;
+			}
+			eptr->outputhead = pack->next;
+			if (eptr->outputhead==NULL) {
+				eptr->outputtail = &(eptr->outputhead);
+			}
+			csserv_delete_packet(pack);
+			csserv_outputcheck(eptr);
+			continue;
+		}
+#endif
+#ifdef HAVE_WRITEV
+		// gathered write of queued packets (read data is queued as many packets)
+		more = 0;
+		for (n=0 ; pack!=NULL && n<CSSERV_IOVMAX ; pack=pack->next) {
+			iov[n].iov_base = pack->startptr;
+			iov[n].iov_len = pack->bytesleft;
+			n++;
+			if (pack->srcleft>0) {	// rest of this packet has to be sent from file
+				more = 1;
+				break;
+			}
+		}
+#if defined(CSSERV_SENDFILE) && defined(MSG_MORE)
+		if (more) {	// do not push header alone - data follows
+			memset(&msg,0,sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = n;
+			i=sendmsg(eptr->sock,&msg,MSG_MORE);
+		} else
+#endif
+		i=writev(eptr->sock,iov,n);
+#else
 		i=write(eptr->sock,pack->startptr,pack->bytesleft);
+#endif
 		if (i==0) {
 //			syslog(LOG_NOTICE,"(write) connection closed");
 			eptr->state = CLOSE;
@@ -1642,18 +1814,43 @@ void csserv_write(csserventry *eptr) {
 			return;
 		}
 		stats_bytesout+=i;
+#ifdef HAVE_WRITEV
+		while (i>0) {
+			pack = eptr->outputhead;
+			if ((uint32_t)i<pack->bytesleft) {
+				pack->startptr+=i;
+				pack->bytesleft-=i;
+				return;
+			}
+			i-=pack->bytesleft;
+			pack->startptr+=pack->bytesleft;
+			pack->bytesleft=0;
+			if (pack->srcleft>0) {
+				break;
+			}
+			eptr->outputhead = pack->next;
+			if (eptr->outputhead==NULL) {
+				eptr->outputtail = &(eptr->outputhead);
+			}
+			csserv_delete_packet(pack);
+			csserv_outputcheck(eptr);
+		}
+#else
 		pack->startptr+=i;
 		pack->bytesleft-=i;
 		if (pack->bytesleft>0) {
 			return;
 		}
-		free(pack->packet);
+		if (pack->srcleft>0) {
+			continue;
+		}
 		eptr->outputhead = pack->next;
 		if (eptr->outputhead==NULL) {
 			eptr->outputtail = &(eptr->outputhead);
 		}
-		free(pack);
+		csserv_delete_packet(pack);
 		csserv_outputcheck(eptr);
+#endif
 	}
 }
 
@@ -1793,6 +1990,7 @@ void csserv_serve(struct pollfd *pdesc) {
 #endif
 	int ns;
 	uint8_t lstate;
+	uint8_t i;
 
 	if (lsockpdescpos>=0 && (pdesc[lsockpdescpos].revents & POLLIN)) {
 //	if (FD_ISSET(lsock,rset)) {
@@ -1838,8 +2036,12 @@ void csserv_serve(struct pollfd *pdesc) {
 				eptr->rjobid = 0;
 				eptr->todocnt = 0;
 
-				eptr->rpacket = NULL;
+				eptr->rpacketcnt = 0;
 				eptr->wpacket = NULL;
+
+				eptr->rsfd = -1;
+				eptr->rsblocks = 0;
+				eptr->rsoffset = 0;
 			}
 #endif
 		}
@@ -1924,8 +2126,11 @@ void csserv_serve(struct pollfd *pdesc) {
 	while ((eptr=*kptr)) {
 		if (eptr->state == CLOSED) {
 			tcpclose(eptr->sock);
-			if (eptr->rpacket) {
-				csserv_delete_packet(eptr->rpacket);
+			for (i=0 ; i<eptr->rpacketcnt ; i++) {
+				csserv_delete_packet(eptr->rpackets[i]);
+			}
+			if (eptr->rsfd>=0) {
+				close(eptr->rsfd);
 			}
 			if (eptr->wpacket) {
 				csserv_delete_preserved(eptr->wpacket);
@@ -1952,12 +2157,9 @@ void csserv_serve(struct pollfd *pdesc) {
 #endif
 			pptr = eptr->outputhead;
 			while (pptr) {
-				if (pptr->packet) {
-					free(pptr->packet);
-				}
 				paptr = pptr;
 				pptr = pptr->next;
-				free(paptr);
+				csserv_delete_packet(paptr);
 			}
 			*kptr = eptr->next;
 			free(eptr);
@@ -1978,6 +2180,13 @@ uint16_t csserv_getlistenport() {
 int csserv_init(void) {
 	ListenHost = cfg_getstr("CSSERV_LISTEN_HOST","*");
 	ListenPort = cfg_getstr("CSSERV_LISTEN_PORT","9422");
+#ifdef CSSERV_SENDFILE
+	SendFile = cfg_getuint8("CSSERV_SENDFILE",0);
+#else
+	if (cfg_getuint8("CSSERV_SENDFILE",0)) {
+		syslog(LOG_NOTICE,"main server module: CSSERV_SENDFILE not supported on this platform - ignored");
+	}
+#endif
 
 	lsock = tcpsocket();
 	if (lsock<0) {
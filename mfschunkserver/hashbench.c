@@ -0,0 +1,124 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// chunk hash lock contention benchmark ("make mfshashbench mfshashbench1")
+// worker threads lock and release random chunks with hdd_chunk_get / hdd_chunk_release of the chunk server
+// mfshashbench uses the same striped locks as mfschunkserver, mfshashbench1 is built with one lock (HASHLOCKS=1) for comparison
+// usage: mfshashbench [-t maxthreads] [-c chunks] [-n operations per thread]
+
+// hddspacemgr.c is included to use its static hash functions directly
+#include "hddspacemgr.c"
+
+#include <sys/time.h>
+
+// chunk server main loop is not linked - hash functions don't need it
+void main_destructregister(void (*fun)(void)) {
+	(void)fun;
+}
+
+void main_timeregister_name(int mode,uint32_t seconds,uint32_t offset,void (*fun)(void),const char *name) {
+	(void)mode;
+	(void)seconds;
+	(void)offset;
+	(void)fun;
+	(void)name;
+}
+
+static uint32_t chunks = 100000;
+static uint32_t operations = 1000000;
+
+static void* bench_worker(void *arg) {
+	uint64_t rnd,chunkid;
+	uint32_t i;
+	chunk *c;
+
+	rnd = (uintptr_t)arg * 7919 + 1;
+	for (i=0 ; i<operations ; i++) {
+		rnd = rnd * UINT64_C(6364136223846793005) + UINT64_C(1442695040888963407);
+		chunkid = (rnd>>33)%chunks + 1;
+		c = hdd_chunk_get(chunkid,CH_NEW_NONE);
+		if (c!=NULL) {
+			hdd_chunk_release(c);
+		}
+	}
+	return NULL;
+}
+
+static double now(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+int main(int argc,char **argv) {
+	pthread_t *threads;
+	uint32_t i,th,maxthreads;
+	chunk *c;
+	double st,t;
+	int ch;
+
+	maxthreads = 16;
+	while ((ch = getopt(argc,argv,"t:c:n:")) != -1) {
+		switch (ch) {
+			case 't':
+				maxthreads = strtoul(optarg,NULL,10);
+				break;
+			case 'c':
+				chunks = strtoul(optarg,NULL,10);
+				break;
+			case 'n':
+				operations = strtoul(optarg,NULL,10);
+				break;
+			default:
+				fprintf(stderr,"usage: %s [-t maxthreads] [-c chunks] [-n operations per thread]\n",argv[0]);
+				return 1;
+		}
+	}
+	if (maxthreads==0 || chunks==0) {
+		fprintf(stderr,"number of threads and chunks must be positive\n");
+		return 1;
+	}
+	threads = malloc(sizeof(pthread_t)*maxthreads);
+	if (threads==NULL) {
+		printf("out of memory\n");
+		return 1;
+	}
+
+	for (i=0 ; i<HASHLOCKS ; i++) {
+		eassert(pthread_mutex_init(&(hashstripes[i].lock),NULL)==0);
+		hashstripes[i].cclist = NULL;
+	}
+	for (i=1 ; i<=chunks ; i++) {
+		c = hdd_chunk_get(i,CH_NEW_AUTO);
+		hdd_chunk_release(c);
+	}
+
+	for (th=1 ; th<=maxthreads ; th*=2) {
+		st = now();
+		for (i=0 ; i<th ; i++) {
+			eassert(pthread_create(threads+i,NULL,bench_worker,(void*)(uintptr_t)i)==0);
+		}
+		for (i=0 ; i<th ; i++) {
+			eassert(pthread_join(threads[i],NULL)==0);
+		}
+		t = now()-st;
+		printf("hash locks: %u ; threads: %2"PRIu32" ; get+release: %.2lf M/s\n",HASHLOCKS,th,(double)th*operations/(t*1000000.0));
+	}
+	free(threads);
+	return 0;
+}
@@ -37,9 +37,8 @@
 #include <errno.h>
 #include <limits.h>
 #include <pthread.h>
-#ifdef MMAP_ALLOC
+#include <sys/uio.h>
 #include <sys/mman.h>
-#endif
 
 #include "MFSCommunication.h"
 #include "cfg.h"
@@ -48,6 +47,9 @@
 #include "main.h"
 #include "slogger.h"
 #include "massert.h"
+#include "bufpool.h"
+#include "iouring.h"
+#include "hddspacemgr.h"
 
 #define PRESERVE_BLOCK 1
 
@@ -70,6 +72,22 @@
 
 #define LOSTCHUNKSBLOCKSIZE 1024
 
+// durability of written chunks (folder fsync policy)
+#define FSYNC_IMMEDIATE 0	// fsync of each chunk in hdd_io_end
+#define FSYNC_GROUP 1		// hdd_io_end waits for one sync shared by all chunks closed in the same time window
+#define FSYNC_DEFERRED 2	// folder is synced in background (writes are confirmed before they are durable)
+
+#ifdef O_DIRECT
+// direct I/O - offsets, sizes and buffers aligned to DIOALIGN (data starts at CHUNKHDRSIZE which is not), so data goes through bounce buffers
+#define DIOALIGN 4096
+#define DIOBUFFSIZE ((HDD_READ_MAXBLOCKS<<16)+2*DIOALIGN)
+#define DIOPERSLAB 16
+#endif
+
+/* crc tables and preserved blocks are taken from slab pools (one mapping per slab) */
+#define CRCPERSLAB 256
+#define BLOCKSPERSLAB 16
+
 #define CHUNKHDRSIZE (1024+4*1024)
 #define CHUNKHDRCRC 1024
 
@@ -84,12 +102,28 @@
 #define DHASHSIZE 64
 #define DHASHPOS(chunkid) ((chunkid)&0x3F)
 
+#define CHGHASHSIZE 65536
+#define CHGHASHPOS(chunkid) ((chunkid)&0xFFFF)
+#define CHGMAXCOUNT 1000000
+
 #define CH_NEW_NONE 0
 #define CH_NEW_AUTO 1
 #define CH_NEW_EXCLUSIVE 2
 
 #define CHUNKLOCKED ((void*)1)
 
+#define BCACHE_NONE 0xFFFFFFFF
+#define BCACHE_HASHPOS(chunkid,version,blocknum) ((((chunkid)*0x9E3779B97F4A7C15ULL)^((uint64_t)(version)*0xC2B2AE3D27D4EB4FULL)^(blocknum))&bcachehashmask)
+
+typedef struct bcacheentry {
+	uint64_t chunkid;
+	uint32_t version;
+	uint16_t blocknum;
+	uint8_t valid;
+	uint8_t ref;
+	uint32_t next;
+} bcacheentry;
+
 typedef struct damagedchunk {
 	uint64_t chunkid;
 	struct damagedchunk *next;
@@ -101,6 +135,12 @@ typedef struct lostchunk {
 	struct lostchunk *next;
 } lostchunk;
 
+typedef struct changedchunk {
+	uint64_t chunkid;
+	uint32_t gen;
+	struct changedchunk *next;
+} changedchunk;
+
 typedef struct dopchunk {
 	uint64_t chunkid;
 	struct dopchunk *next;
@@ -113,6 +153,14 @@ typedef struct ioerror {
 	uint32_t timestamp;
 } ioerror;
 
+// failed group sync - kept until every thread waiting for one of its tickets has got the error
+typedef struct syncerror {
+	uint64_t ticketfrom,ticketto;
+	uint64_t waiting;
+	int err;
+	struct syncerror *next;
+} syncerror;
+
 typedef struct _cntcond {
 	pthread_cond_t cond;
 	uint32_t wcnt;
@@ -137,6 +185,7 @@ typedef struct chunk {
 	cntcond *ccond;
 	uint8_t *crc;
 	int fd;
+	int dfd;	// O_DIRECT descriptor (only in folders with direct I/O)
 
 #ifdef PRESERVE_BLOCK
 	uint8_t *block;
@@ -167,6 +216,7 @@ typedef struct folder {
 	unsigned int needrefresh:1;
 	unsigned int todel:2;
 	unsigned int damaged:1;
+	uint8_t direct;		// not a bit field - cleared by hdd_dio_fd without folderlock (stripe lock is held there)
 	uint64_t leavefree;
 	uint64_t avail;
 	uint64_t total;
@@ -182,6 +232,33 @@ typedef struct folder {
 	double carry;
 	pthread_t scanthread;
 	struct chunk *testhead,**testtail;
+	/* background job queue of this folder (bgjobs) */
+	uint32_t fid;
+	uint32_t jqueued;
+	uint64_t jwaitsum;
+	uint32_t jwaitcnt;
+	uint32_t jwaitmax;
+	uint32_t jwaitavglast;
+	uint32_t jwaitmaxlast;
+#ifdef HAVE_IO_URING
+	/* asynchronous reads */
+	void *ring;
+	pthread_t ringthread;
+#endif
+	/* durability (fsync policy) */
+	uint8_t fsyncpolicy;
+	pthread_mutex_t synclock;
+	pthread_cond_t synccond;
+	uint64_t syncticket;	// group: last ticket given to closed chunk
+	uint64_t syncdone;	// group: all tickets up to this one are synced
+	syncerror *syncerrors;	// group: failed syncs not yet reported to all their threads
+	uint8_t syncing;	// group: some thread is syncing now
+	int *syncfds;	// group: descriptors waiting for sync
+	uint32_t syncfdscnt,syncfdssize;
+	uint32_t syncpending;	// deferred: chunks closed since last sync
+	uint32_t syncfirst;	// deferred: when first of them was closed
+	uint32_t syncchunks;	// chunks made durable (stats - protected by statslock)
+	uint32_t syncchunkslast;
 	struct folder *next;
 } folder;
 
@@ -197,9 +274,20 @@ typedef struct damaged {
 */
 
 static uint32_t HDDTestFreq=10;
+static uint8_t FolderWorkers=4;
+static uint32_t FolderQueueSize=250;
+static uint8_t FsyncPolicy=FSYNC_IMMEDIATE;	// default for folders without "fsync=..." in mfshdd.cfg
+static uint32_t FsyncGroupTime=0;	// ms
+static uint32_t FsyncDeferredTime=10;	// s
+#ifdef HAVE_IO_URING
+static uint8_t HDDIoUring=0;
+#define RINGSIZE 256
+#endif
 
 /* folders data */
 static folder *folderhead=NULL;
+static folder **folderbyid=NULL;	// indexed by folder->fid (folders are never freed)
+static uint32_t foldercount=0;
 
 /* chunk hash */
 static chunk* hashtab[HASHSIZE];
@@ -229,9 +317,26 @@ static pthread_mutex_t ndoplock = PTHREAD_MUTEX_INITIALIZER;
 // master reports = damaged chunks, lost chunks, errorcounter, hddspacechanged
 static pthread_mutex_t dclock = PTHREAD_MUTEX_INITIALIZER;
 
-// hashtab - only hash tab, chunks have their own separate locks
-static pthread_mutex_t hashlock = PTHREAD_MUTEX_INITIALIZER;
-static cntcond *cclist = NULL;
+// chunks changed since last acknowledged checkpoint (for delta registration)
+static changedchunk *chghashtab[CHGHASHSIZE];
+static uint32_t chgcount=0;
+static uint32_t chggen=0;
+static uint8_t chgoverflow=0;
+static uint32_t chgpos;
+static pthread_mutex_t chglock = PTHREAD_MUTEX_INITIALIZER;
+
+// hashtab - buckets are divided into stripes with separate locks (bucket i belongs to stripe i%HASHLOCKS), chunks have their own separate locks
+// threads waiting for locked chunk use condition from stripe's own list (condition is always used with the same mutex)
+// lock order: folderlock -> stripe lock(s) (ascending when more than one) -> testlock,chglock
+#ifndef HASHLOCKS
+#define HASHLOCKS 256
+#endif
+typedef struct _hashstripe {
+	pthread_mutex_t lock;
+	cntcond *cclist;
+} hashstripe;
+static hashstripe hashstripes[HASHLOCKS];
+#define HASHSTRIPE(hashpos) (hashstripes+((hashpos)&(HASHLOCKS-1)))
 
 // folderhead + all data in structures
 static pthread_mutex_t folderlock = PTHREAD_MUTEX_INITIALIZER;
@@ -250,6 +355,23 @@ static pthread_cond_t scanprogresscond = PTHREAD_COND_INITIALIZER;
 
 static uint32_t emptyblockcrc;
 
+static void *crcpool;
+static void *blockpool;
+#ifdef O_DIRECT
+static void *diopool = NULL;
+#endif
+
+// block cache - blocks already verified by crc, keyed by (chunkid,version,blocknum), CLOCK replacement
+static bcacheentry *bcacheentries = NULL;
+static uint8_t *bcachedata = NULL;
+static uint32_t *bcachehash = NULL;
+static uint32_t bcachehashmask;
+static uint32_t bcachesize = 0;	// in blocks, 0 - disabled
+static uint32_t bcachehand;
+static uint32_t bcache_hits=0;
+static uint32_t bcache_misses=0;
+static pthread_mutex_t bcachelock = PTHREAD_MUTEX_INITIALIZER;
+
 static uint32_t stats_bytesr=0;
 static uint32_t stats_bytesw=0;
 static uint32_t stats_opr=0;
@@ -319,6 +441,75 @@ void printbacktrace(void) {
 	free(strs);
 }
 */
+void hdd_changes_mark(uint64_t chunkid) {
+	changedchunk *cc;
+	uint32_t hashpos = CHGHASHPOS(chunkid);
+	eassert(pthread_mutex_lock(&chglock)==0);
+	if (chgoverflow==0) {
+		for (cc=chghashtab[hashpos] ; cc && cc->chunkid!=chunkid ; cc=cc->next) {}
+		if (cc) {
+			cc->gen = chggen;
+		} else if (chgcount>=CHGMAXCOUNT) {
+			chgoverflow = 1;
+		} else {
+			cc = malloc(sizeof(changedchunk));
+			passert(cc);
+			cc->chunkid = chunkid;
+			cc->gen = chggen;
+			cc->next = chghashtab[hashpos];
+			chghashtab[hashpos] = cc;
+			chgcount++;
+		}
+	}
+	eassert(pthread_mutex_unlock(&chglock)==0);
+}
+
+static void hdd_changes_prune(uint8_t all,uint32_t gen) {
+	changedchunk *cc,**ccp;
+	uint32_t i;
+	for (i=0 ; i<CHGHASHSIZE ; i++) {
+		ccp = &(chghashtab[i]);
+		while ((cc=*ccp)) {
+			if (all || (int32_t)(gen - cc->gen)>=0) {
+				*ccp = cc->next;
+				free(cc);
+				chgcount--;
+			} else {
+				ccp = &(cc->next);
+			}
+		}
+	}
+}
+
+void hdd_changes_clear(void) {
+	eassert(pthread_mutex_lock(&chglock)==0);
+	hdd_changes_prune(1,0);
+	chgoverflow = 0;
+	eassert(pthread_mutex_unlock(&chglock)==0);
+}
+
+uint32_t hdd_changes_checkpoint(void) {
+	uint32_t gen;
+	eassert(pthread_mutex_lock(&chglock)==0);
+	gen = chggen++;
+	eassert(pthread_mutex_unlock(&chglock)==0);
+	return gen;
+}
+
+void hdd_changes_ack(uint32_t gen) {
+	eassert(pthread_mutex_lock(&chglock)==0);
+	hdd_changes_prune(0,gen);
+	eassert(pthread_mutex_unlock(&chglock)==0);
+}
+
+int hdd_changes_overflow(void) {
+	int result;
+	eassert(pthread_mutex_lock(&chglock)==0);
+	result = chgoverflow;
+	eassert(pthread_mutex_unlock(&chglock)==0);
+	return result;
+}
+
 void hdd_report_damaged_chunk(uint64_t chunkid) {
 	damagedchunk *dc;
 	eassert(pthread_mutex_lock(&dclock)==0);
@@ -396,6 +587,7 @@ void hdd_get_lost_chunk_data(uint8_t *buff) {
 			for (i=0 ; i<lc->chunksinblock ; i++) {
 				chunkid = lc->chunkidblock[i];
 				put64bit(&buff,chunkid);
+				hdd_changes_mark(chunkid);
 			}
 			lc = lc->next;
 			free(nlc);
@@ -467,6 +659,147 @@ void hdd_op_stats(uint32_t *op_create,uint32_t *op_delete,uint32_t *op_version,u
 	eassert(pthread_mutex_unlock(&statslock)==0);
 }
 
+void hdd_bufpool_stats(uint32_t *crcused,uint32_t *blockused) {
+	uint32_t total;
+	bufpool_stats(crcpool,&total,crcused);
+	bufpool_stats(blockpool,&total,blockused);
+}
+
+void hdd_bcache_stats(uint32_t *hits,uint32_t *misses) {
+	eassert(pthread_mutex_lock(&bcachelock)==0);
+	*hits = bcache_hits;
+	*misses = bcache_misses;
+	bcache_hits=0;
+	bcache_misses=0;
+	eassert(pthread_mutex_unlock(&bcachelock)==0);
+}
+
+static inline uint32_t hdd_bcache_find(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	uint32_t i;
+	for (i=bcachehash[BCACHE_HASHPOS(chunkid,version,blocknum)] ; i!=BCACHE_NONE ; i=bcacheentries[i].next) {
+		if (bcacheentries[i].chunkid==chunkid && bcacheentries[i].version==version && bcacheentries[i].blocknum==blocknum) {
+			return i;
+		}
+	}
+	return BCACHE_NONE;
+}
+
+static inline void hdd_bcache_unlink(uint32_t i) {
+	uint32_t *ip;
+	bcacheentry *be = bcacheentries+i;
+	ip = bcachehash+BCACHE_HASHPOS(be->chunkid,be->version,be->blocknum);
+	while (*ip!=i) {
+		ip = &(bcacheentries[*ip].next);
+	}
+	*ip = be->next;
+	be->valid = 0;
+}
+
+/* copies given part of cached block, returns 1 on hit */
+static int hdd_bcache_get(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size) {
+	uint32_t i;
+	if (bcachesize==0) {
+		return 0;
+	}
+	eassert(pthread_mutex_lock(&bcachelock)==0);
+	i = hdd_bcache_find(chunkid,version,blocknum);
+	if (i==BCACHE_NONE) {
+		bcache_misses++;
+		eassert(pthread_mutex_unlock(&bcachelock)==0);
+		return 0;
+	}
+	bcacheentries[i].ref = 1;
+	memcpy(buffer,bcachedata+((uint64_t)i<<16)+offset,size);
+	bcache_hits++;
+	eassert(pthread_mutex_unlock(&bcachelock)==0);
+	return 1;
+}
+
+/* block must be already verified */
+static void hdd_bcache_put(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *block) {
+	uint32_t i,hp;
+	bcacheentry *be;
+	if (bcachesize==0) {
+		return;
+	}
+	eassert(pthread_mutex_lock(&bcachelock)==0);
+	i = hdd_bcache_find(chunkid,version,blocknum);
+	if (i==BCACHE_NONE) {
+		while (bcacheentries[bcachehand].valid && bcacheentries[bcachehand].ref) {
+			bcacheentries[bcachehand].ref = 0;
+			bcachehand = (bcachehand+1)%bcachesize;
+		}
+		i = bcachehand;
+		bcachehand = (bcachehand+1)%bcachesize;
+		be = bcacheentries+i;
+		if (be->valid) {
+			hdd_bcache_unlink(i);
+		}
+		be->chunkid = chunkid;
+		be->version = version;
+		be->blocknum = blocknum;
+		be->valid = 1;
+		be->ref = 0;
+		hp = BCACHE_HASHPOS(chunkid,version,blocknum);
+		be->next = bcachehash[hp];
+		bcachehash[hp] = i;
+	}
+	memcpy(bcachedata+((uint64_t)i<<16),block,0x10000);
+	eassert(pthread_mutex_unlock(&bcachelock)==0);
+}
+
+static void hdd_bcache_invalidate(uint64_t chunkid,uint32_t version,uint16_t blocknum) {
+	uint32_t i;
+	if (bcachesize==0) {
+		return;
+	}
+	eassert(pthread_mutex_lock(&bcachelock)==0);
+	i = hdd_bcache_find(chunkid,version,blocknum);
+	if (i!=BCACHE_NONE) {
+		hdd_bcache_unlink(i);
+	}
+	eassert(pthread_mutex_unlock(&bcachelock)==0);
+}
+
+static void hdd_bcache_init(void) {
+	uint32_t i,hsize;
+	bcachesize = cfg_getuint32("HDD_BLOCK_CACHE_SIZE",0)*16;	// MiB -> 64KiB blocks
+	if (bcachesize==0) {
+		return;
+	}
+	for (hsize=1024 ; hsize<bcachesize ; hsize<<=1) {}
+	bcachedata = malloc((uint64_t)bcachesize<<16);
+	bcacheentries = malloc(sizeof(bcacheentry)*bcachesize);
+	bcachehash = malloc(sizeof(uint32_t)*hsize);
+	if (bcachedata==NULL || bcacheentries==NULL || bcachehash==NULL) {
+		syslog(LOG_WARNING,"can't allocate block cache (%"PRIu32" MiB) - cache disabled",bcachesize/16);
+		free(bcachedata);
+		free(bcacheentries);
+		free(bcachehash);
+		bcachedata = NULL;
+		bcacheentries = NULL;
+		bcachehash = NULL;
+		bcachesize = 0;
+		return;
+	}
+	for (i=0 ; i<bcachesize ; i++) {
+		bcacheentries[i].valid = 0;
+		bcacheentries[i].ref = 0;
+	}
+	for (i=0 ; i<hsize ; i++) {
+		bcachehash[i] = BCACHE_NONE;
+	}
+	bcachehashmask = hsize-1;
+	bcachehand = 0;
+}
+
+static void hdd_bcache_term(void) {
+	free(bcachedata);
+	free(bcacheentries);
+	free(bcachehash);
+	bcachesize = 0;
+}
+
 static inline void hdd_stats_read(uint32_t size) {
 	eassert(pthread_mutex_lock(&statslock)==0);
 	stats_opr++;
@@ -515,11 +848,13 @@ static inline void hdd_stats_datawrite(folder *f,uint32_t size,int64_t wtime) {
 	eassert(pthread_mutex_unlock(&statslock)==0);
 }
 
-static inline void hdd_stats_datafsync(folder *f,int64_t fsynctime) {
+static inline void hdd_stats_datafsync(folder *f,int64_t fsynctime,uint32_t chunks) {
+	eassert(pthread_mutex_lock(&statslock)==0);
+	f->syncchunks += chunks;
 	if (fsynctime<=0) {
+		eassert(pthread_mutex_unlock(&statslock)==0);
 		return;
 	}
-	eassert(pthread_mutex_lock(&statslock)==0);
 	stats_wtime += fsynctime;
 	f->cstat.fsyncops++;
 	f->cstat.usecfsyncsum += fsynctime;
@@ -529,6 +864,64 @@ static inline void hdd_stats_datafsync(folder *f,int64_t fsynctime) {
 	eassert(pthread_mutex_unlock(&statslock)==0);
 }
 
+uint32_t hdd_folder_queues(uint8_t *workers,uint32_t *queuesize) {
+	*workers = FolderWorkers;
+	*queuesize = FolderQueueSize;
+	return foldercount;
+}
+
+int32_t hdd_chunk_folder(uint64_t chunkid) {
+	chunk *c;
+	int32_t fid;
+	hashstripe *hs = HASHSTRIPE(HASHPOS(chunkid));
+	fid = -1;
+	pthread_mutex_lock(&(hs->lock));
+	for (c=hashtab[HASHPOS(chunkid)] ; c ; c=c->next) {
+		if (c->chunkid==chunkid) {
+			if (c->state!=CH_DELETED && c->state!=CH_TOBEDELETED && c->owner!=NULL && c->owner->damaged==0) {
+				fid = c->owner->fid;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(hs->lock));
+	return fid;
+}
+
+void hdd_folder_job_queued(uint32_t fid) {
+	if (fid>=foldercount) {
+		return;
+	}
+	eassert(pthread_mutex_lock(&statslock)==0);
+	folderbyid[fid]->jqueued++;
+	eassert(pthread_mutex_unlock(&statslock)==0);
+}
+
+void hdd_folder_job_rejected(uint32_t fid) {
+	if (fid>=foldercount) {
+		return;
+	}
+	eassert(pthread_mutex_lock(&statslock)==0);
+	folderbyid[fid]->jqueued--;
+	eassert(pthread_mutex_unlock(&statslock)==0);
+}
+
+void hdd_folder_job_started(uint32_t fid,uint32_t waittime) {
+	folder *f;
+	if (fid>=foldercount) {
+		return;
+	}
+	f = folderbyid[fid];
+	eassert(pthread_mutex_lock(&statslock)==0);
+	f->jqueued--;
+	f->jwaitsum += waittime;
+	f->jwaitcnt++;
+	if (waittime>f->jwaitmax) {
+		f->jwaitmax = waittime;
+	}
+	eassert(pthread_mutex_unlock(&statslock)==0);
+}
+
 uint32_t hdd_diskinfo_v1_size() {
 	folder *f;
 	uint32_t s=0,sl;
@@ -574,7 +967,10 @@ void hdd_diskinfo_v1_data(uint8_t *buff) {
 	pthread_mutex_unlock(&folderlock);
 }
 
-uint32_t hdd_diskinfo_v2_size() {
+// entry without path: 34B + 3*64B stats (+17B of queue and fsync stats when listver>=1)
+#define DISKINFO_ENTRY_SIZE(listver) (((listver)>=1)?243:226)
+
+uint32_t hdd_diskinfo_v2_size(uint8_t listver) {
 	folder *f;
 	uint32_t s=0,sl;
 	pthread_mutex_lock(&folderlock);
@@ -583,12 +979,12 @@ uint32_t hdd_diskinfo_v2_size() {
 		if (sl>255) {
 			sl=255;
 		}
-		s+=2+226+sl;
+		s+=2+DISKINFO_ENTRY_SIZE(listver)+sl;
 	}
 	return s;
 }
 
-void hdd_diskinfo_v2_data(uint8_t *buff) {
+void hdd_diskinfo_v2_data(uint8_t *buff,uint8_t listver) {
 	folder *f;
 	hddstats s;
 	uint32_t sl;
@@ -599,13 +995,13 @@ void hdd_diskinfo_v2_data(uint8_t *buff) {
 		for (f=folderhead ; f ; f=f->next ) {
 			sl = strlen(f->path);
 			if (sl>255) {
-				put16bit(&buff,226+255);	// size of this entry
+				put16bit(&buff,DISKINFO_ENTRY_SIZE(listver)+255);	// size of this entry
 				put8bit(&buff,255);
 				memcpy(buff,"(...)",5);
 				memcpy(buff+5,f->path+(sl-250),250);
 				buff+=255;
 			} else {
-				put16bit(&buff,226+sl);	// size of this entry
+				put16bit(&buff,DISKINFO_ENTRY_SIZE(listver)+sl);	// size of this entry
 				put8bit(&buff,sl);
 				if (sl>0) {
 					memcpy(buff,f->path,sl);
@@ -629,6 +1025,13 @@ void hdd_diskinfo_v2_data(uint8_t *buff) {
 				hdd_stats_add(&s,&(f->stats[(f->statspos+pos)%STATSHISTORY]));
 			}
 			hdd_stats_binary_pack(&buff,&s);	// 64B
+			if (listver>=1) {
+				put32bit(&buff,f->jqueued);	// jobs waiting in folder queues
+				put32bit(&buff,f->jwaitavglast);	// queue wait (usec) during last minute
+				put32bit(&buff,f->jwaitmaxlast);
+				put8bit(&buff,f->fsyncpolicy);
+				put32bit(&buff,f->syncchunkslast);	// chunks made durable during last minute
+			}
 		}
 		eassert(pthread_mutex_unlock(&statslock)==0);
 	}
@@ -647,6 +1050,13 @@ void hdd_diskinfo_movestats(void) {
 		}
 		f->stats[f->statspos]=f->cstat;
 		hdd_stats_clear(&(f->cstat));
+		f->jwaitavglast = (f->jwaitcnt>0)?(f->jwaitsum/f->jwaitcnt):0;
+		f->jwaitmaxlast = f->jwaitmax;
+		f->jwaitsum = 0;
+		f->jwaitcnt = 0;
+		f->jwaitmax = 0;
+		f->syncchunkslast = f->syncchunks;
+		f->syncchunks = 0;
 	}
 	eassert(pthread_mutex_unlock(&statslock)==0);
 	pthread_mutex_unlock(&folderlock);
@@ -659,23 +1069,19 @@ static inline void hdd_chunk_remove(chunk *c) {
 	while ((cp=*cptr)) {
 		if (c==cp) {
 			*cptr = cp->next;
+			hdd_changes_mark(cp->chunkid);
 			if (cp->fd>=0) {
 				close(cp->fd);
 			}
+			if (cp->dfd>=0) {
+				close(cp->dfd);
+			}
 			if (cp->crc!=NULL) {
-#ifdef MMAP_ALLOC
-				munmap(cp->crc,4096);
-#else
-				free(cp->crc);
-#endif
+				bufpool_free(crcpool,cp->crc);
 			}
 #ifdef PRESERVE_BLOCK
 			if (cp->block!=NULL) {
-# ifdef MMAP_ALLOC
-				munmap(cp->block,0x10000);
-# else
-				free(cp->block);
-# endif
+				bufpool_free(blockpool,cp->block);
 			}
 #endif /* PRESERVE_BLOCK */
 			if (cp->filename!=NULL) {
@@ -698,8 +1104,23 @@ static inline void hdd_chunk_remove(chunk *c) {
 	}
 }
 
+static void hdd_hash_lockall(void) {
+	uint32_t i;
+	for (i=0 ; i<HASHLOCKS ; i++) {
+		pthread_mutex_lock(&(hashstripes[i].lock));
+	}
+}
+
+static void hdd_hash_unlockall(void) {
+	uint32_t i;
+	for (i=HASHLOCKS ; i>0 ; i--) {
+		pthread_mutex_unlock(&(hashstripes[i-1].lock));
+	}
+}
+
 static void hdd_chunk_release(chunk *c) {
-	pthread_mutex_lock(&hashlock);
+	hashstripe *hs = HASHSTRIPE(HASHPOS(c->chunkid));
+	pthread_mutex_lock(&(hs->lock));
 //	syslog(LOG_WARNING,"hdd_chunk_release got chunk: %016"PRIX64" (c->state:%u)",c->chunkid,c->state);
 	if (c->state==CH_LOCKED) {
 		c->state = CH_AVAIL;
@@ -718,13 +1139,14 @@ static void hdd_chunk_release(chunk *c) {
 			hdd_chunk_remove(c);
 		}
 	}
-	pthread_mutex_unlock(&hashlock);
+	pthread_mutex_unlock(&(hs->lock));
 }
 
 static chunk* hdd_chunk_tryfind(uint64_t chunkid) {
 	uint32_t hashpos = HASHPOS(chunkid);
+	hashstripe *hs = HASHSTRIPE(hashpos);
 	chunk *c;
-	pthread_mutex_lock(&hashlock);
+	pthread_mutex_lock(&(hs->lock));
 	for (c=hashtab[hashpos] ; c && c->chunkid!=chunkid ; c=c->next) {}
 	if (c!=NULL) {
 		if (c->state==CH_LOCKED) {
@@ -738,15 +1160,16 @@ static chunk* hdd_chunk_tryfind(uint64_t chunkid) {
 //	if (c!=NULL && c!=CHUNKLOCKED) {
 //		syslog(LOG_WARNING,"hdd_chunk_tryfind returns chunk: %016"PRIX64" (c->state:%u)",c->chunkid,c->state);
 //	}
-	pthread_mutex_unlock(&hashlock);
+	pthread_mutex_unlock(&(hs->lock));
 	return c;
 }
 
 static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 	uint32_t hashpos = HASHPOS(chunkid);
+	hashstripe *hs = HASHSTRIPE(hashpos);
 	chunk *c;
 	cntcond *cc;
-	pthread_mutex_lock(&hashlock);
+	pthread_mutex_lock(&(hs->lock));
 	for (c=hashtab[hashpos] ; c && c->chunkid!=chunkid ; c=c->next) {}
 	if (c==NULL) {
 		if (cflag!=CH_NEW_NONE) {
@@ -762,6 +1185,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			c->crcsteps = 0;
 			c->crcchanged = 0;
 			c->fd = -1;
+			c->dfd = -1;
 			c->crc = NULL;
 			c->state = CH_LOCKED;
 			c->ccond = NULL;
@@ -776,12 +1200,12 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 			hashtab[hashpos]=c;
 		}
 //		syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016"PRIX64" (c->state:%u)",c->chunkid,c->state);
-		pthread_mutex_unlock(&hashlock);
+		pthread_mutex_unlock(&(hs->lock));
 		return c;
 	}
 	if (cflag==CH_NEW_EXCLUSIVE) {
 		if (c->state==CH_AVAIL || c->state==CH_LOCKED) {
-			pthread_mutex_unlock(&hashlock);
+			pthread_mutex_unlock(&(hs->lock));
 			return NULL;
 		}
 	}
@@ -790,27 +1214,22 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 		case CH_AVAIL:
 			c->state=CH_LOCKED;
 //			syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016"PRIX64" (c->state:%u)",c->chunkid,c->state);
-			pthread_mutex_unlock(&hashlock);
+			pthread_mutex_unlock(&(hs->lock));
 			return c;
 		case CH_DELETED:
 			if (cflag!=CH_NEW_NONE) {
 				if (c->fd>=0) {
 					close(c->fd);
 				}
+				if (c->dfd>=0) {
+					close(c->dfd);
+				}
 				if (c->crc!=NULL) {
-#ifdef MMAP_ALLOC
-					munmap(c->crc,4096);
-#else
-					free(c->crc);
-#endif
+					bufpool_free(crcpool,c->crc);
 				}
 #ifdef PRESERVE_BLOCK
 				if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap(c->crc,0x10000);
-# else
-					free(c->block);
-# endif
+					bufpool_free(blockpool,c->block);
 				}
 #endif /* PRESERVE_BLOCK */
 				if (c->filename!=NULL) {
@@ -835,6 +1254,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 				c->crcsteps = 0;
 				c->crcchanged = 0;
 				c->fd = -1;
+				c->dfd = -1;
 				c->crc = NULL;
 #ifdef PRESERVE_BLOCK
 				c->block = NULL;
@@ -843,7 +1263,7 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 #endif /* PRESERVE_BLOCK */
 				c->state = CH_LOCKED;
 //				syslog(LOG_WARNING,"hdd_chunk_get returns chunk: %016"PRIX64" (c->state:%u)",c->chunkid,c->state);
-				pthread_mutex_unlock(&hashlock);
+				pthread_mutex_unlock(&(hs->lock));
 				return c;
 			}
 			if (c->ccond==NULL) {	// no more waiting threads - remove
@@ -853,26 +1273,26 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 //				printbacktrace();
 				pthread_cond_signal(&(c->ccond->cond));
 			}
-			pthread_mutex_unlock(&hashlock);
+			pthread_mutex_unlock(&(hs->lock));
 			return NULL;
 		case CH_TOBEDELETED:
 		case CH_LOCKED:
 			if (c->ccond==NULL) {
-				for (cc=cclist ; cc && cc->wcnt ; cc=cc->next) {}
+				for (cc=hs->cclist ; cc && cc->wcnt ; cc=cc->next) {}
 				if (cc==NULL) {
 					cc = malloc(sizeof(cntcond));
 					passert(cc);
 					pthread_cond_init(&(cc->cond),NULL);
 					cc->wcnt = 0;
-					cc->next = cclist;
-					cclist = cc;
+					cc->next = hs->cclist;
+					hs->cclist = cc;
 				}
 				c->ccond = cc;
 			}
 			c->ccond->wcnt++;
 //			printf("wait for %s chunk: %"PRIu64" on ccond:%p\n",(c->state==CH_LOCKED)?"LOCKED":"TOBEDELETED",c->chunkid,c->ccond);
 //			printbacktrace();
-			pthread_cond_wait(&(c->ccond->cond),&hashlock);
+			pthread_cond_wait(&(c->ccond->cond),&(hs->lock));
 //			printf("%s chunk: %"PRIu64" woke up on ccond:%p\n",(c->state==CH_LOCKED)?"LOCKED":(c->state==CH_DELETED)?"DELETED":(c->state==CH_AVAIL)?"AVAIL":"TOBEDELETED",c->chunkid,c->ccond);
 			c->ccond->wcnt--;
 			if (c->ccond->wcnt==0) {
@@ -883,8 +1303,9 @@ static chunk* hdd_chunk_get(uint64_t chunkid,uint8_t cflag) {
 }
 
 static void hdd_chunk_delete(chunk *c) {
+	hashstripe *hs = HASHSTRIPE(HASHPOS(c->chunkid));
 	folder *f;
-	pthread_mutex_lock(&hashlock);
+	pthread_mutex_lock(&(hs->lock));
 	f = c->owner;
 	if (c->ccond) {
 		c->state = CH_DELETED;
@@ -894,7 +1315,7 @@ static void hdd_chunk_delete(chunk *c) {
 	} else {
 		hdd_chunk_remove(c);
 	}
-	pthread_mutex_unlock(&hashlock);
+	pthread_mutex_unlock(&(hs->lock));
 	pthread_mutex_lock(&folderlock);
 	f->chunkcount--;
 	f->needrefresh = 1;
@@ -910,6 +1331,7 @@ static chunk* hdd_chunk_create(folder *f,uint64_t chunkid,uint32_t version) {
 		return NULL;
 	}
 	c->version = version;
+	hdd_changes_mark(chunkid);
 	leng = strlen(f->path);
 	c->filename = malloc(leng+39);
 	passert(c->filename);
@@ -1053,9 +1475,9 @@ void hdd_check_folders() {
 		}
 		if (err && f->todel<2) {
 			syslog(LOG_WARNING,"%u errors occurred in %u seconds on folder: %s",LASTERRSIZE,LASTERRTIME,f->path);
-			pthread_mutex_lock(&hashlock);
-			pthread_mutex_lock(&testlock);
 			for (i=0 ; i<HASHSIZE ; i++) {
+				pthread_mutex_lock(&(HASHSTRIPE(i)->lock));
+				pthread_mutex_lock(&testlock);
 				cptr = &(hashtab[i]);
 				while ((c=*cptr)) {
 					if (c->owner==f) {
@@ -1065,20 +1487,15 @@ void hdd_check_folders() {
 							if (c->fd>=0) {
 								close(c->fd);
 							}
+							if (c->dfd>=0) {
+								close(c->dfd);
+							}
 							if (c->crc!=NULL) {
-#ifdef MMAP_ALLOC
-								munmap(c->crc,4096);
-#else
-								free(c->crc);
-#endif
+								bufpool_free(crcpool,c->crc);
 							}
 #ifdef PRESERVE_BLOCK
 							if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-								munmap(c->block,0x10000);
-# else
-								free(c->block);
-# endif
+								bufpool_free(blockpool,c->block);
 							}
 #endif /* PRESERVE_BLOCK */
 							if (c->filename) {
@@ -1099,9 +1516,9 @@ void hdd_check_folders() {
 						cptr = &(c->next);
 					}
 				}
+				pthread_mutex_unlock(&testlock);
+				pthread_mutex_unlock(&(HASHSTRIPE(i)->lock));
 			}
-			pthread_mutex_unlock(&testlock);
-			pthread_mutex_unlock(&hashlock);
 			f->damaged=1;
 			changed=1;
 		} else {
@@ -1148,12 +1565,12 @@ void hdd_error_occured(chunk *c) {
 static uint32_t hdd_get_chunks_pos;
 
 void hdd_get_chunks_begin() {
-	pthread_mutex_lock(&hashlock);
+	hdd_hash_lockall();
 	hdd_get_chunks_pos=0;
 }
 
 void hdd_get_chunks_end() {
-	pthread_mutex_unlock(&hashlock);
+	hdd_hash_unlockall();
 }
 
 uint32_t hdd_get_chunks_next_list_count() {
@@ -1187,6 +1604,54 @@ void hdd_get_chunks_next_list_data(uint8_t *buff) {
 	}
 }
 
+void hdd_get_changes_begin() {
+	hdd_hash_lockall();
+	eassert(pthread_mutex_lock(&chglock)==0);
+	chgpos=0;
+}
+
+void hdd_get_changes_end() {
+	eassert(pthread_mutex_unlock(&chglock)==0);
+	hdd_hash_unlockall();
+}
+
+uint32_t hdd_get_changes_next_list_count() {
+	uint32_t res=0;
+	uint32_t i=0;
+	changedchunk *cc;
+	while (res<CHUNKS_CUT_COUNT && chgpos+i<CHGHASHSIZE) {
+		for (cc = chghashtab[chgpos+i] ; cc ; cc=cc->next) {
+			res++;
+		}
+		i++;
+	}
+	return res;
+}
+
+void hdd_get_changes_next_list_data(uint8_t *buff) {
+	uint32_t res=0;
+	uint32_t v;
+	changedchunk *cc;
+	chunk *c;
+	while (res<CHUNKS_CUT_COUNT && chgpos<CHGHASHSIZE) {
+		for (cc = chghashtab[chgpos] ; cc ; cc=cc->next) {
+			put64bit(&buff,cc->chunkid);
+			for (c=hashtab[HASHPOS(cc->chunkid)] ; c && c->chunkid!=cc->chunkid ; c=c->next) {}
+			if (c && c->filename!=NULL && c->owner!=NULL && c->state!=CH_DELETED && c->state!=CH_TOBEDELETED) {
+				v = c->version;
+				if (c->owner->todel) {
+					v|=0x80000000;
+				}
+			} else {
+				v = 0;	// chunk doesn't exist any more
+			}
+			put32bit(&buff,v);
+			res++;
+		}
+		chgpos++;
+	}
+}
+
 /*
 // for old register packets - deprecated
 uint32_t hdd_get_chunks_count() {
@@ -1286,11 +1751,7 @@ void hdd_get_space(uint64_t *usedspace,uint64_t *totalspace,uint32_t *chunkcount
 }
 
 static inline void chunk_emptycrc(chunk *c) {
-#ifdef MMAP_ALLOC
-	c->crc = mmap(NULL,4096,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-#else
-	c->crc = (uint8_t*)malloc(4096);
-#endif
+	c->crc = bufpool_alloc(crcpool);
 	memset(c->crc,0,4096);	// make valgrind happy
 	passert(c->crc);
 }
@@ -1324,11 +1785,7 @@ static inline int chunk_readcrc(chunk *c) {
 		syslog(LOG_WARNING,"chunk_readcrc: file:%s - wrong id/version in header (%016"PRIX64"_%08"PRIX32")",c->filename,chunkid,version);
 		return ERROR_IO;
 	}
-#ifdef MMAP_ALLOC
-	c->crc = mmap(NULL,4096,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-#else
-	c->crc = (uint8_t*)malloc(4096);
-#endif
+	c->crc = bufpool_alloc(crcpool);
 	passert(c->crc);
 #ifdef USE_PIO
 	ret = pread(c->fd,c->crc,4096,CHUNKHDRCRC);
@@ -1339,11 +1796,7 @@ static inline int chunk_readcrc(chunk *c) {
 	hdd_stats_read(4096);
 	if (ret!=4096) {
 		mfs_arg_errlog_silent(LOG_WARNING,"chunk_readcrc: file:%s - read error",c->filename);
-#ifdef MMAP_ALLOC
-		munmap(c->crc,4096);
-#else
-		free(c->crc);
-#endif
+		bufpool_free(crcpool,c->crc);
 		c->crc = NULL;
 		return ERROR_IO;
 	}
@@ -1351,11 +1804,7 @@ static inline int chunk_readcrc(chunk *c) {
 }
 
 static inline void chunk_freecrc(chunk *c) {
-#ifdef MMAP_ALLOC
-	munmap(c->crc,4096);
-#else
-	free(c->crc);
-#endif
+	bufpool_free(crcpool,c->crc);
 	c->crc = NULL;
 }
 
@@ -1381,13 +1830,13 @@ static inline int chunk_writecrc(chunk *c) {
 void hdd_test_show_chunks(void) {
 	uint32_t hashpos;
 	chunk *c;
-	pthread_mutex_lock(&hashlock);
 	for (hashpos=0 ; hashpos<HASHSIZE ; hashpos++) {
+		pthread_mutex_lock(&(HASHSTRIPE(hashpos)->lock));
 		for (c=hashtab[hashpos] ; c ; c=c->next) {
 			printf("chunk id:%"PRIu64" version:%"PRIu32" state:%"PRIu8"\n",c->chunkid,c->version,c->state);
 		}
+		pthread_mutex_unlock(&(HASHSTRIPE(hashpos)->lock));
 	}
-	pthread_mutex_unlock(&hashlock);
 }
 
 void hdd_test_show_openedchunks(void) {
@@ -1501,11 +1950,7 @@ void hdd_delayed_ops() {
 				if (c->blocksteps>0) {
 					c->blocksteps--;
 				} else if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap(c->block,0x10000);
-# else
-					free(c->block);
-# endif
+					bufpool_free(blockpool,c->block);
 					c->block = NULL;
 					c->blockno = 0xFFFF;
 				}
@@ -1520,6 +1965,10 @@ void hdd_delayed_ops() {
 						hdd_report_damaged_chunk(c->chunkid);
 					}
 					c->fd = -1;
+					if (c->dfd>=0) {
+						close(c->dfd);
+						c->dfd = -1;
+					}
 				}
 //				printf("crc\n");
 				if (c->crcsteps>0) {	// decrease counter
@@ -1556,6 +2005,154 @@ static inline uint64_t get_usectime() {
 	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
 }
 
+/* syncs given descriptors - whole filesystem at once when possible */
+static int hdd_sync_fds(int *fds,uint32_t fdscnt) {
+#ifdef HAVE_SYNCFS
+	(void)fdscnt;
+	return syncfs(fds[0]);
+#else
+	uint32_t i;
+	int ret = 0;
+	for (i=0 ; i<fdscnt ; i++) {
+#ifdef F_FULLFSYNC
+		if (fcntl(fds[i],F_FULLFSYNC)<0) {
+#else
+		if (fsync(fds[i])<0) {
+#endif
+			ret = -1;
+		}
+	}
+	return ret;
+#endif
+}
+
+/* group commit - chunks closed while a sync is in progress are synced together by the next leader, which may additionally wait FsyncGroupTime for more of them */
+static int hdd_group_sync(chunk *c) {
+	folder *f = c->owner;
+	uint64_t ticket,target,ts,te;
+	syncerror *se,**sep;
+	int *fds;
+	uint32_t fdscnt;
+	int ret,err;
+
+	pthread_mutex_lock(&(f->synclock));
+	ticket = ++(f->syncticket);
+	if (f->syncfdscnt>=f->syncfdssize) {
+		f->syncfdssize = (f->syncfdssize)?(f->syncfdssize*2):16;
+		f->syncfds = realloc(f->syncfds,sizeof(int)*f->syncfdssize);
+		passert(f->syncfds);
+	}
+	f->syncfds[f->syncfdscnt++] = c->fd;
+	while (f->syncdone<ticket) {
+		if (f->syncing) {
+			pthread_cond_wait(&(f->synccond),&(f->synclock));
+			continue;
+		}
+		f->syncing = 1;
+		pthread_mutex_unlock(&(f->synclock));
+		if (FsyncGroupTime>0) {
+			usleep(FsyncGroupTime*1000);
+		}
+		pthread_mutex_lock(&(f->synclock));
+		// descriptors of all threads waiting for tickets up to target stay opened until they are woken up
+		target = f->syncticket;
+		fds = f->syncfds;
+		fdscnt = f->syncfdscnt;
+		f->syncfds = NULL;
+		f->syncfdscnt = 0;
+		f->syncfdssize = 0;
+		pthread_mutex_unlock(&(f->synclock));
+		ts = get_usectime();
+		ret = hdd_sync_fds(fds,fdscnt);
+		err = errno;
+		te = get_usectime();
+		hdd_stats_datafsync(f,te-ts,fdscnt);
+		pthread_mutex_lock(&(f->synclock));
+		if (ret<0) {
+			// every ticket in (syncdone,target] belongs to one waiting thread
+			se = malloc(sizeof(syncerror));
+			passert(se);
+			se->ticketfrom = f->syncdone+1;
+			se->ticketto = target;
+			se->waiting = target-f->syncdone;
+			se->err = err;
+			se->next = f->syncerrors;
+			f->syncerrors = se;
+		}
+		free(fds);
+		f->syncdone = target;
+		f->syncing = 0;
+		pthread_cond_broadcast(&(f->synccond));
+	}
+	ret = 0;
+	sep = &(f->syncerrors);
+	while ((se=*sep)) {
+		if (ticket>=se->ticketfrom && ticket<=se->ticketto) {
+			errno = se->err;
+			ret = -1;
+			se->waiting--;
+			if (se->waiting==0) {
+				*sep = se->next;
+				free(se);
+			}
+			break;
+		}
+		sep = &(se->next);
+	}
+	pthread_mutex_unlock(&(f->synclock));
+	return ret;
+}
+
+static void hdd_deferred_sync(folder *f) {
+	pthread_mutex_lock(&(f->synclock));
+	if (f->syncpending==0) {
+		f->syncfirst = time(NULL);
+	}
+	f->syncpending++;
+	pthread_mutex_unlock(&(f->synclock));
+}
+
+/* background syncs of folders with "deferred" policy (called by folders thread, force - on exit) */
+static void hdd_deferred_flush(int force) {
+	folder *f;
+	uint32_t pending,now;
+	uint64_t ts,te;
+#ifdef HAVE_SYNCFS
+	int fd;
+#endif
+	int ret;
+
+	now = time(NULL);
+	for (f=folderhead ; f ; f=f->next) {
+		pthread_mutex_lock(&(f->synclock));
+		pending = f->syncpending;
+		if (pending==0 || (force==0 && f->syncfirst+FsyncDeferredTime>now)) {
+			pthread_mutex_unlock(&(f->synclock));
+			continue;
+		}
+		f->syncpending = 0;
+		pthread_mutex_unlock(&(f->synclock));
+		ts = get_usectime();
+#ifdef HAVE_SYNCFS
+		fd = open(f->path,O_RDONLY);
+		if (fd>=0) {
+			ret = syncfs(fd);
+			close(fd);
+		} else {
+			ret = -1;
+		}
+#else
+		sync();
+		ret = 0;
+#endif
+		te = get_usectime();
+		hdd_stats_datafsync(f,te-ts,pending);
+		if (ret<0) {
+			mfs_arg_errlog(LOG_WARNING,"hdd_deferred_flush: folder:%s - sync error",f->path);
+		}
+	}
+}
+
 static int hdd_io_begin(chunk *c,int newflag) {
 	dopchunk *cc;
 	int status;
@@ -1604,11 +2201,7 @@ static int hdd_io_begin(chunk *c,int newflag) {
 		}
 #ifdef PRESERVE_BLOCK
 		if (c->block==NULL) {
-# ifdef MMAP_ALLOC
-			c->block = mmap(NULL,0x10000,PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,-1,0);
-# else
-			c->block = malloc(0x10000);
-# endif
+			c->block = bufpool_alloc(blockpool);
 //			syslog(LOG_WARNING,"chunk: %016"PRIX64", block:%p",c->chunkid,c->block);
 			passert(c->block);
 			c->blockno = 0xFFFF;
@@ -1642,24 +2235,40 @@ static int hdd_io_end(chunk *c) {
 			mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - write error",c->filename);
 			return status;
 		}
-		ts = get_usectime();
+		switch (c->owner->fsyncpolicy) {
+		case FSYNC_GROUP:
+			if (hdd_group_sync(c)<0) {
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (group) error",c->filename);
+				return ERROR_IO;
+			}
+			break;
+		case FSYNC_DEFERRED:
+			hdd_deferred_sync(c->owner);
+			break;
+		default:
+			ts = get_usectime();
 #ifdef F_FULLFSYNC
-		if (fcntl(c->fd,F_FULLFSYNC)<0) {
-			mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (via fcntl) error",c->filename);
-			return ERROR_IO;
-		}
+			if (fcntl(c->fd,F_FULLFSYNC)<0) {
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (via fcntl) error",c->filename);
+				return ERROR_IO;
+			}
 #else
-		if (fsync(c->fd)<0) {
-			mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (direct call) error",c->filename);
-			return ERROR_IO;
-		}
+			if (fsync(c->fd)<0) {
+				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - fsync (direct call) error",c->filename);
+				return ERROR_IO;
+			}
 #endif
-		te = get_usectime();
-		hdd_stats_datafsync(c->owner,te-ts);
+			te = get_usectime();
+			hdd_stats_datafsync(c->owner,te-ts,1);
+		}
 	}
 	c->crcrefcount--;
 	if (c->crcrefcount==0) {
 		if (OPENSTEPS==0) {
+			if (c->dfd>=0) {
+				close(c->dfd);
+				c->dfd = -1;
+			}
 			if (close(c->fd)<0) {
 				c->fd = -1;
 				mfs_arg_errlog_silent(LOG_WARNING,"hdd_io_end: file:%s - close error",c->filename);
@@ -1677,7 +2286,148 @@ static int hdd_io_end(chunk *c) {
 	return STATUS_OK;
 }
 
+/* data I/O - O_DIRECT in folders marked with '!' in mfshdd.cfg, page cache otherwise */
+
+#ifdef O_DIRECT
+/* returns O_DIRECT descriptor of chunk file (opened on first use) or -1 when page cache should be used */
+static int hdd_dio_fd(chunk *c) {
+	if (c->owner->direct==0) {
+		return -1;
+	}
+	if (c->dfd<0) {
+		c->dfd = open(c->filename,((c->owner->todel<2)?O_RDWR:O_RDONLY) | O_DIRECT);
+		if (c->dfd<0 && errno==EINVAL) {	// filesystem doesn't support direct I/O
+			mfs_arg_syslog(LOG_WARNING,"hdd space manager: direct I/O not supported in folder '%s' - using page cache",c->owner->path);
+			c->owner->direct = 0;
+		}
+	}
+	return c->dfd;
+}
+
+/* reads aligned window covering requested range into bounce buffer and copies requested part to iov */
+static ssize_t hdd_dio_readv(int dfd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset) {
+	uint8_t *bb,*p;
+	uint64_t start,end;
+	ssize_t ret,size,l;
+	uint32_t i;
+
+	for (size=0,i=0 ; i<iovcnt ; i++) {
+		size += iov[i].iov_len;
+	}
+	start = offset & ~((uint64_t)(DIOALIGN-1));
+	end = (offset+size+DIOALIGN-1) & ~((uint64_t)(DIOALIGN-1));
+	if (end-start>DIOBUFFSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	bb = bufpool_alloc(diopool);
+	passert(bb);
+	ret = pread(dfd,bb,end-start,start);
+	if (ret>=0) {
+		// window ends behind end of file, so data part can be shorter
+		ret = (ret>(ssize_t)(offset-start))?ret-(ssize_t)(offset-start):0;
+		if (ret>size) {
+			ret = size;
+		}
+		p = bb+(offset-start);
+		for (l=ret,i=0 ; i<iovcnt && l>0 ; i++) {
+			if ((ssize_t)(iov[i].iov_len)<l) {
+				memcpy(iov[i].iov_base,p,iov[i].iov_len);
+				p += iov[i].iov_len;
+				l -= iov[i].iov_len;
+			} else {
+				memcpy(iov[i].iov_base,p,l);
+				l = 0;
+			}
+		}
+	}
+	bufpool_free(diopool,bb);
+	return ret;
+}
+
+/* read-modify-write of aligned window covering requested range, fsize is size of file after this write */
+static ssize_t hdd_dio_write(chunk *c,int dfd,const uint8_t *buff,uint32_t size,uint64_t offset,uint64_t fsize) {
+	uint8_t *bb;
+	uint64_t start,end;
+	ssize_t ret;
+
+	start = offset & ~((uint64_t)(DIOALIGN-1));
+	end = (offset+size+DIOALIGN-1) & ~((uint64_t)(DIOALIGN-1));
+	if (end-start>DIOBUFFSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+	bb = bufpool_alloc(diopool);
+	passert(bb);
+	if (start<offset) {	// first sector
+		ret = pread(dfd,bb,DIOALIGN,start);
+		if (ret<0) {
+			bufpool_free(diopool,bb);
+			return -1;
+		}
+		if (ret<DIOALIGN) {
+			memset(bb+ret,0,DIOALIGN-ret);
+		}
+	}
+	if (offset+size<end && (start==offset || end-start>DIOALIGN)) {	// last sector (when it's not the first one)
+		ret = pread(dfd,bb+(end-start-DIOALIGN),DIOALIGN,end-DIOALIGN);
+		if (ret<0) {
+			bufpool_free(diopool,bb);
+			return -1;
+		}
+		if (ret<DIOALIGN) {
+			memset(bb+(end-start-DIOALIGN)+ret,0,DIOALIGN-ret);
+		}
+	}
+	memcpy(bb+(offset-start),buff,size);
+	ret = pwrite(dfd,bb,end-start,start);
+	bufpool_free(diopool,bb);
+	if (ret!=(ssize_t)(end-start)) {
+		return (ret<0)?-1:0;
+	}
+	if (end>fsize) {	// aligned write went behind end of file
+		if (ftruncate(c->fd,fsize)<0) {
+			return -1;
+		}
+	}
+	return size;
+}
+#endif /* O_DIRECT */
+
+static inline ssize_t hdd_data_read(chunk *c,uint8_t *buff,uint32_t size,uint64_t offset) {
+#ifdef O_DIRECT
+	struct iovec iov;
+	int dfd;
+	dfd = hdd_dio_fd(c);
+	if (dfd>=0) {
+		iov.iov_base = buff;
+		iov.iov_len = size;
+		return hdd_dio_readv(dfd,&iov,1,offset);
+	}
+#endif /* O_DIRECT */
+#ifdef USE_PIO
+	return pread(c->fd,buff,size,offset);
+#else /* USE_PIO */
+	lseek(c->fd,offset,SEEK_SET);
+	return read(c->fd,buff,size);
+#endif /* USE_PIO */
+}
 
+static inline ssize_t hdd_data_write(chunk *c,const uint8_t *buff,uint32_t size,uint64_t offset) {
+#ifdef O_DIRECT
+	int dfd;
+	dfd = hdd_dio_fd(c);
+	if (dfd>=0) {
+		return hdd_dio_write(c,dfd,buff,size,offset,CHUNKHDRSIZE+(((uint64_t)(c->blocks))<<16));
+	}
+#endif /* O_DIRECT */
+#ifdef USE_PIO
+	return pwrite(c->fd,buff,size,offset);
+#else /* USE_PIO */
+	lseek(c->fd,offset,SEEK_SET);
+	return write(c->fd,buff,size);
+#endif /* USE_PIO */
+}
 
 
 /* I/O operations */
@@ -1770,6 +2520,17 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		hdd_chunk_release(c);
 		return STATUS_OK;
 	}
+	if (hdd_bcache_get(c->chunkid,c->version,blocknum,buffer,offset,size)) {
+		if (size==0x10000) {
+			rcrcptr = (c->crc)+(4*blocknum);
+			crc = get32bit(&rcrcptr);
+		} else {
+			crc = mycrc32(0,buffer,size);
+		}
+		put32bit(&crcbuff,crc);
+		hdd_chunk_release(c);
+		return STATUS_OK;
+	}
 	if (offset==0 && size==0x10000) {
 #ifdef PRESERVE_BLOCK
 		if (c->blockno==blocknum) {
@@ -1778,12 +2539,7 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		} else {
 #endif /* PRESERVE_BLOCK */
 		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pread(c->fd,buffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-		ret = read(c->fd,buffer,0x10000);
-#endif /* USE_PIO */
+		ret = hdd_data_read(c,buffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 		te = get_usectime();
 		hdd_stats_dataread(c->owner,0x10000,te-ts);
 #ifdef PRESERVE_BLOCK
@@ -1808,16 +2564,12 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
+		hdd_bcache_put(c->chunkid,c->version,blocknum,buffer);
 	} else {
 #ifdef PRESERVE_BLOCK
 		if (c->blockno != blocknum) {
 			ts = get_usectime();
-#ifdef USE_PIO
-			ret = pread(c->fd,c->block,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-			ret = read(c->fd,c->block,0x10000);
-#endif /* USE_PIO */
+			ret = hdd_data_read(c,c->block,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 			te = get_usectime();
 			hdd_stats_dataread(c->owner,0x10000,te-ts);
 			c->blockno = blocknum;
@@ -1829,12 +2581,7 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 		postcrc = mycrc32(0,c->block+offset+size,0x10000-(offset+size));
 #else /* PRESERVE_BLOCK */
 		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pread(c->fd,blockbuffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-		ret = read(c->fd,blockbuffer,0x10000);
-#endif /* USE_PIO */
+		ret = hdd_data_read(c,blockbuffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 		te = get_usectime();
 		hdd_stats_dataread(c->owner,0x10000,te-ts);
 //		crc = mycrc32(0,blockbuffer+offset,size);	// first calc crc for piece
@@ -1868,8 +2615,10 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 			return ERROR_IO;
 		}
 #ifdef PRESERVE_BLOCK
+		hdd_bcache_put(c->chunkid,c->version,blocknum,c->block);
 		memcpy(buffer,c->block+offset,size);
 #else /* PRESERVE_BLOCK */
+		hdd_bcache_put(c->chunkid,c->version,blocknum,blockbuffer);
 		memcpy(buffer,blockbuffer+offset,size);
 #endif /* PRESERVE_BLOCK */
 	}
@@ -1878,6 +2627,320 @@ int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer
 	return STATUS_OK;
 }
 
+/* blocks are checked in page cache (mmap) - no copy, caller gets own descriptor to send data from chunk file */
+static inline int hdd_map_blocks(chunk *c,uint16_t blocknum,uint16_t n,uint8_t **crcbuffs,int *sfd,uint64_t *soffset) {
+	static long pagesize = 0;
+	struct stat sb;
+	uint64_t foffset,mapoffset,maplen;
+	uint8_t *map;
+	const uint8_t *rcrcptr;
+	uint8_t *wcrcptr;
+	uint32_t crc;
+	uint16_t i;
+	uint64_t ts,te;
+	int fd;
+
+	if (pagesize==0) {
+		pagesize = sysconf(_SC_PAGESIZE);
+	}
+	foffset = CHUNKHDRSIZE+(((uint32_t)blocknum)<<16);
+	// file shorter than expected would give SIGBUS - let normal read report it
+	if (pagesize<=0 || fstat(c->fd,&sb)<0 || (uint64_t)sb.st_size<foffset+(((uint32_t)n)<<16)) {
+		return -1;
+	}
+	mapoffset = foffset - (foffset%pagesize);
+	maplen = (foffset-mapoffset)+(((uint32_t)n)<<16);
+	ts = get_usectime();
+#ifdef MAP_POPULATE
+	map = mmap(NULL,maplen,PROT_READ,MAP_SHARED|MAP_POPULATE,c->fd,mapoffset);
+#else
+	map = mmap(NULL,maplen,PROT_READ,MAP_SHARED,c->fd,mapoffset);
+#endif
+	if (map==MAP_FAILED) {
+		return -1;
+	}
+	fd = dup(c->fd);
+	if (fd<0) {
+		munmap(map,maplen);
+		return -1;
+	}
+	rcrcptr = (c->crc)+(4*blocknum);
+	for (i=0 ; i<n ; i++) {
+		crc = mycrc32(0,map+(foffset-mapoffset)+(((uint32_t)i)<<16),0x10000);
+		if (get32bit(&rcrcptr)!=crc) {
+			munmap(map,maplen);
+			close(fd);
+			return 0;
+		}
+		wcrcptr = crcbuffs[i];
+		put32bit(&wcrcptr,crc);
+	}
+	munmap(map,maplen);
+	te = get_usectime();
+	hdd_stats_dataread(c->owner,((uint32_t)n)<<16,te-ts);
+	*sfd = fd;
+	*soffset = foffset;
+	return 1;
+}
+
+/* checks n whole blocks read into buffers, their crc goes to crcbuffs */
+static inline int hdd_check_blocks(chunk *c,uint16_t blocknum,uint16_t n,uint8_t **buffers,uint8_t **crcbuffs) {
+	const uint8_t *rcrcptr;
+	uint8_t *wcrcptr;
+	uint32_t crc;
+	uint16_t i;
+
+	rcrcptr = (c->crc)+(4*blocknum);
+	for (i=0 ; i<n ; i++) {
+		crc = mycrc32(0,buffers[i],0x10000);
+		if (get32bit(&rcrcptr)!=crc) {
+			return -1;
+		}
+		wcrcptr = crcbuffs[i];
+		put32bit(&wcrcptr,crc);
+	}
+	return 0;
+}
+
+/* reads whole consecutive blocks with one vectored read, every block is checked against its crc */
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,int *sfd,uint16_t *sblocks,uint64_t *soffset) {
+	chunk *c;
+	ssize_t ret;
+	uint8_t *wcrcptr;
+	uint16_t i,n;
+	uint64_t ts,te;
+	struct iovec iov[HDD_READ_MAXBLOCKS];
+#ifdef O_DIRECT
+	int dfd;
+#endif
+
+	if (sfd!=NULL) {
+		*sfd = -1;
+		*sblocks = 0;
+	}
+	if (blocks==0 || blocks>HDD_READ_MAXBLOCKS) {
+		return ERROR_EINVAL;
+	}
+	c = hdd_chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	if (c->version!=version && version>0) {
+		hdd_chunk_release(c);
+		return ERROR_WRONGVERSION;
+	}
+	if ((uint32_t)blocknum+blocks>0x400) {
+		hdd_chunk_release(c);
+		return ERROR_BNUMTOOBIG;
+	}
+	// blocks behind end of chunk are zeros
+	n = (blocknum>=c->blocks)?0:(blocknum+blocks>c->blocks)?(c->blocks-blocknum):blocks;
+	for (i=n ; i<blocks ; i++) {
+		memset(buffers[i],0,0x10000);
+		wcrcptr = crcbuffs[i];
+		put32bit(&wcrcptr,emptyblockcrc);
+	}
+	if (n>0 && sfd!=NULL && c->owner->direct==0) {	// mapping would bring data into page cache
+		switch (hdd_map_blocks(c,blocknum,n,crcbuffs,sfd,soffset)) {
+		case 1:
+			*sblocks = n;
+			hdd_chunk_release(c);
+			return STATUS_OK;
+		case 0:
+			syslog(LOG_WARNING,"read_blocks_from_chunk: file:%s - crc error",c->filename);
+			hdd_error_occured(c);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_CRC;
+		}
+		// can't map - read data
+	}
+	if (n>0) {
+		for (i=0 ; i<n ; i++) {
+			iov[i].iov_base = buffers[i];
+			iov[i].iov_len = 0x10000;
+		}
+		ts = get_usectime();
+#ifdef O_DIRECT
+		if ((dfd=hdd_dio_fd(c))>=0) {
+			ret = hdd_dio_readv(dfd,iov,n,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
+		} else
+#endif /* O_DIRECT */
+		{
+#ifdef HAVE_PREADV
+			ret = preadv(c->fd,iov,n,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
+#elif defined(HAVE_READV)
+			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
+			ret = readv(c->fd,iov,n);
+#else
+			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
+			for (ret=0,i=0 ; i<n ; i++) {
+				if (read(c->fd,buffers[i],0x10000)!=0x10000) {
+					break;
+				}
+				ret += 0x10000;
+			}
+#endif
+		}
+		te = get_usectime();
+		hdd_stats_dataread(c->owner,0x10000*n,te-ts);
+		if (ret!=0x10000*(ssize_t)n) {
+			mfs_arg_errlog_silent(LOG_WARNING,"read_blocks_from_chunk: file:%s - read error",c->filename);
+			hdd_error_occured(c);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_IO;
+		}
+		if (hdd_check_blocks(c,blocknum,n,buffers,crcbuffs)<0) {
+			syslog(LOG_WARNING,"read_blocks_from_chunk: file:%s - crc error",c->filename);
+			hdd_error_occured(c);
+			hdd_report_damaged_chunk(chunkid);
+			hdd_chunk_release(c);
+			return ERROR_CRC;
+		}
+	}
+	hdd_chunk_release(c);
+	return STATUS_OK;
+}
+
+#ifdef HAVE_IO_URING
+typedef struct _aioread {
+	chunk *c;
+	uint16_t blocknum;
+	uint16_t n;
+	uint16_t iovpos;	// first iov not filled yet (after short read)
+	uint32_t rbytes;	// bytes already read
+	uint64_t ts;
+	struct iovec iov[HDD_READ_MAXBLOCKS];
+	uint8_t *buffers[HDD_READ_MAXBLOCKS];
+	uint8_t *crcbuffs[HDD_READ_MAXBLOCKS];
+	void (*done)(uint8_t status,void *arg);
+	void *arg;
+} aioread;
+
+/* same as hdd_read_blocks, but data is read by folder's ring and checked by its reaper thread which then calls 'done' */
+/* returns 0 when read can't be started this way (chunk busy, not opened, no ring etc.) - then nothing is called */
+int hdd_read_blocks_async(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,void (*done)(uint8_t status,void *arg),void *arg) {
+	chunk *c;
+	aioread *ar;
+	uint8_t *wcrcptr;
+	uint16_t i,n;
+
+	if (blocks==0 || blocks>HDD_READ_MAXBLOCKS || (uint32_t)blocknum+blocks>0x400) {
+		return 0;
+	}
+	c = hdd_chunk_tryfind(chunkid);	// main thread can't wait for chunk
+	if (c==NULL || c==CHUNKLOCKED) {
+		return 0;
+	}
+	if ((c->version!=version && version>0) || c->fd<0 || c->crc==NULL || c->owner==NULL || c->owner->ring==NULL || c->owner->direct || blocknum>=c->blocks) {
+		hdd_chunk_release(c);
+		return 0;
+	}
+	n = (blocknum+blocks>c->blocks)?(c->blocks-blocknum):blocks;
+	ar = malloc(sizeof(aioread));
+	passert(ar);
+	ar->c = c;
+	ar->blocknum = blocknum;
+	ar->n = n;
+	ar->iovpos = 0;
+	ar->rbytes = 0;
+	ar->done = done;
+	ar->arg = arg;
+	for (i=0 ; i<n ; i++) {
+		ar->iov[i].iov_base = buffers[i];
+		ar->iov[i].iov_len = 0x10000;
+		ar->buffers[i] = buffers[i];
+		ar->crcbuffs[i] = crcbuffs[i];
+	}
+	ar->ts = get_usectime();
+	if (ioring_readv(c->owner->ring,c->fd,ar->iov,n,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),ar)<0) {
+		free(ar);
+		hdd_chunk_release(c);
+		return 0;
+	}
+	// blocks behind end of chunk are zeros
+	for (i=n ; i<blocks ; i++) {
+		memset(buffers[i],0,0x10000);
+		wcrcptr = crcbuffs[i];
+		put32bit(&wcrcptr,emptyblockcrc);
+	}
+	return 1;
+}
+
+/* short read - skips filled part of iov ; returns 1 when there is still something to read */
+static inline int hdd_aioread_advance(aioread *ar,uint32_t leng) {
+	ar->rbytes += leng;
+	while (leng>0 && ar->iovpos<ar->n) {
+		if (leng>=ar->iov[ar->iovpos].iov_len) {
+			leng -= ar->iov[ar->iovpos].iov_len;
+			ar->iovpos++;
+		} else {
+			ar->iov[ar->iovpos].iov_base = ((uint8_t*)(ar->iov[ar->iovpos].iov_base))+leng;
+			ar->iov[ar->iovpos].iov_len -= leng;
+			leng = 0;
+		}
+	}
+	return (ar->iovpos<ar->n)?1:0;
+}
+
+void* hdd_ring_thread(void *arg) {
+	folder *f = (folder*)arg;
+	aioread *ar;
+	void *udata;
+	int32_t res;
+	ssize_t ret;
+	uint64_t offset;
+	uint8_t status;
+	uint64_t te;
+	chunk *c;
+
+	while (ioring_wait(f->ring,&udata,&res)==0) {
+		if (udata==NULL) {	// hdd_term
+			break;
+		}
+		ar = (aioread*)udata;
+		c = ar->c;
+		if (res>0 && hdd_aioread_advance(ar,res)) {	// short read - read the rest
+			offset = CHUNKHDRSIZE+(((uint32_t)(ar->blocknum))<<16)+ar->rbytes;
+			if (ioring_readv(f->ring,c->fd,ar->iov+ar->iovpos,ar->n-ar->iovpos,offset,ar)==0) {
+				continue;
+			}
+			// ring is full - read it in this thread
+			do {
+				ret = preadv(c->fd,ar->iov+ar->iovpos,ar->n-ar->iovpos,offset);
+				if (ret>0) {
+					offset += ret;
+				}
+			} while (ret>0 && hdd_aioread_advance(ar,ret));
+			if (ret<0) {
+				res = -errno;
+			}
+		}
+		te = get_usectime();
+		hdd_stats_dataread(f,((uint32_t)(ar->n))<<16,te-ar->ts);
+		if (res<0 || ar->rbytes!=(((uint32_t)(ar->n))<<16)) {
+			errno = (res<0)?-res:EIO;
+			mfs_arg_errlog_silent(LOG_WARNING,"read_blocks_from_chunk: file:%s - read error",c->filename);
+			hdd_error_occured(c);
+			hdd_report_damaged_chunk(c->chunkid);
+			status = ERROR_IO;
+		} else if (hdd_check_blocks(c,ar->blocknum,ar->n,ar->buffers,ar->crcbuffs)<0) {
+			syslog(LOG_WARNING,"read_blocks_from_chunk: file:%s - crc error",c->filename);
+			hdd_error_occured(c);
+			hdd_report_damaged_chunk(c->chunkid);
+			status = ERROR_CRC;
+		} else {
+			status = STATUS_OK;
+		}
+		hdd_chunk_release(c);
+		ar->done(status,ar->arg);
+		free(ar);
+	}
+	return NULL;
+}
+#endif
+
 int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff) {
 	chunk *c;
 	int ret;
@@ -1924,6 +2987,7 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 		hdd_chunk_release(c);
 		return ERROR_CRC;
 	}
+	hdd_bcache_invalidate(c->chunkid,c->version,blocknum);
 	if (offset==0 && size==0x10000) {
 		if (blocknum>=c->blocks) {
 			wcrcptr = (c->crc)+(4*(c->blocks));
@@ -1933,12 +2997,7 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 			c->blocks=blocknum+1;
 		}
 		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pwrite(c->fd,buffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-		ret = write(c->fd,buffer,0x10000);
-#endif /* USE_PIO */
+		ret = hdd_data_write(c,buffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 		te = get_usectime();
 		hdd_stats_datawrite(c->owner,0x10000,te-ts);
 		if (crc!=mycrc32(0,buffer,0x10000)) {
@@ -1958,6 +3017,7 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 			hdd_chunk_release(c);
 			return ERROR_IO;
 		}
+		hdd_bcache_put(c->chunkid,c->version,blocknum,buffer);
 #ifdef PRESERVE_BLOCK
 		memcpy(c->block,buffer,0x10000);
 		c->blockno = blocknum;
@@ -1967,12 +3027,7 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 #ifdef PRESERVE_BLOCK
 			if (c->blockno != blocknum) {
 				ts = get_usectime();
-#ifdef USE_PIO
-				ret = pread(c->fd,c->block,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-				lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-				ret = read(c->fd,c->block,0x10000);
-#endif /* USE_PIO */
+				ret = hdd_data_read(c,c->block,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 				te = get_usectime();
 				hdd_stats_dataread(c->owner,0x10000,te-ts);
 				c->blockno = blocknum;
@@ -1981,12 +3036,7 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 			}
 #else /* PRESERVE_BLOCK */
 			ts = get_usectime();
-#ifdef USE_PIO
-			ret = pread(c->fd,blockbuffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
-#else /* USE_PIO */
-			lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16),SEEK_SET);
-			ret = read(c->fd,blockbuffer,0x10000);
-#endif /* USE_PIO */
+			ret = hdd_data_read(c,blockbuffer,0x10000,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16));
 			te = get_usectime();
 			hdd_stats_dataread(c->owner,0x10000,te-ts);
 #endif /* PRESERVE_BLOCK */
@@ -2049,24 +3099,14 @@ int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t
 #ifdef PRESERVE_BLOCK
 		memcpy(c->block+offset,buffer,size);
 		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pwrite(c->fd,c->block+offset,size,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset);
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset,SEEK_SET);
-		ret = write(c->fd,c->block+offset,size);
-#endif /* USE_PIO */
+		ret = hdd_data_write(c,c->block+offset,size,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset);
 		te = get_usectime();
 		hdd_stats_datawrite(c->owner,size,te-ts);
 		chcrc = mycrc32(0,c->block+offset,size);
 #else /* PRESERVE_BLOCK */
 		memcpy(blockbuffer+offset,buffer,size);
 		ts = get_usectime();
-#ifdef USE_PIO
-		ret = pwrite(c->fd,blockbuffer+offset,size,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset);
-#else /* USE_PIO */
-		lseek(c->fd,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset,SEEK_SET);
-		ret = write(c->fd,blockbuffer+offset,size);
-#endif /* USE_PIO */
+		ret = hdd_data_write(c,blockbuffer+offset,size,CHUNKHDRSIZE+(((uint32_t)blocknum)<<16)+offset);
 		te = get_usectime();
 		hdd_stats_datawrite(c->owner,size,te-ts);
 		chcrc = mycrc32(0,blockbuffer+offset,size);
@@ -2440,6 +3480,7 @@ static int hdd_int_duplicate(uint64_t chunkid,uint32_t version,uint32_t newversi
 		}
 		hdd_stats_write(4);
 		oc->version = newversion;
+		hdd_changes_mark(chunkid);
 	} else {
 		status = hdd_io_begin(oc,0);
 		if (status!=STATUS_OK) {
@@ -2610,6 +3651,7 @@ static int hdd_int_version(uint64_t chunkid,uint32_t version,uint32_t newversion
 	}
 	hdd_stats_write(4);
 	c->version = newversion;
+	hdd_changes_mark(chunkid);
 	status = hdd_io_end(c);
 	if (status!=STATUS_OK) {
 		hdd_error_occured(c);
@@ -2689,6 +3731,7 @@ static int hdd_int_truncate(uint64_t chunkid,uint32_t version,uint32_t newversio
 	}
 	hdd_stats_write(4);
 	c->version = newversion;
+	hdd_changes_mark(chunkid);
 	// step 2. truncate
 	blocks = ((length+0xFFFF)>>16);
 	if (blocks>c->blocks) {
@@ -2880,6 +3923,7 @@ static int hdd_int_duptrunc(uint64_t chunkid,uint32_t version,uint32_t newversio
 		}
 		hdd_stats_write(4);
 		oc->version = newversion;
+		hdd_changes_mark(chunkid);
 	} else {
 		status = hdd_io_begin(oc,0);
 		if (status!=STATUS_OK) {
@@ -3266,6 +4310,7 @@ int hdd_chunkop(uint64_t chunkid,uint32_t version,uint32_t newversion,uint64_t c
 
 void* hdd_tester_thread(void* arg) {
 	folder *f,*of;
+	hashstripe *hs;
 	chunk *c;
 	uint64_t chunkid;
 	uint32_t version;
@@ -3281,7 +4326,6 @@ void* hdd_tester_thread(void* arg) {
 		chunkid=0;
 		version=0;
 		pthread_mutex_lock(&folderlock);
-		pthread_mutex_lock(&hashlock);
 		pthread_mutex_lock(&testlock);
 		of = f;
 		do {
@@ -3292,20 +4336,28 @@ void* hdd_tester_thread(void* arg) {
 		} while ((f->damaged || f->todel) && of!=f);
 		if (of==f && (f->damaged || f->todel)) {	// all folders have status "damaged" and or "marked for removal", so no more work to do.
 			pthread_mutex_unlock(&testlock);
-			pthread_mutex_unlock(&hashlock);
 			pthread_mutex_unlock(&folderlock);
 			return arg;
 		}
 		c = f->testhead;
-		if (c && c->state==CH_AVAIL) {
+		if (c) {
 			chunkid = c->chunkid;
-			version = c->version;
-			path = strdup(c->filename);
-			passert(path);
 		}
 		pthread_mutex_unlock(&testlock);
-		pthread_mutex_unlock(&hashlock);
 		pthread_mutex_unlock(&folderlock);
+		if (chunkid>0) {	// chunk state is protected by its stripe lock which has to be taken before testlock - check again
+			hs = HASHSTRIPE(HASHPOS(chunkid));
+			pthread_mutex_lock(&(hs->lock));
+			pthread_mutex_lock(&testlock);
+			c = f->testhead;
+			if (c && c->chunkid==chunkid && c->state==CH_AVAIL) {
+				version = c->version;
+				path = strdup(c->filename);
+				passert(path);
+			}
+			pthread_mutex_unlock(&testlock);
+			pthread_mutex_unlock(&(hs->lock));
+		}
 		if (path) {
 			syslog(LOG_NOTICE,"testing chunk: %s",path);
 			if (hdd_int_test(chunkid,version)!=STATUS_OK) {
@@ -3599,6 +4651,7 @@ void* hdd_folders_thread(void *arg) {
 	for (;;) {
 		sleep(1);
 		hdd_check_folders();
+		hdd_deferred_flush(0);
 		eassert(pthread_mutex_lock(&termlock)==0);
 		if (term) {
 			eassert(pthread_mutex_unlock(&termlock)==0);
@@ -3639,6 +4692,7 @@ void hdd_term(void) {
 	cntcond *cc,*ccn;
 	lostchunk *lc,*lcn;
 	damagedchunk *dmc,*dmcn;
+	syncerror *se;
 
 	eassert(pthread_mutex_lock(&termlock)==0);
 	term=1;
@@ -3646,11 +4700,35 @@ void hdd_term(void) {
 	eassert(pthread_join(testerthread,NULL)==0);
 	eassert(pthread_join(foldersthread,NULL)==0);
 	eassert(pthread_join(delayedthread,NULL)==0);
+	hdd_deferred_flush(1);
+#ifdef HAVE_IO_URING
+	for (f=folderhead ; f ; f=f->next) {
+		if (f->ring) {
+			if (ioring_wakeup(f->ring)==0) {
+				eassert(pthread_join(f->ringthread,NULL)==0);
+			}
+			ioring_delete(f->ring);
+			f->ring = NULL;
+		}
+	}
+#endif
 	for (f=folderhead ; f ; f = fn) {
 		fn = f->next;
+		eassert(pthread_mutex_destroy(&(f->synclock))==0);
+		eassert(pthread_cond_destroy(&(f->synccond))==0);
+		if (f->syncfds) {
+			free(f->syncfds);
+		}
+		while ((se=f->syncerrors)) {
+			f->syncerrors = se->next;
+			free(se);
+		}
 		free(f->path);
 		free(f);
 	}
+	free(folderbyid);
+	folderbyid = NULL;
+	foldercount = 0;
 	for (i=0 ; i<HASHSIZE ; i++) {
 		for (c=hashtab[i] ; c ; c = cn) {
 			cn = c->next;
@@ -3664,20 +4742,15 @@ void hdd_term(void) {
 				if (c->fd>=0) {
 					close(c->fd);
 				}
+				if (c->dfd>=0) {
+					close(c->dfd);
+				}
 				if (c->crc!=NULL) {
-#ifdef MMAP_ALLOC
-					munmap(c->crc,4096);
-#else
-					free(c->crc);
-#endif
+					bufpool_free(crcpool,c->crc);
 				}
 #ifdef PRESERVE_BLOCK
 				if (c->block!=NULL) {
-# ifdef MMAP_ALLOC
-					munmap(c->block,0x10000);
-# else
-					free(c->block);
-# endif
+					bufpool_free(blockpool,c->block);
 				}
 #endif /* PRESERVE_BLOCK */
 				if (c->filename) {
@@ -3699,14 +4772,17 @@ void hdd_term(void) {
 		dcn = dc->next;
 		free(dc);
 	}
-	for (cc=cclist ; cc ; cc = ccn) {
-		ccn = cc->next;
-		if (cc->wcnt) {
-			syslog(LOG_WARNING,"hddspacemgr (atexit): used cond !!!");
-		} else {
-			pthread_cond_destroy(&(cc->cond));
+	for (i=0 ; i<HASHLOCKS ; i++) {
+		for (cc=hashstripes[i].cclist ; cc ; cc = ccn) {
+			ccn = cc->next;
+			if (cc->wcnt) {
+				syslog(LOG_WARNING,"hddspacemgr (atexit): used cond !!!");
+			} else {
+				pthread_cond_destroy(&(cc->cond));
+			}
+			free(cc);
 		}
-		free(cc);
+		hashstripes[i].cclist = NULL;
 	}
 	for (lc=lostchunks ; lc ; lc = lcn) {
 		lcn = lc->next;
@@ -3716,11 +4792,22 @@ void hdd_term(void) {
 		dmcn = dmc->next;
 		free(dmc);
 	}
+	hdd_changes_prune(1,0);
+	hdd_bcache_term();
+	bufpool_delete(crcpool);
+	bufpool_delete(blockpool);
+#ifdef O_DIRECT
+	if (diopool) {
+		bufpool_delete(diopool);
+		diopool = NULL;
+	}
+#endif
 }
 
 int hdd_init(void) {
 	uint32_t l,p;
-	int lfp,td;
+	int lfp,td,direct;
+	uint8_t policy;
 	uint32_t hp;
 	FILE *fd;
 	char buff[1000];
@@ -3735,6 +4822,10 @@ int hdd_init(void) {
 	for (hp=0 ; hp<HASHSIZE ; hp++) {
 		hashtab[hp]=NULL;
 	}
+	for (hp=0 ; hp<HASHLOCKS ; hp++) {
+		eassert(pthread_mutex_init(&(hashstripes[hp].lock),NULL)==0);
+		hashstripes[hp].cclist = NULL;
+	}
 	for (hp=0 ; hp<DHASHSIZE ; hp++) {
 		dophashtab[hp]=NULL;
 	}
@@ -3752,6 +4843,17 @@ int hdd_init(void) {
 //	emptyblockcrc = mycrc32(0,blockbuffer,0x10000);
 	emptyblockcrc = mycrc32_zeroblock(0,0x10000);
 
+	hdd_bcache_init();
+	crcpool = bufpool_new(4096,CRCPERSLAB,1);
+	blockpool = bufpool_new(0x10000,BLOCKSPERSLAB,1);
+
+	FsyncPolicy = cfg_getuint8("HDD_FSYNC_POLICY",FSYNC_IMMEDIATE);
+	if (FsyncPolicy>FSYNC_DEFERRED) {
+		FsyncPolicy = FSYNC_IMMEDIATE;
+	}
+	FsyncGroupTime = cfg_getuint32("HDD_FSYNC_GROUP_TIME",0);
+	FsyncDeferredTime = cfg_getuint32("HDD_FSYNC_DEFERRED_TIME",10);
+
 	hddfname = cfg_getstr("HDD_CONF_FILENAME",ETC_PATH "/mfshdd.cfg");
 
 	fd = fopen(hddfname,"r");
@@ -3768,6 +4870,24 @@ int hdd_init(void) {
 		while (l>0 && (buff[l-1]=='\r' || buff[l-1]=='\n' || buff[l-1]==' ' || buff[l-1]=='\t')) {
 			l--;
 		}
+		policy = FsyncPolicy;
+		for (p=l ; p>0 && buff[p-1]!=' ' && buff[p-1]!='\t' ; p--) {}
+		if (p>0 && l>p+6 && memcmp(buff+p,"fsync=",6)==0) {	// folder options
+			buff[l]='\0';
+			if (strcmp(buff+p+6,"immediate")==0) {
+				policy = FSYNC_IMMEDIATE;
+			} else if (strcmp(buff+p+6,"group")==0) {
+				policy = FSYNC_GROUP;
+			} else if (strcmp(buff+p+6,"deferred")==0) {
+				policy = FSYNC_DEFERRED;
+			} else {
+				mfs_arg_syslog(LOG_WARNING,"hdd space manager: unknown fsync policy '%s' - using default",buff+p+6);
+			}
+			l = p;
+			while (l>0 && (buff[l-1]==' ' || buff[l-1]=='\t')) {
+				l--;
+			}
+		}
 		if (l>0) {
 			if (buff[l-1]!='/') {
 				buff[l]='/';
@@ -3776,13 +4896,17 @@ int hdd_init(void) {
 			} else {
 				buff[l]='\0';
 			}
-			if (buff[0]=='*') {
-				td = 1;
-				pptr = buff+1;
+			td = 0;
+			direct = 0;
+			pptr = buff;
+			while (*pptr=='*' || *pptr=='!') {	// '*' - marked for removal, '!' - direct I/O
+				if (*pptr=='*') {
+					td = 1;
+				} else {
+					direct = 1;
+				}
+				pptr++;
 				l--;
-			} else {
-				td = 0;
-				pptr = buff;
 			}
 			lockfname = (char*)malloc(l+6);
 			passert(lockfname);
@@ -3836,6 +4960,17 @@ int hdd_init(void) {
 			passert(f);
 			f->todel = td;
 			f->damaged = 0;
+#ifdef O_DIRECT
+			f->direct = direct;
+			if (direct && diopool==NULL) {
+				diopool = bufpool_new(DIOBUFFSIZE,DIOPERSLAB,0);
+			}
+#else
+			if (direct) {
+				mfs_arg_syslog(LOG_NOTICE,"hdd space manager: direct I/O not supported on this platform - folder '%s' uses page cache",pptr);
+			}
+			f->direct = 0;
+#endif
 			f->path = strdup(pptr);
 			passert(f->path);
 			f->leavefree = 0x10000000; // about 256MB  -  future: (uint64_t)as*0x40000000;
@@ -3859,6 +4994,30 @@ int hdd_init(void) {
 			f->testhead = NULL;
 			f->testtail = &(f->testhead);
 			f->carry = (double)(random()&0x7FFFFFFF)/(double)(0x7FFFFFFF);
+			f->fid = foldercount++;
+			f->jqueued = 0;
+			f->jwaitsum = 0;
+			f->jwaitcnt = 0;
+			f->jwaitmax = 0;
+			f->jwaitavglast = 0;
+			f->jwaitmaxlast = 0;
+#ifdef HAVE_IO_URING
+			f->ring = NULL;
+#endif
+			f->fsyncpolicy = policy;
+			eassert(pthread_mutex_init(&(f->synclock),NULL)==0);
+			eassert(pthread_cond_init(&(f->synccond),NULL)==0);
+			f->syncticket = 0;
+			f->syncdone = 0;
+			f->syncerrors = NULL;
+			f->syncing = 0;
+			f->syncfds = NULL;
+			f->syncfdscnt = 0;
+			f->syncfdssize = 0;
+			f->syncpending = 0;
+			f->syncfirst = 0;
+			f->syncchunks = 0;
+			f->syncchunkslast = 0;
 			f->next = folderhead;
 			folderhead = f;
 		}
@@ -3872,10 +5031,39 @@ int hdd_init(void) {
 	}
 	free(hddfname);
 
+	folderbyid = malloc(sizeof(folder*)*foldercount);
+	passert(folderbyid);
+	for (f=folderhead ; f ; f=f->next) {
+		folderbyid[f->fid] = f;
+	}
+	FolderWorkers = cfg_getuint8("HDD_FOLDER_WORKERS",4);
+	FolderQueueSize = cfg_getuint32("HDD_FOLDER_QUEUE_SIZE",250);
+	if (FolderQueueSize<10) {
+		FolderQueueSize = 10;
+	}
+
 	eassert(pthread_attr_init(&thattr)==0);
 	eassert(pthread_attr_setstacksize(&thattr,0x100000)==0);
 	eassert(pthread_attr_setdetachstate(&thattr,PTHREAD_CREATE_JOINABLE)==0);
 
+#ifdef HAVE_IO_URING
+	HDDIoUring = cfg_getuint8("HDD_IO_URING",0);
+	if (HDDIoUring) {
+		for (f=folderhead ; f ; f=f->next) {
+			f->ring = ioring_new(RINGSIZE);
+			if (f->ring==NULL) {
+				mfs_arg_errlog(LOG_WARNING,"hdd space manager: can't create io_uring for folder '%s' - using threads",f->path);
+			} else {
+				eassert(pthread_create(&(f->ringthread),&thattr,hdd_ring_thread,f)==0);
+			}
+		}
+	}
+#else
+	if (cfg_getuint8("HDD_IO_URING",0)) {
+		syslog(LOG_NOTICE,"hdd space manager: HDD_IO_URING not supported on this platform - ignored");
+	}
+#endif
+
 	scanprogress=0;
 	scanprogresswaiting=0;
 	l=0;
@@ -26,6 +26,15 @@
 void hdd_stats(uint32_t *br,uint32_t *bw,uint32_t *opr,uint32_t *opw,uint32_t *dbr,uint32_t *dbw,uint32_t *dopr,uint32_t *dopw,uint64_t *rtime,uint64_t *wtime);
 void hdd_op_stats(uint32_t *op_create,uint32_t *op_delete,uint32_t *op_version,uint32_t *op_duplicate,uint32_t *op_truncate,uint32_t *op_duptrunc,uint32_t *op_test);
 uint32_t hdd_errorcounter(void);
+void hdd_bcache_stats(uint32_t *hits,uint32_t *misses);
+void hdd_bufpool_stats(uint32_t *crcused,uint32_t *blockused);
+
+/* per folder job queues (bgjobs) */
+uint32_t hdd_folder_queues(uint8_t *workers,uint32_t *queuesize);
+int32_t hdd_chunk_folder(uint64_t chunkid);
+void hdd_folder_job_queued(uint32_t fid);
+void hdd_folder_job_rejected(uint32_t fid);
+void hdd_folder_job_started(uint32_t fid,uint32_t waittime);
 
 /* lock/unlock pair */
 uint32_t hdd_get_damaged_chunk_count(void);
@@ -36,8 +45,8 @@ void hdd_get_lost_chunk_data(uint8_t *buff);
 /* lock/unlock pair */
 uint32_t hdd_diskinfo_v1_size();
 void hdd_diskinfo_v1_data(uint8_t *buff);
-uint32_t hdd_diskinfo_v2_size();
-void hdd_diskinfo_v2_data(uint8_t *buff);
+uint32_t hdd_diskinfo_v2_size(uint8_t listver);
+void hdd_diskinfo_v2_data(uint8_t *buff,uint8_t listver);
 /* lock/unlock pair */
 void hdd_get_chunks_begin();
 void hdd_get_chunks_end();
@@ -45,6 +54,18 @@ uint32_t hdd_get_chunks_next_list_count();
 void hdd_get_chunks_next_list_data(uint8_t *buff);
 //uint32_t hdd_get_chunks_count();
 //void hdd_get_chunks_data(uint8_t *buff);
+/* lock/unlock pair */
+void hdd_get_changes_begin();
+void hdd_get_changes_end();
+uint32_t hdd_get_changes_next_list_count();
+void hdd_get_changes_next_list_data(uint8_t *buff);
+
+/* chunks changed since last checkpoint acknowledged by master */
+void hdd_changes_mark(uint64_t chunkid);
+void hdd_changes_clear(void);
+uint32_t hdd_changes_checkpoint(void);
+void hdd_changes_ack(uint32_t gen);
+int hdd_changes_overflow(void);
 
 //uint32_t get_changedchunkscount();
 //void fill_changedchunksinfo(uint8_t *buff);
@@ -56,6 +77,12 @@ int hdd_open(uint64_t chunkid);
 int hdd_close(uint64_t chunkid);
 int hdd_read(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint8_t *buffer,uint32_t offset,uint32_t size,uint8_t *crcbuff);
 int hdd_write(uint64_t chunkid,uint32_t version,uint16_t blocknum,const uint8_t *buffer,uint32_t offset,uint32_t size,const uint8_t *crcbuff);
+/* whole blocks only (up to HDD_READ_MAXBLOCKS), buffers[i] and crcbuffs[i] receive block blocknum+i */
+/* sfd!=NULL - zero-copy: first *sblocks blocks are only verified and left in chunk file, data should be sent from descriptor *sfd (to be closed by caller, -1 if not used) starting at *soffset */
+#define HDD_READ_MAXBLOCKS 16
+int hdd_read_blocks(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,int *sfd,uint16_t *sblocks,uint64_t *soffset);
+/* io_uring (HDD_IO_URING): returns 1 when read was submitted - 'done' is called from folder's reaper thread, 0 - use hdd_read_blocks */
+int hdd_read_blocks_async(uint64_t chunkid,uint32_t version,uint16_t blocknum,uint16_t blocks,uint8_t **buffers,uint8_t **crcbuffs,void (*done)(uint8_t status,void *arg),void *arg);
 
 /* chunk info */
 int hdd_check_version(uint64_t chunkid,uint32_t version);
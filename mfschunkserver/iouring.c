@@ -0,0 +1,213 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "massert.h"
+#include "iouring.h"
+
+typedef struct _ioring {
+	int fd;
+	pthread_mutex_t sqlock;
+	/* submission ring */
+	unsigned *sqhead,*sqtail,*sqmask,*sqentries,*sqarray;
+	struct io_uring_sqe *sqes;
+	void *sqmap;
+	size_t sqmapsize;
+	size_t sqessize;
+	/* completion ring */
+	unsigned *cqhead,*cqtail,*cqmask;
+	struct io_uring_cqe *cqes;
+	void *cqmap;
+	size_t cqmapsize;
+	/* submitted and not reaped operations - kept below completion ring size, so completions are never dropped */
+	uint32_t inflight;
+	uint32_t cqentries;
+} ioring;
+
+static inline int ioring_setup(uint32_t entries,struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static inline int ioring_enter(int fd,uint32_t tosubmit,uint32_t mincomplete,uint32_t flags) {
+	return syscall(__NR_io_uring_enter,fd,tosubmit,mincomplete,flags,NULL,0);
+}
+
+void* ioring_new(uint32_t entries) {
+	struct io_uring_params p;
+	ioring *r;
+	uint8_t *sqptr,*cqptr;
+
+	r = malloc(sizeof(ioring));
+	passert(r);
+	memset(&p,0,sizeof(p));
+	r->fd = ioring_setup(entries,&p);
+	if (r->fd<0) {
+		free(r);
+		return NULL;
+	}
+	r->sqmapsize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	r->cqmapsize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cqmapsize>r->sqmapsize) {
+			r->sqmapsize = r->cqmapsize;
+		}
+		r->cqmapsize = r->sqmapsize;
+	}
+	r->sqmap = mmap(NULL,r->sqmapsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQ_RING);
+	if (r->sqmap==MAP_FAILED) {
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cqmap = r->sqmap;
+	} else {
+		r->cqmap = mmap(NULL,r->cqmapsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_CQ_RING);
+		if (r->cqmap==MAP_FAILED) {
+			munmap(r->sqmap,r->sqmapsize);
+			close(r->fd);
+			free(r);
+			return NULL;
+		}
+	}
+	r->sqessize = p.sq_entries*sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL,r->sqessize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,r->fd,IORING_OFF_SQES);
+	if (r->sqes==MAP_FAILED) {
+		if (r->cqmap!=r->sqmap) {
+			munmap(r->cqmap,r->cqmapsize);
+		}
+		munmap(r->sqmap,r->sqmapsize);
+		close(r->fd);
+		free(r);
+		return NULL;
+	}
+	sqptr = r->sqmap;
+	r->sqhead = (unsigned*)(sqptr+p.sq_off.head);
+	r->sqtail = (unsigned*)(sqptr+p.sq_off.tail);
+	r->sqmask = (unsigned*)(sqptr+p.sq_off.ring_mask);
+	r->sqentries = (unsigned*)(sqptr+p.sq_off.ring_entries);
+	r->sqarray = (unsigned*)(sqptr+p.sq_off.array);
+	cqptr = r->cqmap;
+	r->cqhead = (unsigned*)(cqptr+p.cq_off.head);
+	r->cqtail = (unsigned*)(cqptr+p.cq_off.tail);
+	r->cqmask = (unsigned*)(cqptr+p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe*)(cqptr+p.cq_off.cqes);
+	r->inflight = 0;
+	r->cqentries = p.cq_entries;
+	eassert(pthread_mutex_init(&(r->sqlock),NULL)==0);
+	return r;
+}
+
+void ioring_delete(void *rp) {
+	ioring *r = (ioring*)rp;
+	munmap(r->sqes,r->sqessize);
+	if (r->cqmap!=r->sqmap) {
+		munmap(r->cqmap,r->cqmapsize);
+	}
+	munmap(r->sqmap,r->sqmapsize);
+	close(r->fd);
+	eassert(pthread_mutex_destroy(&(r->sqlock))==0);
+	free(r);
+}
+
+// put one entry into submission ring and submit it (without SQPOLL kernel reads ring only during io_uring_enter, so not submitted entry can be withdrawn)
+// 'reserve' entries of completion ring are left for other operations (wakeup)
+static int ioring_submit(ioring *r,uint8_t opcode,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,void *udata,uint32_t reserve) {
+	struct io_uring_sqe *sqe;
+	unsigned tail,head,idx;
+	int ret;
+
+	eassert(pthread_mutex_lock(&(r->sqlock))==0);
+	tail = *(r->sqtail);
+	head = __atomic_load_n(r->sqhead,__ATOMIC_ACQUIRE);
+	if (tail-head >= *(r->sqentries) || __atomic_load_n(&(r->inflight),__ATOMIC_ACQUIRE)+reserve >= r->cqentries) {
+		eassert(pthread_mutex_unlock(&(r->sqlock))==0);
+		errno = EBUSY;
+		return -1;
+	}
+	idx = tail & *(r->sqmask);
+	sqe = r->sqes+idx;
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)iov;
+	sqe->len = iovcnt;
+	sqe->off = offset;
+	sqe->user_data = (uint64_t)(uintptr_t)udata;
+	r->sqarray[idx] = idx;
+	__atomic_store_n(r->sqtail,tail+1,__ATOMIC_RELEASE);
+	do {
+		ret = ioring_enter(r->fd,1,0,0);
+	} while (ret<0 && errno==EINTR);
+	if (ret!=1) {
+		__atomic_store_n(r->sqtail,tail,__ATOMIC_RELEASE);
+		eassert(pthread_mutex_unlock(&(r->sqlock))==0);
+		return -1;
+	}
+	__atomic_add_fetch(&(r->inflight),1,__ATOMIC_RELEASE);
+	eassert(pthread_mutex_unlock(&(r->sqlock))==0);
+	return 0;
+}
+
+int ioring_readv(void *r,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,void *udata) {
+	return ioring_submit((ioring*)r,IORING_OP_READV,fd,iov,iovcnt,offset,udata,1);
+}
+
+int ioring_wakeup(void *r) {
+	return ioring_submit((ioring*)r,IORING_OP_NOP,-1,NULL,0,0,NULL,0);
+}
+
+int ioring_wait(void *rp,void **udata,int32_t *res) {
+	ioring *r = (ioring*)rp;
+	struct io_uring_cqe *cqe;
+	unsigned head,tail;
+	int ret;
+
+	for (;;) {
+		head = *(r->cqhead);
+		tail = __atomic_load_n(r->cqtail,__ATOMIC_ACQUIRE);
+		if (head!=tail) {
+			cqe = r->cqes+(head & *(r->cqmask));
+			*udata = (void*)(uintptr_t)(cqe->user_data);
+			*res = cqe->res;
+			__atomic_store_n(r->cqhead,head+1,__ATOMIC_RELEASE);
+			__atomic_sub_fetch(&(r->inflight),1,__ATOMIC_RELEASE);
+			return 0;
+		}
+		ret = ioring_enter(r->fd,0,1,IORING_ENTER_GETEVENTS);
+		if (ret<0 && errno!=EINTR) {
+			return -1;
+		}
+	}
+}
+
+#endif /* HAVE_IO_URING */
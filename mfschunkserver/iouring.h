@@ -0,0 +1,35 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _IOURING_H_
+#define _IOURING_H_
+
+#include <sys/uio.h>
+#include <inttypes.h>
+
+// minimal io_uring (raw syscalls, no liburing) - many submitters, one thread reaping completions
+void* ioring_new(uint32_t entries);
+void ioring_delete(void *r);
+// returns 0 when request was submitted, -1 otherwise (ring full, too many operations in flight or error), iov must be valid until completion
+int ioring_readv(void *r,int fd,const struct iovec *iov,uint32_t iovcnt,uint64_t offset,void *udata);
+// wakes up reaper with udata==NULL
+int ioring_wakeup(void *r);
+// waits for next completion, res is result of operation (negative errno on error)
+int ioring_wait(void *r,void **udata,int32_t *res);
+
+#endif
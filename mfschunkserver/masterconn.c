@@ -48,6 +48,7 @@
 #include "csserv.h"
 
 #define MaxPacketSize 10000
+#define CHECKPOINT_DELAY 5
 
 // mode
 enum {FREE,CONNECTING,HEADER,DATA,KILL};
@@ -87,6 +88,9 @@ static char *MasterPort;
 static char *BindHost;
 static uint32_t Timeout;
 
+// session given by master - used for delta registration after reconnect
+static uint64_t sessionid=0;
+
 static uint32_t stats_bytesout=0;
 static uint32_t stats_bytesin=0;
 static uint32_t stats_maxjobscnt=0;
@@ -159,6 +163,43 @@ uint8_t* masterconn_create_attached_packet(masterconn *eptr,uint32_t type,uint32
 	return ptr;
 }
 
+void masterconn_sendregister_delta(masterconn *eptr) {
+	uint8_t *buff;
+	uint32_t chunks,myip;
+	uint16_t myport;
+	uint64_t usedspace,totalspace;
+	uint64_t tdusedspace,tdtotalspace;
+	uint32_t chunkcount,tdchunkcount;
+
+	myip = csserv_getlistenip();
+	myport = csserv_getlistenport();
+	buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+4+4+2+2+8);
+	put8bit(&buff,60);
+	put16bit(&buff,VERSMAJ);
+	put8bit(&buff,VERSMID);
+	put8bit(&buff,VERSMIN);
+	put32bit(&buff,myip);
+	put16bit(&buff,myport);
+	put16bit(&buff,Timeout);
+	put64bit(&buff,sessionid);
+	hdd_get_changes_begin();
+	while ((chunks = hdd_get_changes_next_list_count())) {
+		buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+chunks*(8+4));
+		put8bit(&buff,61);
+		hdd_get_changes_next_list_data(buff);
+	}
+	hdd_get_changes_end();
+	hdd_get_space(&usedspace,&totalspace,&chunkcount,&tdusedspace,&tdtotalspace,&tdchunkcount);
+	buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+8+8+4+8+8+4);
+	put8bit(&buff,62);
+	put64bit(&buff,usedspace);
+	put64bit(&buff,totalspace);
+	put32bit(&buff,chunkcount);
+	put64bit(&buff,tdusedspace);
+	put64bit(&buff,tdtotalspace);
+	put32bit(&buff,tdchunkcount);
+}
+
 void masterconn_sendregister(masterconn *eptr) {
 	uint8_t *buff;
 	uint32_t chunks,myip;
@@ -167,6 +208,16 @@ void masterconn_sendregister(masterconn *eptr) {
 	uint64_t tdusedspace,tdtotalspace;
 	uint32_t chunkcount,tdchunkcount;
 
+	if (sessionid!=0) {
+		if (hdd_changes_overflow()==0) {
+			syslog(LOG_NOTICE,"sending only chunks changed since last connection");
+			masterconn_sendregister_delta(eptr);
+			return;
+		}
+		syslog(LOG_NOTICE,"too many chunks changed since last connection - sending all chunks");
+		sessionid = 0;
+	}
+	hdd_changes_clear();
 	myip = csserv_getlistenip();
 	myport = csserv_getlistenport();
 	buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER,1+4+4+2+2);
@@ -320,9 +371,29 @@ void masterconn_check_hdd_reports() {
 }
 
 #ifdef BGJOBS
+// chunk changed by job has to be reported again after reconnection unless master got this status before next checkpoint
+void masterconn_job_changes_mark(void *packet) {
+	const uint8_t *ptr;
+	uint32_t type;
+	packetstruct *outpacket = (packetstruct*)packet;
+	ptr = outpacket->packet;
+	type = get32bit(&ptr);
+	ptr+=4;
+	hdd_changes_mark(get64bit(&ptr));
+	if (type==CSTOMA_CHUNKOP) {
+		uint64_t copychunkid;
+		ptr+=8;
+		copychunkid = get64bit(&ptr);
+		if (copychunkid>0) {
+			hdd_changes_mark(copychunkid);
+		}
+	}
+}
+
 void masterconn_jobfinished(uint8_t status,void *packet) {
 	uint8_t *ptr;
 	masterconn *eptr = masterconnsingleton;
+	masterconn_job_changes_mark(packet);
 	if (eptr->mode==DATA || eptr->mode==HEADER) {
 		ptr = masterconn_get_packet_data(packet);
 		ptr[8]=status;
@@ -335,6 +406,7 @@ void masterconn_jobfinished(uint8_t status,void *packet) {
 void masterconn_chunkopfinished(uint8_t status,void *packet) {
 	uint8_t *ptr;
 	masterconn *eptr = masterconnsingleton;
+	masterconn_job_changes_mark(packet);
 	if (eptr->mode==DATA || eptr->mode==HEADER) {
 		ptr = masterconn_get_packet_data(packet);
 		ptr[32]=status;
@@ -347,6 +419,7 @@ void masterconn_chunkopfinished(uint8_t status,void *packet) {
 void masterconn_replicationfinished(uint8_t status,void *packet) {
 	uint8_t *ptr;
 	masterconn *eptr = masterconnsingleton;
+	masterconn_job_changes_mark(packet);
 //	syslog(LOG_NOTICE,"job replication status: %"PRIu8,status);
 	if (eptr->mode==DATA || eptr->mode==HEADER) {
 		ptr = masterconn_get_packet_data(packet);
@@ -359,6 +432,7 @@ void masterconn_replicationfinished(uint8_t status,void *packet) {
 
 void masterconn_unwantedjobfinished(uint8_t status,void *packet) {
 	(void)status;
+	masterconn_job_changes_mark(packet);
 	masterconn_delete_packet(packet);
 }
 
@@ -790,10 +864,54 @@ void masterconn_chunk_checksum_tab(masterconn *eptr,const uint8_t *data,uint32_t
 	}
 }
 
+void masterconn_register_session(masterconn *eptr,const uint8_t *data,uint32_t length) {
+	uint64_t sid;
+	if (length!=8) {
+		syslog(LOG_NOTICE,"MATOCS_REGISTER_SESSION - wrong size (%"PRIu32"/8)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	sid = get64bit(&data);
+	if (sid==0) {	// delta registration rejected
+		if (sessionid!=0) {
+			syslog(LOG_NOTICE,"master doesn't know previous session - sending all chunks");
+			sessionid = 0;
+			masterconn_sendregister(eptr);
+		}
+		return;
+	}
+	sessionid = sid;
+}
+
+void masterconn_register_checkpoint_ack(masterconn *eptr,const uint8_t *data,uint32_t length) {
+	if (length!=4) {
+		syslog(LOG_NOTICE,"MATOCS_REGISTER_CHECKPOINT_ACK - wrong size (%"PRIu32"/4)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	hdd_changes_ack(get32bit(&data));
+}
+
+void masterconn_checkpoint(void) {
+	masterconn *eptr = masterconnsingleton;
+	uint8_t *buff;
+	if ((eptr->mode==DATA || eptr->mode==HEADER) && sessionid!=0) {
+		masterconn_check_hdd_reports();	// lost chunks have to be sent before checkpoint
+		buff = masterconn_create_attached_packet(eptr,CSTOMA_REGISTER_CHECKPOINT,4);
+		put32bit(&buff,hdd_changes_checkpoint());
+	}
+}
+
 void masterconn_gotpacket(masterconn *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
 	switch (type) {
 		case ANTOAN_NOP:
 			break;
+		case MATOCS_REGISTER_SESSION:
+			masterconn_register_session(eptr,data,length);
+			break;
+		case MATOCS_REGISTER_CHECKPOINT_ACK:
+			masterconn_register_checkpoint_ack(eptr,data,length);
+			break;
 		case MATOCS_CREATE:
 			masterconn_create(eptr,data,length);
 			break;
@@ -1239,6 +1357,7 @@ int masterconn_init(void) {
 
 	main_eachloopregister(masterconn_check_hdd_reports);
 	main_timeregister(TIMEMODE_RUN_LATE,ReconnectionDelay,0,masterconn_reconnect);
+	main_timeregister(TIMEMODE_SKIP_LATE,CHECKPOINT_DELAY,0,masterconn_checkpoint);
 	main_destructregister(masterconn_term);
 	main_pollregister(masterconn_desc,masterconn_serve);
 	main_reloadregister(masterconn_reload);
@@ -278,10 +278,14 @@
 // length:64
 #define MLTOMA_DOWNLOAD_DATA 62
 // offset:64 leng:32
+// (since version 1.6.21 - many requests can be sent without waiting for answers)
+// offset:64 leng:32 flags:8 (since version 1.6.21 ; flags: 1 - MATOML_DOWNLOAD_ZDATA answer accepted)
 #define MATOML_DOWNLOAD_DATA 63
 // offset:64 leng:32 crc:32 data:lengB
 #define MLTOMA_DOWNLOAD_END 64
 // -
+#define MATOML_DOWNLOAD_ZDATA 65
+// offset:64 leng:32 crc:32 zdata:(length-16)B (zlib stream of lengB of data ; crc of uncompressed data)
 
 
 
@@ -309,6 +313,13 @@
 //      	N*[chunkid:64 version:32]
 //      rver==52:	// version 5 / END
 //      	usedspace:64 totalspace:64 chunks:32 tdusedspace:64 tdtotalspace:64 tdchunks:32
+// - version 6 (only chunks changed since last acknowledged checkpoint of given session):
+//      rver==60:	// version 6 / BEGIN
+//      	version:32 myip:32 myport:16 tcptimeout:16 sessionid:64
+//      rver==61:	// version 6 / CHANGES
+//      	N*[chunkid:64 version:32]	- version==0 means that chunk doesn't exist any more
+//      rver==62:	// version 6 / END
+//      	usedspace:64 totalspace:64 chunks:32 tdusedspace:64 tdtotalspace:64 tdchunks:32
 
 #define CSTOMA_SPACE 101
 // usedspace:64 totalspace:64
@@ -325,6 +336,12 @@
 // N*[chunkid:64]	- now N is always 1
 #define CSTOMA_ERROR_OCCURRED 106
 // -
+#define MATOCS_REGISTER_SESSION 107
+// sessionid:64	- 0 means that session is unknown and all chunks should be sent (rver==50)
+#define CSTOMA_REGISTER_CHECKPOINT 108
+// gen:32
+#define MATOCS_REGISTER_CHECKPOINT_ACK 109
+// gen:32
 
 #define MATOCS_CREATE 110
 // chunkid:64 version:32
@@ -503,6 +520,14 @@
 //  sessionid:32 sesflags:8
 //  status:8
 
+#define REGISTER_FOLLOWER 6
+// rcode==6: connect to metalogger serving reads (session registered in master) (since version 1.6.21)
+// CUTOMA:
+//  rcode:8 sessionid:32 version:32
+// MLTOCU:
+//  metaversion:64
+//  status:8
+
 #define CUTOMA_FUSE_REGISTER 400
 // blob:64B ... (depends on blob - see blob descriptions above)
 #define MATOCU_FUSE_REGISTER 401
@@ -719,6 +744,20 @@
 // msgid:32 status:8
 // msgid:32 qflags:8 sinodes:32 slength:64 ssize:64 srealsize:64 hinodes:32 hlength:64 hsize:64 hrealsize:64 curinodes:32 curlength:64 cursize:64 currealsize:64
 
+// read-only metadata operations (LOOKUP,GETATTR,READLINK,GETDIR) can be also sent to metalogger with live metadata (registered with REGISTER_FOLLOWER)
+// answer with status ERROR_DELAYED means that metalogger metadata are older than required - ask master
+#define CUTOMA_FUSE_MINVERSION 478
+// minversion:64 (client -> metalogger only ; since version 1.6.21) - do not answer following requests using metadata older than minversion
+#define MATOCU_FUSE_METAVERSION 479
+// msgid:32 (always 0) metaversion:64 (master -> client ; since version 1.6.21) - sent before answer when metadata have been changed since last packet sent to client
+
+// used when chunk has no available copies - data can be rebuilt as xor of all other chunks from its xor group (parity included)
+#define CUTOMA_FUSE_READ_XOR_CHUNKS 480
+// msgid:32 inode:32 chunkindx:32
+#define MATOCU_FUSE_READ_XOR_CHUNKS 481
+// msgid:32 status:8
+// msgid:32 chunkid:64 N*[ chunkid:64 version:32 count:8 count*[ip:32 port:16] ] (since version 1.6.21)
+
 
 // special - reserved (opened) inodes - keep opened files.
 #define CUTOMA_FUSE_RESERVED_INODES 499
@@ -732,10 +771,14 @@
 
 #define CUTOMA_CSERV_LIST 500
 // -
+// since version 1.6.21:
+// extended:8
 #define MATOCU_CSERV_LIST 501
 // 	N*[ip:32 port:16 used:64 total:64 chunks:32 tdused:64 tdtotal:64 tdchunks:32 errorcount:32 ]
 // since version 1.5.13:
 // 	N*[version:32 ip:32 port:16 used:64 total:64 chunks:32 tdused:64 tdtotal:64 tdchunks:32 errorcount:32 ]
+// extended (since version 1.6.21):
+// 	N*[version:32 ip:32 port:16 used:64 total:64 chunks:32 tdused:64 tdtotal:64 tdchunks:32 errorcount:32 regpending:32 regmerged:32 ]
 
 #define CUTOCS_HDD_LIST_V1 502
 // -
@@ -759,10 +802,14 @@
 
 #define CUTOMA_INFO 510
 // -
+// since version 1.6.21:
+// infover:8 (optional - 1 means that client understands extended answer)
 #define MATOCU_INFO 511
 // 	totalspace:64 availspace:64 trashspace:64 trashnodes:32 reservedspace:64 reservednodes:32 allnodes:32 dirnodes:32 filenodes:32 chunks:32 tdchunks:32
 // since version 1.5.13:
 // 	version:32 totalspace:64 availspace:64 trashspace:64 trashnodes:32 reservedspace:64 reservednodes:32 allnodes:32 dirnodes:32 filenodes:32 chunks:32 chunkcopies:32 tdcopies:32
+// since version 1.6.21 (only when infover>=1 has been sent):
+// 	version:32 totalspace:64 availspace:64 trashspace:64 trashnodes:32 reservedspace:64 reservednodes:32 allnodes:32 dirnodes:32 filenodes:32 chunks:32 chunkcopies:32 tdcopies:32 dcentries:32 dchits:32 dcmisses:32 dcinvalidated:32 dcexpired:32
 
 #define CUTOMA_FSTEST_INFO 512
 // -
@@ -796,12 +843,25 @@
 #define MATOCU_MLOG_LIST 523
 // N * [ version:32 ip:32 ]
 
+#define CUTOMA_LATENCY_INFO 524
+// -
+#define MATOCU_LATENCY_INFO 525
+// buckets:8 N * [ group:8 nleng:8 name:nlengB count:64 sumusec:64 maxusec:32 buckets * [ count:64 ] ]
+// group: 0 - main loop, 1 - timer, 2 - client message, 3 - poll serve, 4 - each loop ; bucket 0: <2us, bucket N: 2^N..2^(N+1)-1 us, last bucket: >=2^(buckets-1) us
+
+#define CUTOMA_STALL_INFO 526
+// -
+#define MATOCU_STALL_INFO 527
+// thresholdusec:32 N * [ time:32 usec:32 group:8 nleng:8 name:nlengB frames:8 frames * [ fleng:8 frame:flengB ] ]
+// newest first ; group as in MATOCU_LATENCY_INFO ; frames - backtrace sampled while callback was running (0 - not sampled)
+
 
 // CHUNKSERVER STATS
 
 #define CUTOCS_HDD_LIST_V2 600
-// -
+// - | listver:8
 #define CSTOCU_HDD_LIST_V2 601
-// N*[ entrysize:16 path:NAME flags:8 errchunkid:64 errtime:32 used:64 total:64 chunkscount:32 bytesread:64 usecread:64 usecreadmax:64 byteswriten:64 usecwrite:64 usecwritemax:64]
+// N*[ entrysize:16 path:NAME flags:8 errchunkid:64 errtime:32 used:64 total:64 chunkscount:32 3 * [ rbytes:64 wbytes:64 usecreadsum:64 usecwritesum:64 usecfsyncsum:64 rops:32 wops:32 fsyncops:32 usecreadmax:32 usecwritemax:32 usecfsyncmax:32 ] ]
+// listver>=1 (1.6.21): entries extended with jobsqueued:32 jobswaitavg:32 jobswaitmax:32 fsyncpolicy:8 syncchunks:32 (older cgi accepts only exact entry sizes)
 
 #endif
@@ -20,6 +20,11 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#ifdef HAVE_PCLMUL
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
 #include "MFSCommunication.h"
 
 /* original crc32 code
@@ -65,13 +70,25 @@ uint32_t crc32(uint32_t crc,uint8_t *block,uint32_t leng) {
 
 #ifdef FASTCRC
 #define BYTEREV(w) (((w)>>24)+(((w)>>8)&0xff00)+(((w)&0xff00)<<8)+(((w)&0xff)<<24))
-static uint32_t crc_table[4][256];
+#ifdef WORDS_BIGENDIAN
+#define CRC_TABLES 4
+#else
+#define CRC_TABLES 16	/* slice-by-16 */
+#endif
+static uint32_t crc_table[CRC_TABLES][256];
 #else
 static uint32_t crc_table[256];
 #endif
 
+#ifdef HAVE_PCLMUL
+static uint8_t crc_pclmul = 0;
+#endif
+
 void crc_generate_main_tables(void) {
 	uint32_t c,poly,i;
+#if defined(FASTCRC) && !defined(WORDS_BIGENDIAN)
+	uint32_t j;
+#endif
 
 	poly = CRC_POLY;
 	for (i=0; i<256; i++) {
@@ -107,33 +124,108 @@ void crc_generate_main_tables(void) {
 		crc_table[3][i] = c;
 #else /* little endian */
 		c = crc_table[0][i];
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[1][i] = c;
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[2][i] = c;
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[3][i] = c;
+		for (j=1 ; j<CRC_TABLES ; j++) {
+			c = crc_table[0][c&0xff]^(c>>8);
+			crc_table[j][i] = c;
+		}
 #endif
-/*
-		c = crc_table[0][i];
-		crc_table[4][i] = BYTEREV(c);
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[1][i] = c;
-		crc_table[5][i] = BYTEREV(c);
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[2][i] = c;
-		crc_table[6][i] = BYTEREV(c);
-		c = crc_table[0][c&0xff]^(c>>8);
-		crc_table[3][i] = c;
-		crc_table[7][i] = BYTEREV(c);
-*/
 	}
 #endif
 }
 
+#ifdef HAVE_PCLMUL
+/* PCLMULQDQ folding (Intel "Fast CRC Computation Using PCLMULQDQ Instruction") for reflected CRC_POLY */
+/* works on inverted crc, leng must be multiple of 16 and at least 64 */
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_pclmul(uint32_t crc,const uint8_t *block,uint32_t leng) {
+	static const uint64_t k1k2[2] __attribute__((aligned(16))) = {0x0154442bd4ULL,0x01c6e41596ULL};
+	static const uint64_t k3k4[2] __attribute__((aligned(16))) = {0x01751997d0ULL,0x00ccaa009eULL};
+	static const uint64_t k5k0[2] __attribute__((aligned(16))) = {0x0163cd6124ULL,0x0000000000ULL};
+	static const uint64_t poly[2] __attribute__((aligned(16))) = {0x01db710641ULL,0x01f7011641ULL};
+	__m128i x0,x1,x2,x3,x4,x5,x6,x7,x8,y5,y6,y7,y8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(block+0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(block+0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(block+0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(block+0x30));
+	x1 = _mm_xor_si128(x1,_mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	block += 64;
+	leng -= 64;
+
+	// fold four 128-bit lanes in parallel
+	while (leng>=64) {
+		x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+		x6 = _mm_clmulepi64_si128(x2,x0,0x00);
+		x7 = _mm_clmulepi64_si128(x3,x0,0x00);
+		x8 = _mm_clmulepi64_si128(x4,x0,0x00);
+		x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+		x2 = _mm_clmulepi64_si128(x2,x0,0x11);
+		x3 = _mm_clmulepi64_si128(x3,x0,0x11);
+		x4 = _mm_clmulepi64_si128(x4,x0,0x11);
+		y5 = _mm_loadu_si128((const __m128i*)(block+0x00));
+		y6 = _mm_loadu_si128((const __m128i*)(block+0x10));
+		y7 = _mm_loadu_si128((const __m128i*)(block+0x20));
+		y8 = _mm_loadu_si128((const __m128i*)(block+0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,x5),y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2,x6),y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3,x7),y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4,x8),y8);
+		block += 64;
+		leng -= 64;
+	}
+
+	// fold lanes into one
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x3),x5);
+	x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1,x4),x5);
+
+	// remaining 16-byte blocks
+	while (leng>=16) {
+		x2 = _mm_loadu_si128((const __m128i*)block);
+		x5 = _mm_clmulepi64_si128(x1,x0,0x00);
+		x1 = _mm_clmulepi64_si128(x1,x0,0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,x2),x5);
+		block += 16;
+		leng -= 16;
+	}
+
+	// 128 -> 64 bits
+	x2 = _mm_clmulepi64_si128(x1,x0,0x10);
+	x3 = _mm_setr_epi32(~0,0,~0,0);
+	x1 = _mm_srli_si128(x1,8);
+	x1 = _mm_xor_si128(x1,x2);
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+	x2 = _mm_srli_si128(x1,4);
+	x1 = _mm_and_si128(x1,x3);
+	x1 = _mm_clmulepi64_si128(x1,x0,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+	x2 = _mm_and_si128(x1,x3);
+	x2 = _mm_clmulepi64_si128(x2,x0,0x10);
+	x2 = _mm_and_si128(x2,x3);
+	x2 = _mm_clmulepi64_si128(x2,x0,0x00);
+	x1 = _mm_xor_si128(x1,x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1,4));
+}
+#endif
+
 uint32_t mycrc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
 #ifdef FASTCRC
 	const uint32_t *block4;
+#ifndef WORDS_BIGENDIAN
+	uint32_t w1,w2,w3;
+#endif
 #endif
 
 #ifdef FASTCRC
@@ -145,13 +237,26 @@ uint32_t mycrc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
 #define CRC_REORDER crc^=0xFFFFFFFF
 #define CRC_ONE_BYTE crc = crc_table[0][(crc ^ *block++) & 0xFF] ^ (crc >> 8)
 #define CRC_FOUR_BYTES crc ^= *block4++; crc = crc_table[3][crc & 0xff] ^ crc_table[2][(crc >> 8) & 0xff] ^ crc_table[1][(crc >> 16) & 0xff] ^ crc_table[0][crc >> 24]
+#define CRC_SIXTEEN_BYTES crc ^= *block4++; w1 = *block4++; w2 = *block4++; w3 = *block4++; \
+	crc = crc_table[15][crc & 0xff] ^ crc_table[14][(crc >> 8) & 0xff] ^ crc_table[13][(crc >> 16) & 0xff] ^ crc_table[12][crc >> 24] \
+	    ^ crc_table[11][w1 & 0xff] ^ crc_table[10][(w1 >> 8) & 0xff] ^ crc_table[9][(w1 >> 16) & 0xff] ^ crc_table[8][w1 >> 24] \
+	    ^ crc_table[7][w2 & 0xff] ^ crc_table[6][(w2 >> 8) & 0xff] ^ crc_table[5][(w2 >> 16) & 0xff] ^ crc_table[4][w2 >> 24] \
+	    ^ crc_table[3][w3 & 0xff] ^ crc_table[2][(w3 >> 8) & 0xff] ^ crc_table[1][(w3 >> 16) & 0xff] ^ crc_table[0][w3 >> 24]
 #endif
 	CRC_REORDER;
+#ifdef HAVE_PCLMUL
+	if (crc_pclmul && leng>=64) {
+		crc = crc32_pclmul(crc,block,leng&0xFFFFFFF0);
+		block += leng&0xFFFFFFF0;
+		leng &= 0xF;
+	}
+#endif
 	while (leng && ((unsigned long)block & 3)) {
 		CRC_ONE_BYTE;
 		leng--;
 	}
 	block4 = (const uint32_t*)block;
+#ifdef WORDS_BIGENDIAN
 	while (leng>=32) {
 		CRC_FOUR_BYTES;
 		CRC_FOUR_BYTES;
@@ -163,6 +268,19 @@ uint32_t mycrc32(uint32_t crc,const uint8_t *block,uint32_t leng) {
 		CRC_FOUR_BYTES;
 		leng-=32;
 	}
+#else /* little endian */
+	while (leng>=64) {
+		CRC_SIXTEEN_BYTES;
+		CRC_SIXTEEN_BYTES;
+		CRC_SIXTEEN_BYTES;
+		CRC_SIXTEEN_BYTES;
+		leng-=64;
+	}
+	while (leng>=16) {
+		CRC_SIXTEEN_BYTES;
+		leng-=16;
+	}
+#endif
 	while (leng>=4) {
 		CRC_FOUR_BYTES;
 		leng-=4;
@@ -248,9 +366,35 @@ static void crc_generate_combine_tables(void) {
 	}
 }
 
+#ifdef HAVE_PCLMUL
+/* x^(8*j*16^i) mod CRC_POLY (reflected) - multiplying by it appends j*16^i zero bytes */
+static uint32_t crc_xpow_table[8][16];
+
+/* a*b mod CRC_POLY (reflected): carry-less product, upper 32 bits folded with zero-data slice step */
+__attribute__((target("pclmul,sse2")))
+static inline uint32_t crc_multiply(uint32_t a,uint32_t b) {
+	uint64_t r;
+	uint32_t l;
+	r = _mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi32_si128(a),_mm_cvtsi32_si128(b),0x00));
+	r <<= 1;
+	l = r;
+	return (uint32_t)(r>>32) ^ crc_table[3][l & 0xff] ^ crc_table[2][(l >> 8) & 0xff] ^ crc_table[1][(l >> 16) & 0xff] ^ crc_table[0][l >> 24];
+}
+#endif
+
 uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
 	uint8_t i;
 
+#ifdef HAVE_PCLMUL
+	if (crc_pclmul) {
+		for (i=0 ; leng2 ; i++, leng2>>=4) {
+			if (leng2&0xF) {
+				crc1 = crc_multiply(crc1,crc_xpow_table[i][leng2&0xF]);
+			}
+		}
+		return crc1^crc2;
+	}
+#endif
 	/* add leng2 zeros to crc1 */
 	i=0;
 	while (leng2) {
@@ -268,6 +412,22 @@ uint32_t mycrc32_combine(uint32_t crc1, uint32_t crc2, uint32_t leng2) {
 }
 
 void mycrc32_init(void) {
+#ifdef HAVE_PCLMUL
+	unsigned int eax,ebx,ecx,edx;
+	uint32_t i,j;
+#endif
 	crc_generate_main_tables();
 	crc_generate_combine_tables();
+#ifdef HAVE_PCLMUL
+	if (__get_cpuid(1,&eax,&ebx,&ecx,&edx) && (ecx & bit_PCLMUL) && (edx & bit_SSE2)) {
+		crc_pclmul = 1;
+		for (i=0 ; i<8 ; i++) {
+			crc_xpow_table[i][0] = 0x80000000;	// 1 (reflected)
+			crc_xpow_table[i][1] = crc_combine_table[4*i][3][0x80];	// 1 shifted by 16^i zero bytes
+			for (j=2 ; j<16 ; j++) {
+				crc_xpow_table[i][j] = crc_multiply(crc_xpow_table[i][j-1],crc_xpow_table[i][1]);
+			}
+		}
+	}
+#endif
 }
@@ -84,4 +84,32 @@ static inline uint8_t get8bit(const uint8_t **ptr) {
 	return t8;
 }
 
+// variable length (7 bits per byte, lowest bits first) - at most 10 bytes
+static inline void putvar64bit(uint8_t **ptr,uint64_t val) {
+	while (val>=0x80) {
+		(*ptr)[0]=(val&0x7F)|0x80;
+		(*ptr)++;
+		val>>=7;
+	}
+	(*ptr)[0]=val;
+	(*ptr)++;
+}
+
+// returns -1 when data ends before last byte of number
+static inline int getvar64bit(const uint8_t **ptr,const uint8_t *endptr,uint64_t *val) {
+	uint64_t t64;
+	uint8_t shift;
+	t64=0;
+	for (shift=0 ; shift<64 && (*ptr)<endptr ; shift+=7) {
+		t64|=((uint64_t)((*ptr)[0]&0x7F))<<shift;
+		if (((*ptr)[0]&0x80)==0) {
+			(*ptr)++;
+			*val=t64;
+			return 0;
+		}
+		(*ptr)++;
+	}
+	return -1;
+}
+
 #endif
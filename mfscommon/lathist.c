@@ -0,0 +1,80 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "datapack.h"
+#include "massert.h"
+#include "lathist.h"
+
+static lathist *lathisthead = NULL;
+static lathist **lathisttail = &lathisthead;
+
+// histograms are never freed - they live as long as the process
+lathist* lathist_new(uint8_t group,const char *name) {
+	lathist *h;
+	h = malloc(sizeof(lathist));
+	passert(h);
+	memset(h,0,sizeof(lathist));
+	h->group = group;
+	h->name = name;
+	h->next = NULL;
+	*lathisttail = h;
+	lathisttail = &(h->next);
+	return h;
+}
+
+uint32_t lathist_info_size(void) {
+	lathist *h;
+	uint32_t nleng,size;
+	size = 1;
+	for (h=lathisthead ; h ; h=h->next) {
+		nleng = strlen(h->name);
+		if (nleng>255) {
+			nleng = 255;
+		}
+		size += 2+nleng+8+8+4+8*LATHIST_BUCKETS;
+	}
+	return size;
+}
+
+void lathist_info_data(uint8_t *buff) {
+	lathist *h;
+	uint32_t nleng,i;
+	put8bit(&buff,LATHIST_BUCKETS);
+	for (h=lathisthead ; h ; h=h->next) {
+		nleng = strlen(h->name);
+		if (nleng>255) {
+			nleng = 255;
+		}
+		put8bit(&buff,h->group);
+		put8bit(&buff,nleng);
+		memcpy(buff,h->name,nleng);
+		buff+=nleng;
+		put64bit(&buff,h->count);
+		put64bit(&buff,h->sum);
+		put32bit(&buff,h->max);
+		for (i=0 ; i<LATHIST_BUCKETS ; i++) {
+			put64bit(&buff,h->buckets[i]);
+		}
+	}
+}
@@ -0,0 +1,71 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LATHIST_H_
+#define _LATHIST_H_
+
+#include <sys/time.h>
+#include <inttypes.h>
+
+// log2 buckets: bucket 0 - below 2us, bucket N - from 2^N to 2^(N+1)-1 us, last bucket - 2^23us (about 8s) and more
+#define LATHIST_BUCKETS 24
+
+#define LATHIST_GROUP_MAINLOOP 0
+#define LATHIST_GROUP_TIMER 1
+#define LATHIST_GROUP_MESSAGE 2
+#define LATHIST_GROUP_POLL 3
+#define LATHIST_GROUP_EACHLOOP 4
+
+typedef struct _lathist {
+	uint64_t count;
+	uint64_t sum;		// usec
+	uint32_t max;		// usec
+	uint64_t buckets[LATHIST_BUCKETS];
+	uint8_t group;
+	const char *name;	// not copied
+	struct _lathist *next;
+} lathist;
+
+static inline uint64_t lathist_usec(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return ((uint64_t)(tv.tv_sec))*1000000+tv.tv_usec;
+}
+
+static inline void lathist_add(lathist *h,uint64_t start,uint64_t end) {
+	uint64_t usec;
+	uint32_t b;
+	usec = (end>start)?end-start:0;	// time can go backward
+	h->count++;
+	h->sum += usec;
+	if (usec>h->max) {
+		h->max = (usec>0xFFFFFFFF)?0xFFFFFFFF:usec;
+	}
+	b = 0;
+	while (usec>1 && b<LATHIST_BUCKETS-1) {
+		usec>>=1;
+		b++;
+	}
+	h->buckets[b]++;
+}
+
+lathist* lathist_new(uint8_t group,const char *name);
+uint32_t lathist_info_size(void);
+void lathist_info_data(uint8_t *buff);
+
+#endif
@@ -53,6 +53,10 @@
 #ifdef USE_PTHREADS
 #include <pthread.h>
 #endif
+#if defined(HAVE_EXECINFO_H) && defined(HAVE_BACKTRACE)
+#include <execinfo.h>
+#define STALL_USE_BACKTRACE 1
+#endif
 
 #define STR_AUX(x) #x
 #define STR(x) STR_AUX(x)
@@ -64,6 +68,8 @@
 #include "init.h"
 #include "massert.h"
 #include "slogger.h"
+#include "lathist.h"
+#include "datapack.h"
 
 #define RM_RESTART 0
 #define RM_START 1
@@ -105,6 +111,7 @@ static rlentry *rlhead=NULL;
 typedef struct pollentry {
 	void (*desc)(struct pollfd *,uint32_t *);
 	void (*serve)(struct pollfd *);
+	lathist *hist;
 	struct pollentry *next;
 } pollentry;
 
@@ -113,6 +120,7 @@ static pollentry *pollhead=NULL;
 
 typedef struct eloopentry {
 	void (*fun)(void);
+	lathist *hist;
 	struct eloopentry *next;
 } eloopentry;
 
@@ -126,6 +134,7 @@ typedef struct timeentry {
 	int mode;
 //	int offset;
 	void (*fun)(void);
+	lathist *hist;
 	struct timeentry *next;
 } timeentry;
 
@@ -133,6 +142,32 @@ static timeentry *timehead=NULL;
 
 static uint32_t now;
 static uint64_t usecnow;
+
+// stall detector - callbacks running longer than STALL_THRESHOLD_MS are remembered in ring buffer
+#define STALL_RING 64
+#define STALL_MAXFRAMES 24
+
+typedef struct stallentry {
+	uint32_t time;
+	uint32_t usec;
+	lathist *hist;		// callback identity (group and name)
+	uint32_t frames;
+	char **symbols;		// sampled backtrace (malloc'ed by backtrace_symbols)
+} stallentry;
+
+static stallentry stallring[STALL_RING];
+static uint32_t stallpos,stallcnt;
+static uint64_t StallThreshold;	// usec, 0 - disabled
+#ifdef STALL_USE_BACKTRACE
+static uint32_t StallBacktrace;
+#ifdef USE_PTHREADS
+static pthread_t mainthread;
+#endif
+static volatile uint64_t cbstart;	// start of currently running callback (0 - none)
+static volatile uint64_t samplestart;	// callback start for which sample was taken
+static volatile int sampleframes;
+static void* sample[STALL_MAXFRAMES];
+#endif
 //static int alcnt=0;
 
 #ifdef USE_PTHREADS
@@ -175,24 +210,26 @@ void main_reloadregister (void (*fun)(void)) {
 	rlhead = aux;
 }
 
-void main_pollregister (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(struct pollfd *)) {
+void main_pollregister_name (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(struct pollfd *),const char *name) {
 	pollentry *aux=(pollentry*)malloc(sizeof(pollentry));
 	passert(aux);
 	aux->desc = desc;
 	aux->serve = serve;
+	aux->hist = lathist_new(LATHIST_GROUP_POLL,name);
 	aux->next = pollhead;
 	pollhead = aux;
 }
 
-void main_eachloopregister (void (*fun)(void)) {
+void main_eachloopregister_name (void (*fun)(void),const char *name) {
 	eloopentry *aux=(eloopentry*)malloc(sizeof(eloopentry));
 	passert(aux);
 	aux->fun = fun;
+	aux->hist = lathist_new(LATHIST_GROUP_EACHLOOP,name);
 	aux->next = eloophead;
 	eloophead = aux;
 }
 
-void main_timeregister (int mode,uint32_t seconds,uint32_t offset,void (*fun)(void)) {
+void main_timeregister_name (int mode,uint32_t seconds,uint32_t offset,void (*fun)(void),const char *name) {
 	timeentry *aux;
 	if (seconds==0 || offset>=seconds) return;
 	aux = (timeentry*)malloc(sizeof(timeentry));
@@ -205,6 +242,7 @@ void main_timeregister (int mode,uint32_t seconds,uint32_t offset,void (*fun)(vo
 	aux->offset = offset;
 	aux->mode = mode;
 	aux->fun = fun;
+	aux->hist = lathist_new(LATHIST_GROUP_TIMER,name);
 	aux->next = timehead;
 	timehead = aux;
 }
@@ -305,6 +343,181 @@ void destruct() {
 	}
 }
 
+#ifdef STALL_USE_BACKTRACE
+// SIGALRM handler - takes backtrace of callback which runs too long (only first sample of each call)
+void main_stall_sample(int signo) {
+	uint64_t s;
+#ifndef USE_PTHREADS
+	(void)signo;
+#endif
+	s = cbstart;
+	if (s==0 || samplestart==s || lathist_usec()<s+StallThreshold) {
+		return;
+	}
+#ifdef USE_PTHREADS
+	if (pthread_equal(pthread_self(),mainthread)==0) {	// process timer signal can be delivered to any thread - pass it to main loop
+		pthread_kill(mainthread,signo);
+		return;
+	}
+#endif
+	sampleframes = backtrace(sample,STALL_MAXFRAMES);
+	samplestart = s;
+}
+#endif
+
+void main_stall(lathist *hist,uint64_t tstart,uint64_t tend) {
+	stallentry *se;
+	se = stallring + stallpos;
+	if (se->symbols) {
+		free(se->symbols);
+	}
+	se->time = tstart/1000000;
+	se->usec = (tend-tstart>0xFFFFFFFF)?0xFFFFFFFF:tend-tstart;
+	se->hist = hist;
+	se->frames = 0;
+	se->symbols = NULL;
+#ifdef STALL_USE_BACKTRACE
+	if (samplestart==tstart && sampleframes>0) {
+		se->symbols = backtrace_symbols(sample,sampleframes);
+		if (se->symbols) {
+			se->frames = sampleframes;
+		}
+	}
+#endif
+	stallpos = (stallpos+1)%STALL_RING;
+	if (stallcnt<STALL_RING) {
+		stallcnt++;
+	}
+	syslog(LOG_WARNING,"main loop stall: %s took %"PRIu32" ms",hist->name,se->usec/1000);
+}
+
+static inline uint64_t main_callstart(void) {
+	uint64_t tstart;
+	tstart = lathist_usec();
+#ifdef STALL_USE_BACKTRACE
+	cbstart = tstart;
+#endif
+	return tstart;
+}
+
+static inline void main_callend(lathist *hist,uint64_t tstart) {
+	uint64_t tend;
+	tend = lathist_usec();
+#ifdef STALL_USE_BACKTRACE
+	cbstart = 0;
+#endif
+	lathist_add(hist,tstart,tend);
+	if (StallThreshold>0 && tend>tstart+StallThreshold) {
+		main_stall(hist,tstart,tend);
+	}
+}
+
+static inline void main_runtimer(timeentry *timeit) {
+	uint64_t tstart;
+	tstart = main_callstart();
+	timeit->fun();
+	main_callend(timeit->hist,tstart);
+}
+
+uint32_t main_stall_info_size(void) {
+	uint32_t i,j,size,l;
+	stallentry *se;
+	size = 4;
+	for (i=0 ; i<stallcnt ; i++) {
+		se = stallring + ((stallpos+STALL_RING-1-i)%STALL_RING);
+		l = strlen(se->hist->name);
+		size += 4+4+1+1+((l>255)?255:l)+1;
+		for (j=0 ; j<se->frames ; j++) {
+			l = strlen(se->symbols[j]);
+			size += 1+((l>255)?255:l);
+		}
+	}
+	return size;
+}
+
+// newest first
+void main_stall_info_data(uint8_t *buff) {
+	uint32_t i,j,l;
+	stallentry *se;
+	put32bit(&buff,StallThreshold);
+	for (i=0 ; i<stallcnt ; i++) {
+		se = stallring + ((stallpos+STALL_RING-1-i)%STALL_RING);
+		put32bit(&buff,se->time);
+		put32bit(&buff,se->usec);
+		put8bit(&buff,se->hist->group);
+		l = strlen(se->hist->name);
+		if (l>255) {
+			l = 255;
+		}
+		put8bit(&buff,l);
+		memcpy(buff,se->hist->name,l);
+		buff+=l;
+		put8bit(&buff,se->frames);
+		for (j=0 ; j<se->frames ; j++) {
+			l = strlen(se->symbols[j]);
+			if (l>255) {
+				l = 255;
+			}
+			put8bit(&buff,l);
+			memcpy(buff,se->symbols[j],l);
+			buff+=l;
+		}
+	}
+}
+
+void main_stall_reload(void) {
+#ifdef STALL_USE_BACKTRACE
+	struct itimerval it;
+	struct sigaction sa;
+#endif
+	StallThreshold = (uint64_t)cfg_getuint32("STALL_THRESHOLD_MS",1000)*1000;
+#ifdef STALL_USE_BACKTRACE
+	StallBacktrace = cfg_getuint32("STALL_BACKTRACE",0);
+	if (StallThreshold>0 && StallBacktrace) {
+		if (sampleframes==0) {	// first call of backtrace can allocate memory - do it here, not in signal handler
+			sampleframes = backtrace(sample,STALL_MAXFRAMES);
+			samplestart = 0;
+		}
+#ifdef SA_RESTART
+		sa.sa_flags = SA_RESTART;
+#else
+		sa.sa_flags = 0;
+#endif
+		sigemptyset(&sa.sa_mask);
+		sa.sa_handler = main_stall_sample;
+		sigaction(SIGALRM,&sa,(struct sigaction *)0);
+		it.it_interval.tv_sec = StallThreshold/4000000;
+		it.it_interval.tv_usec = (StallThreshold/4)%1000000;
+		if (it.it_interval.tv_sec==0 && it.it_interval.tv_usec<10000) {
+			it.it_interval.tv_usec = 10000;
+		}
+		it.it_value = it.it_interval;
+	} else {
+		memset(&it,0,sizeof(it));
+	}
+	setitimer(ITIMER_REAL,&it,NULL);
+#endif
+}
+
+void main_stall_init(void) {
+	uint32_t i;
+	for (i=0 ; i<STALL_RING ; i++) {
+		stallring[i].symbols = NULL;
+	}
+	stallpos = 0;
+	stallcnt = 0;
+#ifdef STALL_USE_BACKTRACE
+#ifdef USE_PTHREADS
+	mainthread = pthread_self();
+#endif
+	cbstart = 0;
+	samplestart = 0;
+	sampleframes = 0;
+#endif
+	main_stall_reload();
+	main_reloadregister(main_stall_reload);
+}
+
 void mainloop() {
 	uint32_t prevtime = 0;
 	struct timeval tv;
@@ -315,10 +528,13 @@ void mainloop() {
 	weentry *weit;
 	rlentry *rlit;
 	struct pollfd pdesc[MFSMAXFILES];
-	uint32_t ndesc;
+	uint32_t ndesc,j;
 	int i;
 	int t,r;
+	lathist *loophist;
+	uint64_t tstart,tcall;
 
+	loophist = lathist_new(LATHIST_GROUP_MAINLOOP,"main loop (without poll)");
 	t = 0;
 	while (t!=3) {
 		tv.tv_sec=0;
@@ -333,6 +549,7 @@ void mainloop() {
 		usecnow *= 1000000;
 		usecnow += tv.tv_usec;
 		now = tv.tv_sec;
+		tstart = usecnow;
 		if (i<0) {
 			if (errno==EAGAIN) {
 				syslog(LOG_WARNING,"poll returned EAGAIN");
@@ -343,13 +560,20 @@ void mainloop() {
 				syslog(LOG_WARNING,"poll error: %s",strerr(errno));
 				break;
 			}
-		} else {
-			for (pollit = pollhead ; pollit != NULL ; pollit = pollit->next) {
-				pollit->serve(pdesc);
+			// interrupted by signal (i.e. stall sampling timer) - no events, but serve functions still run (timeouts etc.)
+			for (j=0 ; j<ndesc ; j++) {
+				pdesc[j].revents = 0;
 			}
 		}
+		for (pollit = pollhead ; pollit != NULL ; pollit = pollit->next) {
+			tcall = main_callstart();
+			pollit->serve(pdesc);
+			main_callend(pollit->hist,tcall);
+		}
 		for (eloopit = eloophead ; eloopit != NULL ; eloopit = eloopit->next) {
+			tcall = main_callstart();
 			eloopit->fun();
+			main_callend(eloopit->hist,tcall);
 		}
 		if (now<prevtime || now>prevtime+10) {
 			// time has changed !!! - recalculate "nextevent" time
@@ -371,10 +595,10 @@ void mainloop() {
 					while (now >= timeit->nextevent) {
 						timeit->nextevent += timeit->seconds;
 					}
-					timeit->fun();
+					main_runtimer(timeit);
 				} else { /* timeit->mode == TIMEMODE_SKIP_LATE */
 					if (now == timeit->nextevent) {
-						timeit->fun();
+						main_runtimer(timeit);
 					}
 					while (now >= timeit->nextevent) {
 						timeit->nextevent += timeit->seconds;
@@ -383,6 +607,7 @@ void mainloop() {
 			}
 		}
 		prevtime = now;
+		lathist_add(loophist,tstart,lathist_usec());
 #ifdef USE_PTHREADS
 		pthread_mutex_lock(&signal_lock);
 #endif
@@ -1098,6 +1323,7 @@ int main(int argc,char **argv) {
 		if (rundaemon) {
 			close_msg_channel();
 		}
+		main_stall_init();
 		mainloop();
 		ch=0;
 	} else {
@@ -29,9 +29,15 @@ void main_destructregister (void (*fun)(void));
 void main_canexitregister (int (*fun)(void));
 void main_wantexitregister (void (*fun)(void));
 void main_reloadregister (void (*fun)(void));
-void main_pollregister (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(struct pollfd *));
-void main_eachloopregister (void (*fun)(void));
-void main_timeregister (int mode,uint32_t seconds,uint32_t offset,void (*fun)(void));
+void main_pollregister_name (void (*desc)(struct pollfd *,uint32_t *),void (*serve)(struct pollfd *),const char *name);
+void main_eachloopregister_name (void (*fun)(void),const char *name);
+void main_timeregister_name (int mode,uint32_t seconds,uint32_t offset,void (*fun)(void),const char *name);
+// function name is used to identify timer in latency histograms
+#define main_timeregister(mode,seconds,offset,fun) main_timeregister_name(mode,seconds,offset,fun,#fun)
+#define main_pollregister(desc,serve) main_pollregister_name(desc,serve,#serve)
+#define main_eachloopregister(fun) main_eachloopregister_name(fun,#fun)
+uint32_t main_stall_info_size(void);
+void main_stall_info_data(uint8_t *buff);
 uint32_t main_time(void);
 uint64_t main_utime(void);
 
@@ -0,0 +1,578 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/types.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "datapack.h"
+#include "zfile.h"
+
+#if defined(HAVE_ZLIB_H) && (defined(HAVE_FOPENCOOKIE) || defined(HAVE_FUNOPEN))
+#define ZFILE_ENABLED 1
+#endif
+
+#define ZFILE_BLOCKSIZE 0x100000
+#define ZFILE_MAXBLOCKSIZE 0x4000000
+#define ZFILE_HEADERSIZE 12
+#define ZFILE_FOOTERSIZE 28
+#define ZFILE_INDEXMAGIC "MFSZ IDX"
+
+#ifdef ZFILE_ENABLED
+
+typedef struct _zfile {
+	FILE *fd;
+	int level;		// 0 - reader
+	uint8_t eof,error;
+	uint8_t *raw;		// current block (decompressed)
+	uint8_t *comp;
+	uint32_t blocksize;
+	uint32_t compsize;
+	uint32_t rawleng;
+	uint32_t rawpos;
+	uint64_t rawoffset;	// raw offset of current block
+	uint64_t fileoffset;	// file offset of next block
+	uint32_t nextblock;
+	uint64_t rawsize;
+	uint64_t *index;	// file offsets of blocks (reader: NULL when file has no valid index)
+	uint32_t blocks;
+	uint32_t indexsize;
+} zfile;
+
+static void zfile_free(zfile *z) {
+	if (z->raw) {
+		free(z->raw);
+	}
+	if (z->comp) {
+		free(z->comp);
+	}
+	if (z->index) {
+		free(z->index);
+	}
+	free(z);
+}
+
+static zfile* zfile_new(FILE *fd,int level,uint32_t blocksize) {
+	zfile *z;
+	z = malloc(sizeof(zfile));
+	if (z==NULL) {
+		return NULL;
+	}
+	z->fd = fd;
+	z->level = level;
+	z->eof = 0;
+	z->error = 0;
+	z->blocksize = blocksize;
+	z->compsize = compressBound(blocksize);
+	z->rawleng = 0;
+	z->rawpos = 0;
+	z->rawoffset = 0;
+	z->fileoffset = ZFILE_HEADERSIZE;
+	z->nextblock = 0;
+	z->rawsize = 0;
+	z->index = NULL;
+	z->blocks = 0;
+	z->indexsize = 0;
+	z->raw = malloc(blocksize);
+	z->comp = malloc(z->compsize);
+	if (z->raw==NULL || z->comp==NULL) {
+		zfile_free(z);
+		return NULL;
+	}
+	return z;
+}
+
+/* writer */
+
+static int zfile_storeblock(zfile *z) {
+	uint8_t hdr[8],*ptr;
+	uLongf cleng;
+	if (z->rawleng==0) {
+		return 0;
+	}
+	if (z->blocks>=z->indexsize) {
+		uint64_t *nindex;
+		z->indexsize = (z->indexsize)?z->indexsize*2:256;
+		nindex = realloc(z->index,sizeof(uint64_t)*z->indexsize);
+		if (nindex==NULL) {
+			return -1;
+		}
+		z->index = nindex;
+	}
+	cleng = z->compsize;
+	if (compress2(z->comp,&cleng,z->raw,z->rawleng,z->level)!=Z_OK) {
+		errno = EINVAL;
+		return -1;
+	}
+	ptr = hdr;
+	put32bit(&ptr,z->rawleng);
+	put32bit(&ptr,cleng);
+	if (fwrite(hdr,1,8,z->fd)!=8 || fwrite(z->comp,1,cleng,z->fd)!=cleng) {
+		return -1;
+	}
+	z->index[z->blocks++] = z->fileoffset;
+	z->fileoffset += 8+cleng;
+	z->rawsize += z->rawleng;
+	z->rawleng = 0;
+	return 0;
+}
+
+static int zfile_storeindex(zfile *z) {
+	uint8_t buff[ZFILE_FOOTERSIZE],*ptr;
+	uint32_t i;
+	memset(buff,0,8);
+	if (fwrite(buff,1,8,z->fd)!=8) {	// end of blocks marker
+		return -1;
+	}
+	for (i=0 ; i<z->blocks ; i++) {
+		ptr = buff;
+		put64bit(&ptr,z->index[i]);
+		if (fwrite(buff,1,8,z->fd)!=8) {
+			return -1;
+		}
+	}
+	ptr = buff;
+	put64bit(&ptr,z->fileoffset+8);
+	put64bit(&ptr,z->rawsize);
+	put32bit(&ptr,z->blocks);
+	memcpy(ptr,ZFILE_INDEXMAGIC,8);
+	if (fwrite(buff,1,ZFILE_FOOTERSIZE,z->fd)!=ZFILE_FOOTERSIZE) {
+		return -1;
+	}
+	return 0;
+}
+
+static int64_t zfile_dowrite(zfile *z,const char *buf,uint64_t size) {
+	uint64_t done;
+	uint32_t l;
+	if (z->error) {
+		return -1;
+	}
+	done = 0;
+	while (done<size) {
+		l = z->blocksize - z->rawleng;
+		if (l>size-done) {
+			l = size-done;
+		}
+		memcpy(z->raw+z->rawleng,buf+done,l);
+		z->rawleng += l;
+		done += l;
+		if (z->rawleng==z->blocksize) {
+			if (zfile_storeblock(z)<0) {
+				z->error = 1;
+				return -1;
+			}
+		}
+	}
+	return done;
+}
+
+/* reader */
+
+static void zfile_loadindex(zfile *z) {
+	uint8_t buff[ZFILE_FOOTERSIZE];
+	const uint8_t *ptr;
+	uint64_t indexoffset,filesize;
+	uint32_t i;
+	off_t pos;
+
+	if (fseeko(z->fd,0,SEEK_END)<0 || (pos=ftello(z->fd))<ZFILE_HEADERSIZE+8+ZFILE_FOOTERSIZE) {
+		return;
+	}
+	filesize = pos;
+	if (fseeko(z->fd,filesize-ZFILE_FOOTERSIZE,SEEK_SET)<0 || fread(buff,1,ZFILE_FOOTERSIZE,z->fd)!=ZFILE_FOOTERSIZE) {
+		return;
+	}
+	ptr = buff;
+	indexoffset = get64bit(&ptr);
+	z->rawsize = get64bit(&ptr);
+	z->blocks = get32bit(&ptr);
+	if (memcmp(ptr,ZFILE_INDEXMAGIC,8)!=0 || indexoffset+8ULL*z->blocks+ZFILE_FOOTERSIZE!=filesize || (uint64_t)(z->blocks)*z->blocksize<z->rawsize) {
+		return;
+	}
+	if (fseeko(z->fd,indexoffset,SEEK_SET)<0) {
+		return;
+	}
+	z->index = malloc(sizeof(uint64_t)*(z->blocks+1));
+	if (z->index==NULL) {
+		return;
+	}
+	for (i=0 ; i<z->blocks ; i++) {
+		if (fread(buff,1,8,z->fd)!=8) {
+			free(z->index);
+			z->index = NULL;
+			return;
+		}
+		ptr = buff;
+		z->index[i] = get64bit(&ptr);
+	}
+}
+
+static int zfile_loadblock(zfile *z) {
+	uint8_t hdr[8];
+	const uint8_t *ptr;
+	uint32_t rleng,cleng;
+	uLongf dleng;
+
+	z->rawpos = 0;
+	z->rawleng = 0;
+	if (fread(hdr,1,8,z->fd)!=8) {
+		errno = EIO;	// truncated file
+		return -1;
+	}
+	ptr = hdr;
+	rleng = get32bit(&ptr);
+	cleng = get32bit(&ptr);
+	if (rleng==0) {
+		z->eof = 1;
+		return 0;
+	}
+	if (rleng>z->blocksize || cleng>z->compsize || fread(z->comp,1,cleng,z->fd)!=cleng) {
+		errno = EIO;
+		return -1;
+	}
+	dleng = rleng;
+	if (uncompress(z->raw,&dleng,z->comp,cleng)!=Z_OK || dleng!=rleng) {
+		errno = EIO;
+		return -1;
+	}
+	z->fileoffset += 8+cleng;
+	z->rawleng = rleng;
+	return 0;
+}
+
+static int64_t zfile_doread(zfile *z,char *buf,uint64_t size) {
+	uint64_t done;
+	uint32_t l;
+	if (z->error) {
+		return -1;
+	}
+	done = 0;
+	while (done<size) {
+		if (z->rawpos==z->rawleng) {
+			if (z->eof) {
+				break;
+			}
+			z->rawoffset += z->rawleng;
+			if (zfile_loadblock(z)<0) {
+				z->error = 1;
+				return (done>0)?(int64_t)done:-1;
+			}
+			z->nextblock++;
+			continue;
+		}
+		l = z->rawleng - z->rawpos;
+		if (l>size-done) {
+			l = size-done;
+		}
+		memcpy(buf+done,z->raw+z->rawpos,l);
+		z->rawpos += l;
+		done += l;
+	}
+	return done;
+}
+
+// random access is possible only when file has valid block index
+static int64_t zfile_doseek(zfile *z,int64_t offset,int whence) {
+	uint64_t cur,target;
+	uint32_t b;
+
+	if (z->level>0) {
+		cur = z->rawsize + z->rawleng;
+	} else {
+		cur = z->rawoffset + z->rawpos;
+	}
+	if (whence==SEEK_SET) {
+		target = offset;
+	} else if (whence==SEEK_CUR) {
+		target = cur+offset;
+	} else if (whence==SEEK_END && z->level==0 && z->index) {
+		target = z->rawsize+offset;
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+	if (target==cur) {
+		return cur;
+	}
+	if (z->level>0 || z->index==NULL || target>z->rawsize) {
+		errno = EINVAL;
+		return -1;
+	}
+	z->error = 0;
+	b = target / z->blocksize;
+	if (b>=z->blocks) {	// end of file
+		z->eof = 1;
+		z->rawoffset = z->rawsize;
+		z->rawleng = 0;
+		z->rawpos = 0;
+		z->nextblock = z->blocks;
+		return target;
+	}
+	if (z->rawleng==0 || z->nextblock!=b+1) {
+		z->eof = 0;
+		z->fileoffset = z->index[b];
+		if (fseeko(z->fd,z->fileoffset,SEEK_SET)<0 || zfile_loadblock(z)<0) {
+			z->error = 1;
+			return -1;
+		}
+		z->nextblock = b+1;
+		z->rawoffset = (uint64_t)b*z->blocksize;
+	}
+	z->rawpos = target - z->rawoffset;
+	return target;
+}
+
+static int zfile_doclose(zfile *z) {
+	int ret = 0;
+	if (z->level>0) {
+		if (z->error || zfile_storeblock(z)<0 || zfile_storeindex(z)<0) {
+			ret = -1;
+		}
+	}
+	if (fclose(z->fd)!=0) {
+		ret = -1;
+	}
+	zfile_free(z);
+	return ret;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+static ssize_t zfile_cookie_read(void *cookie,char *buf,size_t size) {
+	return zfile_doread((zfile*)cookie,buf,size);
+}
+
+static ssize_t zfile_cookie_write(void *cookie,const char *buf,size_t size) {
+	int64_t r = zfile_dowrite((zfile*)cookie,buf,size);
+	return (r<0)?0:r;	// fopencookie expects 0 on error
+}
+
+static int zfile_cookie_seek(void *cookie,off64_t *offset,int whence) {
+	int64_t r = zfile_doseek((zfile*)cookie,*offset,whence);
+	if (r<0) {
+		return -1;
+	}
+	*offset = r;
+	return 0;
+}
+
+static int zfile_cookie_close(void *cookie) {
+	return zfile_doclose((zfile*)cookie);
+}
+
+static FILE* zfile_fopen(zfile *z) {
+	cookie_io_functions_t iof;
+	iof.read = (z->level>0)?NULL:zfile_cookie_read;
+	iof.write = (z->level>0)?zfile_cookie_write:NULL;
+	iof.seek = zfile_cookie_seek;
+	iof.close = zfile_cookie_close;
+	return fopencookie(z,(z->level>0)?"w":"r",iof);
+}
+#else /* HAVE_FUNOPEN */
+static int zfile_cookie_read(void *cookie,char *buf,int size) {
+	return zfile_doread((zfile*)cookie,buf,size);
+}
+
+static int zfile_cookie_write(void *cookie,const char *buf,int size) {
+	return zfile_dowrite((zfile*)cookie,buf,size);
+}
+
+static fpos_t zfile_cookie_seek(void *cookie,fpos_t offset,int whence) {
+	return zfile_doseek((zfile*)cookie,offset,whence);
+}
+
+static int zfile_cookie_close(void *cookie) {
+	return zfile_doclose((zfile*)cookie);
+}
+
+static FILE* zfile_fopen(zfile *z) {
+	if (z->level>0) {
+		return funopen(z,NULL,zfile_cookie_write,zfile_cookie_seek,zfile_cookie_close);
+	} else {
+		return funopen(z,zfile_cookie_read,NULL,zfile_cookie_seek,zfile_cookie_close);
+	}
+}
+#endif
+
+#endif /* ZFILE_ENABLED */
+
+int zfile_supported(void) {
+#ifdef ZFILE_ENABLED
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+FILE* zfile_wopen(const char *fname,int level) {
+#ifdef ZFILE_ENABLED
+	FILE *fd,*zfd;
+	zfile *z;
+	uint8_t hdr[ZFILE_HEADERSIZE],*ptr;
+
+	if (level>0) {
+		if (level>9) {
+			level = 9;
+		}
+		fd = fopen(fname,"w");
+		if (fd==NULL) {
+			return NULL;
+		}
+		memcpy(hdr,ZFILE_MAGIC,8);
+		ptr = hdr+8;
+		put32bit(&ptr,ZFILE_BLOCKSIZE);
+		if (fwrite(hdr,1,ZFILE_HEADERSIZE,fd)!=ZFILE_HEADERSIZE || (z=zfile_new(fd,level,ZFILE_BLOCKSIZE))==NULL) {
+			fclose(fd);
+			return NULL;
+		}
+		zfd = zfile_fopen(z);
+		if (zfd==NULL) {
+			fclose(fd);
+			zfile_free(z);
+		}
+		return zfd;
+	}
+#else
+	(void)level;
+#endif
+	return fopen(fname,"w");
+}
+
+FILE* zfile_ropen(const char *fname) {
+	FILE *fd;
+	uint8_t hdr[ZFILE_HEADERSIZE];
+#ifdef ZFILE_ENABLED
+	FILE *zfd;
+	zfile *z;
+	const uint8_t *ptr;
+	uint32_t blocksize;
+#endif
+
+	fd = fopen(fname,"r");
+	if (fd==NULL) {
+		return NULL;
+	}
+	if (fread(hdr,1,ZFILE_HEADERSIZE,fd)!=ZFILE_HEADERSIZE || memcmp(hdr,ZFILE_MAGIC,8)!=0) {
+		rewind(fd);
+		return fd;
+	}
+#ifdef ZFILE_ENABLED
+	ptr = hdr+8;
+	blocksize = get32bit(&ptr);
+	if (blocksize==0 || blocksize>ZFILE_MAXBLOCKSIZE || (z=zfile_new(fd,0,blocksize))==NULL) {
+		fclose(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	zfile_loadindex(z);
+	if (fseeko(fd,ZFILE_HEADERSIZE,SEEK_SET)<0 || (zfd=zfile_fopen(z))==NULL) {
+		fclose(fd);
+		zfile_free(z);
+		return NULL;
+	}
+	return zfd;
+#else
+	fclose(fd);
+	errno = EINVAL;	// compressed file and no zlib
+	return NULL;
+#endif
+}
+
+char* zfile_load(const char *fname,uint64_t *leng) {
+	FILE *fd;
+	char *buff,*nbuff;
+	uint64_t size,pos;
+
+	fd = zfile_ropen(fname);
+	if (fd==NULL) {
+		return NULL;
+	}
+	size = 0x100000;
+	pos = 0;
+	buff = malloc(size);
+	while (buff) {
+		pos += fread(buff+pos,1,size-pos,fd);
+		if (pos<size) {
+			break;
+		}
+		size *= 2;
+		nbuff = realloc(buff,size);
+		if (nbuff==NULL) {
+			free(buff);
+		}
+		buff = nbuff;
+	}
+	if (buff && ferror(fd)) {
+		free(buff);
+		buff = NULL;
+	}
+	fclose(fd);
+	*leng = pos;
+	return buff;
+}
+
+// returns 1 when source is already compressed (nothing is written)
+int zfile_compress(const char *src,const char *dst,int level) {
+	FILE *in,*out;
+	char buff[65536];
+	size_t r;
+	int status;
+
+	in = fopen(src,"r");
+	if (in==NULL) {
+		return -1;
+	}
+	r = fread(buff,1,8,in);
+	if (r==8 && memcmp(buff,ZFILE_MAGIC,8)==0) {
+		fclose(in);
+		return 1;
+	}
+	out = zfile_wopen(dst,level);
+	if (out==NULL) {
+		fclose(in);
+		return -1;
+	}
+	status = 0;
+	do {
+		if (r>0 && fwrite(buff,1,r,out)!=r) {
+			status = -1;
+			break;
+		}
+		r = fread(buff,1,65536,in);
+	} while (r>0);
+	if (ferror(in)) {
+		status = -1;
+	}
+	fclose(in);
+	if (fclose(out)!=0) {
+		status = -1;
+	}
+	if (status<0) {
+		unlink(dst);
+	}
+	return status;
+}
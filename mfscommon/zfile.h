@@ -0,0 +1,38 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ZFILE_H_
+#define _ZFILE_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+
+// block-wise compressed files:
+// "MFSZ 1.0" blocksize:32 ( rawleng:32 compleng:32 data:compleng[] )* 0:32 0:32 ( blockoffset:64 )* indexoffset:64 rawsize:64 blocks:32 "MFSZ IDX"
+#define ZFILE_MAGIC "MFSZ 1.0"
+
+int zfile_supported(void);
+// level==0 - plain file
+FILE* zfile_wopen(const char *fname,int level);
+// opens both compressed and plain files
+FILE* zfile_ropen(const char *fname);
+// returns whole (decompressed) file in malloc'ed buffer
+char* zfile_load(const char *fname,uint64_t *leng);
+int zfile_compress(const char *src,const char *dst,int level);
+
+#endif
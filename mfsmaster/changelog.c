@@ -22,14 +22,18 @@
 #include <stdarg.h>
 #include <syslog.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "main.h"
 #include "changelog.h"
 #include "matomlserv.h"
 #include "cfg.h"
+#include "slogger.h"
+#include "zfile.h"
 
 #define MAXLOGLINESIZE 10000
 static uint32_t BackLogsNumber;
+static uint32_t ChangelogCompression;
 static FILE *fd;
 
 void changelog_rotate() {
@@ -51,6 +55,26 @@ void changelog_rotate() {
 	matomlserv_broadcast_logrotate();
 }
 
+// called after metadata store (in background process) - compresses change log rotated by last changelog_rotate
+void changelog_compress(void) {
+	if (ChangelogCompression==0 || BackLogsNumber==0) {
+		return;
+	}
+	switch (zfile_compress("changelog.1.mfs","changelog.1.mfs.tmp",ChangelogCompression)) {
+	case 0:
+		if (rename("changelog.1.mfs.tmp","changelog.1.mfs")<0) {
+			mfs_errlog(LOG_WARNING,"can't rename changelog.1.mfs.tmp -> changelog.1.mfs");
+			unlink("changelog.1.mfs.tmp");
+		}
+		break;
+	case -1:
+		if (errno!=ENOENT) {	// no changes since previous rotation
+			mfs_errlog(LOG_WARNING,"can't compress changelog.1.mfs");
+		}
+		break;
+	}
+}
+
 void changelog(uint64_t version,const char *format,...) {
 	static char printbuff[MAXLOGLINESIZE];
 	va_list ap;
@@ -82,6 +106,11 @@ void changelog(uint64_t version,const char *format,...) {
 
 int changelog_init(void) {
 	BackLogsNumber = cfg_getuint32("BACK_LOGS",50);
+	ChangelogCompression = cfg_getuint32("CHANGELOG_COMPRESSION",0);
+	if (ChangelogCompression>0 && zfile_supported()==0) {
+		syslog(LOG_WARNING,"change log compression is not supported on this system - change logs will be stored uncompressed");
+		ChangelogCompression = 0;
+	}
 	fd = NULL;
 	return 0;
 }
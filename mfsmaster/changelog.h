@@ -22,6 +22,7 @@
 #include <inttypes.h>
 
 void changelog_rotate(void);
+void changelog_compress(void);
 void changelog(uint64_t version,const char *format,...);
 int changelog_init(void);
 
@@ -27,6 +27,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #ifdef METARESTORE
 #include <time.h>
 #endif
@@ -96,6 +97,10 @@ static slist *slfreehead = NULL;
 
 #endif /* METARESTORE */
 
+#define FREF_NONE 0
+#define FREF_ONE 1
+#define FREF_LIST 2
+
 typedef struct _flist {
 	uint32_t inode;
 	uint16_t indx;
@@ -126,13 +131,22 @@ typedef struct chunk {
 	unsigned interrupted:1;
 	unsigned operation:4;
 #endif
+	unsigned ftype:2;
 	uint32_t lockedto;
+	uint32_t xorgid;	// xor parity group (0 - none)
 #ifndef METARESTORE
 //	uint32_t lockedby;
 	slist *slisthead;
 //	bcdata *bestchunk;
 #endif
-	flist *flisthead;
+	union {
+		struct {
+			uint32_t inode;
+			uint16_t indx;
+			uint8_t goal;
+		} one;		// FREF_ONE - chunk used by one file only (most common case)
+		flist *head;	// FREF_LIST - chunk shared by snapshots/appends
+	} fref;
 	struct chunk *next;
 } chunk;
 
@@ -150,6 +164,19 @@ static chunk *chfreehead = NULL;
 
 static chunk *chunkhash[HASHSIZE];
 static uint64_t nextchunkid=1;
+
+// xor parity groups - parity chunk contains xor of all data chunks, so any one chunk from group can be rebuilt from others
+typedef struct _xorgroup {
+	uint64_t parityid;
+	uint8_t cnt;
+	uint64_t chunkid[MAXXORPARTS];
+} xorgroup;
+
+static xorgroup **xorgtab=NULL;		// indexed by group id (0 - not used)
+static uint32_t xorgsize=0;
+static uint32_t *xorgfree=NULL;		// stack of unused group ids
+static uint32_t xorgfreecnt=0;
+static uint32_t xorgroups=0;
 #define LOCKTIMEOUT 120
 
 #define UNUSED_DELETE_TIMEOUT (86400*7)
@@ -176,6 +203,11 @@ static double TmpMaxDelFrac;
 static uint32_t TmpMaxDel;
 static uint32_t LoopTime;
 static uint32_t HashSteps;
+static uint32_t XorGoal;
+static uint32_t XorParts;
+
+static uint64_t xorcand[MAXXORPARTS];	// chunks waiting for parity
+static uint32_t xorcandcnt=0;
 
 //#define MAXCOPY 2
 //#define MAXDEL 6
@@ -315,6 +347,111 @@ static inline void flist_free(flist* p) {
 
 #endif /* USE_FLIST_BUCKETS */
 
+// file references: single reference is kept inside chunk, list is used only for chunks with two or more references
+
+static inline uint8_t chunk_fref_goal(chunk *c) {
+	flist *f;
+	uint8_t goal;
+	if (c->ftype==FREF_ONE) {
+		return c->fref.one.goal;
+	}
+	goal = 0;
+	if (c->ftype==FREF_LIST) {
+		for (f=c->fref.head ; f ; f=f->next) {
+			if (f->goal > goal) {
+				goal = f->goal;
+			}
+		}
+	}
+	return goal;
+}
+
+// returns 1 when reference exists
+static inline int chunk_fref_setgoal(chunk *c,uint32_t inode,uint16_t indx,uint8_t goal) {
+	flist *f;
+	int found;
+	if (c->ftype==FREF_ONE) {
+		if (c->fref.one.inode==inode && c->fref.one.indx==indx) {
+			c->fref.one.goal = goal;
+			return 1;
+		}
+		return 0;
+	}
+	found = 0;
+	if (c->ftype==FREF_LIST) {
+		for (f=c->fref.head ; f ; f=f->next) {
+			if (f->inode==inode && f->indx==indx) {
+				f->goal = goal;
+				found = 1;
+			}
+		}
+	}
+	return found;
+}
+
+static inline void chunk_fref_add(chunk *c,uint32_t inode,uint16_t indx,uint8_t goal) {
+	flist *f;
+	if (c->ftype==FREF_NONE) {
+		c->fref.one.inode = inode;
+		c->fref.one.indx = indx;
+		c->fref.one.goal = goal;
+		c->ftype = FREF_ONE;
+		return;
+	}
+	if (c->ftype==FREF_ONE) {	// second reference - move inline one to the list
+		f = flist_malloc();
+		f->inode = c->fref.one.inode;
+		f->indx = c->fref.one.indx;
+		f->goal = c->fref.one.goal;
+		f->next = NULL;
+		c->fref.head = f;
+		c->ftype = FREF_LIST;
+	}
+	f = flist_malloc();
+	f->inode = inode;
+	f->indx = indx;
+	f->goal = goal;
+	f->next = c->fref.head;
+	c->fref.head = f;
+}
+
+// returns 1 when reference has been removed
+static inline int chunk_fref_remove(chunk *c,uint32_t inode,uint16_t indx) {
+	flist *f,**fp;
+	int found;
+	if (c->ftype==FREF_ONE) {
+		if (c->fref.one.inode==inode && c->fref.one.indx==indx) {
+			c->ftype = FREF_NONE;
+			return 1;
+		}
+		return 0;
+	}
+	found = 0;
+	if (c->ftype==FREF_LIST) {
+		fp = &(c->fref.head);
+		while ((f=*fp)) {
+			if (f->inode==inode && f->indx==indx) {
+				*fp = f->next;
+				flist_free(f);
+				found = 1;
+			} else {
+				fp = &(f->next);
+			}
+		}
+		f = c->fref.head;
+		if (f==NULL) {
+			c->ftype = FREF_NONE;
+		} else if (f->next==NULL) {	// last reference - keep it inline
+			c->ftype = FREF_ONE;
+			c->fref.one.inode = f->inode;
+			c->fref.one.indx = f->indx;
+			c->fref.one.goal = f->goal;
+			flist_free(f);
+		}
+	}
+	return found;
+}
+
 #ifdef USE_CHUNK_BUCKETS
 static inline chunk* chunk_malloc() {
 	chunk_bucket *cb;
@@ -404,21 +541,12 @@ void chunk_cfg_check() {
 }
 #endif
 */
-chunk* chunk_new(uint64_t chunkid) {
-	uint32_t chunkpos = HASHPOS(chunkid);
-	chunk *newchunk;
-	newchunk = chunk_malloc();
-#ifndef METARESTORE
-	chunks++;
-	allchunkcounts[0][0]++;
-	regularchunkcounts[0][0]++;
-#endif
-	newchunk->next = chunkhash[chunkpos];
-	chunkhash[chunkpos] = newchunk;
+static inline void chunk_setup(chunk *newchunk,uint64_t chunkid) {
 	newchunk->chunkid = chunkid;
 	newchunk->version = 0;
 	newchunk->goal = 0;
 	newchunk->lockedto = 0;
+	newchunk->xorgid = 0;
 #ifndef METARESTORE
 	newchunk->allvalidcopies = 0;
 	newchunk->regularvalidcopies = 0;
@@ -427,7 +555,21 @@ chunk* chunk_new(uint64_t chunkid) {
 	newchunk->operation = NONE;
 	newchunk->slisthead = NULL;
 #endif
-	newchunk->flisthead = NULL;
+	newchunk->ftype = FREF_NONE;
+}
+
+chunk* chunk_new(uint64_t chunkid) {
+	uint32_t chunkpos = HASHPOS(chunkid);
+	chunk *newchunk;
+	newchunk = chunk_malloc();
+#ifndef METARESTORE
+	chunks++;
+	allchunkcounts[0][0]++;
+	regularchunkcounts[0][0]++;
+#endif
+	newchunk->next = chunkhash[chunkpos];
+	chunkhash[chunkpos] = newchunk;
+	chunk_setup(newchunk,chunkid);
 	lastchunkid = chunkid;
 	lastchunkptr = newchunk;
 	return newchunk;
@@ -449,6 +591,113 @@ chunk* chunk_find(uint64_t chunkid) {
 	return NULL;
 }
 
+static inline xorgroup* chunk_xor_get(uint32_t gid) {
+	if (gid==0 || gid>=xorgsize) {
+		return NULL;
+	}
+	return xorgtab[gid];
+}
+
+// join parity chunk and data chunks into one group (all chunks have to exist and can't belong to any other group)
+static uint32_t chunk_xor_attach(chunk *pc,uint8_t cnt,const uint64_t *chunkids) {
+	chunk *c;
+	xorgroup *xg;
+	uint32_t gid,i;
+
+	if (cnt<2 || cnt>MAXXORPARTS || pc->xorgid!=0) {
+		return 0;
+	}
+	for (i=0 ; i<cnt ; i++) {
+		c = chunk_find(chunkids[i]);
+		if (c==NULL || c->xorgid!=0 || c==pc) {
+			return 0;
+		}
+	}
+	if (xorgfreecnt>0) {
+		gid = xorgfree[--xorgfreecnt];
+	} else {
+		if (xorgsize==0) {
+			xorgsize = 1;	// id 0 means no group
+		}
+		gid = xorgsize;
+		xorgsize *= 2;
+		xorgtab = realloc(xorgtab,sizeof(xorgroup*)*xorgsize);
+		xorgfree = realloc(xorgfree,sizeof(uint32_t)*xorgsize);
+		passert(xorgtab);
+		passert(xorgfree);
+		for (i=xorgsize-1 ; i>gid ; i--) {
+			xorgtab[i] = NULL;
+			xorgfree[xorgfreecnt++] = i;
+		}
+		xorgtab[0] = NULL;
+	}
+	xg = malloc(sizeof(xorgroup));
+	passert(xg);
+	xg->parityid = pc->chunkid;
+	xg->cnt = cnt;
+	pc->xorgid = gid;
+	for (i=0 ; i<cnt ; i++) {
+		xg->chunkid[i] = chunkids[i];
+		chunk_find(chunkids[i])->xorgid = gid;
+	}
+	xorgtab[gid] = xg;
+	xorgroups++;
+	return gid;
+}
+
+static void chunk_xor_detach(uint32_t gid) {
+	xorgroup *xg;
+	chunk *c;
+	uint32_t i;
+	xg = chunk_xor_get(gid);
+	if (xg==NULL) {
+		return;
+	}
+	c = chunk_find(xg->parityid);
+	if (c && c->xorgid==gid) {
+		c->xorgid = 0;
+	}
+	for (i=0 ; i<xg->cnt ; i++) {
+		c = chunk_find(xg->chunkid[i]);
+		if (c && c->xorgid==gid) {
+			c->xorgid = 0;
+		}
+	}
+	free(xg);
+	xorgtab[gid] = NULL;
+	xorgfree[xorgfreecnt++] = gid;
+	xorgroups--;
+}
+
+#ifdef METARESTORE
+int chunk_xor_group(uint64_t parityid,uint8_t cnt,const uint64_t *chunkids) {
+	chunk *pc;
+	pc = chunk_find(parityid);
+	if (pc!=NULL) {
+		return ERROR_CHUNKEXIST;
+	}
+	if (parityid>=nextchunkid) {
+		nextchunkid = parityid+1;
+	}
+	pc = chunk_new(parityid);
+	pc->version = 1;
+	if (chunk_xor_attach(pc,cnt,chunkids)==0) {
+		return ERROR_MISMATCH;
+	}
+	return STATUS_OK;
+}
+
+int chunk_xor_release(uint64_t parityid) {
+	chunk *pc;
+	pc = chunk_find(parityid);
+	if (pc==NULL || pc->xorgid==0) {
+		return ERROR_NOCHUNK;
+	}
+	chunk_xor_detach(pc->xorgid);
+	return STATUS_OK;
+}
+#endif
+
 #ifndef METARESTORE
 void chunk_delete(chunk* c) {
 //	slist *s;
@@ -457,15 +706,14 @@ void chunk_delete(chunk* c) {
 		lastchunkid=0;
 		lastchunkptr=NULL;
 	}
-/* not needed - function called only if slisthead==NULL and flisthead==NULL
+/* not needed - function called only if slisthead==NULL and ftype==FREF_NONE
 	while ((s=c->slisthead)) {
 		s = c->slisthead;
 		c->slisthead = s->next;
 		slist_free(s);
 	}
-	while ((f=c->flisthead)) {
-		f = c->flisthead;
-		c->flisthead = f->next;
+	while (c->ftype==FREF_LIST && (f=c->fref.head)) {
+		c->fref.head = f->next;
 		flist_free(f);
 	}
 */
@@ -541,14 +789,8 @@ void chunk_store_chunkcounters(uint8_t *buff,uint8_t matrixid) {
 }
 
 void chunk_refresh_goal(chunk* c) {
-	flist *f;
 	uint8_t oldgoal = c->goal;
-	c->goal = 0;
-	for (f=c->flisthead ; f ; f=f->next) {
-		if (f->goal > c->goal) {
-			c->goal = f->goal;
-		}
-	}
+	c->goal = chunk_fref_goal(c);
 	if (c->goal!=oldgoal) {
 		chunk_state_change(oldgoal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
 	}
@@ -793,7 +1035,6 @@ void chunk_load_goal(void) {
 
 int chunk_set_file_goal(uint64_t chunkid,uint32_t inode,uint16_t indx,uint8_t goal) {
 	chunk *c;
-	flist *f;
 #ifndef METARESTORE
 	uint8_t oldgoal;
 #endif
@@ -804,15 +1045,8 @@ int chunk_set_file_goal(uint64_t chunkid,uint32_t inode,uint16_t indx,uint8_t go
 #ifndef METARESTORE
 	oldgoal = c->goal;
 #endif
-	c->goal = 0;
-	for (f=c->flisthead ; f ; f=f->next) {
-		if (f->inode == inode && f->indx == indx) {
-			f->goal = goal;
-		}
-		if (f->goal > c->goal) {
-			c->goal = f->goal;
-		}
-	}
+	chunk_fref_setgoal(c,inode,indx,goal);
+	c->goal = chunk_fref_goal(c);
 #ifndef METARESTORE
 	if (oldgoal!=c->goal) {
 		chunk_state_change(oldgoal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
@@ -823,36 +1057,20 @@ int chunk_set_file_goal(uint64_t chunkid,uint32_t inode,uint16_t indx,uint8_t go
 
 int chunk_delete_file(uint64_t chunkid,uint32_t inode,uint16_t indx) {
 	chunk *c;
-	flist *f,**fp;
 #ifndef METARESTORE
 	uint8_t oldgoal;
 #endif
-	uint32_t i;
 	c = chunk_find(chunkid);
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
 	}
-	i=0;
 #ifndef METARESTORE
 	oldgoal = c->goal;
 #endif
-	c->goal = 0;
-	fp = &(c->flisthead);
-	while ((f=*fp)) {
-		if (f->inode == inode && f->indx == indx) {
-			*fp = f->next;
-			flist_free(f);
-			i=1;
-		} else {
-			if (f->goal > c->goal) {
-				c->goal = f->goal;
-			}
-			fp = &(f->next);
-		}
-	}
-	if (i==0) {
+	if (chunk_fref_remove(c,inode,indx)==0) {
 		syslog(LOG_WARNING,"(delete file) serious structure inconsistency: (chunkid:%016"PRIX64" ; inode:%"PRIu32" ; index:%"PRIu16")",chunkid,inode,indx);
 	}
+	c->goal = chunk_fref_goal(c);
 #ifndef METARESTORE
 	if (oldgoal!=c->goal) {
 		chunk_state_change(oldgoal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
@@ -863,42 +1081,22 @@ int chunk_delete_file(uint64_t chunkid,uint32_t inode,uint16_t indx) {
 
 int chunk_add_file(uint64_t chunkid,uint32_t inode,uint16_t indx,uint8_t goal) {
 	chunk *c;
-	flist *f;
 #ifndef METARESTORE
 	uint8_t oldgoal;
 #endif
-	uint32_t i;
 	c = chunk_find(chunkid);
 	if (c==NULL) {
 		return ERROR_NOCHUNK;
 	}
-	i=0;
 #ifndef METARESTORE
 	oldgoal = c->goal;
 #endif
-	c->goal = 0;
-	for (f=c->flisthead ; f ; f=f->next) {
-		if (f->inode == inode && f->indx == indx) {
-			f->goal = goal;
-			i=1;
-		}
-		if (f->goal > c->goal) {
-			c->goal = f->goal;
-		}
-	}
-	if (i==0) {
-		f = flist_malloc();
-		f->inode = inode;
-		f->indx = indx;
-		f->goal = goal;
-		f->next = c->flisthead;
-		c->flisthead = f;
-		if (goal > c->goal) {
-			c->goal = goal;
-		}
+	if (chunk_fref_setgoal(c,inode,indx,goal)==0) {
+		chunk_fref_add(c,inode,indx,goal);
 	} else {
 		syslog(LOG_WARNING,"(add file) serious structure inconsistency: (chunkid:%016"PRIX64" ; inode:%"PRIu32" ; index:%"PRIu16")",chunkid,inode,indx);
 	}
+	c->goal = chunk_fref_goal(c);
 #ifndef METARESTORE
 	if (oldgoal!=c->goal) {
 		chunk_state_change(oldgoal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
@@ -991,7 +1189,6 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 #endif
 	uint32_t i;
 	chunk *oc,*c;
-	flist *f,**fp;
 
 	if (ochunkid==0) {	// new chunk
 //		servcount = matocsserv_getservers_ordered(ptrs,MINMAXRND,NULL,NULL);
@@ -1015,11 +1212,7 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 		c->interrupted = 0;
 		c->operation = CREATE;
 #endif
-		c->flisthead = flist_malloc();
-		c->flisthead->inode = inode;
-		c->flisthead->indx = indx;
-		c->flisthead->goal = goal;
-		c->flisthead->next = NULL;
+		chunk_fref_add(c,inode,indx,goal);
 #ifndef METARESTORE
 		if (servcount<goal) {
 			c->allvalidcopies = servcount;
@@ -1052,17 +1245,8 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 			return ERROR_LOCKED;
 		}
 #endif
-		fp = &(oc->flisthead);
-		i=1;
-		while ((f=*fp)) {
-			if (f->inode==inode && f->indx==indx) {
-				f->goal = goal;	// not needed.
-				break;
-			}
-			fp = &(f->next);
-			i=0;
-		}
-		if (i && f && f->next==NULL) {	// refcount==1
+		i = chunk_fref_setgoal(oc,inode,indx,goal);	// setting goal not needed.
+		if (i && oc->ftype==FREF_ONE && oc->xorgid==0) {	// refcount==1 (chunk from xor group is duplicated - its parity has to stay valid)
 			*nchunkid = ochunkid;
 			c = oc;
 #ifndef METARESTORE
@@ -1101,7 +1285,7 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 			}
 #endif
 		} else {
-			if (f==NULL) {	// it's serious structure error
+			if (i==0) {	// it's serious structure error
 #ifndef METARESTORE
 				syslog(LOG_WARNING,"serious structure inconsistency: (chunkid:%016"PRIX64" ; inode:%"PRIu32" ; index:%"PRIu16")",ochunkid,inode,indx);
 #else
@@ -1122,10 +1306,9 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 						c->interrupted = 0;
 						c->operation = DUPLICATE;
 #endif
-						// move f to new chunk
-						c->flisthead = f;
-						*fp = f->next;
-						f->next = NULL;
+						// move reference to new chunk
+						chunk_fref_remove(oc,inode,indx);
+						chunk_fref_add(c,inode,indx,goal);
 #ifndef METARESTORE
 					}
 					s = slist_malloc();
@@ -1149,12 +1332,7 @@ int chunk_multi_modify(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t
 #ifndef METARESTORE
 				oldgoal = oc->goal;
 #endif
-				oc->goal = 0;
-				for (f=oc->flisthead ; f ; f=f->next) {
-					if (f->goal > oc->goal) {
-						oc->goal = f->goal;
-					}
-				}
+				oc->goal = chunk_fref_goal(oc);
 #ifndef METARESTORE
 				if (oldgoal!=oc->goal) {
 					chunk_state_change(oldgoal,oc->goal,oc->allvalidcopies,oc->allvalidcopies,oc->regularvalidcopies,oc->regularvalidcopies);
@@ -1183,7 +1361,6 @@ int chunk_multi_truncate(uint64_t *nchunkid,uint64_t ochunkid,uint32_t length,ui
 int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32_t inode,uint16_t indx,uint8_t goal) {
 #endif
 	chunk *oc,*c;
-	flist *f,**fp;
 	uint32_t i;
 
 	c=NULL;
@@ -1196,17 +1373,8 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32
 		return ERROR_LOCKED;
 	}
 #endif
-	fp = &(oc->flisthead);
-	i=1;
-	while ((f=*fp)) {
-		if (f->inode==inode && f->indx==indx) {
-			f->goal = goal;	// not needed.
-			break;
-		}
-		fp = &(f->next);
-		i=0;
-	}
-	if (i && f && f->next==NULL) {	// refcount==1
+	i = chunk_fref_setgoal(oc,inode,indx,goal);	// setting goal not needed.
+	if (i && oc->ftype==FREF_ONE && oc->xorgid==0) {	// refcount==1 (chunk from xor group is duplicated - its parity has to stay valid)
 		*nchunkid = ochunkid;
 		c = oc;
 #ifndef METARESTORE
@@ -1237,7 +1405,7 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32
 		c->version++;
 #endif
 	} else {
-		if (f==NULL) {	// it's serious structure error
+		if (i==0) {	// it's serious structure error
 #ifndef METARESTORE
 				syslog(LOG_WARNING,"serious structure inconsistency: (chunkid:%016"PRIX64" ; inode:%"PRIu32" ; index:%"PRIu16")",ochunkid,inode,indx);
 #else
@@ -1258,10 +1426,9 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32
 					c->interrupted = 0;
 					c->operation = DUPTRUNC;
 #endif
-					// move f to new chunk
-					c->flisthead = f;
-					*fp = f->next;
-					f->next = NULL;
+					// move reference to new chunk
+					chunk_fref_remove(oc,inode,indx);
+					chunk_fref_add(c,inode,indx,goal);
 #ifndef METARESTORE
 				}
 				s = slist_malloc();
@@ -1285,12 +1452,7 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32
 #ifndef METARESTORE
 			oldgoal = oc->goal;
 #endif
-			oc->goal = 0;
-			for (f=oc->flisthead ; f ; f=f->next) {
-				if (f->goal > oc->goal) {
-					oc->goal = f->goal;
-				}
-			}
+			oc->goal = chunk_fref_goal(oc);
 #ifndef METARESTORE
 			if (oldgoal!=oc->goal) {
 				chunk_state_change(oldgoal,oc->goal,oc->allvalidcopies,oc->allvalidcopies,oc->regularvalidcopies,oc->regularvalidcopies);
@@ -1373,7 +1535,6 @@ int chunk_repair(uint32_t inode,uint16_t indx,uint64_t ochunkid,uint32_t *nversi
 	uint32_t bestversion;
 	uint8_t oldgoal;
 	chunk *c;
-	flist *f,**fp;
 	slist *s;
 
 	*nversion=0;
@@ -1401,19 +1562,8 @@ int chunk_repair(uint32_t inode,uint16_t indx,uint64_t ochunkid,uint32_t *nversi
 	}
 	if (bestversion==0) {	// didn't find sensible chunk - so erase it
 		oldgoal = c->goal;
-		c->goal = 0;
-		fp = &(c->flisthead);
-		while ((f=*fp)) {
-			if (f->inode == inode && f->indx == indx) {
-				*fp = f->next;
-				flist_free(f);
-			} else {
-				if (f->goal > c->goal) {
-					c->goal = f->goal;
-				}
-				fp = &(f->next);
-			}
-		}
+		chunk_fref_remove(c,inode,indx);
+		c->goal = chunk_fref_goal(c);
 		if (oldgoal!=c->goal) {
 			chunk_state_change(oldgoal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,c->regularvalidcopies);
 		}
@@ -1534,7 +1684,7 @@ int chunk_getversionandlocations(uint64_t chunkid,uint32_t cuip,uint32_t *versio
 	*version = c->version;
 	cnt=0;
 	for (s=c->slisthead ;s ; s=s->next) {
-		if (s->valid!=INVALID && s->valid!=DEL) {
+		if (s->valid!=INVALID && s->valid!=DEL && matocsserv_isdetached(s->ptr)==0) {
 			if (cnt<100 && matocsserv_getlocation(s->ptr,&(lstab[cnt].ip),&(lstab[cnt].port))==0) {
 				lstab[cnt].dist = (lstab[cnt].ip==cuip)?0:1;	// in the future prepare more sofisticated distance function
 				lstab[cnt].rnd = rndu32();
@@ -1564,6 +1714,49 @@ int chunk_getversionandlocations(uint64_t chunkid,uint32_t cuip,uint32_t *versio
 	return STATUS_OK;
 }
 
+// locations of all other chunks from xor group (used by clients to rebuild data of chunk without available copies)
+int chunk_xor_getlocations(uint64_t chunkid,uint32_t cuip,uint8_t buff[CHUNK_XOR_LOCSIZE],uint32_t *leng) {
+	chunk *c;
+	xorgroup *xg;
+	uint64_t gid;
+	uint32_t i;
+	uint8_t *wptr;
+	uint32_t version;
+	uint8_t count;
+	uint8_t loc[256*6];	// the same size as declared in chunks.h
+	int status;
+
+	c = chunk_find(chunkid);
+	if (c==NULL) {
+		return ERROR_NOCHUNK;
+	}
+	xg = chunk_xor_get(c->xorgid);
+	if (xg==NULL) {
+		return ERROR_CHUNKLOST;
+	}
+	wptr = buff;
+	for (i=0 ; i<=xg->cnt ; i++) {
+		gid = (i<xg->cnt)?xg->chunkid[i]:xg->parityid;
+		if (gid==chunkid) {
+			continue;
+		}
+		status = chunk_getversionandlocations(gid,cuip,&version,&count,loc);
+		if (status!=STATUS_OK) {
+			return status;
+		}
+		if (count==0) {
+			return ERROR_CHUNKLOST;
+		}
+		put64bit(&wptr,gid);
+		put32bit(&wptr,version);
+		put8bit(&wptr,count);
+		memcpy(wptr,loc,count*6);
+		wptr += count*6;
+	}
+	*leng = wptr-buff;
+	return STATUS_OK;
+}
+
 /* ---- */
 
 void chunk_server_has_chunk(void *ptr,uint64_t chunkid,uint32_t version) {
@@ -1730,6 +1923,42 @@ void chunk_server_disconnected(void *ptr) {
 	fs_cs_disconnected();
 }
 
+// chunk reported in delta registration - replace old state of copy with reported one
+void chunk_server_changed_chunk(void *ptr,uint64_t chunkid,uint32_t version) {
+	chunk *c;
+	slist **sptr,*s;
+	if (version==0) {
+		chunk_lost(ptr,chunkid);
+		return;
+	}
+	c = chunk_find(chunkid);
+	if (c!=NULL) {
+		sptr=&(c->slisthead);
+		while ((s=*sptr)) {
+			if (s->ptr==ptr) {
+				if (s->valid==BUSY || s->valid==TDBUSY || s->valid==DEL) {	// status will come later
+					return;
+				}
+				if (s->valid==TDVALID) {
+					chunk_state_change(c->goal,c->goal,c->allvalidcopies,c->allvalidcopies-1,c->regularvalidcopies,c->regularvalidcopies);
+					c->allvalidcopies--;
+				}
+				if (s->valid==VALID) {
+					chunk_state_change(c->goal,c->goal,c->allvalidcopies,c->allvalidcopies-1,c->regularvalidcopies,c->regularvalidcopies-1);
+					c->allvalidcopies--;
+					c->regularvalidcopies--;
+				}
+				*sptr = s->next;
+				slist_free(s);
+				break;
+			} else {
+				sptr = &(s->next);
+			}
+		}
+	}
+	chunk_server_has_chunk(ptr,chunkid,version);
+}
+
 void chunk_got_delete_status(void *ptr,uint64_t chunkid,uint8_t status) {
 	chunk *c;
 	slist *s,**st;
@@ -1923,6 +2152,28 @@ void chunk_got_duptrunc_status(void *ptr,uint64_t chunkid,uint8_t status) {
 	chunk_operation_status(c,status,ptr);
 }
 
+// server is temporarily unavailable - keep its copies, but finish all operations waiting for it
+// deletions without status are queued again (resent after reattach - delta registration doesn't report unchanged chunks)
+void chunk_server_detached(void *ptr) {
+	chunk *c;
+	slist *s;
+	uint32_t i;
+	for (i=0 ; i<HASHSIZE ; i++) {
+		for (c=chunkhash[i] ; c ; c=c->next ) {
+			for (s=c->slisthead ; s ; s=s->next) {
+				if (s->ptr==ptr) {
+					if (s->valid==DEL) {
+						matocsserv_send_deletechunk(ptr,c->chunkid,0);
+					} else if (c->operation!=NONE && (s->valid==BUSY || s->valid==TDBUSY)) {
+						chunk_operation_status(c,ERROR_DISCONNECTED,ptr);
+					}
+					break;
+				}
+			}
+		}
+	}
+}
+
 /* ----------------------- */
 /* JOBS (DELETE/REPLICATE) */
 /* ----------------------- */
@@ -1945,63 +2196,395 @@ void chunk_store_info(uint8_t *buff) {
 
 //jobs state: jobshpos
 
-void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
-	slist *s;
-	static void* ptrs[65535];
-	static uint16_t servcount;
-	static uint32_t min,max;
-	void* rptrs[65536];
-	uint16_t rservcount;
-	void *srcptr;
-//	uint32_t ip;
-//	uint16_t port;
-	uint16_t i;
-	uint32_t vc,tdc,ivc,bc,tdb,dc;
-	static loop_info inforec;
-	static uint32_t delcount;
-
-	if (c==NULL) {
-		if (scount==0) {
-			servcount=0;
-			delcount=0;
-		} else if (scount==1) {
-			uint32_t delnotdone,deldone,prevdelnotdone;
-			delnotdone = inforec.notdone.del_invalid + inforec.notdone.del_unused + inforec.notdone.del_diskclean + inforec.notdone.del_overgoal;
-			deldone = inforec.done.del_invalid + inforec.done.del_unused + inforec.done.del_diskclean + inforec.done.del_overgoal;
-			prevdelnotdone = chunksinfo.notdone.del_invalid + chunksinfo.notdone.del_unused + chunksinfo.notdone.del_diskclean + chunksinfo.notdone.del_overgoal;
-			if (delnotdone > deldone && delnotdone > prevdelnotdone) {
-				TmpMaxDelFrac *= 1.3;
-				TmpMaxDel = TmpMaxDelFrac;
-				syslog(LOG_NOTICE,"DEL_LIMIT temporary increased to: %u/s",TmpMaxDel);
-			}
-			if (delnotdone < deldone && TmpMaxDelFrac > MaxDel) {
-				TmpMaxDelFrac /= 1.3;
-				if (TmpMaxDelFrac<MaxDel) {
-					TmpMaxDelFrac = MaxDel;
-				}
-				TmpMaxDel = TmpMaxDelFrac;
-				syslog(LOG_NOTICE,"DEL_LIMIT decreased back to: %u/s",TmpMaxDel);
-			}
-//			prevdeldone = chunksinfo.done.del_invalid + chunksinfo.done.del_unused + chunksinfo.done.del_diskclean + chunksinfo.done.del_overgoal;
-			chunksinfo = inforec;
-			memset(&inforec,0,sizeof(inforec));
-			chunksinfo_loopstart = chunksinfo_loopend;
-			chunksinfo_loopend = main_time();
+// some data chunk is leaving group (unused or goal changed)
+static inline int chunk_xor_dissolving(xorgroup *xg) {
+	chunk *gc;
+	uint32_t i;
+	for (i=0 ; i<xg->cnt ; i++) {
+		gc = chunk_find(xg->chunkid[i]);
+		if (gc==NULL || gc->ftype==FREF_NONE || gc->goal!=XorGoal) {
+			return 1;
 		}
-		return;
 	}
-// step 1. calculate number of valid and invalid copies
-	vc=tdc=ivc=bc=tdb=dc=0;
-	for (s=c->slisthead ; s ; s=s->next) {
-		switch (s->valid) {
+	return 0;
+}
+
+// copies needed by data chunk from dissolving group (the same as without group, unused chunk is kept until group is dropped)
+static inline uint8_t chunk_xor_leftcopies(chunk *c) {
+	if (c->ftype==FREF_NONE) {
+		return 1;
+	}
+	if (XorGoal>0 && c->goal==XorGoal) {
+		return 2;
+	}
+	return c->goal;
+}
+
+// all used data chunks from dissolving group have their own copies - parity is no longer needed
+static inline int chunk_xor_dissolved(xorgroup *xg) {
+	chunk *gc;
+	uint32_t i;
+	for (i=0 ; i<xg->cnt ; i++) {
+		gc = chunk_find(xg->chunkid[i]);
+		if (gc!=NULL && gc->ftype!=FREF_NONE && (gc->operation!=NONE || gc->regularvalidcopies<chunk_xor_leftcopies(gc))) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// number of copies needed by chunk
+static inline uint8_t chunk_xor_copies(chunk *c) {
+	xorgroup *xg;
+	chunk *gc;
+	uint32_t i;
+	xg = chunk_xor_get(c->xorgid);
+	if (xg!=NULL) {
+		if (xg->parityid==c->chunkid) {
+			return 1;
+		}
+		if (chunk_xor_dissolving(xg)) {
+			return chunk_xor_leftcopies(c);
+		}
+		// one copy is enough only when all other chunks from group are available
+		gc = chunk_find(xg->parityid);
+		if (gc==NULL || gc->allvalidcopies==0) {
+			return 2;
+		}
+		for (i=0 ; i<xg->cnt ; i++) {
+			if (xg->chunkid[i]!=c->chunkid) {
+				gc = chunk_find(xg->chunkid[i]);
+				if (gc==NULL || gc->allvalidcopies==0) {
+					return 2;
+				}
+			}
+		}
+		return 1;
+	}
+	if (XorGoal>0 && c->goal==XorGoal) {	// not protected yet
+		return 2;
+	}
+	return c->goal;
+}
+
+static inline int chunk_xor_server_used(void *ptr,void **used,uint32_t usedcnt) {
+	uint32_t i;
+	for (i=0 ; i<usedcnt ; i++) {
+		if (used[i]==ptr) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// copy of chunk that can be used as a source of xor replication
+static void* chunk_xor_source(chunk *c,void **used,uint32_t usedcnt) {
+	slist *s;
+	void *any = NULL;
+	for (s=c->slisthead ; s ; s=s->next) {
+		if (s->valid==VALID && matocsserv_isdetached(s->ptr)==0 && matocsserv_replication_read_counter(s->ptr)<MaxReadRepl) {
+			if (!chunk_xor_server_used(s->ptr,used,usedcnt)) {
+				return s->ptr;
+			}
+			if (any==NULL) {
+				any = s->ptr;
+			}
+		}
+	}
+	return (usedcnt>0)?NULL:any;
+}
+
+// all servers that have any copy of given chunk
+static uint32_t chunk_xor_add_servers(chunk *c,void **used,uint32_t usedcnt) {
+	slist *s;
+	for (s=c->slisthead ; s ; s=s->next) {
+		if (!chunk_xor_server_used(s->ptr,used,usedcnt)) {
+			used[usedcnt++] = s->ptr;
+		}
+	}
+	return usedcnt;
+}
+
+// rebuild missing chunk (data or parity) as xor of all other chunks from its group
+static int chunk_xor_rebuild(chunk *c) {
+	xorgroup *xg;
+	chunk *gc;
+	static void* rptrs[65536];
+	static void* used[65536];
+	uint16_t rservcount;
+	uint32_t usedcnt;
+	void *src[MAXXORPARTS];
+	uint64_t srcid[MAXXORPARTS];
+	uint32_t srcversion[MAXXORPARTS];
+	uint32_t i,cnt;
+	void *dst;
+
+	xg = chunk_xor_get(c->xorgid);
+	if (xg==NULL) {
+		return 0;
+	}
+	cnt = 0;
+	for (i=0 ; i<=xg->cnt ; i++) {
+		gc = chunk_find((i<xg->cnt)?xg->chunkid[i]:xg->parityid);
+		if (gc==c) {
+			continue;
+		}
+		if (gc==NULL || gc->operation!=NONE || cnt>=MAXXORPARTS) {
+			return 0;
+		}
+		src[cnt] = chunk_xor_source(gc,NULL,0);
+		if (src[cnt]==NULL) {	// two chunks from group are not available - can't rebuild
+			return 0;
+		}
+		srcid[cnt] = gc->chunkid;
+		srcversion[cnt] = gc->version;
+		cnt++;
+	}
+	// prefer servers without any chunk from this group
+	usedcnt = 0;
+	for (i=0 ; i<=xg->cnt ; i++) {
+		gc = chunk_find((i<xg->cnt)?xg->chunkid[i]:xg->parityid);
+		if (gc) {
+			usedcnt = chunk_xor_add_servers(gc,used,usedcnt);
+		}
+	}
+	rservcount = matocsserv_getservers_lessrepl(rptrs,MaxWriteRepl);
+	dst = NULL;
+	for (i=0 ; i<rservcount && dst==NULL ; i++) {
+		if (!chunk_xor_server_used(rptrs[i],used,usedcnt)) {
+			dst = rptrs[i];
+		}
+	}
+	usedcnt = chunk_xor_add_servers(c,used,0);
+	for (i=0 ; i<rservcount && dst==NULL ; i++) {
+		if (!chunk_xor_server_used(rptrs[i],used,usedcnt)) {
+			dst = rptrs[i];
+		}
+	}
+	if (dst==NULL) {
+		return 0;
+	}
+	if (matocsserv_send_replicatechunk_xor(dst,c->chunkid,c->version,cnt,src,srcid,srcversion)<0) {
+		return 0;
+	}
+	stats_replications++;
+	return 1;
+}
+
+// make parity chunk for collected candidates - every data chunk and parity should be placed on different server
+static void chunk_xor_make_group(void) {
+	chunk *c,*pc;
+	static void* rptrs[65536];
+	uint16_t rservcount;
+	void *used[MAXXORPARTS];
+	void *src[MAXXORPARTS];
+	uint64_t srcid[MAXXORPARTS];
+	uint32_t srcversion[MAXXORPARTS];
+	uint32_t i,j;
+	void *dst;
+
+	for (i=0 ; i<xorcandcnt ; i++) {
+		c = chunk_find(xorcand[i]);
+		if (c==NULL || c->xorgid!=0 || c->goal!=XorGoal || c->ftype==FREF_NONE || c->operation!=NONE || c->lockedto>=(uint32_t)main_time() || (src[i]=chunk_xor_source(c,used,i))==NULL) {
+			// remove this candidate and wait for another one
+			for (j=i+1 ; j<xorcandcnt ; j++) {
+				xorcand[j-1] = xorcand[j];
+			}
+			xorcandcnt--;
+			return;
+		}
+		used[i] = src[i];
+		srcid[i] = c->chunkid;
+		srcversion[i] = c->version;
+	}
+	rservcount = matocsserv_getservers_lessrepl(rptrs,MaxWriteRepl);
+	dst = NULL;
+	for (i=0 ; i<rservcount && dst==NULL ; i++) {
+		if (!chunk_xor_server_used(rptrs[i],used,xorcandcnt)) {
+			dst = rptrs[i];
+		}
+	}
+	if (dst==NULL) {	// not enough servers - try again later with other chunks
+		xorcandcnt = 0;
+		return;
+	}
+	pc = chunk_new(nextchunkid++);
+	pc->version = 1;
+	if (chunk_xor_attach(pc,xorcandcnt,xorcand)==0) {	// should never happen
+		xorcandcnt = 0;
+		return;
+	}
+	fs_xorgroup(pc->chunkid,xorcandcnt,xorcand);
+	matocsserv_send_replicatechunk_xor(dst,pc->chunkid,pc->version,xorcandcnt,src,srcid,srcversion);
+	stats_replications++;
+	xorcandcnt = 0;
+}
+
+// chunk with goal equal to XOR_GOAL can be joined with other such chunks
+static void chunk_xor_candidate(chunk *c) {
+	uint32_t i;
+	for (i=0 ; i<xorcandcnt ; i++) {
+		if (xorcand[i]==c->chunkid) {
+			return;
+		}
+	}
+	xorcand[xorcandcnt++] = c->chunkid;
+	if (xorcandcnt>=XorParts) {
+		chunk_xor_make_group();
+	}
+}
+
+// group is no longer needed (data chunk is unused or its goal changed) - store this decision in changelog
+static void chunk_xor_drop(chunk *c) {
+	xorgroup *xg;
+	xg = chunk_xor_get(c->xorgid);
+	if (xg!=NULL) {
+		fs_xorrelease(xg->parityid);
+		chunk_xor_detach(c->xorgid);
+	}
+}
+
+// keep copy on server without other chunks from group
+static void* chunk_xor_keep(chunk *c) {
+	xorgroup *xg;
+	chunk *gc;
+	slist *s;
+	static void* used[65536];
+	uint32_t usedcnt,i;
+	xg = chunk_xor_get(c->xorgid);
+	if (xg==NULL) {
+		return NULL;
+	}
+	usedcnt = 0;
+	for (i=0 ; i<=xg->cnt ; i++) {
+		gc = chunk_find((i<xg->cnt)?xg->chunkid[i]:xg->parityid);
+		if (gc && gc!=c) {
+			usedcnt = chunk_xor_add_servers(gc,used,usedcnt);
+		}
+	}
+	for (s=c->slisthead ; s ; s=s->next) {
+		if (s->valid==VALID && !chunk_xor_server_used(s->ptr,used,usedcnt)) {
+			return s->ptr;
+		}
+	}
+	return NULL;
+}
+
+// move single copy of chunk sharing server with other chunk from its group (all other chunks have to be already reduced to one copy)
+static int chunk_xor_spread(chunk *c) {
+	xorgroup *xg;
+	chunk *gc;
+	slist *s;
+	static void* rptrs[65536];
+	static void* used[65536];
+	uint16_t rservcount;
+	uint32_t usedcnt,i;
+	void *srcptr;
+
+	xg = chunk_xor_get(c->xorgid);
+	if (xg==NULL) {
+		return 0;
+	}
+	usedcnt = 0;
+	for (i=0 ; i<=xg->cnt ; i++) {
+		gc = chunk_find((i<xg->cnt)?xg->chunkid[i]:xg->parityid);
+		if (gc && gc!=c) {
+			if (gc->allvalidcopies>1 || gc->operation!=NONE) {
+				return 0;
+			}
+			usedcnt = chunk_xor_add_servers(gc,used,usedcnt);
+		}
+	}
+	srcptr = NULL;
+	for (s=c->slisthead ; s ; s=s->next) {
+		if (s->valid==VALID) {
+			if (!chunk_xor_server_used(s->ptr,used,usedcnt)) {
+				return 0;
+			}
+			srcptr = s->ptr;
+		}
+	}
+	if (srcptr==NULL || matocsserv_replication_read_counter(srcptr)>=MaxReadRepl) {
+		return 0;
+	}
+	rservcount = matocsserv_getservers_lessrepl(rptrs,MaxWriteRepl);
+	for (i=0 ; i<rservcount ; i++) {
+		if (rptrs[i]!=srcptr && !chunk_xor_server_used(rptrs[i],used,usedcnt)) {
+			stats_replications++;
+			matocsserv_send_replicatechunk(rptrs[i],c->chunkid,c->version,srcptr);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
+	slist *s;
+	static void* ptrs[65535];
+	static uint16_t servcount;
+	static uint32_t min,max;
+	void* rptrs[65536];
+	uint16_t rservcount;
+	void *srcptr;
+//	uint32_t ip;
+//	uint16_t port;
+	uint16_t i;
+	uint32_t vc,tdc,ivc,bc,tdb,dc,dvc,dtdc;
+	uint8_t goal;
+	void *keepptr;
+	static loop_info inforec;
+	static uint32_t delcount;
+
+	if (c==NULL) {
+		if (scount==0) {
+			servcount=0;
+			delcount=0;
+		} else if (scount==1) {
+			uint32_t delnotdone,deldone,prevdelnotdone;
+			delnotdone = inforec.notdone.del_invalid + inforec.notdone.del_unused + inforec.notdone.del_diskclean + inforec.notdone.del_overgoal;
+			deldone = inforec.done.del_invalid + inforec.done.del_unused + inforec.done.del_diskclean + inforec.done.del_overgoal;
+			prevdelnotdone = chunksinfo.notdone.del_invalid + chunksinfo.notdone.del_unused + chunksinfo.notdone.del_diskclean + chunksinfo.notdone.del_overgoal;
+			if (delnotdone > deldone && delnotdone > prevdelnotdone) {
+				TmpMaxDelFrac *= 1.3;
+				TmpMaxDel = TmpMaxDelFrac;
+				syslog(LOG_NOTICE,"DEL_LIMIT temporary increased to: %u/s",TmpMaxDel);
+			}
+			if (delnotdone < deldone && TmpMaxDelFrac > MaxDel) {
+				TmpMaxDelFrac /= 1.3;
+				if (TmpMaxDelFrac<MaxDel) {
+					TmpMaxDelFrac = MaxDel;
+				}
+				TmpMaxDel = TmpMaxDelFrac;
+				syslog(LOG_NOTICE,"DEL_LIMIT decreased back to: %u/s",TmpMaxDel);
+			}
+//			prevdeldone = chunksinfo.done.del_invalid + chunksinfo.done.del_unused + chunksinfo.done.del_diskclean + chunksinfo.done.del_overgoal;
+			chunksinfo = inforec;
+			memset(&inforec,0,sizeof(inforec));
+			chunksinfo_loopstart = chunksinfo_loopend;
+			chunksinfo_loopend = main_time();
+		}
+		return;
+	}
+// step 1. calculate number of valid and invalid copies (valid copies on detached servers are counted separately - they are missing until server reconnects)
+	vc=tdc=ivc=bc=tdb=dc=dvc=dtdc=0;
+	for (s=c->slisthead ; s ; s=s->next) {
+		switch (s->valid) {
 		case INVALID:
 			ivc++;
 			break;
 		case TDVALID:
-			tdc++;
+			if (matocsserv_isdetached(s->ptr)) {
+				dtdc++;
+			} else {
+				tdc++;
+			}
 			break;
 		case VALID:
-			vc++;
+			if (matocsserv_isdetached(s->ptr)) {
+				dvc++;
+			} else {
+				vc++;
+			}
 			break;
 		case TDBUSY:
 			tdb++;
@@ -2014,21 +2597,31 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 			break;
 		}
 	}
-	if (c->allvalidcopies!=vc+tdc+bc+tdb) {
-		syslog(LOG_WARNING,"wrong all valid copies counter - (counter value: %u, should be: %u) - fixed",c->allvalidcopies,vc+tdc+bc+tdb);
-		chunk_state_change(c->goal,c->goal,c->allvalidcopies,vc+tdc+bc+tdb,c->regularvalidcopies,c->regularvalidcopies);
-		c->allvalidcopies = vc+tdc+bc+tdb;
+	if (c->allvalidcopies!=vc+tdc+bc+tdb+dvc+dtdc) {
+		syslog(LOG_WARNING,"wrong all valid copies counter - (counter value: %u, should be: %u) - fixed",c->allvalidcopies,vc+tdc+bc+tdb+dvc+dtdc);
+		chunk_state_change(c->goal,c->goal,c->allvalidcopies,vc+tdc+bc+tdb+dvc+dtdc,c->regularvalidcopies,c->regularvalidcopies);
+		c->allvalidcopies = vc+tdc+bc+tdb+dvc+dtdc;
 	}
-	if (c->regularvalidcopies!=vc+bc) {
-		syslog(LOG_WARNING,"wrong regular valid copies counter - (counter value: %u, should be: %u) - fixed",c->regularvalidcopies,vc+bc);
-		chunk_state_change(c->goal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,vc+bc);
-		c->regularvalidcopies = vc+bc;
+	if (c->regularvalidcopies!=vc+bc+dvc) {
+		syslog(LOG_WARNING,"wrong regular valid copies counter - (counter value: %u, should be: %u) - fixed",c->regularvalidcopies,vc+bc+dvc);
+		chunk_state_change(c->goal,c->goal,c->allvalidcopies,c->allvalidcopies,c->regularvalidcopies,vc+bc+dvc);
+		c->regularvalidcopies = vc+bc+dvc;
 	}
 
 //	syslog(LOG_WARNING,"chunk %016"PRIX64": ivc=%"PRIu32" , tdc=%"PRIu32" , vc=%"PRIu32" , bc=%"PRIu32" , tdb=%"PRIu32" , dc=%"PRIu32" , goal=%"PRIu8" , scount=%"PRIu16,c->chunkid,ivc,tdc,vc,bc,tdb,dc,c->goal,scount);
 
+// step 1b. rebuild lost chunk from the rest of its xor group
+	if (tdc+vc+tdb+bc==0 && c->xorgid && c->operation==NONE && c->lockedto<(uint32_t)main_time()) {
+		if (jobsnorepbefore<(uint32_t)main_time() && chunk_xor_rebuild(c)) {
+			inforec.done.copy_undergoal++;
+		} else {
+			inforec.notdone.copy_undergoal++;
+		}
+		return ;
+	}
+
 // step 2. check number of copies
-	if (tdc+vc+tdb+bc==0 && ivc>0 && c->flisthead) {
+	if (tdc+vc+tdb+bc+dvc+dtdc==0 && ivc>0 && c->ftype!=FREF_NONE) {
 		syslog(LOG_WARNING,"chunk %016"PRIX64" has only invalid copies (%"PRIu32") - please repair it manually",c->chunkid,ivc);
 		for (s=c->slisthead ; s ; s=s->next) {
 			syslog(LOG_NOTICE,"chunk %016"PRIX64"_%08"PRIX32" - invalid copy on (%s - ver:%08"PRIX32")",c->chunkid,c->version,matocsserv_getstrip(s->ptr),s->version);
@@ -2039,7 +2632,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 // step 3. delete invalid copies
 	if (delcount<TmpMaxDel) {
 		for (s=c->slisthead ; s ; s=s->next) {
-			if (s->valid==INVALID || s->valid==DEL) {
+			if (s->valid==INVALID || (s->valid==DEL && matocsserv_isdetached(s->ptr)==0)) {	// deletion on detached server is already queued
 				if (s->valid==DEL) {
 					syslog(LOG_WARNING,"chunk hasn't been deleted since previous loop - retry");
 				}
@@ -2071,8 +2664,17 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 		return ;
 	}
 
+// step 5b. drop xor group when data chunk is no longer cold (goal changed or chunk is unused) - parity is dropped only after other chunks from group have been replicated
+	if (c->xorgid) {
+		xorgroup *xg = chunk_xor_get(c->xorgid);
+		if (xg && xg->parityid!=c->chunkid && (c->ftype==FREF_NONE || c->goal!=XorGoal) && chunk_xor_dissolved(xg)) {
+			chunk_xor_drop(c);
+		}
+	}
+	goal = chunk_xor_copies(c);
+
 // step 6. delete unused chunk
-	if (c->flisthead==NULL) {
+	if (c->ftype==FREF_NONE && c->xorgid==0) {
 //		syslog(LOG_WARNING,"unused - delete");
 		if (delcount<TmpMaxDel) {
 			for (s=c->slisthead ; s ; s=s->next) {
@@ -2133,15 +2735,19 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 */
 
 // step 7b. if chunk has too many copies then delete some of them
-	if (vc > c->goal) {
+	if (XorGoal>0 && c->xorgid==0 && c->goal==XorGoal && vc>0 && jobsnorepbefore<(uint32_t)main_time()) {
+		chunk_xor_candidate(c);
+	}
+	if (vc > goal) {
 //		syslog(LOG_WARNING,"vc (%"PRIu32") > goal (%"PRIu32") - delete",vc,c->goal);
 		if (delcount<TmpMaxDel) {
 			if (servcount==0) {
 				servcount = matocsserv_getservers_ordered(ptrs,ACCEPTABLE_DIFFERENCE/2.0,&min,&max);
 			}
-			for (i=0 ; i<servcount && vc>c->goal ; i++) {
+			keepptr = (goal==1)?chunk_xor_keep(c):NULL;
+			for (i=0 ; i<servcount && vc>goal ; i++) {
 				for (s=c->slisthead ; s && s->ptr!=ptrs[servcount-1-i] ; s=s->next) {}
-				if (s && s->valid==VALID) {
+				if (s && s->valid==VALID && s->ptr!=keepptr) {
 					chunk_state_change(c->goal,c->goal,c->allvalidcopies,c->allvalidcopies-1,c->regularvalidcopies,c->regularvalidcopies-1);
 					c->allvalidcopies--;
 					c->regularvalidcopies--;
@@ -2156,13 +2762,13 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 				}
 			}
 		} else {
-			inforec.notdone.del_overgoal+=(vc-(c->goal));
+			inforec.notdone.del_overgoal+=(vc-goal);
 		}
 		return;
 	}
 
 // step 7c. if chunk has one copy on each server and some of them have status TODEL then delete one of it
-	if (vc+tdc>=scount && vc<c->goal && tdc>0 && vc+tdc>1) {
+	if (vc+tdc>=scount && vc<goal && tdc>0 && vc+tdc>1) {
 //		syslog(LOG_WARNING,"vc+tdc (%"PRIu32") >= scount (%"PRIu32") and vc (%"PRIu32") < goal (%"PRIu32") and tdc (%"PRIu32") > 0 and vc+tdc > 1 - delete",vc+tdc,scount,vc,c->goal,tdc);
 		if (delcount<TmpMaxDel) {
 			for (s=c->slisthead ; s ; s=s->next) {
@@ -2187,14 +2793,14 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 	}
 
 //step 8. if chunk has number of copies less than goal then make another copy of this chunk
-	if (c->goal > vc && vc+tdc > 0) {
+	if (goal > vc && vc+tdc > 0) {
 		if (jobsnorepbefore<(uint32_t)main_time()) {
 			uint32_t rgvc,rgtdc;
 			rservcount = matocsserv_getservers_lessrepl(rptrs,MaxWriteRepl);
 			rgvc=0;
 			rgtdc=0;
 			for (s=c->slisthead ; s ; s=s->next) {
-				if (matocsserv_replication_read_counter(s->ptr)<MaxReadRepl) {
+				if (matocsserv_isdetached(s->ptr)==0 && matocsserv_replication_read_counter(s->ptr)<MaxReadRepl) {
 					if (s->valid==VALID) {
 						rgvc++;
 					} else if (s->valid==TDVALID) {
@@ -2211,7 +2817,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 							r = 1+(rndu32()%rgvc);
 							srcptr = NULL;
 							for (s=c->slisthead ; s && r>0 ; s=s->next) {
-								if (matocsserv_replication_read_counter(s->ptr)<MaxReadRepl && s->valid==VALID) {
+								if (matocsserv_isdetached(s->ptr)==0 && matocsserv_replication_read_counter(s->ptr)<MaxReadRepl && s->valid==VALID) {
 									r--;
 									srcptr = s->ptr;
 								}
@@ -2220,7 +2826,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 							r = 1+(rndu32()%rgtdc);
 							srcptr = NULL;
 							for (s=c->slisthead ; s && r>0 ; s=s->next) {
-								if (matocsserv_replication_read_counter(s->ptr)<MaxReadRepl && s->valid==TDVALID) {
+								if (matocsserv_isdetached(s->ptr)==0 && matocsserv_replication_read_counter(s->ptr)<MaxReadRepl && s->valid==TDVALID) {
 									r--;
 									srcptr = s->ptr;
 								}
@@ -2241,9 +2847,18 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 		inforec.notdone.copy_undergoal++;
 	}
 
+// step 8b. single copy of chunk from xor group shares server with other chunk from its group - copy it to another server (old copy will be deleted as overgoal)
+	if (goal==1 && vc==1 && tdc==0 && c->xorgid && jobsnorepbefore<(uint32_t)main_time()) {
+		if (chunk_xor_spread(c)) {
+			c->needverincrease=1;
+			inforec.done.copy_undergoal++;
+			return;
+		}
+	}
+
 // step 8. if chunk has number of copies less than goal then make another copy of this chunk
 /*
-	if (c->goal > vc && vc+tdc > 0) {
+	if (goal > vc && vc+tdc > 0) {
 		if (jobscopycount<MaxRepl && maxusage<=0.99 && jobsnorepbefore<(uint32_t)main_time()) {
 			if (servcount==0) {
 				servcount = matocsserv_getservers_ordered(ptrs,MINMAXRND,&min,&max);
@@ -2290,7 +2905,7 @@ void chunk_do_jobs(chunk *c,uint16_t scount,double minusage,double maxusage) {
 	}
 
 // step 9. if there is too big difference between chunkservers then make copy of chunk from server with biggest disk usage on server with lowest disk usage
-	if (c->goal >= vc && vc+tdc>0 && (maxusage-minusage)>ACCEPTABLE_DIFFERENCE) {
+	if (goal >= vc && vc+tdc>0 && (maxusage-minusage)>ACCEPTABLE_DIFFERENCE) {
 		if (servcount==0) {
 			servcount = matocsserv_getservers_ordered(ptrs,ACCEPTABLE_DIFFERENCE/2.0,&min,&max);
 		}
@@ -2401,6 +3016,9 @@ void chunk_jobs_main(void) {
 		maxtscount = tscount;
 	}
 	lasttscount = tscount;
+	if (matocsserv_registration_inprogress() && jobsnorepbefore<=(uint32_t)main_time()) {	// not all chunks from registering servers are known yet
+		jobsnorepbefore = main_time()+1;
+	}
 
 	if (minusage>maxusage) {
 		return;
@@ -2415,7 +3033,7 @@ void chunk_jobs_main(void) {
 		l=0;
 		cp = &(chunkhash[jobshpos]);
 		while ((c=*cp)!=NULL) {
-			if (c->flisthead==NULL && c->slisthead==NULL) {
+			if (c->ftype==FREF_NONE && c->slisthead==NULL && c->xorgid==0) {
 				*cp = (c->next);
 				chunk_delete(c);
 			} else {
@@ -2527,14 +3145,13 @@ void chunk_dump(void) {
 
 #endif
 
-int chunk_load(FILE *fd) {
+static int chunk_xor_load(FILE *fd,uint8_t fver);
+
+int chunk_load_1_5(FILE *fd) {
 	uint8_t hdr[8];
-	uint8_t loadbuff[CHUNKFSIZE*CHUNKCNT];
+	uint8_t loadbuff[CHUNKFSIZE];
 	const uint8_t *ptr;
-	int32_t r;
-	uint32_t i,j;
 	chunk *c;
-	int readlast;
 // chunkdata
 	uint64_t chunkid;
 	uint32_t version,lockedto;
@@ -2547,71 +3164,382 @@ int chunk_load(FILE *fd) {
 	}
 	ptr = hdr;
 	nextchunkid = get64bit(&ptr);
-	readlast = 0;
+	// records are read one by one (stdio buffers them) - xor groups may follow the last record
 	for (;;) {
-		r = fread(loadbuff,1,CHUNKFSIZE*CHUNKCNT,fd);
-		if (r<0) {
+		if (fread(loadbuff,1,CHUNKFSIZE,fd)!=CHUNKFSIZE) {
 			return -1;
 		}
-		if ((r%CHUNKFSIZE)!=0) {
+		ptr = loadbuff;
+		chunkid = get64bit(&ptr);
+		version = get32bit(&ptr);
+		lockedto = get32bit(&ptr);
+		if (chunkid==0) {	// last record
+			break;
+		}
+		if (chunk_find(chunkid)!=NULL) {
+#ifndef METARESTORE
+			syslog(LOG_ERR,"chunk %016"PRIX64" appears twice in metadata",chunkid);
+#else
+			printf("chunk %016"PRIX64" appears twice in metadata\n",chunkid);
+#endif
 			return -1;
 		}
-		i = r/CHUNKFSIZE;
-		ptr = loadbuff;
-		for (j=0 ; j<i ; j++) {
-			chunkid = get64bit(&ptr);
-			if (chunkid>0) {
-				if (readlast==1) {
-					return -1;
-				}
-				c = chunk_new(chunkid);
-				version = get32bit(&ptr);
-				c->version = version;
-				lockedto = get32bit(&ptr);
-				c->lockedto = lockedto;
-			} else {
-				readlast = 1;
-				version = get32bit(&ptr);
-				lockedto = get32bit(&ptr);
+		c = chunk_new(chunkid);
+		c->version = version;
+		c->lockedto = lockedto;
+	}
+	return chunk_xor_load(fd,0x15);
+}
+
+/* columnar chunk section (since "MFSM 1.6")
+
+   nextchunkid:64 partitions:16 partitions * ( chunkcount:32 countsize:32 idsize:32 versionsize:32 lockedsize:32 data )
+
+   every partition covers HASHSIZE/partitions consecutive hash positions and its data contains four columns of varints:
+   - number of chunks for every hash position
+   - chunkid>>16 (lower bits are equal to hash position) - sorted, first one as is, next ones as difference from previous one
+   - versions
+   - lockedto (0 when chunk is not locked)
+
+   partitions are independent, so they are decoded in parallel straight into hash lists */
+
+#define CHUNKPARTS 16
+#define CHUNKPARTHDRSIZE 20
+
+typedef struct _chunk_part {
+	const uint8_t *data;
+	uint32_t chunkcount;
+	uint32_t countsize,idsize,versionsize,lockedsize;
+	uint32_t firstpos,lastpos;
+#ifdef USE_CHUNK_BUCKETS
+	chunk_bucket *cbhead;
+#endif
+	int status;
+} chunk_part;
+
+static void* chunk_part_decode(void *arg) {
+	chunk_part *cp = (chunk_part*)arg;
+	const uint8_t *cptr,*cend,*iptr,*iend,*vptr,*vend,*lptr,*lend;
+	uint64_t bcnt,id,version,lockedto,chunkid;
+	uint32_t pos,i,left;
+	chunk *c;
+#ifdef USE_CHUNK_BUCKETS
+	chunk_bucket *cb;
+#endif
+
+	cp->status = -1;
+	cptr = cp->data;
+	cend = cptr+cp->countsize;
+	iptr = cend;
+	iend = iptr+cp->idsize;
+	vptr = iend;
+	vend = vptr+cp->versionsize;
+	lptr = vend;
+	lend = lptr+cp->lockedsize;
+	left = cp->chunkcount;
+#ifdef USE_CHUNK_BUCKETS
+	cb = NULL;
+	cp->cbhead = NULL;
+#endif
+	for (pos=cp->firstpos ; pos<=cp->lastpos ; pos++) {
+		if (getvar64bit(&cptr,cend,&bcnt)<0 || bcnt>left) {
+			return NULL;
+		}
+		left -= bcnt;
+		chunkid = 0;
+		for (i=0 ; i<bcnt ; i++) {
+			if (getvar64bit(&iptr,iend,&id)<0 || getvar64bit(&vptr,vend,&version)<0 || getvar64bit(&lptr,lend,&lockedto)<0) {
+				return NULL;
+			}
+			if (i>0 && id==0) {	// ids are stored sorted - zero difference means the same chunk twice
+#ifndef METARESTORE
+				syslog(LOG_ERR,"chunk %016"PRIX64" appears twice in metadata",chunkid|pos);
+#else
+				printf("chunk %016"PRIX64" appears twice in metadata\n",chunkid|pos);
+#endif
+				return NULL;
+			}
+			chunkid += (id<<16);
+			if ((chunkid|pos)==0 || version>0xFFFFFFFF || lockedto>0xFFFFFFFF) {
+				return NULL;
 			}
+#ifdef USE_CHUNK_BUCKETS
+			if (cb==NULL || cb->firstfree==CHUNK_BUCKET_SIZE) {
+				cb = (chunk_bucket*)malloc(sizeof(chunk_bucket));
+				passert(cb);
+				cb->next = cp->cbhead;
+				cb->firstfree = 0;
+				cp->cbhead = cb;
+			}
+			c = (cb->bucket)+(cb->firstfree);
+			cb->firstfree++;
+#else
+			c = chunk_malloc();
+#endif
+			chunk_setup(c,chunkid|pos);
+			c->version = version;
+			c->lockedto = lockedto;
+			c->next = chunkhash[pos];
+			chunkhash[pos] = c;
 		}
-		if (i<CHUNKCNT) {
-			break;
+	}
+	if (left>0 || cptr!=cend || iptr!=iend || vptr!=vend || lptr!=lend) {
+		return NULL;
+	}
+	cp->status = 0;
+	return NULL;
+}
+
+// xor groups: count:32 ( parityid:64 cnt:8 cnt * chunkid:64 ) * count
+/* in "MFSM 1.5" format xor section follows the last chunk record and is split into
+   records with zero chunk id (older versions skip them) - 8 bytes of data per record */
+static uint8_t xorrec[CHUNKFSIZE];
+static uint32_t xorrecpos;
+
+static size_t chunk_xor_fread(uint8_t *buff,size_t leng,FILE *fd,uint8_t fver) {
+	const uint8_t *ptr;
+	size_t i;
+	if (fver!=0x15) {
+		return fread(buff,1,leng,fd);
+	}
+	for (i=0 ; i<leng ; i++) {
+		if (xorrecpos>=CHUNKFSIZE) {
+			if (fread(xorrec,1,CHUNKFSIZE,fd)!=CHUNKFSIZE) {
+				return i;
+			}
+			ptr = xorrec;
+			if (get64bit(&ptr)!=0) {
+				return i;
+			}
+			xorrecpos = 8;
 		}
+		buff[i] = xorrec[xorrecpos++];
 	}
-	if (readlast==0) {
+	return i;
+}
+
+static int chunk_xor_fwrite(const uint8_t *buff,size_t leng,FILE *fd,uint8_t fver) {
+	size_t i;
+	if (fver!=0x15) {
+		return (fwrite(buff,1,leng,fd)==leng)?0:-1;
+	}
+	for (i=0 ; i<leng ; i++) {
+		xorrec[xorrecpos++] = buff[i];
+		if (xorrecpos==CHUNKFSIZE) {
+			if (fwrite(xorrec,1,CHUNKFSIZE,fd)!=CHUNKFSIZE) {
+				return -1;
+			}
+			xorrecpos = 8;
+		}
+	}
+	return 0;
+}
+
+static int chunk_xor_load(FILE *fd,uint8_t fver) {
+	uint8_t buff[8+1+8*MAXXORPARTS];
+	const uint8_t *ptr;
+	uint64_t parityid;
+	uint64_t chunkids[MAXXORPARTS];
+	uint32_t i,count;
+	uint8_t cnt;
+	chunk *pc;
+
+	xorrecpos = CHUNKFSIZE;
+	if (chunk_xor_fread(buff,4,fd,fver)!=4) {	// metadata without groups
+		return 0;
+	}
+	ptr = buff;
+	count = get32bit(&ptr);
+	while (count>0) {
+		if (chunk_xor_fread(buff,9,fd,fver)!=9) {
+			return -1;
+		}
+		ptr = buff;
+		parityid = get64bit(&ptr);
+		cnt = get8bit(&ptr);
+		if (cnt<2 || cnt>MAXXORPARTS || chunk_xor_fread(buff,8*cnt,fd,fver)!=8U*cnt) {
+			return -1;
+		}
+		ptr = buff;
+		for (i=0 ; i<cnt ; i++) {
+			chunkids[i] = get64bit(&ptr);
+		}
+		pc = chunk_find(parityid);
+		if (pc==NULL || chunk_xor_attach(pc,cnt,chunkids)==0) {
+			syslog(LOG_WARNING,"xor group with parity chunk %016"PRIX64" is inconsistent - ignored",parityid);
+		}
+		count--;
+	}
+	return 0;
+}
+
+static int chunk_xor_store(FILE *fd,uint8_t fver) {
+	uint8_t buff[8+1+8*MAXXORPARTS];
+	uint8_t *ptr;
+	uint32_t gid,i;
+	xorgroup *xg;
+
+	memset(xorrec,0,CHUNKFSIZE);
+	xorrecpos = 8;
+	ptr = buff;
+	put32bit(&ptr,xorgroups);
+	if (chunk_xor_fwrite(buff,4,fd,fver)<0) {
 		return -1;
 	}
+	for (gid=1 ; gid<xorgsize ; gid++) {
+		xg = xorgtab[gid];
+		if (xg) {
+			ptr = buff;
+			put64bit(&ptr,xg->parityid);
+			put8bit(&ptr,xg->cnt);
+			for (i=0 ; i<xg->cnt ; i++) {
+				put64bit(&ptr,xg->chunkid[i]);
+			}
+			if (chunk_xor_fwrite(buff,9+8*xg->cnt,fd,fver)<0) {
+				return -1;
+			}
+		}
+	}
+	if (fver==0x15 && xorrecpos>8) {	// last record padded with zeros
+		memset(xorrec+xorrecpos,0,CHUNKFSIZE-xorrecpos);
+		if (fwrite(xorrec,1,CHUNKFSIZE,fd)!=CHUNKFSIZE) {
+			return -1;
+		}
+	}
 	return 0;
 }
 
-void chunk_store(FILE *fd) {
+int chunk_load(FILE *fd) {
+	uint8_t hdr[CHUNKPARTHDRSIZE];
+	const uint8_t *ptr;
+	uint8_t *buff;
+	uint64_t size;
+	uint32_t i,parts,partsize,total;
+	chunk_part *cptab;
+	pthread_t *thtab;
+	uint8_t *thstarted;
+	int status;
+
+	if (fread(hdr,1,10,fd)!=10) {
+		return -1;
+	}
+	ptr = hdr;
+	nextchunkid = get64bit(&ptr);
+	parts = get16bit(&ptr);
+	if (parts==0 || parts>HASHSIZE || (HASHSIZE%parts)!=0) {
+		return -1;
+	}
+	partsize = HASHSIZE/parts;
+	cptab = malloc(sizeof(chunk_part)*parts);
+	thtab = malloc(sizeof(pthread_t)*parts);
+	thstarted = malloc(parts);
+	passert(cptab);
+	passert(thtab);
+	passert(thstarted);
+	status = 0;
+	for (i=0 ; i<parts ; i++) {
+		cptab[i].data = NULL;
+		thstarted[i] = 0;
+	}
+	// read sequentially, decode every partition as soon as its data is in memory
+	for (i=0 ; i<parts && status==0 ; i++) {
+		if (fread(hdr,1,CHUNKPARTHDRSIZE,fd)!=CHUNKPARTHDRSIZE) {
+			status = -1;
+			break;
+		}
+		ptr = hdr;
+		cptab[i].chunkcount = get32bit(&ptr);
+		cptab[i].countsize = get32bit(&ptr);
+		cptab[i].idsize = get32bit(&ptr);
+		cptab[i].versionsize = get32bit(&ptr);
+		cptab[i].lockedsize = get32bit(&ptr);
+		cptab[i].firstpos = i*partsize;
+		cptab[i].lastpos = (i+1)*partsize-1;
+		cptab[i].status = -1;
+		size = (uint64_t)(cptab[i].countsize)+(uint64_t)(cptab[i].idsize)+(uint64_t)(cptab[i].versionsize)+(uint64_t)(cptab[i].lockedsize);
+		if (size>(uint64_t)(cptab[i].chunkcount)*25+(uint64_t)partsize*10) {	// more than maximal varint sizes
+			status = -1;
+			break;
+		}
+		buff = malloc(size+1);
+		passert(buff);
+		cptab[i].data = buff;
+		if (fread(buff,1,size,fd)!=size) {
+			status = -1;
+			break;
+		}
+		if (pthread_create(thtab+i,NULL,chunk_part_decode,cptab+i)==0) {
+			thstarted[i] = 1;
+		} else {
+			chunk_part_decode(cptab+i);
+		}
+	}
+	total = 0;
+	for (i=0 ; i<parts ; i++) {
+		if (thstarted[i]) {
+			pthread_join(thtab[i],NULL);
+		}
+		if (cptab[i].data) {
+			free((uint8_t*)(cptab[i].data));
+			if (cptab[i].status<0) {
+				status = -1;
+			}
+#ifdef USE_CHUNK_BUCKETS
+			// link decoded chunks into global allocator (they are freed and reused as usual)
+			if (cptab[i].cbhead) {
+				chunk_bucket *cb;
+				for (cb=cptab[i].cbhead ; cb->next ; cb=cb->next) {}
+				cb->next = cbhead;
+				cbhead = cptab[i].cbhead;
+			}
+#endif
+			total += cptab[i].chunkcount;
+		}
+	}
+	free(cptab);
+	free(thtab);
+	free(thstarted);
+#ifndef METARESTORE
+	chunks = total;
+	allchunkcounts[0][0] += total;
+	regularchunkcounts[0][0] += total;
+#else
+	(void)total;
+#endif
+	lastchunkid = 0;
+	lastchunkptr = NULL;
+	if (status==0) {
+		status = chunk_xor_load(fd,0x16);
+	}
+	return status;
+}
+
+static int chunk_cmp(const void *a,const void *b) {
+	const chunk *ca = *((const chunk* const*)a);
+	const chunk *cb = *((const chunk* const*)b);
+	return (ca->chunkid<cb->chunkid)?-1:(ca->chunkid>cb->chunkid)?1:0;
+}
+
+// old record format ("MFSM 1.5") - can be read by older versions
+static int chunk_store_1_5(FILE *fd,uint32_t now) {
 	uint8_t hdr[8];
 	uint8_t storebuff[CHUNKFSIZE*CHUNKCNT];
 	uint8_t *ptr;
 	uint32_t i,j;
-	size_t happy;
 	chunk *c;
-// chunkdata
-	uint64_t chunkid;
-	uint32_t version;
-	uint32_t lockedto,now;
-#ifndef METARESTORE
-	now = main_time();
-#else
-	now = time(NULL);
-#endif
+	uint32_t lockedto;
+
 	ptr = hdr;
 	put64bit(&ptr,nextchunkid);
-	happy = fwrite(hdr,1,8,fd);
+	if (fwrite(hdr,1,8,fd)!=8) {
+		return -1;
+	}
 	j=0;
 	ptr = storebuff;
 	for (i=0 ; i<HASHSIZE ; i++) {
 		for (c=chunkhash[i] ; c ; c=c->next) {
-			chunkid = c->chunkid;
-			put64bit(&ptr,chunkid);
-			version = c->version;
-			put32bit(&ptr,version);
+			put64bit(&ptr,c->chunkid);
+			put32bit(&ptr,c->version);
 			lockedto = c->lockedto;
 			if (lockedto<now) {
 				lockedto = 0;
@@ -2619,7 +3547,9 @@ void chunk_store(FILE *fd) {
 			put32bit(&ptr,lockedto);
 			j++;
 			if (j==CHUNKCNT) {
-				happy = fwrite(storebuff,1,CHUNKFSIZE*CHUNKCNT,fd);
+				if (fwrite(storebuff,1,CHUNKFSIZE*CHUNKCNT,fd)!=CHUNKFSIZE*CHUNKCNT) {
+					return -1;
+				}
 				j=0;
 				ptr = storebuff;
 			}
@@ -2627,7 +3557,108 @@ void chunk_store(FILE *fd) {
 	}
 	memset(ptr,0,CHUNKFSIZE);
 	j++;
-	happy = fwrite(storebuff,1,CHUNKFSIZE*j,fd);
+	if (fwrite(storebuff,1,CHUNKFSIZE*j,fd)!=CHUNKFSIZE*j) {
+		return -1;
+	}
+	return chunk_xor_store(fd,0x15);
+}
+
+// fver: 0x15 - old record format, 0x16 - columnar format ; returns -1 on write error
+int chunk_store(FILE *fd,uint8_t fver) {
+	uint8_t hdr[CHUNKPARTHDRSIZE];
+	uint8_t *ptr;
+	uint8_t *cbuff,*ibuff,*vbuff,*lbuff;
+	uint8_t *cptr,*iptr,*vptr,*lptr;
+	uint32_t j,part,pos,partsize,partcount,bcnt;
+	uint32_t tabsize;
+	uint64_t previd;
+	chunk *c,**tab;
+	uint32_t lockedto,now;
+	int status;
+#ifndef METARESTORE
+	now = main_time();
+#else
+	now = time(NULL);
+#endif
+	if (fver==0x15) {
+		return chunk_store_1_5(fd,now);
+	}
+	ptr = hdr;
+	put64bit(&ptr,nextchunkid);
+	put16bit(&ptr,CHUNKPARTS);
+	if (fwrite(hdr,1,10,fd)!=10) {
+		return -1;
+	}
+	status = 0;
+	partsize = HASHSIZE/CHUNKPARTS;
+	tabsize = 1024;
+	tab = malloc(sizeof(chunk*)*tabsize);
+	passert(tab);
+	cbuff = malloc(partsize*5);
+	passert(cbuff);
+	for (part=0 ; part<CHUNKPARTS && status==0 ; part++) {
+		partcount = 0;
+		for (pos=part*partsize ; pos<(part+1)*partsize ; pos++) {
+			for (c=chunkhash[pos] ; c ; c=c->next) {
+				partcount++;
+			}
+		}
+		ibuff = malloc(partcount*10+1);
+		vbuff = malloc(partcount*5+1);
+		lbuff = malloc(partcount*5+1);
+		passert(ibuff);
+		passert(vbuff);
+		passert(lbuff);
+		cptr = cbuff;
+		iptr = ibuff;
+		vptr = vbuff;
+		lptr = lbuff;
+		for (pos=part*partsize ; pos<(part+1)*partsize ; pos++) {
+			bcnt = 0;
+			for (c=chunkhash[pos] ; c ; c=c->next) {
+				if (bcnt>=tabsize) {
+					tabsize *= 2;
+					tab = realloc(tab,sizeof(chunk*)*tabsize);
+					passert(tab);
+				}
+				tab[bcnt++] = c;
+			}
+			putvar64bit(&cptr,bcnt);
+			if (bcnt>1) {
+				qsort(tab,bcnt,sizeof(chunk*),chunk_cmp);
+			}
+			previd = 0;
+			for (j=0 ; j<bcnt ; j++) {
+				c = tab[j];
+				putvar64bit(&iptr,(c->chunkid>>16)-previd);
+				previd = c->chunkid>>16;
+				putvar64bit(&vptr,c->version);
+				lockedto = c->lockedto;
+				if (lockedto<now) {
+					lockedto = 0;
+				}
+				putvar64bit(&lptr,lockedto);
+			}
+		}
+		ptr = hdr;
+		put32bit(&ptr,partcount);
+		put32bit(&ptr,cptr-cbuff);
+		put32bit(&ptr,iptr-ibuff);
+		put32bit(&ptr,vptr-vbuff);
+		put32bit(&ptr,lptr-lbuff);
+		if (fwrite(hdr,1,CHUNKPARTHDRSIZE,fd)!=CHUNKPARTHDRSIZE || fwrite(cbuff,1,cptr-cbuff,fd)!=(size_t)(cptr-cbuff) || fwrite(ibuff,1,iptr-ibuff,fd)!=(size_t)(iptr-ibuff) || fwrite(vbuff,1,vptr-vbuff,fd)!=(size_t)(vptr-vbuff) || fwrite(lbuff,1,lptr-lbuff,fd)!=(size_t)(lptr-lbuff)) {
+			status = -1;
+		}
+		free(ibuff);
+		free(vbuff);
+		free(lbuff);
+	}
+	free(cbuff);
+	free(tab);
+	if (status<0) {
+		return -1;
+	}
+	return chunk_xor_store(fd,0x16);
 }
 
 void chunk_term(void) {
@@ -2657,6 +3688,7 @@ void chunk_term(void) {
 	chunk *ch,*chn;
 # endif
 #endif
+	uint32_t gid;
 
 #ifndef METARESTORE
 # ifdef USE_SLIST_BUCKETS
@@ -2682,9 +3714,11 @@ void chunk_term(void) {
 # else
 	for (i=0 ; i<HASHSIZE ; i++) {
 		for (ch = chunkhash[i] ; ch ; ch = ch->next) {
-			for (fl = ch->flisthead ; fl ; fl = fln) {
-				fln = fl->next;
-				free(fl);
+			if (ch->ftype==FREF_LIST) {
+				for (fl = ch->fref.head ; fl ; fl = fln) {
+					fln = fl->next;
+					free(fl);
+				}
 			}
 		}
 	}
@@ -2703,6 +3737,13 @@ void chunk_term(void) {
 		}
 	}
 #endif
+	for (gid=1 ; gid<xorgsize ; gid++) {
+		if (xorgtab[gid]) {
+			free(xorgtab[gid]);
+		}
+	}
+	free(xorgtab);
+	free(xorgfree);
 }
 
 void chunk_newfs(void) {
@@ -2725,6 +3766,17 @@ void chunk_strinit(void) {
 	MaxReadRepl = cfg_getuint32("CHUNKS_READ_REP_LIMIT",5);
 	LoopTime = cfg_getuint32("CHUNKS_LOOP_TIME",300);
 	HashSteps = 1+((HASHSIZE)/LoopTime);
+	XorGoal = cfg_getuint32("CHUNKS_XOR_GOAL",0);
+	if (XorGoal>9) {
+		XorGoal = 0;
+	}
+	XorParts = cfg_getuint32("CHUNKS_XOR_PARTS",3);
+	if (XorParts<2) {
+		XorParts = 2;
+	}
+	if (XorParts>MAXXORPARTS) {
+		XorParts = MAXXORPARTS;
+	}
 //	config_getnewstr("CHUNKS_CONFIG",ETC_PATH "/mfschunks.cfg",&CfgFileName);
 #endif
 	for (i=0 ; i<HASHSIZE ; i++) {
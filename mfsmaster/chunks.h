@@ -21,6 +21,11 @@
 #include <stdio.h>
 #include <inttypes.h>
 
+// max number of data chunks in xor group
+#define MAXXORPARTS 9
+// N*[ chunkid:64 version:32 count:8 count*[ip:32 port:16] ] - all other chunks from xor group
+#define CHUNK_XOR_LOCSIZE (MAXXORPARTS*(13+100*6))
+
 /*
 int chunk_create(uint64_t *chunkid,uint8_t goal);
 int chunk_duplicate(uint64_t *chunkid,uint64_t oldchunkid,uint8_t goal);
@@ -41,6 +46,8 @@ int chunk_multi_truncate(uint32_t ts,uint64_t *nchunkid,uint64_t ochunkid,uint32
 int chunk_unlock(uint64_t chunkid);
 int chunk_increase_version(uint64_t chunkid);
 int chunk_set_version(uint64_t chunkid,uint32_t version);
+int chunk_xor_group(uint64_t parityid,uint8_t cnt,const uint64_t *chunkids);
+int chunk_xor_release(uint64_t parityid);
 
 void chunk_dump(void);
 
@@ -68,11 +75,14 @@ int chunk_repair(uint32_t inode,uint16_t indx,uint64_t ochunkid,uint32_t *nversi
 
 /* ---- */
 int chunk_getversionandlocations(uint64_t chunkid,uint32_t cuip,uint32_t *version,uint8_t *count,uint8_t loc[256*6]);
+int chunk_xor_getlocations(uint64_t chunkid,uint32_t cuip,uint8_t buff[CHUNK_XOR_LOCSIZE],uint32_t *leng);
 /* ---- */
 void chunk_server_has_chunk(void *ptr,uint64_t chunkid,uint32_t version);
 void chunk_damaged(void *ptr,uint64_t chunkid);
 void chunk_lost(void *ptr,uint64_t chunkid);
 void chunk_server_disconnected(void *ptr);
+void chunk_server_detached(void *ptr);
+void chunk_server_changed_chunk(void *ptr,uint64_t chunkid,uint32_t version);
 
 void chunk_got_delete_status(void *ptr,uint64_t chunkid,uint8_t status);
 void chunk_got_replicate_status(void *ptr,uint64_t chunkid,uint32_t version,uint8_t status);
@@ -89,8 +99,9 @@ void chunk_got_duptrunc_status(void *ptr,uint64_t chunkid,uint8_t status);
 /* ---- */
 
 // int chunk_load_1_1(FILE *fd);
+int chunk_load_1_5(FILE *fd);
 int chunk_load(FILE *fd);
-void chunk_store(FILE *fd);
+int chunk_store(FILE *fd,uint8_t fver);
 void chunk_term(void);
 void chunk_newfs(void);
 void chunk_strinit(void);
@@ -19,283 +19,289 @@
 #include "config.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
 #include <stdio.h>
 
-#define DCM_TAB_LENG 500000
-#define DCM_INODEHASH_LENG ((DCM_TAB_LENG)/2)
+#include "main.h"
+#include "massert.h"
 
-#define DCM_INODE_HASH(inode) (((inode)*0x4A4FECD1)%DCM_INODEHASH_LENG)
+// entries not used for this time are forgotten (client has to reread data after next open)
+#define DCM_ENTRY_TIMEOUT 86400
+// whole table is checked for old entries during this time
+#define DCM_CLEAN_LOOP 3600
+#define DCM_MIN_HASHSIZE 65536
 
-#define DCM_NIL 0xFFFFFFFF
+#define DCM_INODE_HASH(inode) (((inode)*0x4A4FECD1)&(dcm_hashsize-1))
 
-typedef struct _datacache_entry {
-	uint32_t inode;
+#define DCM_BUCKET_SIZE 5000
+
+typedef struct _dcm_session {
 	uint32_t sessionid;
-	uint32_t iprev,inext;
-	uint32_t lruprev,lrunext;
-} datacache_entry;
+	uint32_t lastuse;
+	struct _dcm_session *next;
+} dcm_session;
 
-static datacache_entry dcm_tab[DCM_TAB_LENG];
-static uint32_t dcm_inodehash[DCM_INODEHASH_LENG];
-static uint32_t dcm_lru_first,dcm_lru_last;
+typedef struct _dcm_inode {
+	uint32_t inode;
+	dcm_session *sessions;
+	struct _dcm_inode *next;
+} dcm_inode;
 
-// static uint32_t elcount;
+typedef struct _dcm_session_bucket {
+	dcm_session bucket[DCM_BUCKET_SIZE];
+	uint32_t firstfree;
+	struct _dcm_session_bucket *next;
+} dcm_session_bucket;
 
-int dcm_open(uint32_t inode,uint32_t sessionid) {
-	uint32_t ih = DCM_INODE_HASH(inode);
-	uint32_t p,pp,np;
-	p = dcm_inodehash[ih];
-	while (p<DCM_TAB_LENG) {
-		if (dcm_tab[p].inode == inode && dcm_tab[p].sessionid == sessionid) {
-			/* move element to the end of LRU list */
-			if (dcm_lru_last!=p) {	/* do it only if needed */
-				/* remove from LRU chain */
-				pp = dcm_tab[p].lruprev;
-				np = dcm_tab[p].lrunext;
-				if (pp<DCM_TAB_LENG) {
-					dcm_tab[pp].lrunext = np;
-				} else {
-					dcm_lru_first = np;
-				}
-				if (np<DCM_TAB_LENG) {
-					dcm_tab[np].lruprev = pp;
-				} else {
-					dcm_lru_last = pp;
-				}
-				/* add at the end of LRU chain */
-				dcm_tab[p].lruprev = dcm_lru_last;
-				dcm_tab[p].lrunext = DCM_NIL;
-				dcm_tab[dcm_lru_last].lrunext = p;
-				dcm_lru_last = p;
-			}
-			return 1;
-		}
-		p = dcm_tab[p].inext;
-	}
+typedef struct _dcm_inode_bucket {
+	dcm_inode bucket[DCM_BUCKET_SIZE];
+	uint32_t firstfree;
+	struct _dcm_inode_bucket *next;
+} dcm_inode_bucket;
 
-	/* move one element from the beginning to the end */
-	p = dcm_lru_first;
+static dcm_session_bucket *dsbhead = NULL;
+static dcm_session *dsfreehead = NULL;
+static dcm_inode_bucket *dibhead = NULL;
+static dcm_inode *difreehead = NULL;
 
-	/* remove from LRU chain */
-	pp = dcm_tab[p].lruprev;
-	np = dcm_tab[p].lrunext;
-	if (pp<DCM_TAB_LENG) {
-		dcm_tab[pp].lrunext = np;
-	} else {
-		dcm_lru_first = np;
-	}
-	if (np<DCM_TAB_LENG) {
-		dcm_tab[np].lruprev = pp;
-	} else {
-		dcm_lru_last = pp;
+static dcm_inode **dcm_hash;
+static uint32_t dcm_hashsize;
+static uint32_t dcm_inodes;
+static uint32_t dcm_entries;
+static uint32_t dcm_cleanpos;
+
+static uint32_t dcm_stats_hits;
+static uint32_t dcm_stats_misses;
+static uint32_t dcm_stats_invalidated;
+static uint32_t dcm_stats_expired;
+
+static inline dcm_session* dcm_session_malloc(void) {
+	dcm_session_bucket *sb;
+	dcm_session *ret;
+	if (dsfreehead) {
+		ret = dsfreehead;
+		dsfreehead = ret->next;
+		return ret;
 	}
-	/* add at the end of LRU chain */
-	dcm_tab[p].lruprev = dcm_lru_last;
-	dcm_tab[p].lrunext = DCM_NIL;
-	dcm_tab[dcm_lru_last].lrunext = p;
-	dcm_lru_last = p;
-
-	/* then replace this element using current values */
-	if (dcm_tab[p].inode>0) {	/* if element is not empty then remove it first */
-		/* remove from old INODE chain */
-		ih = DCM_INODE_HASH(dcm_tab[p].inode);
-		pp = dcm_tab[p].iprev;
-		np = dcm_tab[p].inext;
-		if (pp<DCM_TAB_LENG) {
-			dcm_tab[pp].inext = np;
-		} else {
-			dcm_inodehash[ih] = np;
-		}
-		if (np<DCM_TAB_LENG) {
-			dcm_tab[np].iprev = pp;
-		}
-//	} else {
-//		elcount++;
+	if (dsbhead==NULL || dsbhead->firstfree==DCM_BUCKET_SIZE) {
+		sb = (dcm_session_bucket*)malloc(sizeof(dcm_session_bucket));
+		passert(sb);
+		sb->next = dsbhead;
+		sb->firstfree = 0;
+		dsbhead = sb;
 	}
+	ret = (dsbhead->bucket)+(dsbhead->firstfree);
+	dsbhead->firstfree++;
+	return ret;
+}
+
+static inline void dcm_session_free(dcm_session *p) {
+	p->next = dsfreehead;
+	dsfreehead = p;
+}
 
-	/* replace values and add to new INODE chain */
-	dcm_tab[p].inode = inode;
-	dcm_tab[p].sessionid = sessionid;
-	ih = DCM_INODE_HASH(inode);
-	np = dcm_inodehash[ih];
-	dcm_tab[p].inext = np;
-	dcm_tab[p].iprev = DCM_NIL;
-	dcm_inodehash[ih] = p;
-	if (np<DCM_TAB_LENG) {
-		dcm_tab[np].iprev = p;
+static inline dcm_inode* dcm_inode_malloc(void) {
+	dcm_inode_bucket *ib;
+	dcm_inode *ret;
+	if (difreehead) {
+		ret = difreehead;
+		difreehead = ret->next;
+		return ret;
 	}
-	return 0;
+	if (dibhead==NULL || dibhead->firstfree==DCM_BUCKET_SIZE) {
+		ib = (dcm_inode_bucket*)malloc(sizeof(dcm_inode_bucket));
+		passert(ib);
+		ib->next = dibhead;
+		ib->firstfree = 0;
+		dibhead = ib;
+	}
+	ret = (dibhead->bucket)+(dibhead->firstfree);
+	dibhead->firstfree++;
+	return ret;
 }
 
-void dcm_modify(uint32_t inode,uint32_t sessionid) {
-	uint32_t ih = DCM_INODE_HASH(inode);
-	uint32_t p,pp,np;
-	p = dcm_inodehash[ih];
-	while (p<DCM_TAB_LENG) {
-		if (dcm_tab[p].inode == inode && dcm_tab[p].sessionid != sessionid) {
-			/* move to the beginning of LRU chain */
-			if (p!=dcm_lru_first) {
-				/* remove from LRU chain */
-				pp = dcm_tab[p].lruprev;
-				np = dcm_tab[p].lrunext;
-				if (pp<DCM_TAB_LENG) {
-					dcm_tab[pp].lrunext = np;
-				} else {
-					dcm_lru_first = np;
-				}
-				if (np<DCM_TAB_LENG) {
-					dcm_tab[np].lruprev = pp;
-				} else {
-					dcm_lru_last = pp;
-				}
-				/* add at the beginning of LRU chain */
-				dcm_tab[p].lruprev = DCM_NIL;
-				dcm_tab[p].lrunext = dcm_lru_first;
-				dcm_tab[dcm_lru_first].lruprev = p;
-				dcm_lru_first = p;
-			}
-			/* remove from INODE chain */
-			pp = dcm_tab[p].iprev;
-			np = dcm_tab[p].inext;
-			if (pp<DCM_TAB_LENG) {
-				dcm_tab[pp].inext = np;
-			} else {
-				dcm_inodehash[ih] = np;
-			}
-			if (np<DCM_TAB_LENG) {
-				dcm_tab[np].iprev = pp;
-			}
-			/* mark as 'empty' */
-			dcm_tab[p].inode = 0;
-			dcm_tab[p].inext = DCM_NIL;
-			dcm_tab[p].iprev = DCM_NIL;
-//			elcount--;
-			/* p = INODE_NEXT(p) */
-			p = np;
-		} else {
-			p = dcm_tab[p].inext;
+static inline void dcm_inode_free(dcm_inode *p) {
+	p->next = difreehead;
+	difreehead = p;
+}
+
+// called when there are two inode records per hash position - table size is doubled
+static void dcm_hash_grow(void) {
+	dcm_inode **newhash;
+	dcm_inode *di,*din;
+	uint32_t i,oldsize,hpos;
+
+	oldsize = dcm_hashsize;
+	newhash = (dcm_inode**)malloc(sizeof(dcm_inode*)*oldsize*2);
+	if (newhash==NULL) {	// not fatal - just use longer chains
+		return;
+	}
+	dcm_hashsize = oldsize*2;
+	for (i=0 ; i<dcm_hashsize ; i++) {
+		newhash[i] = NULL;
+	}
+	for (i=0 ; i<oldsize ; i++) {
+		for (di=dcm_hash[i] ; di ; di=din) {
+			din = di->next;
+			hpos = DCM_INODE_HASH(di->inode);
+			di->next = newhash[hpos];
+			newhash[hpos] = di;
 		}
 	}
+	free(dcm_hash);
+	dcm_hash = newhash;
+	dcm_cleanpos = 0;
 }
 
-int dcm_init(void) {
-	uint32_t i;
+int dcm_open(uint32_t inode,uint32_t sessionid) {
+	uint32_t hpos = DCM_INODE_HASH(inode);
+	dcm_inode *di;
+	dcm_session *ds;
 
-	for (i=0 ; i<DCM_INODEHASH_LENG ; i++) {
-		dcm_inodehash[i]=DCM_NIL;
+	for (di=dcm_hash[hpos] ; di && di->inode!=inode ; di=di->next) {}
+	if (di==NULL) {
+		di = dcm_inode_malloc();
+		di->inode = inode;
+		di->sessions = NULL;
+		di->next = dcm_hash[hpos];
+		dcm_hash[hpos] = di;
+		dcm_inodes++;
+	} else {
+		for (ds=di->sessions ; ds ; ds=ds->next) {
+			if (ds->sessionid==sessionid) {
+				ds->lastuse = main_time();
+				dcm_stats_hits++;
+				return 1;
+			}
+		}
 	}
-	for (i=0 ; i<DCM_TAB_LENG ; i++) {
-		dcm_tab[i].inode=0;
-		dcm_tab[i].sessionid=0;
-		dcm_tab[i].iprev = DCM_NIL;
-		dcm_tab[i].inext = DCM_NIL;
-		dcm_tab[i].lruprev = i-1;
-		dcm_tab[i].lrunext = i+1;
+	ds = dcm_session_malloc();
+	ds->sessionid = sessionid;
+	ds->lastuse = main_time();
+	ds->next = di->sessions;
+	di->sessions = ds;
+	dcm_entries++;
+	dcm_stats_misses++;
+	if (dcm_inodes>dcm_hashsize*2) {
+		dcm_hash_grow();
 	}
-	dcm_tab[0].lruprev = DCM_NIL;
-	dcm_lru_first = 0;
-	dcm_tab[DCM_TAB_LENG-1].lrunext = DCM_NIL;
-	dcm_lru_last = DCM_TAB_LENG-1;
-//	elcount = 0;
 	return 0;
 }
 
-/*
- * consistency tests
- *
-int dcm_test(void) {
-	uint32_t i,p,j;
-	for (i=0 ; i<DCM_INODEHASH_LENG ; i++) {
-		p = dcm_inodehash[i];
-		if (p<DCM_TAB_LENG) {
-			if (dcm_tab[p].iprev!=DCM_NIL) {
-				return 1;
-			}
+// all other sessions lose right to use cached data - drop them at once (together with inode record if nothing left)
+void dcm_modify(uint32_t inode,uint32_t sessionid) {
+	uint32_t hpos = DCM_INODE_HASH(inode);
+	dcm_inode *di,**dip;
+	dcm_session *ds,*dsn,*keep;
+
+	dip = dcm_hash+hpos;
+	while ((di=*dip) && di->inode!=inode) {
+		dip = &(di->next);
+	}
+	if (di==NULL) {
+		return;
+	}
+	keep = NULL;
+	for (ds=di->sessions ; ds ; ds=dsn) {
+		dsn = ds->next;
+		if (ds->sessionid==sessionid) {
+			keep = ds;
 		} else {
-			if (p!=DCM_NIL) {
-				return 2;
-			}
+			dcm_session_free(ds);
+			dcm_entries--;
+			dcm_stats_invalidated++;
 		}
 	}
-	if (dcm_lru_first<DCM_TAB_LENG) {
-		if (dcm_tab[dcm_lru_first].lruprev!=DCM_NIL) {
-			return 3;
-		}
+	if (keep) {
+		keep->next = NULL;
+		di->sessions = keep;
 	} else {
-		if (dcm_lru_first!=DCM_NIL) {
-			return 4;
-		}
+		*dip = di->next;
+		dcm_inode_free(di);
+		dcm_inodes--;
 	}
-	if (dcm_lru_last<DCM_TAB_LENG) {
-		if (dcm_tab[dcm_lru_last].lrunext!=DCM_NIL) {
-			return 5;
-		}
-	} else {
-		if (dcm_lru_last!=DCM_NIL) {
-			return 6;
-		}
+}
+
+// forget entries not used for a long time (only to limit memory usage)
+void dcm_cleanup(void) {
+	uint32_t i,steps,mintime;
+	dcm_inode *di,**dip;
+	dcm_session *ds,**dsp;
+
+	mintime = main_time();
+	if (mintime<DCM_ENTRY_TIMEOUT) {
+		return;
 	}
-	for (i=0 ; i<DCM_TAB_LENG ; i++) {
-		p = dcm_tab[i].iprev;
-		if (p<DCM_TAB_LENG) {
-			if (dcm_tab[p].inext!=i) {
-				return 7;
-			}
-		} else if (p!=DCM_NIL) {
-			return 8;
+	mintime -= DCM_ENTRY_TIMEOUT;
+	steps = 1+(dcm_hashsize/DCM_CLEAN_LOOP);
+	for (i=0 ; i<steps ; i++) {
+		if (dcm_cleanpos>=dcm_hashsize) {
+			dcm_cleanpos = 0;
 		}
-		p = dcm_tab[i].inext;
-		if (p<DCM_TAB_LENG) {
-			if (dcm_tab[p].iprev!=i) {
-				return 9;
-			}
-		} else if (p!=DCM_NIL) {
-			return 10;
-		}
-		p = dcm_tab[i].lruprev;
-		if (p<DCM_TAB_LENG) {
-			if (dcm_tab[p].lrunext!=i) {
-				return 11;
+		dip = dcm_hash+dcm_cleanpos;
+		while ((di=*dip)) {
+			dsp = &(di->sessions);
+			while ((ds=*dsp)) {
+				if (ds->lastuse<mintime) {
+					*dsp = ds->next;
+					dcm_session_free(ds);
+					dcm_entries--;
+					dcm_stats_expired++;
+				} else {
+					dsp = &(ds->next);
+				}
 			}
-		} else if (p!=DCM_NIL) {
-			return 12;
-		}
-		p = dcm_tab[i].lrunext;
-		if (p<DCM_TAB_LENG) {
-			if (dcm_tab[p].lruprev!=i) {
-				return 13;
+			if (di->sessions==NULL) {
+				*dip = di->next;
+				dcm_inode_free(di);
+				dcm_inodes--;
+			} else {
+				dip = &(di->next);
 			}
-		} else if (p!=DCM_NIL) {
-			return 14;
 		}
+		dcm_cleanpos++;
 	}
-	p=0;
-	for (i=dcm_lru_first ; i<DCM_TAB_LENG ; i=dcm_tab[i].lrunext) {
-		p++;
-	}
-	if (p!=DCM_TAB_LENG) {
-		return 15;
-	}
-	p=0;
-	for (i=dcm_lru_last ; i<DCM_TAB_LENG ; i=dcm_tab[i].lruprev) {
-		p++;
-	}
-	if (p!=DCM_TAB_LENG) {
-		return 16;
-	}
-	p=0;
-	for (j=0 ; j<DCM_INODEHASH_LENG ; j++) {
-		for (i=dcm_inodehash[j] ; i<DCM_TAB_LENG ; i=dcm_tab[i].inext) {
-			p++;
-		}
+}
+
+void dcm_info(uint32_t *entries,uint32_t *hits,uint32_t *misses,uint32_t *invalidated,uint32_t *expired) {
+	*entries = dcm_entries;
+	*hits = dcm_stats_hits;
+	*misses = dcm_stats_misses;
+	*invalidated = dcm_stats_invalidated;
+	*expired = dcm_stats_expired;
+}
+
+void dcm_term(void) {
+	dcm_session_bucket *sb,*sbn;
+	dcm_inode_bucket *ib,*ibn;
+	for (sb=dsbhead ; sb ; sb=sbn) {
+		sbn = sb->next;
+		free(sb);
 	}
-	if (p!=elcount) {
-		return 17;
+	for (ib=dibhead ; ib ; ib=ibn) {
+		ibn = ib->next;
+		free(ib);
 	}
-	return 0;
+	free(dcm_hash);
 }
 
-uint32_t dcm_getelcount(void) {
-	return elcount;
+int dcm_init(void) {
+	uint32_t i;
+
+	dcm_hashsize = DCM_MIN_HASHSIZE;
+	dcm_hash = (dcm_inode**)malloc(sizeof(dcm_inode*)*dcm_hashsize);
+	passert(dcm_hash);
+	for (i=0 ; i<dcm_hashsize ; i++) {
+		dcm_hash[i] = NULL;
+	}
+	dcm_inodes = 0;
+	dcm_entries = 0;
+	dcm_cleanpos = 0;
+	dcm_stats_hits = 0;
+	dcm_stats_misses = 0;
+	dcm_stats_invalidated = 0;
+	dcm_stats_expired = 0;
+	main_destructregister(dcm_term);
+	main_timeregister(TIMEMODE_RUN_LATE,1,0,dcm_cleanup);
+	return 0;
 }
-*/
@@ -22,7 +22,8 @@
 #include <inttypes.h>
 
 int dcm_open(uint32_t inode,uint32_t sessionid);
-int dcm_modify(uint32_t inode,uint32_t sessionid);
+void dcm_modify(uint32_t inode,uint32_t sessionid);
+void dcm_info(uint32_t *entries,uint32_t *hits,uint32_t *misses,uint32_t *invalidated,uint32_t *expired);
 int dcm_init(void);
 
 #endif
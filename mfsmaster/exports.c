@@ -127,17 +127,309 @@ void exports_info_data(uint8_t *buff) {
 	}
 }
 
+// exports are indexed twice (both indexes keep records in file order):
+// - ip index: sorted, disjoint ip segments - each segment has list of all records which ip range covers it
+// - path index: hash of export paths - to find candidates all prefixes of requested path are looked up
+// exports_check uses smaller candidate list and checks all other conditions as before
+
+typedef struct _ipsegment {
+	uint32_t fromip;
+	uint32_t rulescnt;
+	uint32_t *rules;
+} ipsegment;
+
+typedef struct _pathentry {
+	const uint8_t *path;
+	uint32_t pleng;
+	uint32_t rulescnt;
+	uint32_t *rules;
+	struct _pathentry *next;
+} pathentry;
+
+static exports **exports_table;
+static uint32_t exports_count;
+static ipsegment *ipsegments;
+static uint32_t ipsegmentscnt;
+static uint32_t *iprules;
+static pathentry **pathhash;
+static uint32_t pathhashsize;
+static uint32_t *pathrules;
+static uint32_t *candidates;
+
+static inline uint32_t exports_pathhash(const uint8_t *path,uint32_t pleng) {
+	uint32_t hash = 5381;
+	while (pleng>0) {
+		hash = hash*33+(*path);
+		path++;
+		pleng--;
+	}
+	return hash;
+}
+
+static void exports_freeindex(void) {
+	uint32_t i;
+	pathentry *pe,*pen;
+	if (exports_table) {
+		free(exports_table);
+	}
+	if (ipsegments) {
+		free(ipsegments);
+	}
+	if (iprules) {
+		free(iprules);
+	}
+	if (pathhash) {
+		for (i=0 ; i<pathhashsize ; i++) {
+			for (pe=pathhash[i] ; pe ; pe=pen) {
+				pen = pe->next;
+				free(pe);
+			}
+		}
+		free(pathhash);
+	}
+	if (pathrules) {
+		free(pathrules);
+	}
+	if (candidates) {
+		free(candidates);
+	}
+	exports_table = NULL;
+	exports_count = 0;
+	ipsegments = NULL;
+	ipsegmentscnt = 0;
+	iprules = NULL;
+	pathhash = NULL;
+	pathhashsize = 0;
+	pathrules = NULL;
+	candidates = NULL;
+}
+
+static int exports_ipcmp(const void *a,const void *b) {
+	uint32_t aa = *((const uint32_t*)a);
+	uint32_t bb = *((const uint32_t*)b);
+	return (aa<bb)?-1:(aa>bb)?1:0;
+}
+
+// returns segment containing given ip
+static inline uint32_t exports_findsegment(uint32_t ip) {
+	uint32_t l,r,m;
+	l = 0;
+	r = ipsegmentscnt;
+	while (r-l>1) {
+		m = (l+r)/2;
+		if (ipsegments[m].fromip<=ip) {
+			l = m;
+		} else {
+			r = m;
+		}
+	}
+	return l;
+}
+
+static pathentry* exports_findpath(const uint8_t *path,uint32_t pleng) {
+	pathentry *pe;
+	for (pe=pathhash[exports_pathhash(path,pleng)&(pathhashsize-1)] ; pe ; pe=pe->next) {
+		if (pe->pleng==pleng && (pleng==0 || memcmp(pe->path,path,pleng)==0)) {
+			return pe;
+		}
+	}
+	return NULL;
+}
+
+static void exports_buildindex(void) {
+	exports *e;
+	pathentry *pe;
+	uint32_t *bounds;
+	uint32_t i,j,s,n,total;
+
+	exports_freeindex();
+	for (e=exports_records ; e ; e=e->next) {
+		exports_count++;
+	}
+	if (exports_count==0) {
+		return;
+	}
+	exports_table = malloc(sizeof(exports*)*exports_count);
+	passert(exports_table);
+	candidates = malloc(sizeof(uint32_t)*exports_count);
+	passert(candidates);
+	for (i=0,e=exports_records ; e ; i++,e=e->next) {
+		exports_table[i] = e;
+	}
+
+// ip index
+	bounds = malloc(sizeof(uint32_t)*(exports_count*2+1));
+	passert(bounds);
+	n = 0;
+	bounds[n++] = 0;
+	for (i=0 ; i<exports_count ; i++) {
+		bounds[n++] = exports_table[i]->fromip;
+		if (exports_table[i]->toip<0xFFFFFFFF) {
+			bounds[n++] = exports_table[i]->toip+1;
+		}
+	}
+	qsort(bounds,n,sizeof(uint32_t),exports_ipcmp);
+	ipsegments = malloc(sizeof(ipsegment)*n);
+	passert(ipsegments);
+	ipsegmentscnt = 0;
+	for (i=0 ; i<n ; i++) {
+		if (i==0 || bounds[i]!=bounds[i-1]) {
+			ipsegments[ipsegmentscnt].fromip = bounds[i];
+			ipsegments[ipsegmentscnt].rulescnt = 0;
+			ipsegmentscnt++;
+		}
+	}
+	free(bounds);
+	total = 0;
+	for (i=0 ; i<exports_count ; i++) {
+		e = exports_table[i];
+		for (s=exports_findsegment(e->fromip) ; s<ipsegmentscnt && ipsegments[s].fromip<=e->toip ; s++) {
+			ipsegments[s].rulescnt++;
+			total++;
+		}
+	}
+	iprules = malloc(sizeof(uint32_t)*(total+1));
+	passert(iprules);
+	total = 0;
+	for (s=0 ; s<ipsegmentscnt ; s++) {
+		ipsegments[s].rules = iprules+total;
+		total += ipsegments[s].rulescnt;
+		ipsegments[s].rulescnt = 0;
+	}
+	for (i=0 ; i<exports_count ; i++) {
+		e = exports_table[i];
+		for (s=exports_findsegment(e->fromip) ; s<ipsegmentscnt && ipsegments[s].fromip<=e->toip ; s++) {
+			ipsegments[s].rules[ipsegments[s].rulescnt++] = i;
+		}
+	}
+
+// path index (meta exports are kept under special empty entry with NULL path)
+	pathhashsize = 256;
+	while (pathhashsize<exports_count*2) {
+		pathhashsize<<=1;
+	}
+	pathhash = malloc(sizeof(pathentry*)*pathhashsize);
+	passert(pathhash);
+	for (i=0 ; i<pathhashsize ; i++) {
+		pathhash[i] = NULL;
+	}
+	for (i=0 ; i<exports_count ; i++) {
+		e = exports_table[i];
+		if (e->meta) {
+			continue;
+		}
+		pe = exports_findpath(e->path,e->pleng);
+		if (pe==NULL) {
+			pe = malloc(sizeof(pathentry));
+			passert(pe);
+			pe->path = e->path;
+			pe->pleng = e->pleng;
+			pe->rulescnt = 0;
+			j = exports_pathhash(e->path,e->pleng)&(pathhashsize-1);
+			pe->next = pathhash[j];
+			pathhash[j] = pe;
+		}
+		pe->rulescnt++;
+	}
+	pathrules = malloc(sizeof(uint32_t)*(exports_count+1));
+	passert(pathrules);
+	total = 0;
+	for (j=0 ; j<pathhashsize ; j++) {
+		for (pe=pathhash[j] ; pe ; pe=pe->next) {
+			pe->rules = pathrules+total;
+			total += pe->rulescnt;
+			pe->rulescnt = 0;
+		}
+	}
+	for (i=0 ; i<exports_count ; i++) {
+		e = exports_table[i];
+		if (e->meta==0) {
+			pe = exports_findpath(e->path,e->pleng);
+			pe->rules[pe->rulescnt++] = i;
+		}
+	}
+}
+
+static inline int exports_match(exports *e,uint32_t ip,uint32_t version,uint8_t meta,const uint8_t *p,uint32_t pleng) {
+	if (ip<e->fromip || ip>e->toip || version<e->minversion || meta!=e->meta) {
+		return 0;
+	}
+	if (meta) {	// no path in META
+		return 1;
+	}
+	if (e->pleng==0) {	// root dir
+		if (pleng==0 || e->alldirs) {
+			return 1;
+		}
+	} else {
+		if (pleng==e->pleng && memcmp(p,e->path,pleng)==0) {
+			return 1;
+		} else if (e->alldirs && pleng>e->pleng && p[e->pleng]=='/' && memcmp(p,e->path,e->pleng)==0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int exports_rulecmp(const void *a,const void *b) {
+	uint32_t aa = *((const uint32_t*)a);
+	uint32_t bb = *((const uint32_t*)b);
+	return (aa<bb)?-1:(aa>bb)?1:0;
+}
+
+// collects records with path equal to requested path or to one of its prefixes (sorted in file order)
+static uint32_t exports_pathcandidates(const uint8_t *p,uint32_t pleng) {
+	pathentry *pe;
+	uint32_t l,cnt;
+	cnt = 0;
+	for (l=0 ; l<=pleng ; l++) {
+		if (l==0 || l==pleng || p[l]=='/') {
+			pe = exports_findpath(p,l);
+			if (pe) {
+				memcpy(candidates+cnt,pe->rules,sizeof(uint32_t)*pe->rulescnt);
+				cnt += pe->rulescnt;
+			}
+		}
+	}
+	if (cnt>1) {
+		qsort(candidates,cnt,sizeof(uint32_t),exports_rulecmp);
+	}
+	return cnt;
+}
+
+static uint32_t exports_pathcandidatescount(const uint8_t *p,uint32_t pleng) {
+	pathentry *pe;
+	uint32_t l,cnt;
+	cnt = 0;
+	for (l=0 ; l<=pleng ; l++) {
+		if (l==0 || l==pleng || p[l]=='/') {
+			pe = exports_findpath(p,l);
+			if (pe) {
+				cnt += pe->rulescnt;
+			}
+		}
+	}
+	return cnt;
+}
+
 uint8_t exports_check(uint32_t ip,uint32_t version,uint8_t meta,const uint8_t *path,const uint8_t rndcode[32],const uint8_t passcode[16],uint8_t *sesflags,uint32_t *rootuid,uint32_t *rootgid,uint32_t *mapalluid,uint32_t *mapallgid) {
 	const uint8_t *p;
-	uint32_t pleng,i;
+	uint32_t pleng,i,rcnt;
+	const uint32_t *rules;
 	uint8_t rndstate;
 	int ok,nopass;
 	md5ctx md5c;
 	uint8_t entrydigest[16];
+	const uint8_t *lastdigest;
+	int lastdigestok;
 	exports *e,*f;
+	ipsegment *seg;
 
 //	syslog(LOG_NOTICE,"check exports for: %u.%u.%u.%u:%s",(ip>>24)&0xFF,(ip>>16)&0xFF,(ip>>8)&0xFF,ip&0xFF,path);
 
+	if (exports_count==0) {
+		return ERROR_EACCES;
+	}
 	if (meta==0) {
 		p = path;
 		while (*p=='/') {
@@ -160,50 +452,39 @@ uint8_t exports_check(uint32_t ip,uint32_t version,uint8_t meta,const uint8_t *p
 			rndstate|=rndcode[i];
 		}
 	}
+	seg = ipsegments + exports_findsegment(ip);
+	if (meta==0 && exports_pathcandidatescount(p,pleng)<seg->rulescnt) {
+		rcnt = exports_pathcandidates(p,pleng);
+		rules = candidates;
+	} else {
+		rcnt = seg->rulescnt;
+		rules = seg->rules;
+	}
 	nopass=0;
 	f=NULL;
-	for (e=exports_records ; e ; e=e->next) {
-		ok = 0;
-//		syslog(LOG_NOTICE,"entry: network:%u.%u.%u.%u-%u.%u.%u.%u",(e->fromip>>24)&0xFF,(e->fromip>>16)&0xFF,(e->fromip>>8)&0xFF,e->fromip&0xFF,(e->toip>>24)&0xFF,(e->toip>>16)&0xFF,(e->toip>>8)&0xFF,e->toip&0xFF);
-		if (ip>=e->fromip && ip<=e->toip && version>=e->minversion && meta==e->meta) {
-//			syslog(LOG_NOTICE,"ip and version ok");
-			// path check
-			if (meta) {	// no path in META
-				ok=1;
+	lastdigest=NULL;
+	lastdigestok=0;
+	for (i=0 ; i<rcnt ; i++) {
+		e = exports_table[rules[i]];
+		ok = exports_match(e,ip,version,meta,p,pleng);
+		if (ok && e->needpassword) {
+			if (rndstate==0 || rndcode==NULL || passcode==NULL) {
+				ok=0;
+				nopass=1;
 			} else {
-				if (e->pleng==0) {	// root dir
-//					syslog(LOG_NOTICE,"rootdir entry (pleng:%u)",pleng);
-					if (pleng==0) {
-						ok=1;
-					} else if (e->alldirs) {
-						ok=1;
-					}
-				} else {
-//					syslog(LOG_NOTICE,"entry path: %s (pleng:%u)",e->path,e->pleng);
-					if (pleng==e->pleng && memcmp(p,e->path,pleng)==0) {
-						ok=1;
-					} else if (e->alldirs && pleng>e->pleng && p[e->pleng]=='/' && memcmp(p,e->path,e->pleng)==0) {
-						ok=1;
-					}
-				}
-			}
-//			if (ok) {
-//				syslog(LOG_NOTICE,"path ok");
-//			}
-			if (ok && e->needpassword) {
-				if (rndstate==0 || rndcode==NULL || passcode==NULL) {
-					ok=0;
-					nopass=1;
-				} else {
+				// records usually share passwords - do not calculate the same digest again
+				if (lastdigest==NULL || memcmp(lastdigest,e->passworddigest,16)!=0) {
 					md5_init(&md5c);
 					md5_update(&md5c,rndcode,16);
 					md5_update(&md5c,e->passworddigest,16);
 					md5_update(&md5c,rndcode+16,16);
 					md5_final(entrydigest,&md5c);
-					if (memcmp(entrydigest,passcode,16)!=0) {
-						ok=0;
-						nopass=1;
-					}
+					lastdigest = e->passworddigest;
+					lastdigestok = (memcmp(entrydigest,passcode,16)==0)?1:0;
+				}
+				if (lastdigestok==0) {
+					ok=0;
+					nopass=1;
 				}
 			}
 		}
@@ -819,6 +1100,7 @@ void exports_loadexports(void) {
 	fclose(fd);
 	exports_freelist(exports_records);
 	exports_records = newexports;
+	exports_buildindex();
 	mfs_syslog(LOG_NOTICE,"exports file has been loaded");
 }
 
@@ -827,6 +1109,7 @@ void exports_reloadexports(void) {
 }
 
 void exports_term(void) {
+	exports_freeindex();
 	exports_freelist(exports_records);
 	free(ExportsFileName);
 }
@@ -834,6 +1117,12 @@ void exports_term(void) {
 int exports_init(void) {
 	ExportsFileName = cfg_getstr("EXPORTS_FILENAME",ETC_PATH "/mfsexports.cfg");
 	exports_records = NULL;
+	exports_table = NULL;
+	ipsegments = NULL;
+	iprules = NULL;
+	pathhash = NULL;
+	pathrules = NULL;
+	candidates = NULL;
 	exports_loadexports();
 	if (exports_records==NULL) {
 		fprintf(stderr,"no exports defined !!!\n");
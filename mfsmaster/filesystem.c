@@ -43,6 +43,7 @@
 #include "datapack.h"
 #include "slogger.h"
 #include "massert.h"
+#include "zfile.h"
 
 #ifndef METARESTORE
 #include "datacachemgr.h"
@@ -92,7 +93,10 @@ typedef struct _bstnode {
 
 typedef struct _sessionidrec {
 	uint32_t sessionid;
-	struct _sessionidrec *next;
+	uint32_t inode;
+	struct _sessionidrec *next;		// next session in node list
+	struct _sessionidrec **prev;		// pointer to this record in node list
+	struct _sessionidrec *hashnext;		// (inode,sessionid) hash chain
 } sessionidrec;
 
 struct _fsnode;
@@ -134,9 +138,13 @@ typedef struct _quotanode {
 
 static quotanode *quotahead;
 static uint32_t QuotaTimeLimit;
+static uint32_t MetadataCompression;
 
 #endif
 
+// metadata file format: 0x16 - "MFSM 1.6" (columnar chunk section), 0x15 - "MFSM 1.5" (readable by older versions)
+static uint8_t MetadataFormat = 0x16;
+
 typedef struct _fsnode {
 	uint32_t id;
 	uint32_t ctime,mtime,atime;
@@ -378,6 +386,88 @@ static inline void sessionidrec_free(sessionidrec* p) {
 
 #endif /* USE_CUIDREC_BUCKETS */
 
+// global (inode,sessionid) hash - files can be opened by thousands of sessions, so node lists are not scanned
+#define SIDHASH_MIN_SIZE 65536
+#define SIDHASH_POS(inode,sessionid) ((((inode)*0x4A4FECD1)^((sessionid)*0x9E3779B1))&(sidhashsize-1))
+
+static sessionidrec **sidhash = NULL;
+static uint32_t sidhashsize = 0;
+static uint32_t sidhashelements = 0;
+
+static inline void sessionidrec_hash_grow(void) {
+	sessionidrec **newhash,*cr,*crn;
+	uint32_t i,oldsize,pos;
+
+	oldsize = sidhashsize;
+	newhash = (sessionidrec**)malloc(sizeof(sessionidrec*)*((oldsize)?(oldsize*2):SIDHASH_MIN_SIZE));
+	passert(newhash);
+	sidhashsize = (oldsize)?(oldsize*2):SIDHASH_MIN_SIZE;
+	for (i=0 ; i<sidhashsize ; i++) {
+		newhash[i] = NULL;
+	}
+	for (i=0 ; i<oldsize ; i++) {
+		for (cr=sidhash[i] ; cr ; cr=crn) {
+			crn = cr->hashnext;
+			pos = SIDHASH_POS(cr->inode,cr->sessionid);
+			cr->hashnext = newhash[pos];
+			newhash[pos] = cr;
+		}
+	}
+	if (sidhash) {
+		free(sidhash);
+	}
+	sidhash = newhash;
+}
+
+static inline sessionidrec* sessionidrec_find(uint32_t inode,uint32_t sessionid) {
+	sessionidrec *cr;
+	if (sidhashsize==0) {
+		return NULL;
+	}
+	for (cr=sidhash[SIDHASH_POS(inode,sessionid)] ; cr ; cr=cr->hashnext) {
+		if (cr->inode==inode && cr->sessionid==sessionid) {
+			return cr;
+		}
+	}
+	return NULL;
+}
+
+static inline void sessionidrec_add(sessionidrec **head,uint32_t inode,uint32_t sessionid) {
+	sessionidrec *cr;
+	uint32_t pos;
+	if (sidhashelements>=sidhashsize) {
+		sessionidrec_hash_grow();
+	}
+	cr = sessionidrec_malloc();
+	cr->sessionid = sessionid;
+	cr->inode = inode;
+	cr->next = *head;
+	if (cr->next) {
+		cr->next->prev = &(cr->next);
+	}
+	cr->prev = head;
+	*head = cr;
+	pos = SIDHASH_POS(inode,sessionid);
+	cr->hashnext = sidhash[pos];
+	sidhash[pos] = cr;
+	sidhashelements++;
+}
+
+static inline void sessionidrec_remove(sessionidrec *cr) {
+	sessionidrec **crp;
+	*(cr->prev) = cr->next;
+	if (cr->next) {
+		cr->next->prev = cr->prev;
+	}
+	crp = sidhash+SIDHASH_POS(cr->inode,cr->sessionid);
+	while (*crp!=cr) {
+		crp = &((*crp)->hashnext);
+	}
+	*crp = cr->hashnext;
+	sidhashelements--;
+	sessionidrec_free(cr);
+}
+
 uint32_t fsnodes_get_next_id() {
 	uint32_t i,mask;
 	while (searchpos<bitmasksize && freebitmask[searchpos]==0xFFFFFFFF) {
@@ -1170,8 +1260,6 @@ static inline void fsnodes_getpath(fsedge *e,uint16_t *pleng,uint8_t **path) {
 }
 
 
-#ifndef METARESTORE
-
 static inline void fsnodes_fill_attr(fsnode *node,fsnode *parent,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,uint8_t attr[35]) {
 	uint8_t *ptr;
 	uint16_t mode;
@@ -1238,7 +1326,11 @@ static inline void fsnodes_fill_attr(fsnode *node,fsnode *parent,uint32_t uid,ui
 		break;
 	case TYPE_DIRECTORY:
 		put32bit(&ptr,node->data.ddata.nlink);
+#ifndef METARESTORE
 		put64bit(&ptr,node->data.ddata.stats->length>>30); // Rescale length to GB because Linux can't bear too long directories :) - It's so funny why Linux is so popular.
+#else
+		put64bit(&ptr,0);	// directory statistics are not kept by metalogger
+#endif
 		break;
 	case TYPE_SYMLINK:
 		put32bit(&ptr,nlink);
@@ -1410,9 +1502,8 @@ static inline uint32_t fsnodes_getdirsize(fsnode *p,uint8_t withattr) {
 	return result;
 }
 
-static inline void fsnodes_getdirdata(uint32_t ts,uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
+static inline void fsnodes_getdirdata(uint32_t rootinode,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t sesflags,fsnode *p,uint8_t *dbuff,uint8_t withattr) {
 	fsedge *e;
-	p->atime = ts;
 // '.' - self
 	dbuff[0]=1;
 	dbuff[1]='.';
@@ -1483,6 +1574,7 @@ static inline void fsnodes_getdirdata(uint32_t ts,uint32_t rootinode,uint32_t ui
 	}
 }
 
+#ifndef METARESTORE
 static inline void fsnodes_checkfile(fsnode *p,uint16_t chunkcount[256]) {
 	uint32_t i;
 	uint64_t chunkid;
@@ -2461,7 +2553,6 @@ static inline int fsnodes_namecheck(uint32_t nleng,const uint8_t *name) {
 	return 0;
 }
 
-#ifndef METARESTORE
 static inline int fsnodes_access(fsnode *node,uint32_t uid,uint32_t gid,uint8_t modemask,uint8_t sesflags) {
 	uint8_t nodemode;
 	if (uid==0) {
@@ -2482,6 +2573,7 @@ static inline int fsnodes_access(fsnode *node,uint32_t uid,uint32_t gid,uint8_t
 	return 0;
 }
 
+#ifndef METARESTORE
 static inline int fsnodes_sticky_access(fsnode *parent,fsnode *node,uint32_t uid) {
 	if (uid==0 || (parent->mode&01000)==0) {	// super user or sticky bit is not set
 		return 1;
@@ -2826,6 +2918,9 @@ uint8_t fs_access(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t ui
 	return fsnodes_access(p,uid,gid,modemask,sesflags)?STATUS_OK:ERROR_EACCES;
 }
 
+#endif
+
+// read-only operations below are also used by metalogger serving reads from live metadata
 uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t nleng,const uint8_t *name,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint32_t *inode,uint8_t attr[35]) {
 	fsnode *wd,*rn;
 	fsedge *e;
@@ -2869,7 +2964,9 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 				*inode = wd->id;
 			}
 			fsnodes_fill_attr(wd,wd,uid,gid,auid,agid,sesflags,attr);
+#ifndef METARESTORE
 			stats_lookup++;
+#endif
 			return STATUS_OK;
 		}
 		if (nleng==2 && name[1]=='.') {	// parent
@@ -2889,7 +2986,9 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 					fsnodes_fill_attr(rn,wd,uid,gid,auid,agid,sesflags,attr);
 				}
 			}
+#ifndef METARESTORE
 			stats_lookup++;
+#endif
 			return STATUS_OK;
 		}
 	}
@@ -2902,7 +3001,9 @@ uint8_t fs_lookup(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t n
 	}
 	*inode = e->child->id;
 	fsnodes_fill_attr(e->child,wd,uid,gid,auid,agid,sesflags,attr);
+#ifndef METARESTORE
 	stats_lookup++;
+#endif
 	return STATUS_OK;
 }
 
@@ -2934,10 +3035,13 @@ uint8_t fs_getattr(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t u
 		}
 	}
 	fsnodes_fill_attr(p,NULL,uid,gid,auid,agid,sesflags,attr);
+#ifndef METARESTORE
 	stats_getattr++;
+#endif
 	return STATUS_OK;
 }
 
+#ifndef METARESTORE
 uint8_t fs_try_setlength(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint8_t opened,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint64_t length,uint8_t attr[35],uint64_t *chunkid) {
 	fsnode *p,*rn;
 	memset(attr,0,35);
@@ -3252,7 +3356,6 @@ uint8_t fs_settrashtime(uint32_t ts,uint32_t inode,uint32_t trashto) {
 }
 */
 
-#ifndef METARESTORE
 uint8_t fs_readlink(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t *pleng,uint8_t **path) {
 	fsnode *p,*rn;
 	(void)sesflags;
@@ -3286,12 +3389,13 @@ uint8_t fs_readlink(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t
 	}
 	*pleng = p->data.sdata.pleng;
 	*path = p->data.sdata.path;
+#ifndef METARESTORE
 	p->atime = main_time();
 	changelog(version++,"%"PRIu32"|ACCESS(%"PRIu32")",(uint32_t)main_time(),inode);
 	stats_readlink++;
+#endif
 	return STATUS_OK;
 }
-#endif
 
 #ifndef METARESTORE
 uint8_t fs_symlink(uint32_t rootinode,uint8_t sesflags,uint32_t parent,uint16_t nleng,const uint8_t *name,uint32_t pleng,const uint8_t *path,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint32_t *inode,uint8_t attr[35]) {
@@ -4115,7 +4219,6 @@ uint8_t fs_append(uint32_t ts,uint32_t inode,uint32_t inode_src) {
 	return STATUS_OK;
 }
 
-#ifndef METARESTORE
 uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,void **dnode,uint32_t *dbuffsize) {
 	fsnode *p,*rn;
 	*dnode = NULL;
@@ -4156,11 +4259,18 @@ uint8_t fs_readdir_size(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint3
 
 void fs_readdir_data(uint32_t rootinode,uint8_t sesflags,uint32_t uid,uint32_t gid,uint32_t auid,uint32_t agid,uint8_t flags,void *dnode,uint8_t *dbuff) {
 	fsnode *p = (fsnode*)dnode;
+#ifndef METARESTORE
+	p->atime = main_time();
 	changelog(version++,"%"PRIu32"|ACCESS(%"PRIu32")",(uint32_t)main_time(),p->id);
-	fsnodes_getdirdata(main_time(),rootinode,uid,gid,auid,agid,sesflags,p,dbuff,flags&GETDIR_FLAG_WITHATTR);
+#endif
+	fsnodes_getdirdata(rootinode,uid,gid,auid,agid,sesflags,p,dbuff,flags&GETDIR_FLAG_WITHATTR);
+#ifndef METARESTORE
 	stats_readdir++;
+#endif
 }
 
+#ifndef METARESTORE
+
 
 uint8_t fs_checkfile(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint16_t chunkcount[256]) {
 	fsnode *p,*rn;
@@ -4250,7 +4360,6 @@ uint8_t fs_opencheck(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t
 
 uint8_t fs_aquire(uint32_t inode,uint32_t sessionid) {
 	fsnode *p;
-	sessionidrec *cr;
 	p = fsnodes_id_to_node(inode);
 	if (!p) {
 		return ERROR_ENOENT;
@@ -4258,15 +4367,10 @@ uint8_t fs_aquire(uint32_t inode,uint32_t sessionid) {
 	if (p->type!=TYPE_FILE && p->type!=TYPE_TRASH && p->type!=TYPE_RESERVED) {
 		return ERROR_EPERM;
 	}
-	for (cr=p->data.fdata.sessionids ; cr ; cr=cr->next) {
-		if (cr->sessionid==sessionid) {
-			return ERROR_EINVAL;
-		}
+	if (sessionidrec_find(inode,sessionid)) {
+		return ERROR_EINVAL;
 	}
-	cr = sessionidrec_malloc();
-	cr->sessionid = sessionid;
-	cr->next = p->data.fdata.sessionids;
-	p->data.fdata.sessionids = cr;
+	sessionidrec_add(&(p->data.fdata.sessionids),inode,sessionid);
 #ifndef METARESTORE
 	changelog(version++,"%"PRIu32"|AQUIRE(%"PRIu32",%"PRIu32")",(uint32_t)main_time(),inode,sessionid);
 #else
@@ -4277,7 +4381,7 @@ uint8_t fs_aquire(uint32_t inode,uint32_t sessionid) {
 
 uint8_t fs_release(uint32_t inode,uint32_t sessionid) {
 	fsnode *p;
-	sessionidrec *cr,**crp;
+	sessionidrec *cr;
 	p = fsnodes_id_to_node(inode);
 	if (!p) {
 		return ERROR_ENOENT;
@@ -4285,20 +4389,15 @@ uint8_t fs_release(uint32_t inode,uint32_t sessionid) {
 	if (p->type!=TYPE_FILE && p->type!=TYPE_TRASH && p->type!=TYPE_RESERVED) {
 		return ERROR_EPERM;
 	}
-	crp = &(p->data.fdata.sessionids);
-	while ((cr=*crp)) {
-		if (cr->sessionid==sessionid) {
-			*crp = cr->next;
-			sessionidrec_free(cr);
+	cr = sessionidrec_find(inode,sessionid);
+	if (cr) {
+		sessionidrec_remove(cr);
 #ifndef METARESTORE
-			changelog(version++,"%"PRIu32"|RELEASE(%"PRIu32",%"PRIu32")",(uint32_t)main_time(),inode,sessionid);
+		changelog(version++,"%"PRIu32"|RELEASE(%"PRIu32",%"PRIu32")",(uint32_t)main_time(),inode,sessionid);
 #else
-			version++;
+		version++;
 #endif
-			return STATUS_OK;
-		} else {
-			crp = &(cr->next);
-		}
+		return STATUS_OK;
 	}
 #ifndef METARESTORE
 	syslog(LOG_WARNING,"release: session not found");
@@ -4573,6 +4672,33 @@ uint8_t fs_incversion(uint64_t chunkid) {
 }
 #endif
 
+#ifndef METARESTORE
+void fs_xorgroup(uint64_t parityid,uint8_t cnt,const uint64_t *chunkids) {
+	char idstr[10*21];
+	uint32_t i,l;
+	l = 0;
+	idstr[0] = 0;
+	for (i=0 ; i<cnt && i<10 ; i++) {
+		l += snprintf(idstr+l,sizeof(idstr)-l,",%"PRIu64,chunkids[i]);
+	}
+	changelog(version++,"%"PRIu32"|XORGROUP(%"PRIu64"%s)",(uint32_t)main_time(),parityid,idstr);
+}
+
+void fs_xorrelease(uint64_t parityid) {
+	changelog(version++,"%"PRIu32"|XORRELEASE(%"PRIu64")",(uint32_t)main_time(),parityid);
+}
+#else
+uint8_t fs_xorgroup(uint64_t parityid,uint8_t cnt,const uint64_t *chunkids) {
+	version++;
+	return chunk_xor_group(parityid,cnt,chunkids);
+}
+
+uint8_t fs_xorrelease(uint64_t parityid) {
+	version++;
+	return chunk_xor_release(parityid);
+}
+#endif
+
 
 #ifndef METARESTORE
 uint8_t fs_repair(uint32_t rootinode,uint8_t sesflags,uint32_t inode,uint32_t uid,uint32_t gid,uint32_t *notchanged,uint32_t *erased,uint32_t *repaired) {
@@ -5847,14 +5973,10 @@ uint8_t fs_emptyreserved(uint32_t ts,uint32_t freeinodes) {
 }
 
 
-#ifdef METARESTORE
-
 uint64_t fs_getversion() {
 	return version;
 }
 
-#endif
-
 enum {FLAG_TREE,FLAG_TRASH,FLAG_RESERVED};
 
 #ifdef METARESTORE
@@ -6234,7 +6356,6 @@ int fs_loadnode(FILE *fd) {
 	uint8_t type;
 	uint32_t indx,pleng,ch,sessionids,sessionid;
 	fsnode *p;
-	sessionidrec *sessionidptr;
 	uint32_t nodepos;
 #ifndef METARESTORE
 	statsrecord *sr;
@@ -6352,10 +6473,9 @@ int fs_loadnode(FILE *fd) {
 		p->data.fdata.sessionids=NULL;
 		while (sessionids) {
 			sessionid = get32bit(&ptr);
-			sessionidptr = sessionidrec_malloc();
-			sessionidptr->sessionid = sessionid;
-			sessionidptr->next = p->data.fdata.sessionids;
-			p->data.fdata.sessionids = sessionidptr;
+			if (sessionidrec_find(p->id,sessionid)==NULL) {
+				sessionidrec_add(&(p->data.fdata.sessionids),p->id,sessionid);
+			}
 #ifndef METARESTORE
 			matocuserv_init_sessions(sessionid,p->id);
 #endif
@@ -6480,7 +6600,6 @@ fsnode* fs_loaduninode_1_4(int flag,uint8_t type,fsnode* node,FILE *fd) {
 	uint32_t pleng,indx,ch,sessionids,sessionid;
 	fsnode *p;
 	fsedge *e;
-	sessionidrec *sessionidptr;
 	uint32_t nodepos;
 #ifdef EDGEHASH
 	uint32_t hpos;
@@ -6628,10 +6747,9 @@ fsnode* fs_loaduninode_1_4(int flag,uint8_t type,fsnode* node,FILE *fd) {
 		p->data.fdata.sessionids=NULL;
 		while (sessionids) {
 			sessionid = get32bit(&ptr);
-			sessionidptr = sessionidrec_malloc();
-			sessionidptr->sessionid = sessionid;
-			sessionidptr->next = p->data.fdata.sessionids;
-			p->data.fdata.sessionids = sessionidptr;
+			if (sessionidrec_find(p->id,sessionid)==NULL) {
+				sessionidrec_add(&(p->data.fdata.sessionids),p->id,sessionid);
+			}
 #ifndef METARESTORE
 			matocuserv_init_sessions(sessionid,p->id);
 #endif
@@ -7111,17 +7229,22 @@ void fs_new(void) {
 }
 #endif
 
+// header, file system and chunks - returns -1 on write error
+static int fs_store_file(FILE *fd) {
+	if (fwrite((MetadataFormat==0x15)?"MFSM 1.5":"MFSM 1.6",1,8,fd)!=8) {
+		return -1;
+	}
+	fs_store(fd);
+	return chunk_store(fd,MetadataFormat);
+}
+
 int fs_emergency_storeall(const char *fname) {
 	FILE *fd;
-	size_t happy;
 	fd = fopen(fname,"w");
 	if (fd==NULL) {
 		return -1;
 	}
-	happy = fwrite("MFSM 1.5",1,8,fd);
-	fs_store(fd);
-	chunk_store(fd);
-	if (ferror(fd)!=0) {
+	if (fs_store_file(fd)<0 || ferror(fd)!=0) {
 		fclose(fd);
 		return -1;
 	}
@@ -7187,7 +7310,6 @@ int fs_emergency_saves() {
 #ifndef METARESTORE
 int fs_storeall(int bg) {
 	FILE *fd;
-	size_t happy;
 #ifdef BACKGROUND_METASTORE
 	int i;
 	struct stat sb;
@@ -7218,7 +7340,7 @@ int fs_storeall(int bg) {
 				return 0;
 			}
 		}
-		fd = fopen("metadata.mfs.back","w");
+		fd = zfile_wopen("metadata.mfs.back",MetadataCompression);
 		if (fd==NULL) {
 			syslog(LOG_ERR,"can't open metadata file");
 #ifdef BACKGROUND_METASTORE
@@ -7228,13 +7350,13 @@ int fs_storeall(int bg) {
 #endif
 			return 0;
 		}
-		happy = fwrite("MFSM 1.5",1,8,fd);
-		fs_store(fd);
-		chunk_store(fd);
-		if (ferror(fd)!=0) {
+		if (fs_store_file(fd)<0 || ferror(fd)!=0) {
+			syslog(LOG_ERR,"can't write metadata");
+			fclose(fd);
+		} else if (fclose(fd)!=0) {	// compressed files are finished on close
 			syslog(LOG_ERR,"can't write metadata");
 		}
-		fclose(fd);
+		changelog_compress();
 		unlink("metadata.mfs.back.tmp");
 		unlink("metadata.mfs");
 #ifdef BACKGROUND_METASTORE
@@ -7269,21 +7391,23 @@ void fs_term(void) {
 }
 
 #else
-void fs_storeall(const char *fname) {
+int fs_storeall(const char *fname) {
 	FILE *fd;
-	size_t happy;
 	fd = fopen(fname,"w");
 	if (fd==NULL) {
 		printf("can't open metadata file\n");
-		return;
+		return -1;
 	}
-	happy = fwrite("MFSM 1.5",1,8,fd);
-	fs_store(fd);
-	chunk_store(fd);
-	if (ferror(fd)!=0) {
+	if (fs_store_file(fd)<0 || ferror(fd)!=0) {
 		printf("can't write metadata\n");
+		fclose(fd);
+		return -1;
 	}
-	fclose(fd);
+	if (fclose(fd)!=0) {
+		printf("can't write metadata\n");
+		return -1;
+	}
+	return 0;
 }
 
 void fs_term(const char *fname) {
@@ -7305,23 +7429,23 @@ int fs_loadall(const char *fname) {
 #endif
 
 #ifdef METARESTORE
-	fd = fopen(fname,"r");
+	fd = zfile_ropen(fname);
 #else
 	backversion = 0;
-	fd = fopen("metadata.mfs.back","r");
+	fd = zfile_ropen("metadata.mfs.back");
 	if (fd!=NULL) {
 		if (fread(bhdr,1,8,fd)==8) {
 //			if (memcmp(bhdr,"MFSM 1.4",8)==0) {
 //				backversion = fs_loadversion_1_4(fd);
 //			} else
-			if (memcmp(bhdr,"MFSM 1.5",8)==0) {
+			if (memcmp(bhdr,"MFSM 1.5",8)==0 || memcmp(bhdr,"MFSM 1.6",8)==0) {
 				backversion = fs_loadversion(fd);
 			}
 		}
 		fclose(fd);
 	}
 
-	fd = fopen("metadata.mfs","r");
+	fd = zfile_ropen("metadata.mfs");
 #endif
 	if (fd==NULL) {
 		fprintf(stderr,"can't open metadata file\n");
@@ -7402,7 +7526,7 @@ int fs_loadall(const char *fname) {
 	} else
 */
 #endif
-	if (memcmp(hdr,"MFSM 1.5",8)==0) {
+	if (memcmp(hdr,"MFSM 1.5",8)==0 || memcmp(hdr,"MFSM 1.6",8)==0) {
 		if (fs_load(fd)<0) {
 #ifndef METARESTORE
 			syslog(LOG_ERR,"error reading metadata (structure)");
@@ -7412,7 +7536,7 @@ int fs_loadall(const char *fname) {
 		}
 		fprintf(stderr,"loading chunks data ... ");
 		fflush(stderr);
-		if (chunk_load(fd)<0) {
+		if (((hdr[7]=='5')?chunk_load_1_5(fd):chunk_load(fd))<0) {
 			fprintf(stderr,"error\n");
 #ifndef METARESTORE
 			syslog(LOG_ERR,"error reading metadata (chunks)");
@@ -7501,6 +7625,12 @@ void fs_cs_disconnected(void) {
 }
 
 int fs_init(void) {
+	MetadataFormat = (cfg_getuint8("METADATA_OLD_FORMAT",0))?0x15:0x16;
+	MetadataCompression = cfg_getuint32("METADATA_COMPRESSION",0);
+	if (MetadataCompression>0 && zfile_supported()==0) {
+		syslog(LOG_WARNING,"metadata compression is not supported on this system - metadata will be stored uncompressed");
+		MetadataCompression = 0;
+	}
 	fprintf(stderr,"loading metadata ...\n");
 	fs_strinit();
 	chunk_strinit();
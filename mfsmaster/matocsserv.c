@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -55,6 +56,21 @@ typedef struct packetstruct {
 	uint8_t *packet;
 } packetstruct;
 
+// chunks reported in CSTOMA_REGISTER waiting to be merged into chunk index
+typedef struct regpacket {
+	uint8_t *packet;		// whole input packet (freed when merged)
+	const uint8_t *ptr;		// next record (chunkid:64 version:32)
+	uint32_t chunksleft;
+	struct regpacket *next;
+} regpacket;
+
+// operations requested while chunkserver is detached
+typedef struct detachedop {
+	uint64_t chunkid;
+	uint32_t version;
+	uint8_t delete;		// 1 - resend deletion after reattach, 0 - finish with error
+} detachedop;
+
 typedef struct matocsserventry {
 	uint8_t mode;
 	int sock;
@@ -79,6 +95,19 @@ typedef struct matocsserventry {
 	uint16_t rrepcounter;
 	uint16_t wrepcounter;
 
+	regpacket *reghead,**regtail;	// registration queue
+	uint32_t regpending;		// chunks waiting in registration queue
+	uint32_t regmerged;		// chunks already merged into chunk index
+	uint8_t regended;		// got last registration packet, waiting for queue
+
+	uint64_t sessionid;		// for delta registration after reconnection (0 - no session)
+	uint32_t detachedtime;		// connection lost at - entry is kept until grace time passes (0 - connected)
+	uint8_t delta;			// receiving delta registration
+	uint8_t deltarejected;		// unknown session - ignore rest of delta registration
+	struct detachedop *detachedops;	// operations sent to detached server
+	uint32_t detachedopscnt,detachedopssize;
+	struct matocsserventry *reattachto;	// detached entry waiting for this connection
+
 	double carry;
 
 	struct matocsserventry *next;
@@ -86,12 +115,17 @@ typedef struct matocsserventry {
 
 static uint64_t maxtotalspace;
 static matocsserventry *matocsservhead=NULL;
+static matocsserventry *matocsservdetached=NULL;
 static int lsock;
 static int32_t lsockpdescpos;
 
 // from config
 static char *ListenHost;
 static char *ListenPort;
+static uint32_t RegisterTimeSlice;
+static uint32_t DisconnectGraceTime;
+
+#define REGBATCH 1000
 
 
 
@@ -671,7 +705,7 @@ int matocsserv_balanced(double balancelimit) {
 	return 0;
 }
 */
-uint32_t matocsserv_cservlist_size(void) {
+uint32_t matocsserv_cservlist_size(uint8_t extended) {
 	matocsserventry *eptr;
 	uint32_t i;
 	i=0;
@@ -680,10 +714,10 @@ uint32_t matocsserv_cservlist_size(void) {
 			i++;
 		}
 	}
-	return i*(4+4+2+8+8+4+8+8+4+4);
+	return i*(4+4+2+8+8+4+8+8+4+4+(extended?4+4:0));
 }
 
-void matocsserv_cservlist_data(uint8_t *ptr) {
+void matocsserv_cservlist_data(uint8_t *ptr,uint8_t extended) {
 	matocsserventry *eptr;
 	for (eptr = matocsservhead ; eptr ; eptr=eptr->next) {
 		if (eptr->mode!=KILL) {
@@ -697,6 +731,10 @@ void matocsserv_cservlist_data(uint8_t *ptr) {
 			put64bit(&ptr,eptr->todeltotalspace);
 			put32bit(&ptr,eptr->todelchunkscount);
 			put32bit(&ptr,eptr->errorcounter);
+			if (extended) {
+				put32bit(&ptr,eptr->regpending);
+				put32bit(&ptr,eptr->regmerged);
+			}
 		}
 	}
 }
@@ -748,6 +786,12 @@ int matocsserv_getlocation(void *e,uint32_t *servip,uint16_t *servport) {
 	return -1;
 }
 
+// connection lost, but chunks are kept for delta registration - copies can't be read nor used as a source
+int matocsserv_isdetached(void *e) {
+	matocsserventry *eptr = (matocsserventry *)e;
+	return (eptr->detachedtime>0)?1:0;
+}
+
 
 uint16_t matocsserv_replication_write_counter(void *e) {
 	matocsserventry *eptr = (matocsserventry *)e;
@@ -842,6 +886,141 @@ void matocsserv_got_chunk_checksum(matocsserventry *eptr,const uint8_t *data,uin
 	}
 }
 
+/* detached chunkservers */
+
+void matocsserv_detached_addop(matocsserventry *eptr,uint64_t chunkid,uint32_t version,uint8_t delete) {
+	if (eptr->detachedopscnt>=eptr->detachedopssize) {
+		eptr->detachedopssize = (eptr->detachedopssize)?eptr->detachedopssize*2:64;
+		eptr->detachedops = realloc(eptr->detachedops,sizeof(detachedop)*eptr->detachedopssize);
+		passert(eptr->detachedops);
+	}
+	eptr->detachedops[eptr->detachedopscnt].chunkid = chunkid;
+	eptr->detachedops[eptr->detachedopscnt].version = version;
+	eptr->detachedops[eptr->detachedopscnt].delete = delete;
+	eptr->detachedopscnt++;
+}
+
+// finish failed operations, keep deletions for reattach
+void matocsserv_detached_finishops(matocsserventry *eptr) {
+	uint32_t i,j;
+	detachedop dop;
+	// new operations can be added here (emergency version increase), so don't cache pointer nor counter
+	for (i=0,j=0 ; i<eptr->detachedopscnt ; i++) {
+		dop = eptr->detachedops[i];
+		if (dop.delete) {
+			eptr->detachedops[j++] = dop;
+		} else {
+			chunk_got_chunkop_status(eptr,dop.chunkid,ERROR_DISCONNECTED);
+		}
+	}
+	eptr->detachedopscnt = j;
+}
+
+void matocsserv_detached_remove(matocsserventry *eptr) {
+	matocsserv_detached_finishops(eptr);
+	chunk_server_disconnected(eptr);
+	if (eptr->detachedops) {
+		free(eptr->detachedops);
+	}
+	if (eptr->servstrip) {
+		free(eptr->servstrip);
+	}
+	free(eptr);
+}
+
+// chunkserver registered from scratch - forget its previous incarnation
+void matocsserv_detached_drop(uint32_t servip,uint16_t servport) {
+	matocsserventry *eptr,**kptr;
+	kptr = &matocsservdetached;
+	while ((eptr=*kptr)) {
+		if (eptr->servip==servip && eptr->servport==servport) {
+			syslog(LOG_NOTICE,"chunkserver sent all chunks - removing previously detached server data - ip: %s, port: %"PRIu16,eptr->servstrip,eptr->servport);
+			*kptr = eptr->next;
+			matocsserv_detached_remove(eptr);
+		} else {
+			kptr = &(eptr->next);
+		}
+	}
+}
+
+void matocsserv_detached_loop(void) {
+	matocsserventry *eptr,**kptr;
+	uint32_t now = main_time();
+	kptr = &matocsservdetached;
+	while ((eptr=*kptr)) {
+		matocsserv_detached_finishops(eptr);
+		if (eptr->detachedtime+DisconnectGraceTime<now) {
+			syslog(LOG_NOTICE,"chunkserver hasn't reconnected in %"PRIu32" seconds - removing its chunks - ip: %s, port: %"PRIu16,DisconnectGraceTime,eptr->servstrip,eptr->servport);
+			*kptr = eptr->next;
+			matocsserv_detached_remove(eptr);
+		} else {
+			kptr = &(eptr->next);
+		}
+	}
+}
+
+// move connection from new entry to the detached one (which is referenced from chunks)
+void matocsserv_reattach(matocsserventry *deptr,matocsserventry *eptr) {
+	matocsserventry **kptr;
+	uint32_t i;
+	uint8_t *data;
+	for (kptr = &matocsservdetached ; *kptr ; kptr = &((*kptr)->next)) {
+		if (*kptr==deptr) {
+			*kptr = deptr->next;
+			break;
+		}
+	}
+	matocsserv_detached_finishops(deptr);
+	deptr->mode = eptr->mode;
+	deptr->sock = eptr->sock;
+	deptr->pdescpos = -1;
+	deptr->lastread = eptr->lastread;
+	deptr->lastwrite = eptr->lastwrite;
+	deptr->inputpacket.next = NULL;
+	deptr->inputpacket.bytesleft = 8;
+	deptr->inputpacket.startptr = deptr->hdrbuff;
+	deptr->inputpacket.packet = NULL;
+	deptr->outputhead = eptr->outputhead;
+	if (deptr->outputhead) {
+		deptr->outputtail = eptr->outputtail;
+	} else {
+		deptr->outputtail = &(deptr->outputhead);
+	}
+	deptr->version = eptr->version;
+	deptr->timeout = eptr->timeout;
+	deptr->detachedtime = 0;
+	deptr->delta = 1;
+	deptr->next = matocsservhead;
+	matocsservhead = deptr;
+	for (i=0 ; i<deptr->detachedopscnt ; i++) {
+		data = matocsserv_createpacket(deptr,MATOCS_DELETE,8+4);
+		put64bit(&data,deptr->detachedops[i].chunkid);
+		put32bit(&data,deptr->detachedops[i].version);
+	}
+	deptr->detachedopscnt = 0;
+	if (eptr->inputpacket.packet) {
+		free(eptr->inputpacket.packet);
+	}
+	if (eptr->servstrip) {
+		free(eptr->servstrip);
+	}
+	free(eptr);
+}
+
+void matocsserv_send_session(matocsserventry *eptr) {
+	uint8_t *data;
+	if (eptr->version<0x010615 || eptr->mode==KILL) {	// delta registration is supported since 1.6.21
+		return;
+	}
+	while (eptr->sessionid==0) {
+		eptr->sessionid = rndu32();
+		eptr->sessionid <<= 32;
+		eptr->sessionid |= rndu32();
+	}
+	data = matocsserv_createpacket(eptr,MATOCS_REGISTER_SESSION,8);
+	put64bit(&data,eptr->sessionid);
+}
+
 int matocsserv_send_createchunk(void *e,uint64_t chunkid,uint32_t version) {
 	matocsserventry *eptr = (matocsserventry *)e;
 	uint8_t *data;
@@ -850,6 +1029,8 @@ int matocsserv_send_createchunk(void *e,uint64_t chunkid,uint32_t version) {
 		data = matocsserv_createpacket(eptr,MATOCS_CREATE,8+4);
 		put64bit(&data,chunkid);
 		put32bit(&data,version);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,0,0);
 	}
 	return 0;
 }
@@ -878,6 +1059,8 @@ int matocsserv_send_deletechunk(void *e,uint64_t chunkid,uint32_t version) {
 		data = matocsserv_createpacket(eptr,MATOCS_DELETE,8+4);
 		put64bit(&data,chunkid);
 		put32bit(&data,version);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,version,1);
 	}
 	return 0;
 }
@@ -1012,6 +1195,8 @@ int matocsserv_send_setchunkversion(void *e,uint64_t chunkid,uint32_t version,ui
 		put64bit(&data,chunkid);
 		put32bit(&data,version);
 		put32bit(&data,oldversion);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,0,0);
 	}
 	return 0;
 }
@@ -1043,6 +1228,8 @@ int matocsserv_send_duplicatechunk(void *e,uint64_t chunkid,uint32_t version,uin
 		put32bit(&data,version);
 		put64bit(&data,oldchunkid);
 		put32bit(&data,oldversion);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,0,0);
 	}
 	return 0;
 }
@@ -1073,6 +1260,8 @@ int matocsserv_send_truncatechunk(void *e,uint64_t chunkid,uint32_t length,uint3
 		put32bit(&data,length);
 		put32bit(&data,version);
 		put32bit(&data,oldversion);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,0,0);
 	}
 	return 0;
 }
@@ -1105,6 +1294,8 @@ int matocsserv_send_duptruncchunk(void *e,uint64_t chunkid,uint32_t version,uint
 		put64bit(&data,oldchunkid);
 		put32bit(&data,oldversion);
 		put32bit(&data,length);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,chunkid,0,0);
 	}
 	return 0;
 }
@@ -1138,6 +1329,8 @@ int matocsserv_send_chunkop(void *e,uint64_t chunkid,uint32_t version,uint32_t n
 		put64bit(&data,copychunkid);
 		put32bit(&data,copyversion);
 		put32bit(&data,leng);
+	} else if (eptr->detachedtime) {
+		matocsserv_detached_addop(eptr,(copychunkid>0)?copychunkid:chunkid,0,0);
 	}
 	return 0;
 }
@@ -1169,14 +1362,246 @@ void matocsserv_got_chunkop_status(matocsserventry *eptr,const uint8_t *data,uin
 	}
 }
 
-void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t length) {
+/* registration queue */
+
+void matocsserv_registration_enqueue(matocsserventry *eptr,const uint8_t *data,uint32_t chunkcount) {
+	regpacket *rp;
+	uint64_t chunkid;
+	uint32_t chunkversion;
+	uint32_t i;
+
+	if (chunkcount==0) {
+		return;
+	}
+	if (RegisterTimeSlice==0 && eptr->reghead==NULL) {
+		for (i=0 ; i<chunkcount ; i++) {
+			chunkid = get64bit(&data);
+			chunkversion = get32bit(&data);
+			chunk_server_has_chunk(eptr,chunkid,chunkversion);
+		}
+		eptr->regmerged += chunkcount;
+		return;
+	}
+	rp = malloc(sizeof(regpacket));
+	passert(rp);
+	rp->packet = eptr->inputpacket.packet;	// take over input buffer - it will be freed after merge
+	eptr->inputpacket.packet = NULL;
+	rp->ptr = data;
+	rp->chunksleft = chunkcount;
+	rp->next = NULL;
+	*(eptr->regtail) = rp;
+	eptr->regtail = &(rp->next);
+	eptr->regpending += chunkcount;
+}
+
+uint32_t matocsserv_registration_merge(matocsserventry *eptr,uint32_t maxchunks) {
+	regpacket *rp;
 	uint64_t chunkid;
 	uint32_t chunkversion;
+	uint32_t cnt;
+
+	cnt = 0;
+	while ((rp=eptr->reghead)!=NULL && cnt<maxchunks) {
+		while (rp->chunksleft>0 && cnt<maxchunks) {
+			chunkid = get64bit(&(rp->ptr));
+			chunkversion = get32bit(&(rp->ptr));
+			chunk_server_has_chunk(eptr,chunkid,chunkversion);
+			rp->chunksleft--;
+			cnt++;
+		}
+		if (rp->chunksleft==0) {
+			eptr->reghead = rp->next;
+			if (eptr->reghead==NULL) {
+				eptr->regtail = &(eptr->reghead);
+			}
+			free(rp->packet);
+			free(rp);
+		}
+	}
+	eptr->regpending -= cnt;
+	eptr->regmerged += cnt;
+	if (eptr->reghead==NULL && eptr->regended) {
+		syslog(LOG_NOTICE,"chunkserver register merged - ip: %s, port: %"PRIu16", chunks: %"PRIu32,eptr->servstrip,eptr->servport,eptr->regmerged);
+		eptr->regended = 0;
+		matocsserv_send_session(eptr);
+	}
+	return cnt;
+}
+
+void matocsserv_registration_free(matocsserventry *eptr) {
+	regpacket *rp,*rpn;
+	for (rp=eptr->reghead ; rp ; rp=rpn) {
+		rpn = rp->next;
+		free(rp->packet);
+		free(rp);
+	}
+	eptr->reghead = NULL;
+	eptr->regtail = &(eptr->reghead);
+	eptr->regpending = 0;
+	eptr->regended = 0;
+}
+
+// merge queued registrations in batches until time slice is used
+void matocsserv_registration_loop(void) {
+	matocsserventry *eptr;
+	struct timeval tv;
+	uint64_t deadline,usec;
+	uint32_t cnt;
+
+	gettimeofday(&tv,NULL);
+	deadline = tv.tv_sec;
+	deadline *= 1000000;
+	deadline += tv.tv_usec;
+	deadline += RegisterTimeSlice*1000;
+	do {
+		cnt = 0;
+		for (eptr = matocsservhead ; eptr ; eptr=eptr->next) {
+			if (eptr->mode!=KILL && eptr->reghead!=NULL) {
+				cnt += matocsserv_registration_merge(eptr,(RegisterTimeSlice>0)?REGBATCH:0xFFFFFFFF);
+			}
+		}
+		if (cnt==0) {
+			return;
+		}
+		gettimeofday(&tv,NULL);
+		usec = tv.tv_sec;
+		usec *= 1000000;
+		usec += tv.tv_usec;
+	} while (usec<deadline);
+}
+
+int matocsserv_registration_inprogress(void) {
+	matocsserventry *eptr;
+	for (eptr = matocsservhead ; eptr ; eptr=eptr->next) {
+		if (eptr->mode!=KILL && eptr->reghead!=NULL) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void matocsserv_register_delta(matocsserventry *eptr,const uint8_t *data,uint32_t length) {
 	matocsserventry *eaptr;
-	uint32_t i,chunkcount;
 	uint8_t rversion;
+	uint64_t sessionid;
+	uint64_t chunkid;
+	uint32_t chunkversion;
+	uint32_t i,cnt;
+	uint8_t *ptr;
 	double us,ts;
 
+	rversion = get8bit(&data);
+	if (rversion==60) {
+		if (length!=25) {
+			syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:BEGIN) - wrong size (%"PRIu32"/25)",length);
+			eptr->mode=KILL;
+			return;
+		}
+		if (eptr->totalspace>0 || eptr->reattachto) {
+			syslog(LOG_WARNING,"got register message from registered chunk-server !!!");
+			eptr->mode=KILL;
+			return;
+		}
+		eptr->version = get32bit(&data);
+		eptr->servip = get32bit(&data);
+		eptr->servport = get16bit(&data);
+		eptr->timeout = get16bit(&data);
+		sessionid = get64bit(&data);
+		if (eptr->timeout<10) {
+			syslog(LOG_NOTICE,"CSTOMA_REGISTER communication timeout too small (%"PRIu16" seconds - should be at least 10 seconds)",eptr->timeout);
+			eptr->mode=KILL;
+			return;
+		}
+		if (eptr->servip==0) {
+			tcpgetpeer(eptr->sock,&(eptr->servip),NULL);
+		}
+		if (eptr->servstrip) {
+			free(eptr->servstrip);
+		}
+		eptr->servstrip = matocsserv_makestrip(eptr->servip);
+		if (((eptr->servip)&0xFF000000) == 0x7F000000) {
+			syslog(LOG_NOTICE,"chunkserver connected using localhost (IP: %s) - you cannot use localhost for communication between chunkserver and master", eptr->servstrip);
+			eptr->mode=KILL;
+			return;
+		}
+		for (eaptr=matocsservhead ; eaptr ; eaptr=eaptr->next) {
+			if (eptr!=eaptr && eaptr->mode!=KILL && eaptr->servip==eptr->servip && eaptr->servport==eptr->servport) {
+				syslog(LOG_WARNING,"chunk-server already connected !!!");
+				eptr->mode=KILL;
+				return;
+			}
+		}
+		for (eaptr=matocsservdetached ; eaptr ; eaptr=eaptr->next) {
+			if (eaptr->sessionid==sessionid && eaptr->servip==eptr->servip && eaptr->servport==eptr->servport) {
+				break;
+			}
+		}
+		if (eaptr==NULL) {
+			syslog(LOG_NOTICE,"chunkserver register (packet version: 6) - unknown session - ip: %s, port: %"PRIu16" - full registration needed",eptr->servstrip,eptr->servport);
+			eptr->deltarejected = 1;
+			ptr = matocsserv_createpacket(eptr,MATOCS_REGISTER_SESSION,8);
+			put64bit(&ptr,0);
+			return;
+		}
+		syslog(LOG_NOTICE,"chunkserver register begin (packet version: 6) - ip: %s, port: %"PRIu16" - reconnected after %"PRIu32" seconds",eptr->servstrip,eptr->servport,main_time()-eaptr->detachedtime);
+		eptr->reattachto = eaptr;
+		return;
+	}
+	if (eptr->deltarejected) {
+		return;
+	}
+	if (eptr->delta==0) {
+		syslog(LOG_WARNING,"CSTOMA_REGISTER (ver 6) - got delta registration packet without session");
+		eptr->mode=KILL;
+		return;
+	}
+	if (rversion==61) {
+		if (((length-1)%12)!=0) {
+			syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:CHANGES) - wrong size (%"PRIu32"/1+N*12)",length);
+			eptr->mode=KILL;
+			return;
+		}
+		cnt = (length-1)/12;
+		for (i=0 ; i<cnt ; i++) {
+			chunkid = get64bit(&data);
+			chunkversion = get32bit(&data);
+			chunk_server_changed_chunk(eptr,chunkid,chunkversion);
+		}
+		eptr->regmerged += cnt;
+	} else {
+		if (length!=41) {
+			syslog(LOG_NOTICE,"CSTOMA_REGISTER (ver 6:END) - wrong size (%"PRIu32"/41)",length);
+			eptr->mode=KILL;
+			return;
+		}
+		eptr->usedspace = get64bit(&data);
+		eptr->totalspace = get64bit(&data);
+		eptr->chunkscount = get32bit(&data);
+		eptr->todelusedspace = get64bit(&data);
+		eptr->todeltotalspace = get64bit(&data);
+		eptr->todelchunkscount = get32bit(&data);
+		if (eptr->totalspace>maxtotalspace) {
+			maxtotalspace=eptr->totalspace;
+		}
+		eptr->delta = 0;
+		us = (double)(eptr->usedspace)/(double)(1024*1024*1024);
+		ts = (double)(eptr->totalspace)/(double)(1024*1024*1024);
+		syslog(LOG_NOTICE,"chunkserver register end (packet version: 6) - ip: %s, port: %"PRIu16", usedspace: %"PRIu64" (%.2lf GiB), totalspace: %"PRIu64" (%.2lf GiB), changed chunks: %"PRIu32,eptr->servstrip,eptr->servport,eptr->usedspace,us,eptr->totalspace,ts,eptr->regmerged);
+		eptr->regmerged = 0;
+		matocsserv_send_session(eptr);
+	}
+}
+
+void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t length) {
+	matocsserventry *eaptr;
+	uint8_t rversion;
+	double us,ts;
+
+	if ((length&1)==1 && data[0]>=60 && data[0]<=62) {
+		matocsserv_register_delta(eptr,data,length);
+		return;
+	}
+
 	if (eptr->totalspace>0) {
 		syslog(LOG_WARNING,"got register message from registered chunk-server !!!");
 		eptr->mode=KILL;
@@ -1295,6 +1720,8 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 					return;
 				}
 			}
+			eptr->deltarejected = 0;
+			matocsserv_detached_drop(eptr->servip,eptr->servport);
 			syslog(LOG_NOTICE,"chunkserver register begin (packet version: 5) - ip: %s, port: %"PRIu16,eptr->servstrip,eptr->servport);
 			return;
 		} else if (rversion==51) {
@@ -1303,12 +1730,7 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 				eptr->mode=KILL;
 				return;
 			}
-			chunkcount = (length-1)/12;
-			for (i=0 ; i<chunkcount ; i++) {
-				chunkid = get64bit(&data);
-				chunkversion = get32bit(&data);
-				chunk_server_has_chunk(eptr,chunkid,chunkversion);
-			}
+			matocsserv_registration_enqueue(eptr,data,(length-1)/12);
 			return;
 		} else if (rversion==52) {
 			if (length!=41) {
@@ -1324,7 +1746,12 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 			eptr->todelchunkscount = get32bit(&data);
 			us = (double)(eptr->usedspace)/(double)(1024*1024*1024);
 			ts = (double)(eptr->totalspace)/(double)(1024*1024*1024);
-			syslog(LOG_NOTICE,"chunkserver register end (packet version: 5) - ip: %s, port: %"PRIu16", usedspace: %"PRIu64" (%.2lf GiB), totalspace: %"PRIu64" (%.2lf GiB)",eptr->servstrip,eptr->servport,eptr->usedspace,us,eptr->totalspace,ts);
+			syslog(LOG_NOTICE,"chunkserver register end (packet version: 5) - ip: %s, port: %"PRIu16", usedspace: %"PRIu64" (%.2lf GiB), totalspace: %"PRIu64" (%.2lf GiB), chunks waiting for merge: %"PRIu32,eptr->servstrip,eptr->servport,eptr->usedspace,us,eptr->totalspace,ts,eptr->regpending);
+			if (eptr->reghead!=NULL) {
+				eptr->regended = 1;
+			} else {
+				matocsserv_send_session(eptr);
+			}
 			return;
 		} else {
 			syslog(LOG_NOTICE,"CSTOMA_REGISTER - wrong version (%"PRIu8"/1..4)",rversion);
@@ -1368,11 +1795,10 @@ void matocsserv_register(matocsserventry *eptr,const uint8_t *data,uint32_t leng
 //		eptr->creation = NULL;
 //		eptr->setversion = NULL;
 //		eptr->duplication = NULL;
-		chunkcount = length/(8+4);
-		for (i=0 ; i<chunkcount ; i++) {
-			chunkid = get64bit(&data);
-			chunkversion = get32bit(&data);
-			chunk_server_has_chunk(eptr,chunkid,chunkversion);
+		matocsserv_detached_drop(eptr->servip,eptr->servport);
+		matocsserv_registration_enqueue(eptr,data,length/(8+4));
+		if (eptr->reghead!=NULL) {
+			eptr->regended = 1;
 		}
 	}
 }
@@ -1409,6 +1835,9 @@ void matocsserv_chunk_damaged(matocsserventry *eptr,const uint8_t *data,uint32_t
 		eptr->mode=KILL;
 		return;
 	}
+	if (eptr->reghead!=NULL) {	// chunks from registration have to be known before
+		matocsserv_registration_merge(eptr,0xFFFFFFFF);
+	}
 	for (i=0 ; i<length/8 ; i++) {
 		chunkid = get64bit(&data);
 //		syslog(LOG_NOTICE,"(%s:%"PRIu16") chunk: %016"PRIX64" is damaged",eptr->servstrip,eptr->servport,chunkid);
@@ -1425,6 +1854,9 @@ void matocsserv_chunks_lost(matocsserventry *eptr,const uint8_t *data,uint32_t l
 		eptr->mode=KILL;
 		return;
 	}
+	if (eptr->reghead!=NULL) {	// chunks from registration have to be known before
+		matocsserv_registration_merge(eptr,0xFFFFFFFF);
+	}
 	for (i=0 ; i<length/8 ; i++) {
 		chunkid = get64bit(&data);
 //		syslog(LOG_NOTICE,"(%s:%"PRIu16") chunk lost: %016"PRIX64,eptr->servstrip,eptr->servport,chunkid);
@@ -1464,6 +1896,21 @@ void matocsserv_broadcast_logrotate() {
 	}
 }
 */
+void matocsserv_register_checkpoint(matocsserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint32_t gen;
+	uint8_t *ptr;
+	if (length!=4) {
+		syslog(LOG_NOTICE,"CSTOMA_REGISTER_CHECKPOINT - wrong size (%"PRIu32"/4)",length);
+		eptr->mode=KILL;
+		return;
+	}
+	gen = get32bit(&data);
+	// all changes reported before checkpoint have to be applied before acknowledge
+	matocsserv_registration_merge(eptr,0xFFFFFFFF);
+	ptr = matocsserv_createpacket(eptr,MATOCS_REGISTER_CHECKPOINT_ACK,4);
+	put32bit(&ptr,gen);
+}
+
 void matocsserv_gotpacket(matocsserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
 	switch (type) {
 		case ANTOAN_NOP:
@@ -1471,6 +1918,9 @@ void matocsserv_gotpacket(matocsserventry *eptr,uint32_t type,const uint8_t *dat
 		case CSTOMA_REGISTER:
 			matocsserv_register(eptr,data,length);
 			break;
+		case CSTOMA_REGISTER_CHECKPOINT:
+			matocsserv_register_checkpoint(eptr,data,length);
+			break;
 		case CSTOMA_SPACE:
 			matocsserv_space(eptr,data,length);
 			break;
@@ -1521,6 +1971,7 @@ void matocsserv_term(void) {
 
 	eptr = matocsservhead;
 	while (eptr) {
+		matocsserv_registration_free(eptr);
 		if (eptr->inputpacket.packet) {
 			free(eptr->inputpacket.packet);
 		}
@@ -1542,6 +1993,20 @@ void matocsserv_term(void) {
 	}
 	matocsservhead=NULL;
 
+	eptr = matocsservdetached;
+	while (eptr) {
+		if (eptr->detachedops) {
+			free(eptr->detachedops);
+		}
+		if (eptr->servstrip) {
+			free(eptr->servstrip);
+		}
+		eaptr = eptr;
+		eptr = eptr->next;
+		free(eaptr);
+	}
+	matocsservdetached=NULL;
+
 	free(ListenHost);
 	free(ListenPort);
 }
@@ -1606,6 +2071,9 @@ void matocsserv_read(matocsserventry *eptr) {
 				free(eptr->inputpacket.packet);
 			}
 			eptr->inputpacket.packet=NULL;
+			if (eptr->reattachto) {	// rest of data will be read by detached entry
+				return;
+			}
 		}
 	}
 }
@@ -1713,6 +2181,19 @@ void matocsserv_serve(struct pollfd *pdesc) {
 			eptr->errorcounter=0;
 			eptr->rrepcounter=0;
 			eptr->wrepcounter=0;
+			eptr->reghead=NULL;
+			eptr->regtail=&(eptr->reghead);
+			eptr->regpending=0;
+			eptr->regmerged=0;
+			eptr->regended=0;
+			eptr->sessionid=0;
+			eptr->detachedtime=0;
+			eptr->delta=0;
+			eptr->deltarejected=0;
+			eptr->detachedops=NULL;
+			eptr->detachedopscnt=0;
+			eptr->detachedopssize=0;
+			eptr->reattachto=NULL;
 
 			eptr->carry=(double)(rndu32())/(double)(0xFFFFFFFFU);
 //				eptr->creation=NULL;
@@ -1746,14 +2227,53 @@ void matocsserv_serve(struct pollfd *pdesc) {
 		}
 	}
 	kptr = &matocsservhead;
+	while ((eptr=*kptr)) {
+		if (eptr->reattachto && eptr->mode!=KILL) {
+			*kptr = eptr->next;
+			matocsserv_reattach(eptr->reattachto,eptr);
+		} else {
+			kptr = &(eptr->next);
+		}
+	}
+	kptr = &matocsservhead;
 	while ((eptr=*kptr)) {
 		if (eptr->mode == KILL) {
 			double us,ts;
 			us = (double)(eptr->usedspace)/(double)(1024*1024*1024);
 			ts = (double)(eptr->totalspace)/(double)(1024*1024*1024);
 			syslog(LOG_NOTICE,"chunkserver disconnected - ip: %s, port: %"PRIu16", usedspace: %"PRIu64" (%.2lf GiB), totalspace: %"PRIu64" (%.2lf GiB)",eptr->servstrip,eptr->servport,eptr->usedspace,us,eptr->totalspace,ts);
+			matocsserv_registration_free(eptr);
 			matocsserv_replication_disconnected(eptr);
+			if (eptr->sessionid!=0 && DisconnectGraceTime>0 && eptr->delta==0) {
+				// keep chunks for a while - chunkserver can reconnect and send only changes
+				syslog(LOG_NOTICE,"chunkserver detached - ip: %s, port: %"PRIu16" - waiting %"PRIu32" seconds for reconnection",eptr->servstrip,eptr->servport,DisconnectGraceTime);
+				eptr->detachedtime = now;
+				chunk_server_detached(eptr);
+				tcpclose(eptr->sock);
+				if (eptr->inputpacket.packet) {
+					free(eptr->inputpacket.packet);
+				}
+				eptr->inputpacket.packet = NULL;
+				pptr = eptr->outputhead;
+				while (pptr) {
+					if (pptr->packet) {
+						free(pptr->packet);
+					}
+					paptr = pptr;
+					pptr = pptr->next;
+					free(paptr);
+				}
+				eptr->outputhead = NULL;
+				eptr->outputtail = &(eptr->outputhead);
+				*kptr = eptr->next;
+				eptr->next = matocsservdetached;
+				matocsservdetached = eptr;
+				continue;
+			}
 			chunk_server_disconnected(eptr);
+			if (eptr->detachedops) {
+				free(eptr->detachedops);
+			}
 			tcpclose(eptr->sock);
 			if (eptr->inputpacket.packet) {
 				free(eptr->inputpacket.packet);
@@ -1778,9 +2298,18 @@ void matocsserv_serve(struct pollfd *pdesc) {
 	}
 }
 
+void matocsserv_reload(void) {
+	RegisterTimeSlice = cfg_getuint32("CS_REGISTER_TIME_SLICE",20);
+	if (RegisterTimeSlice>1000) {
+		RegisterTimeSlice = 1000;
+	}
+	DisconnectGraceTime = cfg_getuint32("CS_DISCONNECT_GRACE_TIME",60);
+}
+
 int matocsserv_init(void) {
 	ListenHost = cfg_getstr("MATOCS_LISTEN_HOST","*");
 	ListenPort = cfg_getstr("MATOCS_LISTEN_PORT","9420");
+	matocsserv_reload();
 
 	lsock = tcpsocket();
 	if (lsock<0) {
@@ -1802,7 +2331,10 @@ int matocsserv_init(void) {
 	matocsserv_replication_init();
 	matocsservhead = NULL;
 	main_destructregister(matocsserv_term);
+	main_reloadregister(matocsserv_reload);
 	main_pollregister(matocsserv_desc,matocsserv_serve);
+	main_eachloopregister(matocsserv_registration_loop);
+	main_eachloopregister(matocsserv_detached_loop);
 	main_timeregister(TIMEMODE_SKIP_LATE,60,0,matocsserv_status);
 	return 0;
 }
@@ -28,10 +28,12 @@ uint16_t matocsserv_getservers_lessrepl(void* ptrs[65535],uint16_t replimit);
 void matocsserv_getspace(uint64_t *totalspace,uint64_t *availspace);
 char* matocsserv_getstrip(void *e);
 int matocsserv_getlocation(void *e,uint32_t *servip,uint16_t *servport);
+int matocsserv_isdetached(void *e);
 uint16_t matocsserv_replication_read_counter(void *e);
 uint16_t matocsserv_replication_write_counter(void *e);
-uint32_t matocsserv_cservlist_size(void);
-void matocsserv_cservlist_data(uint8_t *ptr);
+uint32_t matocsserv_cservlist_size(uint8_t extended);
+void matocsserv_cservlist_data(uint8_t *ptr,uint8_t extended);
+int matocsserv_registration_inprogress(void);
 int matocsserv_send_replicatechunk(void *e,uint64_t chunkid,uint32_t version,void *src);
 int matocsserv_send_replicatechunk_xor(void *e,uint64_t chunkid,uint32_t version,uint8_t cnt,void **src,uint64_t *srcchunkid,uint32_t *srcversion);
 //int matocsserv_send_replicatechunk(void *e,uint64_t chunkid,uint32_t version,uint32_t ip,uint16_t port);
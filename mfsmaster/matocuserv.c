@@ -49,6 +49,7 @@
 #include "sockets.h"
 #include "slogger.h"
 #include "massert.h"
+#include "lathist.h"
 
 #define MaxPacketSize 1000000
 
@@ -77,9 +78,13 @@ typedef struct chunklist {
 // opened files
 typedef struct filelist {
 	uint32_t inode;
+	uint32_t mark;		// used during synchronization with list sent by client
 	struct filelist *next;
 } filelist;
 
+#define OF_HASH(inode,size) (((inode)*0x4A4FECD1)&((size)-1))
+#define OF_MIN_HASHSIZE 16
+
 typedef struct session {
 	uint32_t sessionid;
 	char *info;
@@ -95,7 +100,11 @@ typedef struct session {
 	uint32_t nsocks;	// >0 - connected (number of active connections) ; 0 - not connected
 	uint32_t currentopstats[16];
 	uint32_t lasthouropstats[16];
-	filelist *openedfiles;
+	filelist **openedfiles;		// hash of opened files (NULL - nothing opened yet)
+	uint32_t ofhashsize;
+	uint32_t ofcount;
+	uint32_t ofmark;
+	struct session *hashnext;
 	struct session *next;
 } session;
 
@@ -114,6 +123,8 @@ typedef struct matocuserventry {
 	uint32_t lastread,lastwrite;		//time of last activity
 	uint32_t version;
 	uint32_t peerip;
+	uint64_t metaversion;			//metadata version last sent to client
+	uint64_t changeversion;			//metadata version after last change made by this client
 	uint8_t hdrbuff[8];
 	packetstruct inputpacket;
 	packetstruct *outputhead,**outputtail;
@@ -126,11 +137,86 @@ typedef struct matocuserventry {
 	struct matocuserventry *next;
 } matocuserventry;
 
+#define SESSION_HASHSIZE 4096
+#define SESSION_HASH(sessionid) ((sessionid)&(SESSION_HASHSIZE-1))
+
 static session *sessionshead=NULL;
+static session *sessionshash[SESSION_HASHSIZE];
 static matocuserventry *matocuservhead=NULL;
 static int lsock;
 static int32_t lsockpdescpos;
 static int exiting;
+static uint8_t sessionschanged;	// new sessions not stored yet
+static uint64_t opversion;	// metadata version before operation being served (changes made since then belong to its client)
+
+#define NOOPVERSION UINT64_C(0xFFFFFFFFFFFFFFFF)
+
+// latency histograms of client messages (created on first use)
+#define MSGHIST_FIRST CUTOMA_FUSE_REGISTER
+#define MSGHIST_COUNT (CUTOMA_STALL_INFO-CUTOMA_FUSE_REGISTER+1)
+static lathist *msghist[MSGHIST_COUNT];
+
+static const struct {
+	uint32_t type;
+	const char *name;
+} msgnames[] = {
+	{CUTOMA_FUSE_REGISTER,"register"},
+	{CUTOMA_FUSE_STATFS,"statfs"},
+	{CUTOMA_FUSE_ACCESS,"access"},
+	{CUTOMA_FUSE_LOOKUP,"lookup"},
+	{CUTOMA_FUSE_GETATTR,"getattr"},
+	{CUTOMA_FUSE_SETATTR,"setattr"},
+	{CUTOMA_FUSE_READLINK,"readlink"},
+	{CUTOMA_FUSE_SYMLINK,"symlink"},
+	{CUTOMA_FUSE_MKNOD,"mknod"},
+	{CUTOMA_FUSE_MKDIR,"mkdir"},
+	{CUTOMA_FUSE_UNLINK,"unlink"},
+	{CUTOMA_FUSE_RMDIR,"rmdir"},
+	{CUTOMA_FUSE_RENAME,"rename"},
+	{CUTOMA_FUSE_LINK,"link"},
+	{CUTOMA_FUSE_GETDIR,"readdir"},
+	{CUTOMA_FUSE_OPEN,"open"},
+	{CUTOMA_FUSE_READ_CHUNK,"read chunk"},
+	{CUTOMA_FUSE_WRITE_CHUNK,"write chunk"},
+	{CUTOMA_FUSE_WRITE_CHUNK_END,"write chunk end"},
+	{CUTOMA_FUSE_APPEND,"append"},
+	{CUTOMA_FUSE_CHECK,"check"},
+	{CUTOMA_FUSE_GETTRASHTIME,"gettrashtime"},
+	{CUTOMA_FUSE_SETTRASHTIME,"settrashtime"},
+	{CUTOMA_FUSE_GETGOAL,"getgoal"},
+	{CUTOMA_FUSE_SETGOAL,"setgoal"},
+	{CUTOMA_FUSE_GETTRASH,"gettrash"},
+	{CUTOMA_FUSE_GETDETACHEDATTR,"getdetachedattr"},
+	{CUTOMA_FUSE_GETTRASHPATH,"gettrashpath"},
+	{CUTOMA_FUSE_SETTRASHPATH,"settrashpath"},
+	{CUTOMA_FUSE_UNDEL,"undel"},
+	{CUTOMA_FUSE_PURGE,"purge"},
+	{CUTOMA_FUSE_GETDIRSTATS,"getdirstats"},
+	{CUTOMA_FUSE_TRUNCATE,"truncate"},
+	{CUTOMA_FUSE_REPAIR,"repair"},
+	{CUTOMA_FUSE_SNAPSHOT,"snapshot"},
+	{CUTOMA_FUSE_GETRESERVED,"getreserved"},
+	{CUTOMA_FUSE_GETEATTR,"geteattr"},
+	{CUTOMA_FUSE_SETEATTR,"seteattr"},
+	{CUTOMA_FUSE_QUOTACONTROL,"quotacontrol"},
+	{CUTOMA_FUSE_MINVERSION,"minversion"},
+	{CUTOMA_FUSE_READ_XOR_CHUNKS,"read xor chunks"},
+	{CUTOMA_FUSE_RESERVED_INODES,"reserved inodes"},
+	{CUTOMA_CSERV_LIST,"admin: cserv list"},
+	{CUTOAN_CHART,"admin: chart"},
+	{CUTOAN_CHART_DATA,"admin: chart data"},
+	{CUTOMA_SESSION_LIST,"admin: session list"},
+	{CUTOMA_INFO,"admin: info"},
+	{CUTOMA_FSTEST_INFO,"admin: fstest info"},
+	{CUTOMA_CHUNKSTEST_INFO,"admin: chunkstest info"},
+	{CUTOMA_CHUNKS_MATRIX,"admin: chunks matrix"},
+	{CUTOMA_QUOTA_INFO,"admin: quota info"},
+	{CUTOMA_EXPORTS_INFO,"admin: exports info"},
+	{CUTOMA_MLOG_LIST,"admin: mlog list"},
+	{CUTOMA_LATENCY_INFO,"admin: latency info"},
+	{CUTOMA_STALL_INFO,"admin: stall info"},
+	{0,NULL}
+};
 
 // from config
 static char *ListenHost;
@@ -138,6 +224,110 @@ static char *ListenPort;
 static uint32_t RejectOld;
 //static uint32_t Timeout;
 
+static inline void matocuserv_session_add(session *asesdata) {
+	uint32_t hash = SESSION_HASH(asesdata->sessionid);
+	asesdata->openedfiles = NULL;
+	asesdata->ofhashsize = 0;
+	asesdata->ofcount = 0;
+	asesdata->ofmark = 0;
+	asesdata->next = sessionshead;
+	sessionshead = asesdata;
+	asesdata->hashnext = sessionshash[hash];
+	sessionshash[hash] = asesdata;
+}
+
+static inline session* matocuserv_session_get(uint32_t sessionid) {
+	session *asesdata;
+	for (asesdata = sessionshash[SESSION_HASH(sessionid)] ; asesdata ; asesdata=asesdata->hashnext) {
+		if (asesdata->sessionid==sessionid) {
+			return asesdata;
+		}
+	}
+	return NULL;
+}
+
+static inline void matocuserv_session_hash_remove(session *asesdata) {
+	session **sesdata;
+	sesdata = sessionshash+SESSION_HASH(asesdata->sessionid);
+	while (*sesdata) {
+		if (*sesdata==asesdata) {
+			*sesdata = asesdata->hashnext;
+			return;
+		}
+		sesdata = &((*sesdata)->hashnext);
+	}
+}
+
+/* opened files */
+static inline filelist* matocuserv_openfile_find(session *cr,uint32_t inode) {
+	filelist *ofptr;
+	if (cr->openedfiles==NULL) {
+		return NULL;
+	}
+	for (ofptr = cr->openedfiles[OF_HASH(inode,cr->ofhashsize)] ; ofptr ; ofptr=ofptr->next) {
+		if (ofptr->inode==inode) {
+			return ofptr;
+		}
+	}
+	return NULL;
+}
+
+static void matocuserv_openfile_add(session *cr,uint32_t inode) {
+	filelist *ofptr,*ofnptr,**newhash;
+	uint32_t i,hash,newsize;
+
+	if (cr->ofcount>=cr->ofhashsize) {
+		newsize = (cr->ofhashsize)?(cr->ofhashsize*2):OF_MIN_HASHSIZE;
+		newhash = (filelist**)malloc(sizeof(filelist*)*newsize);
+		passert(newhash);
+		for (i=0 ; i<newsize ; i++) {
+			newhash[i] = NULL;
+		}
+		for (i=0 ; i<cr->ofhashsize ; i++) {
+			for (ofptr = cr->openedfiles[i] ; ofptr ; ofptr=ofnptr) {
+				ofnptr = ofptr->next;
+				hash = OF_HASH(ofptr->inode,newsize);
+				ofptr->next = newhash[hash];
+				newhash[hash] = ofptr;
+			}
+		}
+		if (cr->openedfiles) {
+			free(cr->openedfiles);
+		}
+		cr->openedfiles = newhash;
+		cr->ofhashsize = newsize;
+	}
+	ofptr = (filelist*)malloc(sizeof(filelist));
+	passert(ofptr);
+	hash = OF_HASH(inode,cr->ofhashsize);
+	ofptr->inode = inode;
+	ofptr->mark = cr->ofmark;
+	ofptr->next = cr->openedfiles[hash];
+	cr->openedfiles[hash] = ofptr;
+	cr->ofcount++;
+}
+
+// release (if needed) and free all opened files
+static void matocuserv_openfile_freeall(session *cr,uint8_t release) {
+	filelist *ofptr,*ofnptr;
+	uint32_t i;
+	for (i=0 ; i<cr->ofhashsize ; i++) {
+		for (ofptr = cr->openedfiles[i] ; ofptr ; ofptr=ofnptr) {
+			ofnptr = ofptr->next;
+			if (release) {
+				fs_release(ofptr->inode,cr->sessionid);
+			}
+			free(ofptr);
+		}
+	}
+	if (cr->openedfiles) {
+		free(cr->openedfiles);
+	}
+	cr->openedfiles = NULL;
+	cr->ofhashsize = 0;
+	cr->ofcount = 0;
+}
+
 /* new registration procedure */
 session* matocuserv_new_session(uint8_t newsession,uint8_t nonewid) {
 	session *asesdata;
@@ -157,13 +347,11 @@ session* matocuserv_new_session(uint8_t newsession,uint8_t nonewid) {
 	asesdata->mapallgid = 0;
 	asesdata->newsession = newsession;
 	asesdata->rootinode = MFS_ROOT_ID;
-	asesdata->openedfiles = NULL;
 	asesdata->disconnected = 0;
 	asesdata->nsocks = 1;
 	memset(asesdata->currentopstats,0,4*16);
 	memset(asesdata->lasthouropstats,0,4*16);
-	asesdata->next = sessionshead;
-	sessionshead = asesdata;
+	matocuserv_session_add(asesdata);
 	return asesdata;
 }
 
@@ -172,14 +360,12 @@ session* matocuserv_find_session(uint32_t sessionid) {
 	if (sessionid==0) {
 		return NULL;
 	}
-	for (asesdata = sessionshead ; asesdata ; asesdata=asesdata->next) {
-		if (asesdata->sessionid==sessionid) {
-			asesdata->nsocks++;
-			asesdata->disconnected = 0;
-			return asesdata;
-		}
+	asesdata = matocuserv_session_get(sessionid);
+	if (asesdata) {
+		asesdata->nsocks++;
+		asesdata->disconnected = 0;
 	}
-	return NULL;
+	return asesdata;
 }
 
 void matocuserv_store_sessions() {
@@ -190,6 +376,7 @@ void matocuserv_store_sessions() {
 	int i;
 	FILE *fd;
 
+	sessionschanged = 0;
 	fd = fopen("sessions.mfs.tmp","w");
 	if (fd==NULL) {
 		mfs_errlog_silent(LOG_WARNING,"can't store sessions, open error");
@@ -306,7 +493,6 @@ int matocuserv_load_sessions() {
 			}
 			asesdata->info = NULL;
 			asesdata->newsession = 1;
-			asesdata->openedfiles = NULL;
 			asesdata->disconnected = main_time();
 			asesdata->nsocks = 0;
 			for (i=0 ; i<16 ; i++) {
@@ -327,8 +513,7 @@ int matocuserv_load_sessions() {
 				}
 				asesdata->info[ileng]=0;
 			}
-			asesdata->next = sessionshead;
-			sessionshead = asesdata;
+			matocuserv_session_add(asesdata);
 		}
 		if (ferror(fd)) {
 			syslog(LOG_WARNING,"can't load sessions, fread error");
@@ -375,35 +560,22 @@ session* matocuserv_get_session(uint32_t sessionid) {
 */
 
 int matocuserv_insert_openfile(session* cr,uint32_t inode) {
-	filelist *ofptr,**ofpptr;
 	int status;
 
-	ofpptr = &(cr->openedfiles);
-	while ((ofptr=*ofpptr)) {
-		if (ofptr->inode==inode) {
-			return STATUS_OK;	// file already aquired - nothing to do
-		}
-		if (ofptr->inode>inode) {
-			break;
-		}
-		ofpptr = &(ofptr->next);
+	if (matocuserv_openfile_find(cr,inode)) {
+		return STATUS_OK;	// file already aquired - nothing to do
 	}
 	status = fs_aquire(inode,cr->sessionid);
 	if (status==STATUS_OK) {
-		ofptr = (filelist*)malloc(sizeof(filelist));
-		passert(ofptr);
-		ofptr->inode = inode;
-		ofptr->next = *ofpptr;
-		*ofpptr = ofptr;
+		matocuserv_openfile_add(cr,inode);
 	}
 	return status;
 }
 
 void matocuserv_init_sessions(uint32_t sessionid,uint32_t inode) {
 	session *asesdata;
-	filelist *ofptr,**ofpptr;
 
-	for (asesdata = sessionshead ; asesdata && asesdata->sessionid!=sessionid; asesdata=asesdata->next) ;
+	asesdata = matocuserv_session_get(sessionid);
 	if (asesdata==NULL) {
 		asesdata = (session*)malloc(sizeof(session));
 		passert(asesdata);
@@ -418,36 +590,37 @@ void matocuserv_init_sessions(uint32_t sessionid,uint32_t inode) {
 		asesdata->mapallgid = 0;
 		asesdata->newsession = 0;
 		asesdata->rootinode = MFS_ROOT_ID;
-		asesdata->openedfiles = NULL;
 		asesdata->disconnected = main_time();
 		asesdata->nsocks = 0;
 		memset(asesdata->currentopstats,0,4*16);
 		memset(asesdata->lasthouropstats,0,4*16);
-		asesdata->next = sessionshead;
-		sessionshead = asesdata;
+		matocuserv_session_add(asesdata);
 	}
 
-	ofpptr = &(asesdata->openedfiles);
-	while ((ofptr=*ofpptr)) {
-		if (ofptr->inode==inode) {
-			return;
-		}
-		if (ofptr->inode>inode) {
-			break;
-		}
-		ofpptr = &(ofptr->next);
+	if (matocuserv_openfile_find(asesdata,inode)==NULL) {
+		matocuserv_openfile_add(asesdata,inode);
 	}
-	ofptr = (filelist*)malloc(sizeof(filelist));
-	passert(ofptr);
-	ofptr->inode = inode;
-	ofptr->next = *ofpptr;
-	*ofpptr = ofptr;
 }
 
 uint8_t* matocuserv_createpacket(matocuserventry *eptr,uint32_t type,uint32_t size) {
 	packetstruct *outpacket;
 	uint8_t *ptr;
 	uint32_t psize;
+	uint64_t metaversion;
+
+	// let client know version of its own last change before it gets answer (used for reading from metaloggers)
+	if (eptr->registered==1 && eptr->version>=0x010615 && type!=ANTOAN_NOP) {
+		metaversion = fs_getversion();
+		if (opversion!=NOOPVERSION && metaversion>opversion) {
+			eptr->changeversion = metaversion;
+		}
+		if (eptr->changeversion>eptr->metaversion) {
+			eptr->metaversion = eptr->changeversion;
+			ptr = matocuserv_createpacket(eptr,MATOCU_FUSE_METAVERSION,12);
+			put32bit(&ptr,0);
+			put64bit(&ptr,eptr->metaversion);
+		}
+	}
 
 	outpacket=(packetstruct*)malloc(sizeof(packetstruct));
 	passert(outpacket);
@@ -477,7 +650,7 @@ int matocuserv_open_check(matocuserventry *eptr,uint32_t fid) {
 }
 */
 
-void matocuserv_chunk_status(uint64_t chunkid,uint8_t status) {
+void matocuserv_chunk_status_answer(uint64_t chunkid,uint8_t status) {
 	uint32_t qid,inode,uid,gid,auid,agid;
 	uint64_t fleng;
 	uint8_t type,attr[35];
@@ -580,16 +753,23 @@ void matocuserv_chunk_status(uint64_t chunkid,uint8_t status) {
 	}
 }
 
+void matocuserv_chunk_status(uint64_t chunkid,uint8_t status) {
+	opversion = fs_getversion();
+	matocuserv_chunk_status_answer(chunkid,status);
+	opversion = NOOPVERSION;
+}
+
 void matocuserv_cserv_list(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint8_t *ptr;
-	(void)data;
-	if (length!=0) {
-		syslog(LOG_NOTICE,"CUTOMA_CSERV_LIST - wrong size (%"PRIu32"/0)",length);
+	uint8_t extended;
+	if (length!=0 && length!=1) {
+		syslog(LOG_NOTICE,"CUTOMA_CSERV_LIST - wrong size (%"PRIu32"/0|1)",length);
 		eptr->mode = KILL;
 		return;
 	}
-	ptr = matocuserv_createpacket(eptr,MATOCU_CSERV_LIST,matocsserv_cservlist_size());
-	matocsserv_cservlist_data(ptr);
+	extended = (length==1)?get8bit(&data):0;
+	ptr = matocuserv_createpacket(eptr,MATOCU_CSERV_LIST,matocsserv_cservlist_size(extended));
+	matocsserv_cservlist_data(ptr,extended);
 }
 
 void matocuserv_session_list(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -702,23 +882,29 @@ void matocuserv_info(matocuserventry *eptr,const uint8_t *data,uint32_t length)
 	uint64_t totalspace,availspace,trspace,respace;
 	uint32_t trnodes,renodes,inodes,dnodes,fnodes;
 	uint32_t chunks,chunkcopies,tdcopies;
+	uint32_t dcentries,dchits,dcmisses,dcinvalidated,dcexpired;
+	uint8_t infover;
 	uint8_t *ptr;
 //#ifdef RUSAGE_SELF
 //	struct rusage r;
 //#endif
-	(void)data;
-	if (length!=0) {
-		syslog(LOG_NOTICE,"CUTOMA_INFO - wrong size (%"PRIu32"/0)",length);
+	if (length!=0 && length!=1) {
+		syslog(LOG_NOTICE,"CUTOMA_INFO - wrong size (%"PRIu32"/0|1)",length);
 		eptr->mode = KILL;
 		return;
 	}
+	if (length==1) {
+		infover = get8bit(&data);
+	} else {
+		infover = 0;
+	}
 //#ifdef RUSAGE_SELF
 //	getrusage(RUSAGE_SELF,&r);
 //	syslog(LOG_NOTICE,"maxrss: %lu",r.ru_maxrss);
 //#endif
 	fs_info(&totalspace,&availspace,&trspace,&trnodes,&respace,&renodes,&inodes,&dnodes,&fnodes);
 	chunk_info(&chunks,&chunkcopies,&tdcopies);
-	ptr = matocuserv_createpacket(eptr,MATOCU_INFO,68);
+	ptr = matocuserv_createpacket(eptr,MATOCU_INFO,(infover>=1)?88:68);
 	/* put32bit(&buff,VERSION): */
 	put16bit(&ptr,VERSMAJ);
 	put8bit(&ptr,VERSMID);
@@ -736,6 +922,14 @@ void matocuserv_info(matocuserventry *eptr,const uint8_t *data,uint32_t length)
 	put32bit(&ptr,chunks);
 	put32bit(&ptr,chunkcopies);
 	put32bit(&ptr,tdcopies);
+	if (infover>=1) {
+		dcm_info(&dcentries,&dchits,&dcmisses,&dcinvalidated,&dcexpired);
+		put32bit(&ptr,dcentries);
+		put32bit(&ptr,dchits);
+		put32bit(&ptr,dcmisses);
+		put32bit(&ptr,dcinvalidated);
+		put32bit(&ptr,dcexpired);
+	}
 }
 
 void matocuserv_fstest_info(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -830,6 +1024,30 @@ void matocuserv_mlog_list(matocuserventry *eptr,const uint8_t *data,uint32_t len
 	matomlserv_mloglist_data(ptr);
 }
 
+void matocuserv_latency_info(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint8_t *ptr;
+	(void)data;
+	if (length!=0) {
+		syslog(LOG_NOTICE,"CUTOMA_LATENCY_INFO - wrong size (%"PRIu32"/0)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	ptr = matocuserv_createpacket(eptr,MATOCU_LATENCY_INFO,lathist_info_size());
+	lathist_info_data(ptr);
+}
+
+void matocuserv_stall_info(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint8_t *ptr;
+	(void)data;
+	if (length!=0) {
+		syslog(LOG_NOTICE,"CUTOMA_STALL_INFO - wrong size (%"PRIu32"/0)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	ptr = matocuserv_createpacket(eptr,MATOCU_STALL_INFO,main_stall_info_size());
+	main_stall_info_data(ptr);
+}
+
 void matocuserv_fuse_register(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
 	const uint8_t *rptr;
 	uint8_t *wptr;
@@ -1027,7 +1245,7 @@ void matocuserv_fuse_register(matocuserventry *eptr,const uint8_t *data,uint32_t
 						eptr->sesdata->info[ileng]=0;
 					}
 				}
-				matocuserv_store_sessions();
+				sessionschanged = 1;
 			}
 			wptr = matocuserv_createpacket(eptr,MATOCU_FUSE_REGISTER,(status==STATUS_OK)?((eptr->version>=0x010601)?21:13):1);
 			if (status!=STATUS_OK) {
@@ -1090,7 +1308,7 @@ void matocuserv_fuse_register(matocuserventry *eptr,const uint8_t *data,uint32_t
 						eptr->sesdata->info[ileng]=0;
 					}
 				}
-				matocuserv_store_sessions();
+				sessionschanged = 1;
 			}
 			wptr = matocuserv_createpacket(eptr,MATOCU_FUSE_REGISTER,(status==STATUS_OK)?5:1);
 			if (status!=STATUS_OK) {
@@ -1142,7 +1360,8 @@ void matocuserv_fuse_register(matocuserventry *eptr,const uint8_t *data,uint32_t
 void matocuserv_fuse_reserved_inodes(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
 	const uint8_t *ptr;
 	filelist *ofptr,**ofpptr;
-	uint32_t inode;
+	session *cr;
+	uint32_t inode,i;
 
 	if ((length&0x3)!=0) {
 		syslog(LOG_NOTICE,"CUTOMA_FUSE_RESERVED_INODES - wrong size (%"PRIu32"/N*4)",length);
@@ -1151,68 +1370,36 @@ void matocuserv_fuse_reserved_inodes(matocuserventry *eptr,const uint8_t *data,u
 	}
 
 	ptr = data;
-//	endptr = ptr + length;
-	ofpptr = &(eptr->sesdata->openedfiles);
+	cr = eptr->sesdata;
 	length >>= 2;
-	if (length) {
+	// mark files from client list (aquire new ones), then release all files not marked
+	cr->ofmark++;
+	while (length) {
 		length--;
 		inode = get32bit(&ptr);
-	} else {
-		inode=0;
-	}
-
-	while ((ofptr=*ofpptr) && inode>0) {
-		if (ofptr->inode<inode) {
-			fs_release(ofptr->inode,eptr->sesdata->sessionid);
-			*ofpptr = ofptr->next;
-			free(ofptr);
-		} else if (ofptr->inode>inode) {
-			if (fs_aquire(inode,eptr->sesdata->sessionid)==STATUS_OK) {
-				ofptr = (filelist*)malloc(sizeof(filelist));
-				passert(ofptr);
-				ofptr->next = *ofpptr;
-				ofptr->inode = inode;
-				*ofpptr = ofptr;
-				ofpptr = &(ofptr->next);
-			}
-			if (length) {
-				length--;
-				inode = get32bit(&ptr);
+		if (inode==0) {
+			continue;
+		}
+		ofptr = matocuserv_openfile_find(cr,inode);
+		if (ofptr) {
+			ofptr->mark = cr->ofmark;
+		} else if (fs_aquire(inode,cr->sessionid)==STATUS_OK) {
+			matocuserv_openfile_add(cr,inode);
+		}
+	}
+	for (i=0 ; i<cr->ofhashsize ; i++) {
+		ofpptr = cr->openedfiles+i;
+		while ((ofptr=*ofpptr)) {
+			if (ofptr->mark!=cr->ofmark) {
+				fs_release(ofptr->inode,cr->sessionid);
+				*ofpptr = ofptr->next;
+				free(ofptr);
+				cr->ofcount--;
 			} else {
-				inode=0;
-			}
-		} else {
-			ofpptr = &(ofptr->next);
-			if (length) {
-				length--;
-				inode = get32bit(&ptr);
-			} else {
-				inode=0;
+				ofpptr = &(ofptr->next);
 			}
 		}
 	}
-	while (inode>0) {
-		if (fs_aquire(inode,eptr->sesdata->sessionid)==STATUS_OK) {
-			ofptr = (filelist*)malloc(sizeof(filelist));
-			passert(ofptr);
-			ofptr->next = *ofpptr;
-			ofptr->inode = inode;
-			*ofpptr = ofptr;
-			ofpptr = &(ofptr->next);
-		}
-		if (length) {
-			length--;
-			inode = get32bit(&ptr);
-		} else {
-			inode=0;
-		}
-	}
-	while ((ofptr=*ofpptr)) {
-		fs_release(ofptr->inode,eptr->sesdata->sessionid);
-		*ofpptr = ofptr->next;
-		free(ofptr);
-	}
-
 }
 
 static inline void matocuserv_ugid_remap(matocuserventry *eptr,uint32_t *auid,uint32_t *agid) {
@@ -1937,6 +2124,44 @@ void matocuserv_fuse_read_chunk(matocuserventry *eptr,const uint8_t *data,uint32
 	}
 }
 
+void matocuserv_fuse_read_xor_chunks(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint8_t *ptr;
+	uint8_t status;
+	uint32_t inode;
+	uint32_t indx;
+	uint64_t chunkid;
+	uint64_t fleng;
+	uint32_t msgid;
+	uint32_t leng;
+	uint8_t xorloc[CHUNK_XOR_LOCSIZE];
+	if (length!=12) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_READ_XOR_CHUNKS - wrong size (%"PRIu32"/12)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	msgid = get32bit(&data);
+	inode = get32bit(&data);
+	indx = get32bit(&data);
+	status = fs_readchunk(inode,indx,&chunkid,&fleng);
+	if (status==STATUS_OK) {
+		if (chunkid>0) {
+			status = chunk_xor_getlocations(chunkid,eptr->peerip,xorloc,&leng);
+		} else {
+			status = ERROR_NOCHUNK;
+		}
+	}
+	if (status!=STATUS_OK) {
+		ptr = matocuserv_createpacket(eptr,MATOCU_FUSE_READ_XOR_CHUNKS,5);
+		put32bit(&ptr,msgid);
+		put8bit(&ptr,status);
+		return;
+	}
+	ptr = matocuserv_createpacket(eptr,MATOCU_FUSE_READ_XOR_CHUNKS,12+leng);
+	put32bit(&ptr,msgid);
+	put64bit(&ptr,chunkid);
+	memcpy(ptr,xorloc,leng);
+}
+
 void matocuserv_fuse_write_chunk(matocuserventry *eptr,const uint8_t *data,uint32_t length) {
 	uint8_t *ptr;
 	uint8_t status;
@@ -2685,15 +2910,7 @@ void matocuserv_fuse_getreserved(matocuserventry *eptr,const uint8_t *data,uint3
 
 
 void matocu_session_timedout(session *sesdata) {
-	filelist *fl,*afl;
-	fl=sesdata->openedfiles;
-	while (fl) {
-		afl = fl;
-		fl=fl->next;
-		fs_release(afl->inode,sesdata->sessionid);
-		free(afl);
-	}
-	sesdata->openedfiles=NULL;
+	matocuserv_openfile_freeall(sesdata,1);
 	if (sesdata->info) {
 		free(sesdata->info);
 	}
@@ -2708,6 +2925,7 @@ void matocu_session_check(void) {
 	while ((asesdata=*sesdata)) {
 		if (asesdata->nsocks==0 && ((asesdata->newsession && asesdata->disconnected+NEWSESSION_TIMEOUT<now) || (asesdata->newsession==0 && asesdata->disconnected+OLDSESSION_TIMEOUT<now))) {
 			matocu_session_timedout(asesdata);
+			matocuserv_session_hash_remove(asesdata);
 			*sesdata = asesdata->next;
 			free(asesdata);
 		} else {
@@ -2716,6 +2934,13 @@ void matocu_session_check(void) {
 	}
 }
 
+// sessions file is rewritten at most once per second (not after every registration - important when many mounts reconnect at once)
+void matocu_session_storechanged(void) {
+	if (sessionschanged) {
+		matocuserv_store_sessions();
+	}
+}
+
 void matocu_session_statsmove(void) {
 	session *sesdata;
 	for (sesdata = sessionshead ; sesdata ; sesdata=sesdata->next) {
@@ -2748,10 +2973,7 @@ void matocu_beforedisconnect(matocuserventry *eptr) {
 	}
 }
 
-void matocuserv_gotpacket(matocuserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
-	if (type==ANTOAN_NOP) {
-		return;
-	}
+void matocuserv_dispatch(matocuserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
 	if (eptr->registered==0) {	// sesdata is NULL
 		switch (type) {
 			case CUTOMA_FUSE_REGISTER:
@@ -2790,6 +3012,12 @@ void matocuserv_gotpacket(matocuserventry *eptr,uint32_t type,const uint8_t *dat
 			case CUTOMA_MLOG_LIST:
 				matocuserv_mlog_list(eptr,data,length);
 				break;
+			case CUTOMA_LATENCY_INFO:
+				matocuserv_latency_info(eptr,data,length);
+				break;
+			case CUTOMA_STALL_INFO:
+				matocuserv_stall_info(eptr,data,length);
+				break;
 			default:
 				syslog(LOG_NOTICE,"matocu: got unknown message from unregistered (type:%"PRIu32")",type);
 				eptr->mode=KILL;
@@ -2852,6 +3080,9 @@ void matocuserv_gotpacket(matocuserventry *eptr,uint32_t type,const uint8_t *dat
 			case CUTOMA_FUSE_READ_CHUNK:
 				matocuserv_fuse_read_chunk(eptr,data,length);
 				break;
+			case CUTOMA_FUSE_READ_XOR_CHUNKS:
+				matocuserv_fuse_read_xor_chunks(eptr,data,length);
+				break;
 			case CUTOMA_FUSE_WRITE_CHUNK:
 				matocuserv_fuse_write_chunk(eptr,data,length);
 				break;
@@ -2969,15 +3200,51 @@ void matocuserv_gotpacket(matocuserventry *eptr,uint32_t type,const uint8_t *dat
 	}
 }
 
+void matocuserv_gotpacket(matocuserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
+	uint64_t tstart;
+	lathist *h;
+	uint32_t i;
+	char *name;
+	if (type==ANTOAN_NOP) {
+		return;
+	}
+	tstart = lathist_usec();
+	opversion = fs_getversion();
+	matocuserv_dispatch(eptr,type,data,length);
+	if (fs_getversion()>opversion) {	// changed without answer (delayed) - version will be sent with next packet
+		eptr->changeversion = fs_getversion();
+	}
+	opversion = NOOPVERSION;
+	if (type<MSGHIST_FIRST || type>=MSGHIST_FIRST+MSGHIST_COUNT) {
+		return;
+	}
+	h = msghist[type-MSGHIST_FIRST];
+	if (h==NULL) {
+		for (i=0 ; msgnames[i].name!=NULL && msgnames[i].type!=type ; i++) {}
+		if (msgnames[i].name==NULL) {	// message missing in msgnames - named by its number
+			if (eptr->mode==KILL) {	// unknown message
+				return;
+			}
+			name = malloc(20);
+			passert(name);
+			snprintf(name,20,"message %"PRIu32,type);
+			h = msghist[type-MSGHIST_FIRST] = lathist_new(LATHIST_GROUP_MESSAGE,name);
+		} else {
+			h = msghist[type-MSGHIST_FIRST] = lathist_new(LATHIST_GROUP_MESSAGE,msgnames[i].name);
+		}
+	}
+	lathist_add(h,tstart,lathist_usec());
+}
+
 void matocuserv_term(void) {
 	matocuserventry *eptr,*eptrn;
 	packetstruct *pptr,*pptrn;
 	chunklist *cl,*cln;
 	session *ss,*ssn;
-	filelist *of,*ofn;
 
 	syslog(LOG_NOTICE,"matocu: closing %s:%s",ListenHost,ListenPort);
 	tcpclose(lsock);
+	matocu_session_storechanged();
 
 	for (eptr = matocuservhead ; eptr ; eptr = eptrn) {
 		eptrn = eptr->next;
@@ -2999,10 +3266,7 @@ void matocuserv_term(void) {
 	}
 	for (ss = sessionshead ; ss ; ss = ssn) {
 		ssn = ss->next;
-		for (of = ss->openedfiles ; of ; of = ofn) {
-			ofn = of->next;
-			free(of);
-		}
+		matocuserv_openfile_freeall(ss,0);
 		if (ss->info) {
 			free(ss->info);
 		}
@@ -3196,6 +3460,8 @@ void matocuserv_serve(struct pollfd *pdesc) {
 			tcpgetpeer(ns,&(eptr->peerip),NULL);
 			eptr->registered = 0;
 			eptr->version = 0;
+			eptr->metaversion = 0;
+			eptr->changeversion = 0;
 			eptr->mode = HEADER;
 			eptr->lastread = now;
 			eptr->lastwrite = now;
@@ -3264,9 +3530,13 @@ void matocuserv_serve(struct pollfd *pdesc) {
 }
 
 int matocuserv_sessionsinit(void) {
+	uint32_t i;
 	fprintf(stderr,"loading sessions ... ");
 	fflush(stderr);
 	sessionshead = NULL;
+	for (i=0 ; i<SESSION_HASHSIZE ; i++) {
+		sessionshash[i] = NULL;
+	}
 	switch (matocuserv_load_sessions()) {
 		case 0:	// no file
 			fprintf(stderr,"file not found\n");
@@ -3291,6 +3561,7 @@ int matocuserv_networkinit(void) {
 	RejectOld = cfg_getuint32("REJECT_OLD_CLIENTS",0);
 
 	exiting = 0;
+	opversion = NOOPVERSION;
 	lsock = tcpsocket();
 	if (lsock<0) {
 		mfs_errlog(LOG_ERR,"main master server module: can't create socket");
@@ -3310,6 +3581,7 @@ int matocuserv_networkinit(void) {
 
 	matocuservhead = NULL;
 
+	main_timeregister(TIMEMODE_RUN_LATE,1,0,matocu_session_storechanged);
 	main_timeregister(TIMEMODE_RUN_LATE,10,0,matocu_session_check);
 	main_timeregister(TIMEMODE_RUN_LATE,3600,0,matocu_session_statsmove);
 	main_destructregister(matocuserv_term);
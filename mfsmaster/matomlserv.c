@@ -30,6 +30,9 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
 
 #include "MFSCommunication.h"
 
@@ -44,6 +47,11 @@
 
 #define MaxPacketSize 1500000
 
+// max number of not answered MLTOMA_DOWNLOAD_DATA requests
+#define DL_MAXQUEUE 32
+// max length of requested block
+#define DL_MAXBLOCK 1000000
+
 // matomlserventry.mode
 enum{KILL,HEADER,DATA};
 
@@ -54,6 +62,12 @@ typedef struct packetstruct {
 	uint8_t *packet;
 } packetstruct;
 
+typedef struct dlrequest {
+	uint64_t offset;
+	uint32_t leng;
+	uint8_t flags;
+} dlrequest;
+
 typedef struct matomlserventry {
 	uint8_t mode;
 	int sock;
@@ -71,6 +85,9 @@ typedef struct matomlserventry {
 
 	int metafd,chain1fd,chain2fd;
 
+	dlrequest dlqueue[DL_MAXQUEUE];
+	uint8_t dlqhead,dlqcount;
+
 	struct matomlserventry *next;
 } matomlserventry;
 
@@ -78,6 +95,12 @@ static matomlserventry *matomlservhead=NULL;
 static int lsock;
 static int32_t lsockpdescpos;
 
+static uint8_t *dlbuff=NULL;
+#ifdef HAVE_ZLIB_H
+static uint8_t *dlzbuff=NULL;
+static uLongf dlzbuffsize=0;
+#endif
+
 // from config
 static char *ListenHost;
 static char *ListenPort;
@@ -208,6 +231,9 @@ void matomlserv_download_start(matomlserventry *eptr,const uint8_t *data,uint32_
 		return;
 	}
 	filenum = get8bit(&data);
+	// requests of previous download are dropped
+	eptr->dlqhead = 0;
+	eptr->dlqcount = 0;
 	if (filenum==1 || filenum==2) {
 		if (eptr->metafd>=0) {
 			close(eptr->metafd);
@@ -261,14 +287,13 @@ void matomlserv_download_start(matomlserventry *eptr,const uint8_t *data,uint32_
 }
 
 void matomlserv_download_data(matomlserventry *eptr,const uint8_t *data,uint32_t length) {
-	uint8_t *ptr;
+	dlrequest *req;
 	uint64_t offset;
 	uint32_t leng;
-	uint32_t crc;
-	ssize_t ret;
+	uint8_t flags;
 
-	if (length!=12) {
-		syslog(LOG_NOTICE,"MLTOMA_DOWNLOAD_DATA - wrong size (%"PRIu32"/12)",length);
+	if (length!=12 && length!=13) {
+		syslog(LOG_NOTICE,"MLTOMA_DOWNLOAD_DATA - wrong size (%"PRIu32"/12|13)",length);
 		eptr->mode=KILL;
 		return;
 	}
@@ -279,22 +304,80 @@ void matomlserv_download_data(matomlserventry *eptr,const uint8_t *data,uint32_t
 	}
 	offset = get64bit(&data);
 	leng = get32bit(&data);
-	ptr = matomlserv_createpacket(eptr,MATOML_DOWNLOAD_DATA,16+leng);
-	put64bit(&ptr,offset);
-	put32bit(&ptr,leng);
+	if (length==13) {
+		flags = get8bit(&data);
+	} else {
+		flags = 0;
+	}
+	if (leng>DL_MAXBLOCK) {
+		syslog(LOG_NOTICE,"MLTOMA_DOWNLOAD_DATA - block too long (%"PRIu32"/%u)",leng,DL_MAXBLOCK);
+		eptr->mode=KILL;
+		return;
+	}
+	if (eptr->dlqcount>=DL_MAXQUEUE) {
+		syslog(LOG_NOTICE,"MLTOMA_DOWNLOAD_DATA - too many requests");
+		eptr->mode=KILL;
+		return;
+	}
+	req = eptr->dlqueue + ((eptr->dlqhead+eptr->dlqcount)%DL_MAXQUEUE);
+	req->offset = offset;
+	req->leng = leng;
+	req->flags = flags;
+	eptr->dlqcount++;
+}
+
+// answers are prepared here (one block at a time), not when requests arrive,
+// so a metalogger with many outstanding requests neither holds many megabytes
+// of output buffers nor blocks the main loop with a long series of reads
+void matomlserv_download_send(matomlserventry *eptr) {
+	dlrequest *req;
+	uint8_t *ptr;
+	uint32_t crc;
+	ssize_t ret;
+
+	req = eptr->dlqueue + eptr->dlqhead;
+	eptr->dlqhead = (eptr->dlqhead+1)%DL_MAXQUEUE;
+	eptr->dlqcount--;
+	if (dlbuff==NULL) {
+		dlbuff = malloc(DL_MAXBLOCK);
+		passert(dlbuff);
+	}
 #ifdef HAVE_PREAD
-	ret = pread(eptr->metafd,ptr+4,leng,offset);
+	ret = pread(eptr->metafd,dlbuff,req->leng,req->offset);
 #else /* HAVE_PWRITE */
-	lseek(eptr->metafd,offset,SEEK_SET);
-	ret = read(eptr->metafd,ptr+4,leng);
+	lseek(eptr->metafd,req->offset,SEEK_SET);
+	ret = read(eptr->metafd,dlbuff,req->leng);
 #endif /* HAVE_PWRITE */
-	if (ret!=(ssize_t)leng) {
+	if (ret!=(ssize_t)(req->leng)) {
 		mfs_errlog_silent(LOG_NOTICE,"error reading metafile");
 		eptr->mode=KILL;
 		return;
 	}
-	crc = mycrc32(0,ptr+4,leng);
+	crc = mycrc32(0,dlbuff,req->leng);
+#ifdef HAVE_ZLIB_H
+	if ((req->flags&1) && req->leng>0) {
+		uLongf zleng;
+		if (dlzbuff==NULL) {
+			dlzbuffsize = compressBound(DL_MAXBLOCK);
+			dlzbuff = malloc(dlzbuffsize);
+			passert(dlzbuff);
+		}
+		zleng = dlzbuffsize;
+		if (compress2(dlzbuff,&zleng,dlbuff,req->leng,Z_BEST_SPEED)==Z_OK && zleng<req->leng) {
+			ptr = matomlserv_createpacket(eptr,MATOML_DOWNLOAD_ZDATA,16+zleng);
+			put64bit(&ptr,req->offset);
+			put32bit(&ptr,req->leng);
+			put32bit(&ptr,crc);
+			memcpy(ptr,dlzbuff,zleng);
+			return;
+		}
+	}
+#endif
+	ptr = matomlserv_createpacket(eptr,MATOML_DOWNLOAD_DATA,16+req->leng);
+	put64bit(&ptr,req->offset);
+	put32bit(&ptr,req->leng);
 	put32bit(&ptr,crc);
+	memcpy(ptr,dlbuff,req->leng);
 }
 
 void matomlserv_download_end(matomlserventry *eptr,const uint8_t *data,uint32_t length) {
@@ -304,6 +387,8 @@ void matomlserv_download_end(matomlserventry *eptr,const uint8_t *data,uint32_t
 		eptr->mode=KILL;
 		return;
 	}
+	eptr->dlqhead = 0;
+	eptr->dlqcount = 0;
 	if (eptr->metafd>=0) {
 		close(eptr->metafd);
 		eptr->metafd=-1;
@@ -399,6 +484,16 @@ void matomlserv_term(void) {
 	}
 	matomlservhead=NULL;
 
+	if (dlbuff) {
+		free(dlbuff);
+		dlbuff=NULL;
+	}
+#ifdef HAVE_ZLIB_H
+	if (dlzbuff) {
+		free(dlzbuff);
+		dlzbuff=NULL;
+	}
+#endif
 	free(ListenHost);
 	free(ListenPort);
 }
@@ -508,7 +603,7 @@ void matomlserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
 		pdesc[pos].fd = eptr->sock;
 		pdesc[pos].events = POLLIN;
 		eptr->pdescpos = pos;
-		if (eptr->outputhead!=NULL) {
+		if (eptr->outputhead!=NULL || eptr->dlqcount>0) {
 			pdesc[pos].events |= POLLOUT;
 		}
 		pos++;
@@ -552,6 +647,8 @@ void matomlserv_serve(struct pollfd *pdesc) {
 			eptr->metafd=-1;
 			eptr->chain1fd=-1;
 			eptr->chain2fd=-1;
+			eptr->dlqhead=0;
+			eptr->dlqcount=0;
 		}
 	}
 	for (eptr=matomlservhead ; eptr ; eptr=eptr->next) {
@@ -568,6 +665,10 @@ void matomlserv_serve(struct pollfd *pdesc) {
 				matomlserv_write(eptr);
 			}
 		}
+		// keep at most two download blocks in the output queue
+		if (eptr->mode!=KILL && eptr->dlqcount>0 && (eptr->outputhead==NULL || eptr->outputhead->next==NULL)) {
+			matomlserv_download_send(eptr);
+		}
 		if ((uint32_t)(eptr->lastread+eptr->timeout)<(uint32_t)now) {
 			eptr->mode = KILL;
 		}
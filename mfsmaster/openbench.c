@@ -0,0 +1,394 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// open/release benchmark - many sessions opening the same set of files on running master
+// not built by default: "make -C mfsmaster mfsopenbench"
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "MFSCommunication.h"
+#include "datapack.h"
+#include "sockets.h"
+#include "strerr.h"
+
+#define BATCH 256
+
+static uint8_t *buff;
+static uint32_t buffsize;
+
+static double bench_now(void) {
+	struct timeval tv;
+	gettimeofday(&tv,NULL);
+	return tv.tv_sec+tv.tv_usec/1000000.0;
+}
+
+// receive answer of given type - skip nops and metadata version notifications
+static int32_t bench_recv(int fd,uint32_t type) {
+	uint8_t hdr[8];
+	const uint8_t *rptr;
+	uint32_t cmd,leng;
+	for (;;) {
+		if (tcptoread(fd,hdr,8,10000)!=8) {
+			fprintf(stderr,"error receiving data from mfsmaster: %s\n",strerr(errno));
+			return -1;
+		}
+		rptr = hdr;
+		cmd = get32bit(&rptr);
+		leng = get32bit(&rptr);
+		if (leng>buffsize) {
+			buffsize = leng;
+			buff = realloc(buff,buffsize);
+			if (buff==NULL) {
+				fprintf(stderr,"out of memory\n");
+				return -1;
+			}
+		}
+		if (leng>0 && tcptoread(fd,buff,leng,10000)!=(int32_t)leng) {
+			fprintf(stderr,"error receiving data from mfsmaster: %s\n",strerr(errno));
+			return -1;
+		}
+		if (cmd==type) {
+			return leng;
+		}
+		if (cmd!=ANTOAN_NOP && cmd!=MATOCU_FUSE_METAVERSION) {
+			fprintf(stderr,"got unexpected packet from mfsmaster (type:%"PRIu32")\n",cmd);
+			return -1;
+		}
+	}
+}
+
+// idle sessions have to send nops like mfsmount does - otherwise master closes them
+static void bench_nops(const int *fds,uint32_t sessions) {
+	static double lastnop=0.0;
+	uint8_t nop[8];
+	uint8_t *wptr;
+	uint32_t i;
+	if (bench_now()-lastnop<1.0) {
+		return;
+	}
+	wptr = nop;
+	put32bit(&wptr,ANTOAN_NOP);
+	put32bit(&wptr,0);
+	for (i=0 ; i<sessions ; i++) {
+		tcptowrite(fds[i],nop,8,1000);
+	}
+	lastnop = bench_now();
+}
+
+static int bench_connect(uint32_t ip,uint16_t port) {
+	uint8_t regbuff[8+64+13+10+2];
+	uint8_t *wptr;
+	int fd;
+
+	fd = tcpsocket();
+	if (fd<0) {
+		fprintf(stderr,"can't create socket: %s\n",strerr(errno));
+		return -1;
+	}
+	tcpnodelay(fd);
+	if (tcpnumconnect(fd,ip,port)<0) {
+		fprintf(stderr,"can't connect to mfsmaster: %s\n",strerr(errno));
+		tcpclose(fd);
+		return -1;
+	}
+	wptr = regbuff;
+	put32bit(&wptr,CUTOMA_FUSE_REGISTER);
+	put32bit(&wptr,64+13+10+2);
+	memcpy(wptr,FUSE_REGISTER_BLOB_ACL,64);
+	wptr+=64;
+	put8bit(&wptr,REGISTER_NEWSESSION);
+	put16bit(&wptr,VERSMAJ);
+	put8bit(&wptr,VERSMID);
+	put8bit(&wptr,VERSMIN);
+	put32bit(&wptr,10);
+	memcpy(wptr,"openbench",10);
+	wptr+=10;
+	put32bit(&wptr,2);
+	memcpy(wptr,"/",2);
+	if (tcptowrite(fd,regbuff,sizeof(regbuff),10000)!=sizeof(regbuff) || bench_recv(fd,MATOCU_FUSE_REGISTER)<=1) {
+		fprintf(stderr,"can't register session\n");
+		tcpclose(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// mknod (or lookup existing) file in root directory
+static int bench_mkfile(int fd,uint32_t n,uint32_t *inode) {
+	uint8_t wbuff[8+4+4+1+32+1+2+4+4+4];
+	uint8_t *wptr;
+	const uint8_t *rptr;
+	char name[32];
+	uint8_t nleng;
+	int32_t leng;
+
+	nleng = snprintf(name,32,"openbench.%"PRIu32,n);
+	wptr = wbuff;
+	put32bit(&wptr,CUTOMA_FUSE_MKNOD);
+	put32bit(&wptr,4+4+1+nleng+1+2+4+4+4);
+	put32bit(&wptr,0);
+	put32bit(&wptr,MFS_ROOT_ID);
+	put8bit(&wptr,nleng);
+	memcpy(wptr,name,nleng);
+	wptr+=nleng;
+	put8bit(&wptr,TYPE_FILE);
+	put16bit(&wptr,0644);
+	put32bit(&wptr,0);
+	put32bit(&wptr,0);
+	put32bit(&wptr,0);
+	if (tcptowrite(fd,wbuff,wptr-wbuff,10000)!=wptr-wbuff || (leng=bench_recv(fd,MATOCU_FUSE_MKNOD))<0) {
+		return -1;
+	}
+	if (leng==5 && buff[4]==ERROR_EEXIST) {
+		wptr = wbuff;
+		put32bit(&wptr,CUTOMA_FUSE_LOOKUP);
+		put32bit(&wptr,4+4+1+nleng+4+4);
+		put32bit(&wptr,0);
+		put32bit(&wptr,MFS_ROOT_ID);
+		put8bit(&wptr,nleng);
+		memcpy(wptr,name,nleng);
+		wptr+=nleng;
+		put32bit(&wptr,0);
+		put32bit(&wptr,0);
+		if (tcptowrite(fd,wbuff,wptr-wbuff,10000)!=wptr-wbuff || (leng=bench_recv(fd,MATOCU_FUSE_LOOKUP))<0) {
+			return -1;
+		}
+	}
+	if (leng<8) {
+		fprintf(stderr,"can't create file %s (status: %"PRIu8")\n",name,(leng==5)?buff[4]:0);
+		return -1;
+	}
+	rptr = buff+4;
+	*inode = get32bit(&rptr);
+	return 0;
+}
+
+static int bench_unlink(int fd,uint32_t n) {
+	uint8_t wbuff[8+4+4+1+32+4+4];
+	uint8_t *wptr;
+	char name[32];
+	uint8_t nleng;
+
+	nleng = snprintf(name,32,"openbench.%"PRIu32,n);
+	wptr = wbuff;
+	put32bit(&wptr,CUTOMA_FUSE_UNLINK);
+	put32bit(&wptr,4+4+1+nleng+4+4);
+	put32bit(&wptr,0);
+	put32bit(&wptr,MFS_ROOT_ID);
+	put8bit(&wptr,nleng);
+	memcpy(wptr,name,nleng);
+	wptr+=nleng;
+	put32bit(&wptr,0);
+	put32bit(&wptr,0);
+	if (tcptowrite(fd,wbuff,wptr-wbuff,10000)!=wptr-wbuff || bench_recv(fd,MATOCU_FUSE_UNLINK)<0) {
+		return -1;
+	}
+	return 0;
+}
+
+// open files [from,to) - requests are sent in batches to keep master busy
+static int bench_open(int fd,const uint32_t *inodes,uint32_t from,uint32_t to) {
+	uint8_t wbuff[BATCH*(8+17)];
+	uint8_t *wptr;
+	uint32_t i,j,n;
+
+	for (i=from ; i<to ; i+=n) {
+		n = (to-i>BATCH)?BATCH:to-i;
+		wptr = wbuff;
+		for (j=0 ; j<n ; j++) {
+			put32bit(&wptr,CUTOMA_FUSE_OPEN);
+			put32bit(&wptr,17);
+			put32bit(&wptr,j);
+			put32bit(&wptr,inodes[i+j]);
+			put32bit(&wptr,0);
+			put32bit(&wptr,0);
+			put8bit(&wptr,WANT_READ);
+		}
+		if (tcptowrite(fd,wbuff,wptr-wbuff,10000)!=wptr-wbuff) {
+			fprintf(stderr,"error sending data to mfsmaster: %s\n",strerr(errno));
+			return -1;
+		}
+		for (j=0 ; j<n ; j++) {
+			if (bench_recv(fd,MATOCU_FUSE_OPEN)!=39) {
+				fprintf(stderr,"open error\n");
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+// tell master that only files [0,keep) are still opened (all others are released) and wait until it's done
+static int bench_release(int fd,const uint32_t *inodes,uint32_t keep) {
+	uint8_t *wbuff,*wptr;
+	uint32_t i;
+	int ret;
+
+	wbuff = malloc(8+keep*4+8+17);
+	if (wbuff==NULL) {
+		return -1;
+	}
+	wptr = wbuff;
+	put32bit(&wptr,CUTOMA_FUSE_RESERVED_INODES);
+	put32bit(&wptr,keep*4);
+	for (i=0 ; i<keep ; i++) {
+		put32bit(&wptr,inodes[i]);
+	}
+	// master doesn't answer reserved inodes - use open of already opened file as a barrier
+	put32bit(&wptr,CUTOMA_FUSE_OPEN);
+	put32bit(&wptr,17);
+	put32bit(&wptr,0);
+	put32bit(&wptr,inodes[0]);
+	put32bit(&wptr,0);
+	put32bit(&wptr,0);
+	put8bit(&wptr,WANT_READ);
+	ret = 0;
+	if (tcptowrite(fd,wbuff,wptr-wbuff,10000)!=wptr-wbuff || bench_recv(fd,MATOCU_FUSE_OPEN)!=39) {
+		fprintf(stderr,"release error\n");
+		ret = -1;
+	}
+	free(wbuff);
+	return ret;
+}
+
+static void usage(const char *appname) {
+	fprintf(stderr,"usage: %s [-H master host] [-P master port] [-s sessions] [-f files] [-r rounds]\n",appname);
+	fprintf(stderr,"\nevery session opens the same set of files, then releases half of them and finally all of them\n");
+	fprintf(stderr,"defaults: -H mfsmaster -P 9421 -s 100 -f 1000 -r 3\n");
+}
+
+int main(int argc,char **argv) {
+	const char *mhost="mfsmaster";
+	const char *mport="9421";
+	uint32_t sessions=100,files=1000,rounds=3;
+	uint32_t mip;
+	uint16_t mport16;
+	uint32_t *inodes;
+	int *fds;
+	uint32_t i,r;
+	double st,opent,halft,allt;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "H:P:s:f:r:h?")) != -1) {
+		switch (ch) {
+			case 'H':
+				mhost = optarg;
+				break;
+			case 'P':
+				mport = optarg;
+				break;
+			case 's':
+				sessions = strtoul(optarg,NULL,10);
+				break;
+			case 'f':
+				files = strtoul(optarg,NULL,10);
+				break;
+			case 'r':
+				rounds = strtoul(optarg,NULL,10);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (sessions==0 || files<2 || rounds==0) {
+		usage(argv[0]);
+		return 1;
+	}
+	strerr_init();
+	if (tcpresolve(mhost,mport,&mip,&mport16,0)<0) {
+		fprintf(stderr,"can't resolve master hostname and/or portname (%s:%s)\n",mhost,mport);
+		return 1;
+	}
+	buff = NULL;
+	buffsize = 0;
+	inodes = malloc(sizeof(uint32_t)*files);
+	fds = malloc(sizeof(int)*sessions);
+	if (inodes==NULL || fds==NULL) {
+		fprintf(stderr,"out of memory\n");
+		return 1;
+	}
+	for (i=0 ; i<sessions ; i++) {
+		fds[i] = bench_connect(mip,mport16);
+		if (fds[i]<0) {
+			return 1;
+		}
+	}
+	for (i=0 ; i<files ; i++) {
+		if (bench_mkfile(fds[0],i,inodes+i)<0) {
+			return 1;
+		}
+		bench_nops(fds,sessions);
+	}
+	// sorted list is expected in reserved inodes packet
+	for (i=1 ; i<files ; i++) {
+		if (inodes[i]<inodes[i-1]) {
+			fprintf(stderr,"inodes are not increasing - remove old openbench.* files first\n");
+			return 1;
+		}
+	}
+	printf("sessions: %"PRIu32" , files: %"PRIu32" , opened files per round: %"PRIu64"\n",sessions,files,(uint64_t)sessions*files);
+	for (r=0 ; r<rounds ; r++) {
+		st = bench_now();
+		for (i=0 ; i<sessions ; i++) {
+			if (bench_open(fds[i],inodes,0,files)<0) {
+				return 1;
+			}
+			bench_nops(fds,sessions);
+		}
+		opent = bench_now()-st;
+		st = bench_now();
+		for (i=0 ; i<sessions ; i++) {
+			if (bench_release(fds[i],inodes,files/2)<0) {
+				return 1;
+			}
+			bench_nops(fds,sessions);
+		}
+		halft = bench_now()-st;
+		st = bench_now();
+		for (i=0 ; i<sessions ; i++) {
+			if (bench_release(fds[i],inodes,1)<0) {
+				return 1;
+			}
+			bench_nops(fds,sessions);
+		}
+		allt = bench_now()-st;
+		printf("round %"PRIu32": open: %.3fs (%.0f opens/s) , release half: %.3fs (%.0f releases/s) , release rest: %.3fs (%.0f releases/s)\n",r+1,
+			opent,(double)sessions*files/opent,
+			halft,(double)sessions*(files-files/2)/halft,
+			allt,(double)sessions*(files/2-1)/allt);
+	}
+	for (i=0 ; i<files ; i++) {
+		bench_unlink(fds[0],i);
+	}
+	for (i=0 ; i<sessions ; i++) {
+		tcpclose(fds[i]);
+	}
+	free(inodes);
+	free(fds);
+	free(buff);
+	return 0;
+}
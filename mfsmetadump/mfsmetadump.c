@@ -19,11 +19,13 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 
 #include "MFSCommunication.h"
 #include "datapack.h"
+#include "zfile.h"
 
 #define STR_AUX(x) #x
 #define STR(x) STR_AUX(x)
@@ -32,7 +34,66 @@ const char id[]="@(#) version: " STR(VERSMAJ) "." STR(VERSMID) "." STR(VERSMIN)
 #define MAX_INDEX 0x7FFF
 #define MAX_CHUNKS_PER_FILE (MAX_INDEX+1)
 
-int chunk_load(FILE *fd) {
+// "MFSM 1.5" - xor section is split into records with zero chunk id (8 bytes of data per record)
+static uint8_t xorrec[16];
+static uint32_t xorrecpos;
+
+size_t xor_fread(uint8_t *buff,size_t leng,FILE *fd,uint8_t fver) {
+	const uint8_t *ptr;
+	size_t i;
+	if (fver!=0x15) {
+		return fread(buff,1,leng,fd);
+	}
+	for (i=0 ; i<leng ; i++) {
+		if (xorrecpos>=16) {
+			if (fread(xorrec,1,16,fd)!=16) {
+				return i;
+			}
+			ptr = xorrec;
+			if (get64bit(&ptr)!=0) {
+				return i;
+			}
+			xorrecpos = 8;
+		}
+		buff[i] = xorrec[xorrecpos++];
+	}
+	return i;
+}
+
+// xor groups (after chunk section in both formats, missing in older files)
+int xor_load(FILE *fd,uint8_t fver) {
+	uint8_t hdr[9];
+	const uint8_t *ptr;
+	uint32_t count,i;
+	uint8_t cnt;
+
+	xorrecpos = 16;
+	if (xor_fread(hdr,4,fd,fver)!=4) {
+		return 0;
+	}
+	ptr = hdr;
+	count = get32bit(&ptr);
+	while (count>0) {
+		if (xor_fread(hdr,9,fd,fver)!=9) {
+			return -1;
+		}
+		ptr = hdr;
+		printf("X|p:%016"PRIX64"|c:",get64bit(&ptr));
+		cnt = get8bit(&ptr);
+		for (i=0 ; i<cnt ; i++) {
+			if (xor_fread(hdr,8,fd,fver)!=8) {
+				return -1;
+			}
+			ptr = hdr;
+			printf("%s%016"PRIX64,(i>0)?",":"",get64bit(&ptr));
+		}
+		printf("\n");
+		count--;
+	}
+	return 0;
+}
+
+int chunk_load_1_5(FILE *fd) {
 	uint8_t hdr[8];
 	uint8_t loadbuff[16];
 	const uint8_t *ptr;
@@ -56,7 +117,74 @@ int chunk_load(FILE *fd) {
 		version = get32bit(&ptr);
 		lockedto = get32bit(&ptr);
 		printf("*|i:%016"PRIX64"|v:%08"PRIX32"|t:%10"PRIu32"\n",chunkid,version,lockedto);
+		if (chunkid==0) {	// last record
+			return xor_load(fd,0x15);
+		}
+	}
+}
+
+// columnar format - see chunk_store in mfsmaster/chunks.c
+int chunk_load(FILE *fd) {
+	uint8_t hdr[20];
+	uint8_t *buff;
+	const uint8_t *ptr,*cptr,*iptr,*vptr,*lptr,*endptr;
+	uint64_t nextchunkid,chunkid,bcnt,iddiff,version,lockedto;
+	uint32_t parts,partsize,part,pos,i,size;
+	uint32_t countsize,idsize,versionsize,lockedsize;
+
+	if (fread(hdr,1,10,fd)!=10) {
+		return -1;
+	}
+	ptr = hdr;
+	nextchunkid = get64bit(&ptr);
+	parts = get16bit(&ptr);
+	printf("# nextchunkid: %016"PRIX64"\n",nextchunkid);
+	if (parts==0 || (65536%parts)!=0) {
+		return -1;
+	}
+	partsize = 65536/parts;
+	for (part=0 ; part<parts ; part++) {
+		if (fread(hdr,1,20,fd)!=20) {
+			return -1;
+		}
+		ptr = hdr;
+		ptr += 4;	// chunk count
+		countsize = get32bit(&ptr);
+		idsize = get32bit(&ptr);
+		versionsize = get32bit(&ptr);
+		lockedsize = get32bit(&ptr);
+		size = countsize+idsize+versionsize+lockedsize;
+		buff = malloc(size+1);
+		if (buff==NULL) {
+			return -1;
+		}
+		if (fread(buff,1,size,fd)!=size) {
+			free(buff);
+			return -1;
+		}
+		cptr = buff;
+		iptr = cptr+countsize;
+		vptr = iptr+idsize;
+		lptr = vptr+versionsize;
+		endptr = lptr+lockedsize;
+		for (pos=part*partsize ; pos<(part+1)*partsize ; pos++) {
+			if (getvar64bit(&cptr,buff+countsize,&bcnt)<0) {
+				free(buff);
+				return -1;
+			}
+			chunkid = 0;
+			for (i=0 ; i<bcnt ; i++) {
+				if (getvar64bit(&iptr,buff+countsize+idsize,&iddiff)<0 || getvar64bit(&vptr,buff+countsize+idsize+versionsize,&version)<0 || getvar64bit(&lptr,endptr,&lockedto)<0) {
+					free(buff);
+					return -1;
+				}
+				chunkid += iddiff<<16;
+				printf("*|i:%016"PRIX64"|v:%08"PRIX32"|t:%10"PRIu32"\n",chunkid|pos,(uint32_t)version,(uint32_t)lockedto);
+			}
+		}
+		free(buff);
 	}
+	return xor_load(fd,0x16);
 }
 
 void print_name(FILE *in,uint32_t nleng) {
@@ -333,7 +461,7 @@ int fs_loadall(const char *fname) {
 	FILE *fd;
 	uint8_t hdr[8];
 
-	fd = fopen(fname,"r");
+	fd = zfile_ropen(fname);
 
 	if (fd==NULL) {
 		printf("can't open metadata file\n");
@@ -344,13 +472,13 @@ int fs_loadall(const char *fname) {
 		return -1;
 	}
 	printf("# header: %c%c%c%c%c%c%c%c (%02X%02X%02X%02X%02X%02X%02X%02X)\n",dispchar(hdr[0]),dispchar(hdr[1]),dispchar(hdr[2]),dispchar(hdr[3]),dispchar(hdr[4]),dispchar(hdr[5]),dispchar(hdr[6]),dispchar(hdr[7]),hdr[0],hdr[1],hdr[2],hdr[3],hdr[4],hdr[5],hdr[6],hdr[7]);
-	if (memcmp(hdr,"MFSM 1.5",8)==0) {
+	if (memcmp(hdr,"MFSM 1.5",8)==0 || memcmp(hdr,"MFSM 1.6",8)==0) {
 		if (fs_load(fd)<0) {
 			printf("error reading metadata (structure)\n");
 			fclose(fd);
 			return -1;
 		}
-		if (chunk_load(fd)<0) {
+		if (((hdr[7]=='5')?chunk_load_1_5(fd):chunk_load(fd))<0) {
 			printf("error reading metadata (chunks)\n");
 			fclose(fd);
 			return -1;
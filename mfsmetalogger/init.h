@@ -21,6 +21,8 @@
 #include <stdio.h>
 
 #include "masterconn.h"
+#include "shadow.h"
+#include "mltocuserv.h"
 
 #define STR_AUX(x) #x
 #define STR(x) STR_AUX(x)
@@ -32,6 +34,8 @@ struct {
 	runfn fn;
 	char *name;
 } RunTab[]={
+	{shadow_init,"live metadata"},
 	{masterconn_init,"connection with master"},
+	{mltocuserv_init,"serving reads to clients"},
 	{(runfn)0,"****"}
 };
@@ -30,10 +30,14 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
 
 #include "MFSCommunication.h"
 #include "datapack.h"
 #include "masterconn.h"
+#include "shadow.h"
 #include "crc.h"
 #include "cfg.h"
 #include "main.h"
@@ -44,6 +48,7 @@
 #define MaxPacketSize 1500000
 
 #define META_DL_BLOCK 1000000
+#define META_DL_MAXWINDOW 16
 
 // mode
 enum {FREE,CONNECTING,HEADER,DATA,KILL};
@@ -71,10 +76,15 @@ typedef struct masterconn {
 	uint8_t downloadretrycnt;
 	uint8_t downloading;
 	uint8_t oldmode;
+	uint8_t nozdata;
 	FILE *logfd;	// using stdio because this is text file
 	int metafd;	// using standard unix I/O because this is binary file
 	uint64_t filesize;
 	uint64_t dloffset;
+	uint64_t dlreqoffset;
+	uint32_t dlinflight;
+	uint32_t dlskip;
+	uint32_t dlanswers;
 	uint64_t dlstartuts;
 } masterconn;
 
@@ -86,6 +96,12 @@ static char *MasterHost;
 static char *MasterPort;
 static char *BindHost;
 static uint32_t Timeout;
+static uint32_t DownloadWindow;
+static uint8_t DownloadCompression;
+
+#ifdef HAVE_ZLIB_H
+static uint8_t *dlzbuff=NULL;
+#endif
 
 static uint32_t stats_bytesout=0;
 static uint32_t stats_bytesin=0;
@@ -124,6 +140,8 @@ void masterconn_sendregister(masterconn *eptr) {
 	eptr->downloading=0;
 	eptr->metafd=-1;
 	eptr->logfd=NULL;
+	eptr->dlinflight=0;
+	eptr->dlskip=0;
 
 	buff = masterconn_createpacket(eptr,MLTOMA_REGISTER,1+4+2);
 	put8bit(&buff,1);
@@ -180,6 +198,7 @@ void masterconn_metachanges_log(masterconn *eptr,const uint8_t *data,uint32_t le
 	} else {
 		syslog(LOG_NOTICE,"lost MFS change %"PRIu64": %s",version,data);
 	}
+	shadow_change(version,(const char*)data);
 }
 
 void masterconn_metachanges_flush(void) {
@@ -226,9 +245,15 @@ void masterconn_sessionsdownloadinit(void) {
 void masterconn_download_next(masterconn *eptr) {
 	uint8_t *ptr;
 	uint8_t filenum;
+	uint32_t leng;
 	int64_t dltime;
 	if (eptr->dloffset>=eptr->filesize) {	// end of file
 		filenum = eptr->downloading;
+		if (fsync(eptr->metafd)<0) {
+			mfs_errlog_silent(LOG_NOTICE,"error syncing metafile");
+			masterconn_download_end(eptr);
+			return;
+		}
 		if (masterconn_download_end(eptr)<0) {
 			return;
 		}
@@ -244,6 +269,8 @@ void masterconn_download_next(masterconn *eptr) {
 			if (eptr->oldmode==0) {
 				masterconn_download_init(eptr,11);
 			} else {
+				masterconn_metachanges_flush();
+				shadow_catchup();
 				masterconn_download_init(eptr,2);
 			}
 		} else if (filenum==11) {
@@ -255,23 +282,45 @@ void masterconn_download_next(masterconn *eptr) {
 			if (rename("changelog_ml.tmp","changelog_ml_back.1.mfs")<0) {
 				syslog(LOG_NOTICE,"can't rename downloaded changelog - do it manually before next download");
 			}
+			masterconn_metachanges_flush();
+			shadow_catchup();
 			masterconn_download_init(eptr,2);
 		} else if (filenum==2) {
 			if (rename("sessions_ml.tmp","sessions_ml.mfs")<0) {
 				syslog(LOG_NOTICE,"can't rename downloaded sessions - do it manually before next download");
 			}
 		}
-	} else {	// send request for next data packet
-		ptr = masterconn_createpacket(eptr,MLTOMA_DOWNLOAD_DATA,12);
-		put64bit(&ptr,eptr->dloffset);
-		if (eptr->filesize-eptr->dloffset>META_DL_BLOCK) {
-			put32bit(&ptr,META_DL_BLOCK);
-		} else {
-			put32bit(&ptr,eptr->filesize-eptr->dloffset);
+	} else {	// keep up to DownloadWindow requests for next data packets in flight
+		while (eptr->dlinflight<DownloadWindow && eptr->dlreqoffset<eptr->filesize) {
+			if (eptr->filesize-eptr->dlreqoffset>META_DL_BLOCK) {
+				leng = META_DL_BLOCK;
+			} else {
+				leng = eptr->filesize-eptr->dlreqoffset;
+			}
+			if (DownloadCompression && eptr->nozdata==0) {
+				ptr = masterconn_createpacket(eptr,MLTOMA_DOWNLOAD_DATA,13);
+				put64bit(&ptr,eptr->dlreqoffset);
+				put32bit(&ptr,leng);
+				put8bit(&ptr,1);
+			} else {
+				ptr = masterconn_createpacket(eptr,MLTOMA_DOWNLOAD_DATA,12);
+				put64bit(&ptr,eptr->dlreqoffset);
+				put32bit(&ptr,leng);
+			}
+			eptr->dlreqoffset += leng;
+			eptr->dlinflight++;
 		}
 	}
 }
 
+// data already requested will still come - ignore it and ask again starting from dloffset
+void masterconn_download_retry(masterconn *eptr) {
+	eptr->dlskip = eptr->dlinflight;
+	eptr->dlreqoffset = eptr->dloffset;
+	eptr->dlinflight = 0;
+	masterconn_download_next(eptr);
+}
+
 void masterconn_download_start(masterconn *eptr,const uint8_t *data,uint32_t length) {
 	if (length!=1 && length!=8) {
 		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_START - wrong size (%"PRIu32"/1|8)",length);
@@ -285,6 +334,10 @@ void masterconn_download_start(masterconn *eptr,const uint8_t *data,uint32_t len
 	}
 	eptr->filesize = get64bit(&data);
 	eptr->dloffset = 0;
+	eptr->dlreqoffset = 0;
+	eptr->dlinflight = 0;
+	eptr->dlskip = 0;
+	eptr->dlanswers = 0;
 	eptr->downloadretrycnt = 0;
 	eptr->dlstartuts = main_utime();
 	if (eptr->downloading==1) {
@@ -306,29 +359,8 @@ void masterconn_download_start(masterconn *eptr,const uint8_t *data,uint32_t len
 	masterconn_download_next(eptr);
 }
 
-void masterconn_download_data(masterconn *eptr,const uint8_t *data,uint32_t length) {
-	uint64_t offset;
-	uint32_t leng;
-	uint32_t crc;
+void masterconn_download_block(masterconn *eptr,uint64_t offset,uint32_t leng,uint32_t crc,const uint8_t *data) {
 	ssize_t ret;
-	if (eptr->metafd<0) {
-		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - file not opened");
-		eptr->mode = KILL;
-		return;
-	}
-	if (length<16) {
-		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - wrong size (%"PRIu32"/16+data)",length);
-		eptr->mode = KILL;
-		return;
-	}
-	offset = get64bit(&data);
-	leng = get32bit(&data);
-	crc = get32bit(&data);
-	if (leng+16!=length) {
-		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - wrong size (%"PRIu32"/16+%"PRIu32")",length,leng);
-		eptr->mode = KILL;
-		return;
-	}
 	if (offset!=eptr->dloffset) {
 		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - unexpected file offset (%"PRIu64"/%"PRIu64")",offset,eptr->dloffset);
 		eptr->mode = KILL;
@@ -351,7 +383,7 @@ void masterconn_download_data(masterconn *eptr,const uint8_t *data,uint32_t leng
 			masterconn_download_end(eptr);
 		} else {
 			eptr->downloadretrycnt++;
-			masterconn_download_next(eptr);
+			masterconn_download_retry(eptr);
 		}
 		return;
 	}
@@ -361,23 +393,106 @@ void masterconn_download_data(masterconn *eptr,const uint8_t *data,uint32_t leng
 			masterconn_download_end(eptr);
 		} else {
 			eptr->downloadretrycnt++;
-			masterconn_download_next(eptr);
+			masterconn_download_retry(eptr);
 		}
 		return;
 	}
-	if (fsync(eptr->metafd)<0) {
-		mfs_errlog_silent(LOG_NOTICE,"error syncing metafile");
+	eptr->dloffset+=leng;
+	eptr->downloadretrycnt=0;
+	masterconn_download_next(eptr);
+}
+
+// returns 1 when answer should be ignored (sent before retry or before end of download)
+int masterconn_download_answer(masterconn *eptr) {
+	if (eptr->dlinflight==0 && eptr->dlskip==0) {
+		return 0;
+	}
+	eptr->dlanswers++;
+	if (eptr->dlskip>0) {
+		eptr->dlskip--;
+		return 1;
+	}
+	eptr->dlinflight--;
+	return (eptr->metafd<0)?1:0;
+}
+
+void masterconn_download_data(masterconn *eptr,const uint8_t *data,uint32_t length) {
+	uint64_t offset;
+	uint32_t leng;
+	uint32_t crc;
+	if (masterconn_download_answer(eptr)) {
+		return;
+	}
+	if (eptr->metafd<0) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - file not opened");
+		eptr->mode = KILL;
+		return;
+	}
+	if (length<16) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - wrong size (%"PRIu32"/16+data)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	offset = get64bit(&data);
+	leng = get32bit(&data);
+	crc = get32bit(&data);
+	if (leng+16!=length) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_DATA - wrong size (%"PRIu32"/16+%"PRIu32")",length,leng);
+		eptr->mode = KILL;
+		return;
+	}
+	masterconn_download_block(eptr,offset,leng,crc,data);
+}
+
+void masterconn_download_zdata(masterconn *eptr,const uint8_t *data,uint32_t length) {
+#ifdef HAVE_ZLIB_H
+	uint64_t offset;
+	uint32_t leng;
+	uint32_t crc;
+	uLongf uleng;
+	if (masterconn_download_answer(eptr)) {
+		return;
+	}
+	if (eptr->metafd<0) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_ZDATA - file not opened");
+		eptr->mode = KILL;
+		return;
+	}
+	if (length<16) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_ZDATA - wrong size (%"PRIu32"/16+data)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	offset = get64bit(&data);
+	leng = get32bit(&data);
+	crc = get32bit(&data);
+	if (leng>META_DL_BLOCK) {
+		syslog(LOG_NOTICE,"MATOML_DOWNLOAD_ZDATA - block too long (%"PRIu32"/%u)",leng,META_DL_BLOCK);
+		eptr->mode = KILL;
+		return;
+	}
+	if (dlzbuff==NULL) {
+		dlzbuff = malloc(META_DL_BLOCK);
+		passert(dlzbuff);
+	}
+	uleng = leng;
+	if (uncompress(dlzbuff,&uleng,data,length-16)!=Z_OK || uleng!=leng) {
+		syslog(LOG_NOTICE,"metafile data decompression error");
 		if (eptr->downloadretrycnt>=5) {
 			masterconn_download_end(eptr);
 		} else {
 			eptr->downloadretrycnt++;
-			masterconn_download_next(eptr);
+			masterconn_download_retry(eptr);
 		}
 		return;
 	}
-	eptr->dloffset+=leng;
-	eptr->downloadretrycnt=0;
-	masterconn_download_next(eptr);
+	masterconn_download_block(eptr,offset,leng,crc,dlzbuff);
+#else
+	(void)data;
+	(void)length;
+	syslog(LOG_NOTICE,"got MATOML_DOWNLOAD_ZDATA, but metalogger was compiled without zlib");
+	eptr->mode = KILL;
+#endif
 }
 
 void masterconn_beforeclose(masterconn *eptr) {
@@ -385,6 +500,10 @@ void masterconn_beforeclose(masterconn *eptr) {
 		syslog(LOG_WARNING,"old master detected - please upgrade your master server and then restart metalogger");
 		eptr->oldmode=1;
 	}
+	if (eptr->metafd>=0 && eptr->dlinflight>0 && eptr->dlanswers==0 && DownloadCompression && eptr->nozdata==0) {	// master older than 1.6.21 doesn't accept compression flag
+		syslog(LOG_WARNING,"master doesn't support compressed metadata download - using uncompressed one");
+		eptr->nozdata=1;
+	}
 	if (eptr->metafd>=0) {
 		close(eptr->metafd);
 		unlink("metadata_ml.tmp");
@@ -409,6 +528,9 @@ void masterconn_gotpacket(masterconn *eptr,uint32_t type,const uint8_t *data,uin
 		case MATOML_DOWNLOAD_DATA:
 			masterconn_download_data(eptr,data,length);
 			break;
+		case MATOML_DOWNLOAD_ZDATA:
+			masterconn_download_zdata(eptr,data,length);
+			break;
 		default:
 			syslog(LOG_NOTICE,"got unknown message (type:%"PRIu32")",type);
 			eptr->mode = KILL;
@@ -437,6 +559,12 @@ void masterconn_term(void) {
 		}
 	}
 
+#ifdef HAVE_ZLIB_H
+	if (dlzbuff) {
+		free(dlzbuff);
+		dlzbuff = NULL;
+	}
+#endif
 	free(eptr);
 	free(MasterHost);
 	free(MasterPort);
@@ -735,6 +863,12 @@ int masterconn_init(void) {
 	Timeout = cfg_getuint32("MASTER_TIMEOUT",60);
 	BackLogsNumber = cfg_getuint32("BACK_LOGS",50);
 	MetaDLFreq = cfg_getuint32("META_DOWNLOAD_FREQ",24);
+	DownloadWindow = cfg_getuint32("META_DOWNLOAD_WINDOW",8);
+#ifdef HAVE_ZLIB_H
+	DownloadCompression = cfg_getuint8("META_DOWNLOAD_COMPRESSION",0);
+#else
+	DownloadCompression = 0;
+#endif
 
 	if (Timeout>65536) {
 		Timeout=65535;
@@ -751,6 +885,12 @@ int masterconn_init(void) {
 	if (MetaDLFreq>(BackLogsNumber/2)) {
 		MetaDLFreq=BackLogsNumber/2;
 	}
+	if (DownloadWindow<1) {
+		DownloadWindow=1;
+	}
+	if (DownloadWindow>META_DL_MAXWINDOW) {
+		DownloadWindow=META_DL_MAXWINDOW;
+	}
 	eptr = masterconnsingleton = malloc(sizeof(masterconn));
 	passert(eptr);
 
@@ -760,6 +900,7 @@ int masterconn_init(void) {
 	eptr->logfd = NULL;
 	eptr->metafd = -1;
 	eptr->oldmode = 0;
+	eptr->nozdata = 0;
 
 	if (masterconn_initconnect(eptr)<0) {
 		return -1;
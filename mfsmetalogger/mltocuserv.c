@@ -0,0 +1,720 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// read-only metadata operations for mounts answered from live metadata (see shadow.c)
+// sessions are not created here - clients use sessions registered in master (taken from downloaded sessions file)
+
+#include "config.h"
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+
+#include "MFSCommunication.h"
+
+#include "datapack.h"
+#include "mltocuserv.h"
+#include "filesystem.h"
+#include "shadow.h"
+#include "cfg.h"
+#include "main.h"
+#include "sockets.h"
+#include "slogger.h"
+#include "massert.h"
+
+#define MaxPacketSize 10000
+
+// idle connections are closed after this time (clients reconnect when needed)
+#define IDLE_TIMEOUT 60
+
+// mltocuserventry.mode
+enum{KILL,HEADER,DATA};
+
+typedef struct session {
+	uint32_t sessionid;
+	uint32_t peerip;
+	uint32_t rootinode;
+	uint8_t sesflags;
+	uint32_t rootuid;
+	uint32_t rootgid;
+	uint32_t mapalluid;
+	uint32_t mapallgid;
+	struct session *next;
+} session;
+
+typedef struct packetstruct {
+	struct packetstruct *next;
+	uint8_t *startptr;
+	uint32_t bytesleft;
+	uint8_t *packet;
+} packetstruct;
+
+typedef struct mltocuserventry {
+	uint8_t registered;
+	uint8_t mode;
+	int sock;
+	int32_t pdescpos;
+	uint32_t lastread,lastwrite;
+	uint32_t version;
+	uint32_t peerip;
+	uint64_t minversion;			// don't answer using metadata older than this version
+	uint8_t hdrbuff[8];
+	packetstruct inputpacket;
+	packetstruct *outputhead,**outputtail;
+
+	// copy of session data (sessions can be reloaded at any time)
+	uint32_t rootinode;
+	uint8_t sesflags;
+	uint32_t rootuid;
+	uint32_t rootgid;
+	uint32_t mapalluid;
+	uint32_t mapallgid;
+
+	struct mltocuserventry *next;
+} mltocuserventry;
+
+#define SESSION_HASHSIZE 4096
+#define SESSION_HASH(sessionid) ((sessionid)&(SESSION_HASHSIZE-1))
+
+static session *sessionshash[SESSION_HASHSIZE];
+static time_t sessionsmtime;
+static mltocuserventry *mltocuservhead=NULL;
+static int lsock;
+static int32_t lsockpdescpos;
+
+// from config
+static char *ListenHost;
+static char *ListenPort;
+
+static void mltocuserv_sessions_free(void) {
+	session *sptr,*nsptr;
+	uint32_t i;
+	for (i=0 ; i<SESSION_HASHSIZE ; i++) {
+		for (sptr=sessionshash[i] ; sptr ; sptr=nsptr) {
+			nsptr = sptr->next;
+			free(sptr);
+		}
+		sessionshash[i] = NULL;
+	}
+}
+
+// reads sessions file downloaded from master (only when it has been changed since last load)
+static void mltocuserv_sessions_load(void) {
+	session *sptr;
+	uint32_t ileng,hash;
+	uint8_t fsesrecord[161];	// 161 = 4+4+4+4+1+4+4+4+4+16*4+16*4
+	const uint8_t *ptr;
+	struct stat st;
+	FILE *fd;
+
+	if (stat("sessions_ml.mfs",&st)<0 || st.st_mtime==sessionsmtime) {
+		return;
+	}
+	fd = fopen("sessions_ml.mfs","r");
+	if (fd==NULL) {
+		mfs_errlog_silent(LOG_WARNING,"can't load sessions, fopen error");
+		return;
+	}
+	if (fread(fsesrecord,8,1,fd)!=1 || memcmp(fsesrecord,"MFSS \001\006\001",8)!=0) {
+		syslog(LOG_WARNING,"can't load sessions, bad header");
+		fclose(fd);
+		return;
+	}
+	mltocuserv_sessions_free();
+	while (fread(fsesrecord,161,1,fd)==1) {
+		ptr = fsesrecord;
+		sptr = (session*)malloc(sizeof(session));
+		passert(sptr);
+		sptr->sessionid = get32bit(&ptr);
+		ileng = get32bit(&ptr);
+		sptr->peerip = get32bit(&ptr);
+		sptr->rootinode = get32bit(&ptr);
+		sptr->sesflags = get8bit(&ptr);
+		sptr->rootuid = get32bit(&ptr);
+		sptr->rootgid = get32bit(&ptr);
+		sptr->mapalluid = get32bit(&ptr);
+		sptr->mapallgid = get32bit(&ptr);
+		hash = SESSION_HASH(sptr->sessionid);
+		sptr->next = sessionshash[hash];
+		sessionshash[hash] = sptr;
+		if (ileng>0 && fseek(fd,ileng,SEEK_CUR)<0) {
+			break;
+		}
+	}
+	if (ferror(fd)) {
+		syslog(LOG_WARNING,"can't load sessions, fread error");
+	}
+	fclose(fd);
+	sessionsmtime = st.st_mtime;
+}
+
+static session* mltocuserv_session_find(uint32_t sessionid) {
+	session *sptr;
+	uint8_t i;
+	for (i=0 ; i<2 ; i++) {
+		for (sptr=sessionshash[SESSION_HASH(sessionid)] ; sptr ; sptr=sptr->next) {
+			if (sptr->sessionid==sessionid) {
+				return sptr;
+			}
+		}
+		// maybe session is newer than loaded sessions - try again with fresh file
+		mltocuserv_sessions_load();
+	}
+	return NULL;
+}
+
+uint8_t* mltocuserv_createpacket(mltocuserventry *eptr,uint32_t type,uint32_t size) {
+	packetstruct *outpacket;
+	uint8_t *ptr;
+	uint32_t psize;
+
+	outpacket=(packetstruct*)malloc(sizeof(packetstruct));
+	passert(outpacket);
+	psize = size+8;
+	outpacket->packet=malloc(psize);
+	passert(outpacket->packet);
+	outpacket->bytesleft = psize;
+	ptr = outpacket->packet;
+	put32bit(&ptr,type);
+	put32bit(&ptr,size);
+	outpacket->startptr = (uint8_t*)(outpacket->packet);
+	outpacket->next = NULL;
+	*(eptr->outputtail) = outpacket;
+	eptr->outputtail = &(outpacket->next);
+	return ptr;
+}
+
+void mltocuserv_fuse_register(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	const uint8_t *rptr;
+	uint8_t *wptr;
+	uint32_t sessionid;
+	uint8_t rcode,status;
+	session *sptr;
+
+	if (length!=73 || memcmp(data,FUSE_REGISTER_BLOB_ACL,64)!=0) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_REGISTER - wrong size (%"PRIu32"/73) or wrong register blob",length);
+		eptr->mode = KILL;
+		return;
+	}
+	rptr = data+64;
+	rcode = get8bit(&rptr);
+	if (rcode!=REGISTER_FOLLOWER) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_REGISTER - wrong rcode (%"PRIu8"/%u)",rcode,REGISTER_FOLLOWER);
+		eptr->mode = KILL;
+		return;
+	}
+	sessionid = get32bit(&rptr);
+	eptr->version = get32bit(&rptr);
+	sptr = mltocuserv_session_find(sessionid);
+	if (sptr==NULL) {
+		status = ERROR_BADSESSIONID;
+	} else if ((sptr->sesflags&SESFLAG_DYNAMICIP)==0 && eptr->peerip!=sptr->peerip) {
+		status = ERROR_EACCES;
+	} else {
+		status = STATUS_OK;
+	}
+	if (status!=STATUS_OK) {
+		wptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_REGISTER,1);
+		put8bit(&wptr,status);
+		return;
+	}
+	eptr->rootinode = sptr->rootinode;
+	eptr->sesflags = sptr->sesflags;
+	eptr->rootuid = sptr->rootuid;
+	eptr->rootgid = sptr->rootgid;
+	eptr->mapalluid = sptr->mapalluid;
+	eptr->mapallgid = sptr->mapallgid;
+	eptr->registered = 1;
+	wptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_REGISTER,8);
+	put64bit(&wptr,shadow_live()?fs_getversion():0);	// metadata can be loaded by other thread
+}
+
+void mltocuserv_fuse_minversion(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	if (length!=8) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_MINVERSION - wrong size (%"PRIu32"/8)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	eptr->minversion = get64bit(&data);
+}
+
+// returns 1 when request can't be answered using local metadata
+static inline int mltocuserv_delayed(mltocuserventry *eptr,uint32_t type,uint32_t msgid) {
+	uint8_t *ptr;
+	if (shadow_live() && fs_getversion()>=eptr->minversion) {
+		return 0;
+	}
+	ptr = mltocuserv_createpacket(eptr,type,5);
+	put32bit(&ptr,msgid);
+	put8bit(&ptr,ERROR_DELAYED);
+	return 1;
+}
+
+static inline void mltocuserv_ugid_remap(mltocuserventry *eptr,uint32_t *auid,uint32_t *agid) {
+	if (*auid==0) {
+		*auid = eptr->rootuid;
+		if (agid) {
+			*agid = eptr->rootgid;
+		}
+	} else if (eptr->sesflags&SESFLAG_MAPALL) {
+		*auid = eptr->mapalluid;
+		if (agid) {
+			*agid = eptr->mapallgid;
+		}
+	}
+}
+
+void mltocuserv_fuse_lookup(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint32_t inode,uid,gid,auid,agid;
+	uint8_t nleng;
+	const uint8_t *name;
+	uint32_t newinode;
+	uint8_t attr[35];
+	uint32_t msgid;
+	uint8_t *ptr;
+	uint8_t status;
+	if (length<17) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_LOOKUP - wrong size (%"PRIu32")",length);
+		eptr->mode = KILL;
+		return;
+	}
+	msgid = get32bit(&data);
+	inode = get32bit(&data);
+	nleng = get8bit(&data);
+	if (length!=17U+nleng) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_LOOKUP - wrong size (%"PRIu32":nleng=%"PRIu8")",length,nleng);
+		eptr->mode = KILL;
+		return;
+	}
+	if (mltocuserv_delayed(eptr,MATOCU_FUSE_LOOKUP,msgid)) {
+		return;
+	}
+	name = data;
+	data += nleng;
+	auid = uid = get32bit(&data);
+	agid = gid = get32bit(&data);
+	mltocuserv_ugid_remap(eptr,&uid,&gid);
+	status = fs_lookup(eptr->rootinode,eptr->sesflags,inode,nleng,name,uid,gid,auid,agid,&newinode,attr);
+	ptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_LOOKUP,(status!=STATUS_OK)?5:43);
+	put32bit(&ptr,msgid);
+	if (status!=STATUS_OK) {
+		put8bit(&ptr,status);
+	} else {
+		put32bit(&ptr,newinode);
+		memcpy(ptr,attr,35);
+	}
+}
+
+void mltocuserv_fuse_getattr(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint32_t inode,uid,gid,auid,agid;
+	uint8_t attr[35];
+	uint32_t msgid;
+	uint8_t *ptr;
+	uint8_t status;
+	if (length!=16) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_GETATTR - wrong size (%"PRIu32"/16)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	msgid = get32bit(&data);
+	if (mltocuserv_delayed(eptr,MATOCU_FUSE_GETATTR,msgid)) {
+		return;
+	}
+	inode = get32bit(&data);
+	auid = uid = get32bit(&data);
+	agid = gid = get32bit(&data);
+	mltocuserv_ugid_remap(eptr,&uid,&gid);
+	status = fs_getattr(eptr->rootinode,eptr->sesflags,inode,uid,gid,auid,agid,attr);
+	ptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_GETATTR,(status!=STATUS_OK)?5:39);
+	put32bit(&ptr,msgid);
+	if (status!=STATUS_OK) {
+		put8bit(&ptr,status);
+	} else {
+		memcpy(ptr,attr,35);
+	}
+}
+
+void mltocuserv_fuse_readlink(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint32_t inode;
+	uint32_t pleng;
+	uint8_t *path;
+	uint32_t msgid;
+	uint8_t *ptr;
+	uint8_t status;
+	if (length!=8) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_READLINK - wrong size (%"PRIu32"/8)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	msgid = get32bit(&data);
+	if (mltocuserv_delayed(eptr,MATOCU_FUSE_READLINK,msgid)) {
+		return;
+	}
+	inode = get32bit(&data);
+	status = fs_readlink(eptr->rootinode,eptr->sesflags,inode,&pleng,&path);
+	ptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_READLINK,(status!=STATUS_OK)?5:8+pleng+1);
+	put32bit(&ptr,msgid);
+	if (status!=STATUS_OK) {
+		put8bit(&ptr,status);
+	} else {
+		put32bit(&ptr,pleng+1);
+		if (pleng>0) {
+			memcpy(ptr,path,pleng);
+		}
+		ptr[pleng]=0;
+	}
+}
+
+void mltocuserv_fuse_getdir(mltocuserventry *eptr,const uint8_t *data,uint32_t length) {
+	uint32_t inode,uid,gid,auid,agid;
+	uint8_t flags;
+	uint32_t msgid;
+	uint8_t *ptr;
+	uint8_t status;
+	uint32_t dleng;
+	void *custom;
+	if (length!=16 && length!=17) {
+		syslog(LOG_NOTICE,"CUTOMA_FUSE_GETDIR - wrong size (%"PRIu32"/16|17)",length);
+		eptr->mode = KILL;
+		return;
+	}
+	msgid = get32bit(&data);
+	if (mltocuserv_delayed(eptr,MATOCU_FUSE_GETDIR,msgid)) {
+		return;
+	}
+	inode = get32bit(&data);
+	auid = uid = get32bit(&data);
+	agid = gid = get32bit(&data);
+	mltocuserv_ugid_remap(eptr,&uid,&gid);
+	if (length==17) {
+		flags = get8bit(&data);
+	} else {
+		flags = 0;
+	}
+	status = fs_readdir_size(eptr->rootinode,eptr->sesflags,inode,uid,gid,flags,&custom,&dleng);
+	ptr = mltocuserv_createpacket(eptr,MATOCU_FUSE_GETDIR,(status!=STATUS_OK)?5:4+dleng);
+	put32bit(&ptr,msgid);
+	if (status!=STATUS_OK) {
+		put8bit(&ptr,status);
+	} else {
+		fs_readdir_data(eptr->rootinode,eptr->sesflags,uid,gid,auid,agid,flags,custom,ptr);
+	}
+}
+
+void mltocuserv_gotpacket(mltocuserventry *eptr,uint32_t type,const uint8_t *data,uint32_t length) {
+	if (type==ANTOAN_NOP) {
+		return;
+	}
+	if (eptr->registered==0) {
+		if (type==CUTOMA_FUSE_REGISTER) {
+			mltocuserv_fuse_register(eptr,data,length);
+		} else {
+			syslog(LOG_NOTICE,"mltocu: got unknown message from unregistered (type:%"PRIu32")",type);
+			eptr->mode=KILL;
+		}
+		return;
+	}
+	switch (type) {
+		case CUTOMA_FUSE_MINVERSION:
+			mltocuserv_fuse_minversion(eptr,data,length);
+			break;
+		case CUTOMA_FUSE_LOOKUP:
+			mltocuserv_fuse_lookup(eptr,data,length);
+			break;
+		case CUTOMA_FUSE_GETATTR:
+			mltocuserv_fuse_getattr(eptr,data,length);
+			break;
+		case CUTOMA_FUSE_READLINK:
+			mltocuserv_fuse_readlink(eptr,data,length);
+			break;
+		case CUTOMA_FUSE_GETDIR:
+			mltocuserv_fuse_getdir(eptr,data,length);
+			break;
+		default:
+			syslog(LOG_NOTICE,"mltocu: got unknown message (type:%"PRIu32")",type);
+			eptr->mode=KILL;
+	}
+}
+
+void mltocuserv_term(void) {
+	mltocuserventry *eptr,*eaptr;
+	packetstruct *pptr,*paptr;
+	syslog(LOG_INFO,"mltocu: closing %s:%s",ListenHost,ListenPort);
+	tcpclose(lsock);
+
+	eptr = mltocuservhead;
+	while (eptr) {
+		if (eptr->inputpacket.packet) {
+			free(eptr->inputpacket.packet);
+		}
+		pptr = eptr->outputhead;
+		while (pptr) {
+			if (pptr->packet) {
+				free(pptr->packet);
+			}
+			paptr = pptr;
+			pptr = pptr->next;
+			free(paptr);
+		}
+		eaptr = eptr;
+		eptr = eptr->next;
+		free(eaptr);
+	}
+	mltocuservhead=NULL;
+	mltocuserv_sessions_free();
+
+	free(ListenHost);
+	free(ListenPort);
+}
+
+void mltocuserv_read(mltocuserventry *eptr) {
+	int32_t i;
+	uint32_t type,size;
+	const uint8_t *ptr;
+	for (;;) {
+		i=read(eptr->sock,eptr->inputpacket.startptr,eptr->inputpacket.bytesleft);
+		if (i==0) {
+			eptr->mode = KILL;
+			return;
+		}
+		if (i<0) {
+			if (errno!=EAGAIN) {
+				mfs_arg_errlog_silent(LOG_NOTICE,"mltocu: (ip:%u.%u.%u.%u) read error",(eptr->peerip>>24)&0xFF,(eptr->peerip>>16)&0xFF,(eptr->peerip>>8)&0xFF,eptr->peerip&0xFF);
+				eptr->mode = KILL;
+			}
+			return;
+		}
+		eptr->inputpacket.startptr+=i;
+		eptr->inputpacket.bytesleft-=i;
+
+		if (eptr->inputpacket.bytesleft>0) {
+			return;
+		}
+
+		if (eptr->mode==HEADER) {
+			ptr = eptr->hdrbuff+4;
+			size = get32bit(&ptr);
+
+			if (size>0) {
+				if (size>MaxPacketSize) {
+					syslog(LOG_WARNING,"mltocu: packet too long (%"PRIu32"/%u)",size,MaxPacketSize);
+					eptr->mode = KILL;
+					return;
+				}
+				eptr->inputpacket.packet = malloc(size);
+				passert(eptr->inputpacket.packet);
+				eptr->inputpacket.bytesleft = size;
+				eptr->inputpacket.startptr = eptr->inputpacket.packet;
+				eptr->mode = DATA;
+				continue;
+			}
+			eptr->mode = DATA;
+		}
+
+		if (eptr->mode==DATA) {
+			ptr = eptr->hdrbuff;
+			type = get32bit(&ptr);
+			size = get32bit(&ptr);
+
+			eptr->mode=HEADER;
+			eptr->inputpacket.bytesleft = 8;
+			eptr->inputpacket.startptr = eptr->hdrbuff;
+
+			mltocuserv_gotpacket(eptr,type,eptr->inputpacket.packet,size);
+
+			if (eptr->inputpacket.packet) {
+				free(eptr->inputpacket.packet);
+			}
+			eptr->inputpacket.packet=NULL;
+		}
+	}
+}
+
+void mltocuserv_write(mltocuserventry *eptr) {
+	packetstruct *pack;
+	int32_t i;
+	for (;;) {
+		pack = eptr->outputhead;
+		if (pack==NULL) {
+			return;
+		}
+		i=write(eptr->sock,pack->startptr,pack->bytesleft);
+		if (i<0) {
+			if (errno!=EAGAIN) {
+				mfs_arg_errlog_silent(LOG_NOTICE,"mltocu: (ip:%u.%u.%u.%u) write error",(eptr->peerip>>24)&0xFF,(eptr->peerip>>16)&0xFF,(eptr->peerip>>8)&0xFF,eptr->peerip&0xFF);
+				eptr->mode = KILL;
+			}
+			return;
+		}
+		pack->startptr+=i;
+		pack->bytesleft-=i;
+		if (pack->bytesleft>0) {
+			return;
+		}
+		free(pack->packet);
+		eptr->outputhead = pack->next;
+		if (eptr->outputhead==NULL) {
+			eptr->outputtail = &(eptr->outputhead);
+		}
+		free(pack);
+	}
+}
+
+void mltocuserv_desc(struct pollfd *pdesc,uint32_t *ndesc) {
+	uint32_t pos = *ndesc;
+	mltocuserventry *eptr;
+	pdesc[pos].fd = lsock;
+	pdesc[pos].events = POLLIN;
+	lsockpdescpos = pos;
+	pos++;
+	for (eptr=mltocuservhead ; eptr ; eptr=eptr->next) {
+		pdesc[pos].fd = eptr->sock;
+		pdesc[pos].events = POLLIN;
+		eptr->pdescpos = pos;
+		if (eptr->outputhead!=NULL) {
+			pdesc[pos].events |= POLLOUT;
+		}
+		pos++;
+	}
+	*ndesc = pos;
+}
+
+void mltocuserv_serve(struct pollfd *pdesc) {
+	uint32_t now=main_time();
+	mltocuserventry *eptr,**kptr;
+	packetstruct *pptr,*paptr;
+	int ns;
+
+	if (lsockpdescpos>=0 && (pdesc[lsockpdescpos].revents & POLLIN)) {
+		ns=tcpaccept(lsock);
+		if (ns<0) {
+			mfs_errlog_silent(LOG_NOTICE,"Metalogger<->CU socket: accept error");
+		} else {
+			tcpnonblock(ns);
+			tcpnodelay(ns);
+			eptr = malloc(sizeof(mltocuserventry));
+			passert(eptr);
+			eptr->next = mltocuservhead;
+			mltocuservhead = eptr;
+			eptr->sock = ns;
+			eptr->pdescpos = -1;
+			tcpgetpeer(ns,&(eptr->peerip),NULL);
+			eptr->registered = 0;
+			eptr->version = 0;
+			eptr->minversion = 0;
+			eptr->mode = HEADER;
+			eptr->lastread = now;
+			eptr->lastwrite = now;
+			eptr->inputpacket.next = NULL;
+			eptr->inputpacket.bytesleft = 8;
+			eptr->inputpacket.startptr = eptr->hdrbuff;
+			eptr->inputpacket.packet = NULL;
+			eptr->outputhead = NULL;
+			eptr->outputtail = &(eptr->outputhead);
+		}
+	}
+	for (eptr=mltocuservhead ; eptr ; eptr=eptr->next) {
+		if (eptr->pdescpos>=0) {
+			if (pdesc[eptr->pdescpos].revents & (POLLERR|POLLHUP)) {
+				eptr->mode = KILL;
+			}
+			if ((pdesc[eptr->pdescpos].revents & POLLIN) && eptr->mode!=KILL) {
+				eptr->lastread = now;
+				mltocuserv_read(eptr);
+			}
+			if ((pdesc[eptr->pdescpos].revents & POLLOUT) && eptr->mode!=KILL) {
+				eptr->lastwrite = now;
+				mltocuserv_write(eptr);
+			}
+		}
+		// clients ask synchronously, so there are no keep-alive packets - just close idle connections
+		if (eptr->lastread+IDLE_TIMEOUT<now) {
+			eptr->mode = KILL;
+		}
+	}
+	kptr = &mltocuservhead;
+	while ((eptr=*kptr)) {
+		if (eptr->mode == KILL) {
+			tcpclose(eptr->sock);
+			if (eptr->inputpacket.packet) {
+				free(eptr->inputpacket.packet);
+			}
+			pptr = eptr->outputhead;
+			while (pptr) {
+				if (pptr->packet) {
+					free(pptr->packet);
+				}
+				paptr = pptr;
+				pptr = pptr->next;
+				free(paptr);
+			}
+			*kptr = eptr->next;
+			free(eptr);
+		} else {
+			kptr = &(eptr->next);
+		}
+	}
+}
+
+int mltocuserv_init(void) {
+	uint32_t i;
+
+	if (cfg_getuint32("SERVE_READS",0)==0) {
+		return 0;
+	}
+	if (cfg_getuint32("LIVE_METADATA",0)==0) {
+		syslog(LOG_WARNING,"SERVE_READS needs LIVE_METADATA - serving reads to clients is disabled");
+		return 0;
+	}
+	ListenHost = cfg_getstr("MLTOCU_LISTEN_HOST","*");
+	ListenPort = cfg_getstr("MLTOCU_LISTEN_PORT","9425");
+
+	lsock = tcpsocket();
+	if (lsock<0) {
+		mfs_errlog(LOG_ERR,"metalogger <-> clients module: can't create socket");
+		return -1;
+	}
+	tcpnonblock(lsock);
+	tcpnodelay(lsock);
+	tcpreuseaddr(lsock);
+	if (tcpsetacceptfilter(lsock)<0 && errno!=ENOTSUP) {
+		mfs_errlog_silent(LOG_NOTICE,"mltocu: can't set accept filter");
+	}
+	if (tcpstrlisten(lsock,ListenHost,ListenPort,100)<0) {
+		mfs_errlog(LOG_ERR,"metalogger <-> clients module: can't listen on socket");
+		return -1;
+	}
+	mfs_arg_syslog(LOG_NOTICE,"metalogger <-> clients module: listen on %s:%s",ListenHost,ListenPort);
+
+	for (i=0 ; i<SESSION_HASHSIZE ; i++) {
+		sessionshash[i] = NULL;
+	}
+	sessionsmtime = 0;
+	mltocuservhead = NULL;
+	main_destructregister(mltocuserv_term);
+	main_pollregister(mltocuserv_desc,mltocuserv_serve);
+	return 0;
+}
@@ -0,0 +1,332 @@
+/*
+   Copyright 2005-2010 Jakub Kruszona-Zawadzki, Gemius SA.
+
+   This file is part of MooseFS.
+
+   MooseFS is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, version 3.
+
+   MooseFS is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with MooseFS.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// live copy of metadata - the same code as in mfsmetarestore (filesystem.c and chunks.c compiled with METARESTORE)
+// fed with changes received from master
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "MFSCommunication.h"
+#include "filesystem.h"
+#include "restore.h"
+#include "shadow.h"
+#include "cfg.h"
+#include "main.h"
+#include "slogger.h"
+#include "massert.h"
+#include "zfile.h"
+
+#define BSIZE 10000
+
+// shadowstate
+enum {EMPTY,LAGGING,LOADING,LIVE,BROKEN};
+
+// loadresult
+enum {LOAD_RUNNING,LOAD_OK,LOAD_NOMETA,LOAD_ERROR};
+
+// changes received from master while loader thread works on metadata
+typedef struct _pendingchange {
+	uint64_t version;
+	struct _pendingchange *next;
+	char data[1];
+} pendingchange;
+
+static uint8_t shadowstate;
+static uint64_t lastchange;
+static char *linebuff;
+static uint32_t linebuffsize;
+
+static pendingchange *pendinghead,**pendingtail;
+
+static pthread_t loadthread;
+static pthread_mutex_t loadlock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t loadmetadata;
+static uint8_t loadresult;
+
+static pid_t storepid;
+
+// from config
+static uint32_t LiveMetadata;
+static uint32_t StoreFreq;
+
+// returns: 0 - applied or already there, 1 - hole (changes missing), -1 - error
+int shadow_apply(uint64_t lv,char *line) {
+	uint64_t v;
+	v = fs_getversion();
+	if (lv<v) {
+		return 0;
+	}
+	if (lv>v) {
+		return 1;
+	}
+	if (restore_line(lv,line)!=STATUS_OK || fs_getversion()!=lv+1) {
+		syslog(LOG_WARNING,"live metadata: can't apply change %"PRIu64" - live metadata disabled (restart metalogger to rebuild it)",lv);
+		return -1;
+	}
+	return 0;
+}
+
+int shadow_applychange(uint64_t version,const char *data) {
+	uint32_t leng;
+	leng = strlen(data)+3;
+	if (leng>linebuffsize) {
+		linebuffsize = leng+BSIZE;
+		free(linebuff);
+		linebuff = malloc(linebuffsize);
+		passert(linebuff);
+	}
+	linebuff[0]=':';
+	linebuff[1]=' ';
+	memcpy(linebuff+2,data,leng-2);
+	return shadow_apply(version,linebuff);
+}
+
+int shadow_applyfile(const char *fname) {
+	FILE *fd;
+	char *ptr;
+	uint64_t lv;
+	uint32_t leng;
+	int s;
+
+	fd = zfile_ropen(fname);
+	if (fd==NULL) {
+		return 0;
+	}
+	s = 0;
+	leng = 0;
+	while (s==0 && fgets(linebuff+leng,linebuffsize-leng,fd)) {
+		leng += strlen(linebuff+leng);
+		if (leng==0 || linebuff[leng-1]!='\n') {
+			if (leng+1<linebuffsize) {	// current change log is appended while loading - last change will come from pending queue
+				break;
+			}
+			linebuffsize += BSIZE;	// long line - read the rest of it
+			linebuff = realloc(linebuff,linebuffsize);
+			passert(linebuff);
+			continue;
+		}
+		lv = strtoull(linebuff,&ptr,10);
+		s = shadow_apply(lv,ptr);
+		leng = 0;
+	}
+	fclose(fd);
+	return (s<0)?-1:0;
+}
+
+void shadow_pendingfree(void) {
+	pendingchange *pc,*npc;
+	for (pc=pendinghead ; pc ; pc=npc) {
+		npc = pc->next;
+		free(pc);
+	}
+	pendinghead = NULL;
+	pendingtail = &pendinghead;
+}
+
+void shadow_change(uint64_t version,const char *data) {
+	pendingchange *pc;
+	uint32_t leng;
+	int s;
+	if (LiveMetadata==0) {
+		return;
+	}
+	lastchange = version;
+	if (shadowstate==LOADING) {
+		leng = strlen(data);
+		pc = malloc(sizeof(pendingchange)+leng);
+		passert(pc);
+		pc->version = version;
+		memcpy(pc->data,data,leng+1);
+		pc->next = NULL;
+		*pendingtail = pc;
+		pendingtail = &(pc->next);
+		return;
+	}
+	if (shadowstate!=LIVE) {
+		return;
+	}
+	s = shadow_applychange(version,data);
+	if (s<0) {
+		shadowstate = BROKEN;
+	} else if (s>0) {
+		syslog(LOG_NOTICE,"live metadata: changes from %"PRIu64" to %"PRIu64" are missing - waiting for next download from master",fs_getversion(),version-1);
+		shadowstate = LAGGING;
+	}
+}
+
+// loader thread - main loop only queues changes (and doesn't touch metadata) until it finishes
+void* shadow_loader(void *arg) {
+	uint8_t res;
+	res = LOAD_OK;
+	if (loadmetadata) {
+		if (fs_init("metadata_ml.mfs.back")<0) {
+			res = LOAD_NOMETA;
+		} else {
+			syslog(LOG_NOTICE,"live metadata: downloaded metadata loaded (version: %"PRIu64")",fs_getversion());
+		}
+	}
+	if (res==LOAD_OK) {
+		if (shadow_applyfile("changelog_ml_back.1.mfs")<0 || shadow_applyfile("changelog_ml_back.0.mfs")<0 || shadow_applyfile("changelog_ml.1.mfs")<0 || shadow_applyfile("changelog_ml.0.mfs")<0) {
+			res = LOAD_ERROR;
+		}
+	}
+	eassert(pthread_mutex_lock(&loadlock)==0);
+	loadresult = res;
+	eassert(pthread_mutex_unlock(&loadlock)==0);
+	return arg;
+}
+
+void shadow_loadfinish(uint8_t res) {
+	pendingchange *pc;
+	int s;
+
+	if (res==LOAD_NOMETA) {
+		syslog(LOG_WARNING,"live metadata: can't load downloaded metadata - live metadata disabled (restart metalogger to rebuild it)");
+		shadowstate = BROKEN;
+	} else if (res==LOAD_ERROR) {
+		shadowstate = BROKEN;
+	} else {
+		s = 0;
+		for (pc=pendinghead ; pc && s==0 ; pc=pc->next) {
+			s = shadow_applychange(pc->version,pc->data);
+		}
+		if (s<0) {
+			shadowstate = BROKEN;
+		} else if (lastchange==0 || lastchange+1==fs_getversion()) {
+			syslog(LOG_NOTICE,"live metadata: synchronized with master (version: %"PRIu64")",fs_getversion());
+			shadowstate = LIVE;
+		} else {
+			syslog(LOG_NOTICE,"live metadata: changes from %"PRIu64" to %"PRIu64" are missing - waiting for next download from master",fs_getversion(),lastchange);
+			shadowstate = LAGGING;
+		}
+	}
+	shadow_pendingfree();
+}
+
+void shadow_loadcheck(void) {
+	uint8_t res;
+	if (shadowstate!=LOADING) {
+		return;
+	}
+	eassert(pthread_mutex_lock(&loadlock)==0);
+	res = loadresult;
+	eassert(pthread_mutex_unlock(&loadlock)==0);
+	if (res!=LOAD_RUNNING) {
+		eassert(pthread_join(loadthread,NULL)==0);
+		shadow_loadfinish(res);
+	}
+}
+
+// called after metadata and change logs have been downloaded from master (current change log must be flushed)
+// loading and replaying is done by separate thread - it can take longer than MASTER_TIMEOUT
+void shadow_catchup(void) {
+	if (LiveMetadata==0 || shadowstate==BROKEN || shadowstate==LOADING || shadowstate==LIVE) {
+		return;
+	}
+	loadmetadata = (shadowstate==EMPTY)?1:0;
+	loadresult = LOAD_RUNNING;
+	shadowstate = LOADING;
+	if (pthread_create(&loadthread,NULL,shadow_loader,NULL)!=0) {
+		mfs_errlog(LOG_WARNING,"live metadata: can't create loader thread - loading in foreground");
+		shadow_loader(NULL);
+		shadow_loadfinish(loadresult);
+	}
+}
+
+// returns 1 when metadata are complete and follow changes sent by master
+int shadow_live(void) {
+	return (shadowstate==LIVE)?1:0;
+}
+
+void shadow_storefile(void) {
+	if (fs_storeall("metadata_ml.mfs.tmp")<0) {
+		syslog(LOG_WARNING,"live metadata: can't write metadata_ml.mfs.tmp");
+	} else if (rename("metadata_ml.mfs.tmp","metadata_ml.mfs")<0) {
+		mfs_errlog(LOG_WARNING,"can't rename metadata_ml.mfs.tmp -> metadata_ml.mfs");
+	} else {
+		syslog(LOG_NOTICE,"live metadata stored into metadata_ml.mfs (version: %"PRIu64")",fs_getversion());
+	}
+}
+
+// periodic store - done by child process (like master's background metadata store)
+void shadow_store(void) {
+	pid_t pid;
+	if (shadowstate!=LAGGING && shadowstate!=LIVE) {
+		return;
+	}
+	if (storepid>0 && kill(storepid,0)==0) {
+		syslog(LOG_NOTICE,"live metadata: previous store is still in progress");
+		return;
+	}
+	pid = fork();
+	if (pid<0) {
+		mfs_errlog(LOG_WARNING,"live metadata: fork error - metadata not stored");
+		return;
+	}
+	if (pid==0) {
+		shadow_storefile();
+		exit(0);
+	}
+	storepid = pid;
+}
+
+void shadow_term(void) {
+	if (shadowstate==LOADING) {
+		eassert(pthread_join(loadthread,NULL)==0);
+		shadow_loadfinish(loadresult);
+	}
+	while (storepid>0 && kill(storepid,0)==0) {
+		usleep(100000);
+	}
+	if (shadowstate==LAGGING || shadowstate==LIVE) {
+		shadow_storefile();
+	}
+	shadow_pendingfree();
+	free(linebuff);
+}
+
+int shadow_init(void) {
+	LiveMetadata = cfg_getuint32("LIVE_METADATA",0);
+	StoreFreq = cfg_getuint32("LIVE_METADATA_STORE_FREQ",1);
+	shadowstate = EMPTY;
+	lastchange = 0;
+	pendinghead = NULL;
+	pendingtail = &pendinghead;
+	storepid = 0;
+	linebuffsize = BSIZE;
+	linebuff = malloc(linebuffsize);
+	passert(linebuff);
+	main_destructregister(shadow_term);
+	if (LiveMetadata) {
+		main_eachloopregister(shadow_loadcheck);
+		if (StoreFreq>0) {
+			main_timeregister(TIMEMODE_SKIP_LATE,StoreFreq*3600,0,shadow_store);
+		}
+	}
+	return 0;
+}
@@ -24,7 +24,9 @@
 #include <dirent.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #include "filesystem.h"
 #include "chunks.h"
@@ -87,6 +89,9 @@ int main(int argc,char **argv) {
 //	char *chgdata = NULL;
 	char *appname = argv[0];
 	uint32_t dplen = 0;
+	uint64_t firstversion;
+	struct timeval tvs,tve;
+	double replaytime;
 
 	strerr_init();
 
@@ -206,9 +211,20 @@ int main(int argc,char **argv) {
 		merger_start(argc,argv);
 	}
 
+	firstversion = fs_getversion();
+	gettimeofday(&tvs,NULL);
 	if (merger_loop()<0) {
 		return 1;
 	}
+	gettimeofday(&tve,NULL);
+	if (metaout!=NULL) {
+		replaytime = (tve.tv_sec-tvs.tv_sec)+(tve.tv_usec-tvs.tv_usec)/1000000.0;
+		printf("%"PRIu64" changes applied in %.3lf seconds",fs_getversion()-firstversion,replaytime);
+		if (replaytime>0.0) {
+			printf(" (%.0lf changes/s)",(fs_getversion()-firstversion)/replaytime);
+		}
+		printf("\n");
+	}
 
 	if (metaout==NULL) {
 		fs_dump();
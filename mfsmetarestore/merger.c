@@ -1,15 +1,27 @@
+#include "config.h"
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <inttypes.h>
 
 #include "restore.h"
+#include "zfile.h"
 
-#define BSIZE 10000
-
+// change files are mapped into memory and lines are parsed in place (no copying, no limit for line length)
+// compressed change files are decompressed into memory as a whole
 typedef struct _hentry {
-	FILE *fd;
-	char *buff;
-	char *ptr;
+	char *map;		// whole file
+	uint8_t mapped;		// 0 - map is malloc'ed
+	char *end;
+	char *next;		// beginning of next line
+	char *tail;		// copy of last line when file doesn't end with new line
+	char *ptr;		// current line (after change id)
 	uint64_t nextid;
 } hentry;
 
@@ -61,23 +73,99 @@ void merger_heap_sort_up(void) {
 
 
 void merger_nextentry(uint32_t pos) {
-	if (fgets(heap[pos].buff,BSIZE,heap[pos].fd)) {
-		heap[pos].nextid = strtoull(heap[pos].buff,&(heap[pos].ptr),10);
+	hentry *h = heap+pos;
+	char *lptr,*eptr;
+	uint64_t id;
+	uint32_t leng;
+
+	if (h->next>=h->end) {
+		h->nextid = 0;
+		return;
+	}
+	lptr = h->next;
+	eptr = memchr(lptr,'\n',h->end-lptr);
+	if (eptr==NULL) {	// last line without new line - make terminated copy
+		leng = h->end-lptr;
+		free(h->tail);
+		h->tail = malloc(leng+2);
+		if (h->tail==NULL) {
+			h->nextid = 0;
+			return;
+		}
+		memcpy(h->tail,lptr,leng);
+		h->tail[leng]='\n';
+		h->tail[leng+1]=0;
+		lptr = h->tail;
+		h->next = h->end;
 	} else {
-		heap[pos].nextid = 0;
+		h->next = eptr+1;
+	}
+	id = 0;
+	while (*lptr>='0' && *lptr<='9') {
+		id = id*10+(*lptr-'0');
+		lptr++;
 	}
+	h->ptr = lptr;
+	h->nextid = id;
 }
 
 void merger_delete_entry(void) {
-	fclose(heap[heapsize].fd);
-	free(heap[heapsize].buff);
+	if (heap[heapsize].map) {
+		if (heap[heapsize].mapped) {
+			munmap(heap[heapsize].map,heap[heapsize].end-heap[heapsize].map);
+		} else {
+			free(heap[heapsize].map);
+		}
+	}
+	free(heap[heapsize].tail);
 }
 
 void merger_new_entry(const char *filename) {
-	heap[heapsize].fd = fopen(filename,"r");
-	heap[heapsize].buff = malloc(BSIZE);
-	heap[heapsize].ptr = NULL;
-	heap[heapsize].nextid = 0;
+	hentry *h = heap+heapsize;
+	struct stat st;
+	int fd;
+	void *map;
+	uint64_t leng;
+
+	h->map = NULL;
+	h->mapped = 1;
+	h->end = NULL;
+	h->next = NULL;
+	h->tail = NULL;
+	h->ptr = NULL;
+	h->nextid = 0;
+	fd = open(filename,O_RDONLY);
+	if (fd<0) {
+		return;
+	}
+	if (fstat(fd,&st)<0 || st.st_size==0) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (map==MAP_FAILED) {
+		return;
+	}
+	if (st.st_size>=8 && memcmp(map,ZFILE_MAGIC,8)==0) {
+		munmap(map,st.st_size);
+		h->map = zfile_load(filename,&leng);
+		if (h->map==NULL) {
+			fprintf(stderr,"can't decompress change file: %s\n",filename);
+			return;
+		}
+		h->mapped = 0;
+		h->end = h->map+leng;
+		h->next = h->map;
+		merger_nextentry(heapsize);
+		return;
+	}
+#ifdef MADV_SEQUENTIAL
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+#endif
+	h->map = map;
+	h->end = h->map+st.st_size;
+	h->next = h->map;
 	merger_nextentry(heapsize);
 }
 
@@ -34,32 +34,37 @@
 	(clptr)++; \
 }
 
+// lines are parsed in place (also directly in mapped change files), so names and paths end also at new line
+static const int8_t hexval[256]={
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,  0, 1, 2, 3, 4, 5, 6, 7, 8, 9,-1,-1,-1,-1,-1,-1,
+	-1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+	-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+};
+
+#define GETHEX(ch,clptr,vno) { \
+	int8_t _tmp_h1,_tmp_h2; \
+	_tmp_h1 = hexval[(uint8_t)((clptr)[0])]; \
+	_tmp_h2 = (_tmp_h1>=0)?hexval[(uint8_t)((clptr)[1])]:-1; \
+	if (_tmp_h2<0) { \
+		printf("%"PRIu64": hex expected\n",(vno)); \
+		return 1; \
+	} \
+	(clptr)+=2; \
+	(ch) = _tmp_h1*16+_tmp_h2; \
+}
+
 #define GETNAME(name,clptr,vno,c) { \
 	uint32_t _tmp_i; \
-	char _tmp_c,_tmp_h1,_tmp_h2; \
-	memset((void*)(name),0,256); \
+	char _tmp_c; \
 	_tmp_i = 0; \
-	while ((_tmp_c=*((clptr)++))!=c && _tmp_i<255) { \
+	while ((_tmp_c=*((clptr)++))!=c && _tmp_c!='\n' && _tmp_c!=0 && _tmp_i<255) { \
 		if (_tmp_c=='%') { \
-			_tmp_h1 = *((clptr)++); \
-			_tmp_h2 = *((clptr)++); \
-			if (_tmp_h1>='0' && _tmp_h1<='9') { \
-				_tmp_h1-='0'; \
-			} else if (_tmp_h1>='A' && _tmp_h1<='F') { \
-				_tmp_h1-=('A'-10); \
-			} else { \
-				printf("%"PRIu64": hex expected\n",(vno)); \
-				return 1; \
-			} \
-			if (_tmp_h2>='0' && _tmp_h2<='9') { \
-				_tmp_h2-='0'; \
-			} else if (_tmp_h2>='A' && _tmp_h2<='F') { \
-				_tmp_h2-=('A'-10); \
-			} else { \
-				printf("%"PRIu64": hex expected\n",(vno)); \
-				return 1; \
-			} \
-			_tmp_c = _tmp_h1*16+_tmp_h2; \
+			GETHEX(_tmp_c,clptr,vno); \
 		} \
 		name[_tmp_i++] = _tmp_c; \
 	} \
@@ -69,29 +74,11 @@
 
 #define GETPATH(path,size,clptr,vno,c) { \
 	uint32_t _tmp_i; \
-	char _tmp_c,_tmp_h1,_tmp_h2; \
+	char _tmp_c; \
 	_tmp_i = 0; \
-	while ((_tmp_c=*((clptr)++))!=c) { \
+	while ((_tmp_c=*((clptr)++))!=c && _tmp_c!='\n' && _tmp_c!=0) { \
 		if (_tmp_c=='%') { \
-			_tmp_h1 = *((clptr)++); \
-			_tmp_h2 = *((clptr)++); \
-			if (_tmp_h1>='0' && _tmp_h1<='9') { \
-				_tmp_h1-='0'; \
-			} else if (_tmp_h1>='A' && _tmp_h1<='F') { \
-				_tmp_h1-=('A'-10); \
-			} else { \
-				printf("%"PRIu64": hex expected\n",(vno)); \
-				return 1; \
-			} \
-			if (_tmp_h2>='0' && _tmp_h2<='9') { \
-				_tmp_h2-='0'; \
-			} else if (_tmp_h2>='A' && _tmp_h2<='F') { \
-				_tmp_h2-=('A'-10); \
-			} else { \
-				printf("%"PRIu64": hex expected\n",(vno)); \
-				return 1; \
-			} \
-			_tmp_c = _tmp_h1*16+_tmp_h2; \
+			GETHEX(_tmp_c,clptr,vno); \
 		} \
 		if ((_tmp_i)>=(size)) { \
 			(size) = _tmp_i+1000; \
@@ -115,8 +102,34 @@
 	path[_tmp_i]=0; \
 }
 
-#define GETU32(data,clptr) (data)=strtoul(clptr,&clptr,10)
-#define GETU64(data,clptr) (data)=strtoull(clptr,&clptr,10)
+// strtoul/strtoull replacements (only plain decimal numbers are written to change logs)
+static inline uint32_t restore_getu32(char **clptr) {
+	char *p = *clptr;
+	uint32_t r = 0;
+	while (*p>='0' && *p<='9') {
+		r = r*10+(*p-'0');
+		p++;
+	}
+	*clptr = p;
+	return r;
+}
+
+static inline uint64_t restore_getu64(char **clptr) {
+	char *p = *clptr;
+	uint64_t r = 0;
+	while (*p>='0' && *p<='9') {
+		r = r*10+(*p-'0');
+		p++;
+	}
+	*clptr = p;
+	return r;
+}
+
+#define GETU32(data,clptr) (data)=restore_getu32(&(clptr))
+#define GETU64(data,clptr) (data)=restore_getu64(&(clptr))
+
+// length of line without new line character
+#define LINELENG(ptr) ((int)strcspn((ptr),"\n"))
 
 uint8_t do_access(uint64_t lv,uint32_t ts,char *ptr) {
 	uint32_t inode;
@@ -252,6 +265,32 @@ uint8_t do_incversion(uint64_t lv,uint32_t ts,char *ptr) {
 	return fs_incversion(chunkid);
 }
 
+uint8_t do_xorgroup(uint64_t lv,uint32_t ts,char *ptr) {
+	uint64_t parityid;
+	uint64_t chunkids[255];
+	uint8_t cnt;
+	(void)ts;
+	EAT(ptr,lv,'(');
+	GETU64(parityid,ptr);
+	cnt = 0;
+	while (*ptr==',' && cnt<255) {
+		ptr++;
+		GETU64(chunkids[cnt],ptr);
+		cnt++;
+	}
+	EAT(ptr,lv,')');
+	return fs_xorgroup(parityid,cnt,chunkids);
+}
+
+uint8_t do_xorrelease(uint64_t lv,uint32_t ts,char *ptr) {
+	uint64_t parityid;
+	(void)ts;
+	EAT(ptr,lv,'(');
+	GETU64(parityid,ptr);
+	EAT(ptr,lv,')');
+	return fs_xorrelease(parityid);
+}
+
 uint8_t do_link(uint64_t lv,uint32_t ts,char *ptr) {
 	uint32_t inode,parent;
 	uint8_t name[256];
@@ -527,7 +566,7 @@ uint8_t restore_line(uint64_t lv,char *line) {
 	char *ptr;
 	uint32_t ts;
 	uint8_t status;
-	char* errormsgs[]={ ERROR_STRINGS };
+	static const char* errormsgs[]={ ERROR_STRINGS };
 
 	status = ERROR_MISMATCH;
 	ptr = line;
@@ -547,7 +586,7 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"AQUIRE",6)==0) {
 				status = do_aquire(lv,ts,ptr+6);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'C':
@@ -556,7 +595,7 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"CUSTOMER",8)==0) {	// deprecated
 				status = do_session(lv,ts,ptr+8);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'E':
@@ -565,21 +604,21 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"EMPTYRESERVED",13)==0) {
 				status = do_emptyreserved(lv,ts,ptr+13);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'F':
 			if (strncmp(ptr,"FREEINODES",10)==0) {
 				status = do_freeinodes(lv,ts,ptr+10);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'I':
 			if (strncmp(ptr,"INCVERSION",10)==0) {
 				status = do_incversion(lv,ts,ptr+10);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'L':
@@ -588,21 +627,21 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"LINK",4)==0) {
 				status = do_link(lv,ts,ptr+4);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'M':
 			if (strncmp(ptr,"MOVE",4)==0) {
 				status = do_move(lv,ts,ptr+4);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'P':
 			if (strncmp(ptr,"PURGE",5)==0) {
 				status = do_purge(lv,ts,ptr+5);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'R':
@@ -611,7 +650,7 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"REPAIR",6)==0) {
 				status = do_repair(lv,ts,ptr+6);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'S':
@@ -630,14 +669,14 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"SESSION",7)==0) {
 				status = do_session(lv,ts,ptr+7);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'T':
 			if (strncmp(ptr,"TRUNC",5)==0) {
 				status = do_trunc(lv,ts,ptr+5);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'U':
@@ -648,18 +687,27 @@ uint8_t restore_line(uint64_t lv,char *line) {
 			} else if (strncmp(ptr,"UNLOCK",6)==0) {
 				status = do_unlock(lv,ts,ptr+6);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		case 'W':
 			if (strncmp(ptr,"WRITE",5)==0) {
 				status = do_write(lv,ts,ptr+5);
 			} else {
-				printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
+			}
+			break;
+		case 'X':
+			if (strncmp(ptr,"XORGROUP",8)==0) {
+				status = do_xorgroup(lv,ts,ptr+8);
+			} else if (strncmp(ptr,"XORRELEASE",10)==0) {
+				status = do_xorrelease(lv,ts,ptr+10);
+			} else {
+				printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 			}
 			break;
 		default:
-			printf("%"PRIu64": unknown entry '%s'\n",lv,ptr);
+			printf("%"PRIu64": unknown entry '%.*s'\n",lv,LINELENG(ptr),ptr);
 	}
 	if (status!=STATUS_OK) {
 		printf("%"PRIu64": error: %"PRIu8" (%s)\n",lv,status,errormsgs[status]);
@@ -676,7 +724,7 @@ int restore(uint64_t lv,char *ptr) {
 		lastv = lv-1;
 	}
 	if (vlevel>1) {
-		printf("current meta version: %"PRIu64" ; previous changeid: %"PRIu64" ; current changeid: %"PRIu64" ; change data%s",v,lastv,lv,ptr);
+		printf("current meta version: %"PRIu64" ; previous changeid: %"PRIu64" ; current changeid: %"PRIu64" ; change data%.*s\n",v,lastv,lv,LINELENG(ptr),ptr);
 	}
 	if (lv<lastv) {
 		printf("merge error - possibly corrupted input file - ignore entry\n");
@@ -691,7 +739,7 @@ int restore(uint64_t lv,char *ptr) {
 			return -1;
 		} else {
 			if (vlevel>0) {
-				printf("change%s",ptr);
+				printf("change%.*s\n",LINELENG(ptr),ptr);
 			}
 			if (restore_line(lv,ptr)!=STATUS_OK) {
 				return -1;
@@ -21,6 +21,7 @@
 
 #include <inttypes.h>
 
+uint8_t restore_line(uint64_t lv,char *line);
 int restore(uint64_t lv,char *ptr);
 void restore_setverblevel(uint8_t _vlevel);
 
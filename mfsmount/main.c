@@ -122,6 +122,8 @@ struct mfsopts {
 	char *masterhost;
 	char *masterport;
 	char *bindhost;
+	char *followerhost;
+	char *followerport;
 	char *subfolder;
 	char *password;
 	char *md5pass;
@@ -165,6 +167,8 @@ static struct fuse_opt mfs_opts[] = {
 	MFS_OPT("mfsmaster=%s", masterhost, 0),
 	MFS_OPT("mfsport=%s", masterport, 0),
 	MFS_OPT("mfsbind=%s", bindhost, 0),
+	MFS_OPT("mfsfollower=%s", followerhost, 0),
+	MFS_OPT("mfsfollowerport=%s", followerport, 0),
 	MFS_OPT("mfssubfolder=%s", subfolder, 0),
 	MFS_OPT("mfspassword=%s", password, 0),
 	MFS_OPT("mfsmd5pass=%s", md5pass, 0),
@@ -236,6 +240,8 @@ static void usage(const char *progname) {
 "    -o mfsmaster=HOST           define mfsmaster location (default: mfsmaster)\n"
 "    -o mfsport=PORT             define mfsmaster port number (default: 9421)\n"
 "    -o mfsbind=IP               define source ip address for connections (default: NOT DEFINED - choosen automatically by OS)\n"
+"    -o mfsfollower=HOST         send metadata reads (lookup,getattr,readlink,readdir) to metalogger serving reads (default: NOT DEFINED - all requests go to mfsmaster)\n"
+"    -o mfsfollowerport=PORT     define port number of metalogger serving reads (default: 9425)\n"
 "    -o mfssubfolder=PATH        define subfolder to mount as root (default: /)\n"
 "    -o mfspassword=PASSWORD     authenticate to mfsmaster with password\n"
 "    -o mfsmd5pass=MD5           authenticate to mfsmaster using directly given md5 (only if mfspassword is not defined)\n"
@@ -387,6 +393,10 @@ int mainloop(struct fuse_args *args,const char* mp,int mt,int fg) {
 		fprintf(stderr,"registered to master\n");
 	}
 
+	if (mfsopts.followerhost && mfsopts.meta==0) {
+		fs_init_follower(mfsopts.followerhost,mfsopts.followerport);
+	}
+
 	fprintf(stderr,"mfsmaster accepted connection with parameters: ");
 	j=0;
 	for (i=0 ; i<8 ; i++) {
@@ -733,6 +743,8 @@ int main(int argc, char *argv[]) {
 	mfsopts.masterhost = NULL;
 	mfsopts.masterport = NULL;
 	mfsopts.bindhost = NULL;
+	mfsopts.followerhost = NULL;
+	mfsopts.followerport = NULL;
 	mfsopts.subfolder = NULL;
 	mfsopts.password = NULL;
 	mfsopts.md5pass = NULL;
@@ -781,6 +793,9 @@ int main(int argc, char *argv[]) {
 	if (mfsopts.masterport==NULL) {
 		mfsopts.masterport = strdup("9421");
 	}
+	if (mfsopts.followerport==NULL) {
+		mfsopts.followerport = strdup("9425");
+	}
 	if (mfsopts.subfolder==NULL) {
 		mfsopts.subfolder = strdup("/");
 	}
@@ -823,6 +838,10 @@ int main(int argc, char *argv[]) {
 	if (mfsopts.bindhost) {
 		free(mfsopts.bindhost);
 	}
+	if (mfsopts.followerhost) {
+		free(mfsopts.followerhost);
+	}
+	free(mfsopts.followerport);
 	free(mfsopts.subfolder);
 	stats_term();
 	strerr_term();
@@ -60,6 +60,11 @@ typedef struct _threc {
 
 	uint32_t rcvd_cmd;
 
+	uint8_t flsent;		// packet was sent to follower
+	uint8_t flstatus;	// follower receive status
+	uint8_t flrcvd;		// follower answer was received
+	uint32_t fldeadline;	// time when answer from follower is no longer awaited
+
 	uint32_t packetid;	// thread number
 	struct _threc *next;
 } threc;
@@ -94,6 +99,7 @@ typedef struct _aquired_file {
 #define DEFAULT_INPUT_BUFFSIZE 0x10000
 
 #define RECEIVE_TIMEOUT 10
+#define FOLLOWER_TIMEOUT 2
 
 static threc *threchead=NULL;
 
@@ -106,7 +112,7 @@ static int sessionlost;
 
 static uint32_t maxretries;
 
-static pthread_t rpthid,npthid;
+static pthread_t rpthid,npthid,fpthid;
 static pthread_mutex_t fdlock,reclock,aflock;
 
 static uint32_t sessionid;
@@ -119,6 +125,22 @@ static uint32_t srcip=0;
 
 static uint8_t fterm;
 
+// metadata version known to include all changes made by this client (sent by master)
+static uint64_t metaversion;
+static pthread_mutex_t mvlock;
+
+// follower - metalogger serving reads from live metadata
+static char *followerhost=NULL;
+static char *followerport=NULL;
+static int flfd;
+static uint8_t fldisconnect;	// sending failed - receiver thread closes connection
+static uint8_t flconnecting;
+static uint8_t flterm;
+static uint64_t flminversion;	// minversion already sent to follower
+static time_t flnextconnect;
+static pthread_mutex_t fllock;
+static pthread_cond_t flcond;
+
 void fs_getmasterlocation(uint8_t loc[10]) {
 	put32bit(&loc,masterip);
 	put16bit(&loc,masterport);
@@ -298,6 +320,10 @@ threc* fs_get_my_threc() {
 	rec->rcvd = 0;
 	rec->waiting = 0;
 	rec->rcvd_cmd = 0;
+	rec->flsent = 0;
+	rec->flstatus = 0;
+	rec->flrcvd = 0;
+	rec->fldeadline = 0;
 	if (threchead==NULL) {
 		rec->packetid = 1;
 	} else {
@@ -446,6 +472,265 @@ const uint8_t* fs_sendandreceive(threc *rec,uint32_t expected_cmd,uint32_t *answ
 	return NULL;
 }
 
+// connects and registers in follower using current session id ; returns socket or -1
+static int fs_follower_connect(void) {
+	uint32_t flip;
+	uint16_t flport;
+	uint8_t regbuff[8+73];
+	uint8_t *wptr;
+	const uint8_t *rptr;
+	uint32_t cmd,size;
+	int nfd;
+
+	if (tcpresolve(followerhost,followerport,&flip,&flport,0)<0) {
+		syslog(LOG_WARNING,"can't resolve follower hostname and/or portname (%s:%s)",followerhost,followerport);
+		return -1;
+	}
+	nfd = tcpsocket();
+	tcpnodelay(nfd);
+	if (srcip>0 && tcpnumbind(nfd,srcip,0)<0) {
+		tcpclose(nfd);
+		return -1;
+	}
+	if (tcpnumtoconnect(nfd,flip,flport,1000)<0) {
+		syslog(LOG_WARNING,"can't connect to follower (%s:%s)",followerhost,followerport);
+		tcpclose(nfd);
+		return -1;
+	}
+	wptr = regbuff;
+	put32bit(&wptr,CUTOMA_FUSE_REGISTER);
+	put32bit(&wptr,73);
+	memcpy(wptr,FUSE_REGISTER_BLOB_ACL,64);
+	wptr+=64;
+	put8bit(&wptr,REGISTER_FOLLOWER);
+	put32bit(&wptr,sessionid);
+	put16bit(&wptr,VERSMAJ);
+	put8bit(&wptr,VERSMID);
+	put8bit(&wptr,VERSMIN);
+	if (tcptowrite(nfd,regbuff,8+73,1000)!=8+73 || tcptoread(nfd,regbuff,8,1000)!=8) {
+		tcpclose(nfd);
+		return -1;
+	}
+	rptr = regbuff;
+	cmd = get32bit(&rptr);
+	size = get32bit(&rptr);
+	if (cmd!=MATOCU_FUSE_REGISTER || (size!=1 && size!=8) || tcptoread(nfd,regbuff,size,1000)!=(int32_t)size) {
+		tcpclose(nfd);
+		return -1;
+	}
+	if (size==1) {	// usually session not known yet by follower
+		tcpclose(nfd);
+		return -1;
+	}
+	return nfd;
+}
+
+// sends packet prepared for master to follower and waits for answer passed by follower receiver thread
+// fllock is not held while waiting ; returns NULL when answer should be taken from master
+const uint8_t* fs_sendandreceive_follower(threc *rec,uint32_t expected_cmd,uint32_t *answer_leng) {
+	uint8_t hdr[16];
+	uint8_t *wptr;
+	uint64_t minversion;
+	int nfd;
+
+	if (followerhost==NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&mvlock);
+	minversion = metaversion;
+	pthread_mutex_unlock(&mvlock);
+	pthread_mutex_lock(&fllock);
+	if (flfd<0) {
+		if (flconnecting || time(NULL)<flnextconnect) {
+			pthread_mutex_unlock(&fllock);
+			return NULL;
+		}
+		flconnecting = 1;
+		pthread_mutex_unlock(&fllock);
+		nfd = fs_follower_connect();
+		pthread_mutex_lock(&fllock);
+		flconnecting = 0;
+		if (nfd<0) {
+			flnextconnect = time(NULL)+10;
+			pthread_mutex_unlock(&fllock);
+			return NULL;
+		}
+		flfd = nfd;
+		flminversion = 0;
+		pthread_cond_signal(&flcond);
+	}
+	if (fldisconnect) {
+		pthread_mutex_unlock(&fllock);
+		return NULL;
+	}
+	if (minversion>flminversion) {
+		wptr = hdr;
+		put32bit(&wptr,CUTOMA_FUSE_MINVERSION);
+		put32bit(&wptr,8);
+		put64bit(&wptr,minversion);
+		if (tcptowrite(flfd,hdr,16,1000)!=16) {
+			fldisconnect = 1;
+			pthread_mutex_unlock(&fllock);
+			return NULL;
+		}
+		flminversion = minversion;
+	}
+	pthread_mutex_lock(&(rec->mutex));
+	rec->flsent = 1;
+	rec->flrcvd = 0;
+	rec->fldeadline = time(NULL)+FOLLOWER_TIMEOUT;
+	if (tcptowrite(flfd,rec->obuff,rec->odataleng,1000)!=(int32_t)(rec->odataleng)) {
+		rec->flsent = 0;
+		pthread_mutex_unlock(&(rec->mutex));
+		fldisconnect = 1;
+		pthread_mutex_unlock(&fllock);
+		return NULL;
+	}
+	pthread_mutex_unlock(&fllock);
+	while (rec->flrcvd==0) {
+		rec->waiting = 1;
+		pthread_cond_wait(&(rec->cond),&(rec->mutex));
+		rec->waiting = 0;
+	}
+	if (rec->flstatus!=0 || rec->rcvd_cmd!=expected_cmd) {
+		pthread_mutex_unlock(&(rec->mutex));
+		return NULL;
+	}
+	if (rec->idataleng==1 && rec->ibuff[0]==ERROR_DELAYED) {	// follower is behind - ask master
+		pthread_mutex_unlock(&(rec->mutex));
+		return NULL;
+	}
+	*answer_leng = rec->idataleng;
+	pthread_mutex_unlock(&(rec->mutex));
+	return rec->ibuff;
+}
+
+// wakes threads waiting too long for follower (or all waiting threads when connection is lost) ; returns number of woken threads
+static uint32_t fs_follower_expire(uint8_t all) {
+	threc *rec;
+	uint32_t now,cnt;
+	now = time(NULL);
+	cnt = 0;
+	pthread_mutex_lock(&reclock);
+	for (rec=threchead ; rec ; rec=rec->next) {
+		pthread_mutex_lock(&(rec->mutex));
+		if (rec->flsent && (all || rec->fldeadline<=now)) {
+			rec->flsent = 0;
+			rec->flstatus = 1;
+			rec->flrcvd = 1;
+			if (rec->waiting) {
+				pthread_cond_signal(&(rec->cond));
+			}
+			cnt++;
+		}
+		pthread_mutex_unlock(&(rec->mutex));
+	}
+	pthread_mutex_unlock(&reclock);
+	return cnt;
+}
+
+static void fs_follower_close(int rfd) {
+	pthread_mutex_lock(&fllock);
+	if (flfd==rfd) {
+		tcpclose(flfd);
+		flfd = -1;
+		fldisconnect = 0;
+	}
+	pthread_mutex_unlock(&fllock);
+	fs_follower_expire(1);
+}
+
+// receives answers from follower and passes them to threads by packet id (like fs_receive_thread)
+void* fs_follower_receive_thread(void *arg) {
+	const uint8_t *ptr;
+	uint8_t hdr[12],skipbuff[1024];
+	struct pollfd pfd;
+	threc *rec;
+	uint32_t cmd,size,packetid,leng,lastexpire;
+	int rfd;
+
+	(void)arg;
+	lastexpire = 0;
+	for (;;) {
+		pthread_mutex_lock(&fllock);
+		while (flfd<0 && flterm==0) {
+			pthread_cond_wait(&flcond,&fllock);
+		}
+		if (flterm) {
+			pthread_mutex_unlock(&fllock);
+			return NULL;
+		}
+		rfd = flfd;
+		leng = fldisconnect;
+		pthread_mutex_unlock(&fllock);
+		if (leng) {
+			fs_follower_close(rfd);
+			continue;
+		}
+		if (lastexpire!=(uint32_t)time(NULL)) {
+			lastexpire = time(NULL);
+			if (fs_follower_expire(0)>0) {	// follower doesn't answer - ask master for a while
+				pthread_mutex_lock(&fllock);
+				flnextconnect = time(NULL)+10;
+				pthread_mutex_unlock(&fllock);
+				fs_follower_close(rfd);
+				continue;
+			}
+		}
+		pfd.fd = rfd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd,1,500)<=0 || pfd.revents==0) {
+			continue;
+		}
+		if (tcptoread(rfd,hdr,12,1000)!=12) {	// also idle connection closed by follower
+			fs_follower_close(rfd);
+			continue;
+		}
+		ptr = hdr;
+		cmd = get32bit(&ptr);
+		size = get32bit(&ptr);
+		packetid = get32bit(&ptr);
+		if (size<4) {
+			fs_follower_close(rfd);
+			continue;
+		}
+		size-=4;
+		rec = fs_get_threc_by_id(packetid);
+		if (rec!=NULL) {
+			pthread_mutex_lock(&(rec->mutex));
+			if (rec->flsent) {
+				fs_input_buffer_init(rec,size);
+				if (rec->ibuff==NULL || (size>0 && tcptoread(rfd,rec->ibuff,size,1000)!=(int32_t)size)) {
+					pthread_mutex_unlock(&(rec->mutex));
+					fs_follower_close(rfd);
+					continue;
+				}
+				rec->flsent = 0;
+				rec->flstatus = 0;
+				rec->idataleng = size;
+				rec->rcvd_cmd = cmd;
+				rec->flrcvd = 1;
+				if (rec->waiting) {
+					pthread_cond_signal(&(rec->cond));
+				}
+				pthread_mutex_unlock(&(rec->mutex));
+				continue;
+			}
+			pthread_mutex_unlock(&(rec->mutex));
+		}
+		// late answer - thread has already asked master
+		while (size>0) {
+			leng = (size>1024)?1024:size;
+			if (tcptoread(rfd,skipbuff,leng,1000)!=(int32_t)leng) {
+				fs_follower_close(rfd);
+				break;
+			}
+			size-=leng;
+		}
+	}
+}
+
 /*
 int fs_direct_connect() {
 	int rfd;
@@ -975,6 +1260,21 @@ void* fs_receive_thread(void *arg) {
 			master_stats_inc(MASTER_PACKETSRCVD);
 			continue;
 		}
+		if (cmd==MATOCU_FUSE_METAVERSION && size==12) {
+			r = tcptoread(fd,hdr,8,1000);
+			if (r!=8) {
+				syslog(LOG_WARNING,"master: tcp recv error: %s (3)",strerr(errno));
+				disconnect=1;
+				continue;
+			}
+			master_stats_add(MASTER_BYTESRCVD,8);
+			master_stats_inc(MASTER_PACKETSRCVD);
+			ptr = hdr;
+			pthread_mutex_lock(&mvlock);
+			metaversion = get64bit(&ptr);
+			pthread_mutex_unlock(&mvlock);
+			continue;
+		}
 		if (size<4) {
 			syslog(LOG_WARNING,"master: packet too small");
 			disconnect=1;
@@ -1059,6 +1359,12 @@ int fs_init_master_connection(const char *masterhostname,const char *masterportn
 	return fs_connect(1,masterhostname,masterportname,meta,info,subfolder,passworddigest,flags,rootuid,rootgid,mapalluid,mapallgid);
 }
 
+// called before fork
+void fs_init_follower(const char *flhostname,const char *flportname) {
+	followerhost = strdup(flhostname);
+	followerport = strdup(flportname);
+}
+
 // called after fork
 void fs_init_threads(uint32_t retries) {
 	pthread_attr_t thattr;
@@ -1067,10 +1373,22 @@ void fs_init_threads(uint32_t retries) {
 	pthread_mutex_init(&reclock,NULL);
 	pthread_mutex_init(&fdlock,NULL);
 	pthread_mutex_init(&aflock,NULL);
+	pthread_mutex_init(&mvlock,NULL);
+	pthread_mutex_init(&fllock,NULL);
+	pthread_cond_init(&flcond,NULL);
+	metaversion = 0;
+	flfd = -1;
+	fldisconnect = 0;
+	flconnecting = 0;
+	flterm = 0;
+	flnextconnect = 0;
 	pthread_attr_init(&thattr);
 	pthread_attr_setstacksize(&thattr,0x100000);
 	pthread_create(&rpthid,&thattr,fs_receive_thread,NULL);
 	pthread_create(&npthid,&thattr,fs_nop_thread,NULL);
+	if (followerhost) {
+		pthread_create(&fpthid,&thattr,fs_follower_receive_thread,NULL);
+	}
 	pthread_attr_destroy(&thattr);
 }
 
@@ -1082,7 +1400,17 @@ void fs_term(void) {
 	pthread_mutex_unlock(&fdlock);
 	pthread_join(npthid,NULL);
 	pthread_join(rpthid,NULL);
+	if (followerhost) {
+		pthread_mutex_lock(&fllock);
+		flterm = 1;
+		pthread_cond_signal(&flcond);
+		pthread_mutex_unlock(&fllock);
+		pthread_join(fpthid,NULL);
+	}
 	pthread_mutex_destroy(&aflock);
+	pthread_mutex_destroy(&mvlock);
+	pthread_cond_destroy(&flcond);
+	pthread_mutex_destroy(&fllock);
 	pthread_mutex_destroy(&fdlock);
 	pthread_mutex_destroy(&reclock);
 	for (tr = threchead ; tr ; tr = trn) {
@@ -1112,6 +1440,13 @@ void fs_term(void) {
 	if (fd>=0) {
 		tcpclose(fd);
 	}
+	if (flfd>=0) {
+		tcpclose(flfd);
+	}
+	if (followerhost) {
+		free(followerhost);
+		free(followerport);
+	}
 	free(connect_args.masterhostname);
 	free(connect_args.masterportname);
 	free(connect_args.info);
@@ -1191,7 +1526,10 @@ uint8_t fs_lookup(uint32_t parent,uint8_t nleng,const uint8_t *name,uint32_t uid
 	wptr+=nleng;
 	put32bit(&wptr,uid);
 	put32bit(&wptr,gid);
-	rptr = fs_sendandreceive(rec,MATOCU_FUSE_LOOKUP,&i);
+	rptr = fs_sendandreceive_follower(rec,MATOCU_FUSE_LOOKUP,&i);
+	if (rptr==NULL) {
+		rptr = fs_sendandreceive(rec,MATOCU_FUSE_LOOKUP,&i);
+	}
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
@@ -1223,7 +1561,10 @@ uint8_t fs_getattr(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t attr[35]) {
 	put32bit(&wptr,inode);
 	put32bit(&wptr,uid);
 	put32bit(&wptr,gid);
-	rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETATTR,&i);
+	rptr = fs_sendandreceive_follower(rec,MATOCU_FUSE_GETATTR,&i);
+	if (rptr==NULL) {
+		rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETATTR,&i);
+	}
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
@@ -1320,7 +1661,10 @@ uint8_t fs_readlink(uint32_t inode,const uint8_t **path) {
 		return ERROR_IO;
 	}
 	put32bit(&wptr,inode);
-	rptr = fs_sendandreceive(rec,MATOCU_FUSE_READLINK,&i);
+	rptr = fs_sendandreceive_follower(rec,MATOCU_FUSE_READLINK,&i);
+	if (rptr==NULL) {
+		rptr = fs_sendandreceive(rec,MATOCU_FUSE_READLINK,&i);
+	}
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
@@ -1607,7 +1951,10 @@ uint8_t fs_getdir(uint32_t inode,uint32_t uid,uint32_t gid,const uint8_t **dbuff
 	put32bit(&wptr,inode);
 	put32bit(&wptr,uid);
 	put32bit(&wptr,gid);
-	rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETDIR,&i);
+	rptr = fs_sendandreceive_follower(rec,MATOCU_FUSE_GETDIR,&i);
+	if (rptr==NULL) {
+		rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETDIR,&i);
+	}
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
@@ -1634,7 +1981,10 @@ uint8_t fs_getdir_plus(uint32_t inode,uint32_t uid,uint32_t gid,const uint8_t **
 	put32bit(&wptr,uid);
 	put32bit(&wptr,gid);
 	put8bit(&wptr,GETDIR_FLAG_WITHATTR);
-	rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETDIR,&i);
+	rptr = fs_sendandreceive_follower(rec,MATOCU_FUSE_GETDIR,&i);
+	if (rptr==NULL) {
+		rptr = fs_sendandreceive(rec,MATOCU_FUSE_GETDIR,&i);
+	}
 	if (rptr==NULL) {
 		ret = ERROR_IO;
 	} else if (i==1) {
@@ -1810,6 +2160,39 @@ uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chu
 	return ret;
 }
 
+uint8_t fs_readxorchunks(uint32_t inode,uint32_t indx,uint64_t *chunkid,const uint8_t **xordata,uint32_t *xordatasize) {
+	uint8_t *wptr;
+	const uint8_t *rptr;
+	uint32_t i;
+	uint8_t ret;
+	threc *rec = fs_get_my_threc();
+	*xordata=NULL;
+	*xordatasize=0;
+	wptr = fs_createpacket(rec,CUTOMA_FUSE_READ_XOR_CHUNKS,8);
+	if (wptr==NULL) {
+		return ERROR_IO;
+	}
+	put32bit(&wptr,inode);
+	put32bit(&wptr,indx);
+	rptr = fs_sendandreceive(rec,MATOCU_FUSE_READ_XOR_CHUNKS,&i);
+	if (rptr==NULL) {
+		ret = ERROR_IO;
+	} else if (i==1) {
+		ret = rptr[0];
+	} else if (i<8) {
+		pthread_mutex_lock(&fdlock);
+		disconnect = 1;
+		pthread_mutex_unlock(&fdlock);
+		ret = ERROR_IO;
+	} else {
+		*chunkid = get64bit(&rptr);
+		*xordata = rptr;
+		*xordatasize = i-8;
+		ret = STATUS_OK;
+	}
+	return ret;
+}
+
 uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize) {
 	uint8_t *wptr;
 	const uint8_t *rptr;
@@ -52,6 +52,7 @@ uint8_t fs_opencheck(uint32_t inode,uint32_t uid,uint32_t gid,uint8_t flags,uint
 void fs_release(uint32_t inode);
 
 uint8_t fs_readchunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize);
+uint8_t fs_readxorchunks(uint32_t inode,uint32_t indx,uint64_t *chunkid,const uint8_t **xordata,uint32_t *xordatasize);
 uint8_t fs_writechunk(uint32_t inode,uint32_t indx,uint64_t *length,uint64_t *chunkid,uint32_t *version,const uint8_t **csdata,uint32_t *csdatasize);
 uint8_t fs_writeend(uint64_t chunkid, uint32_t inode, uint64_t length);
 
@@ -70,6 +71,8 @@ uint8_t fs_purge(uint32_t inode);
 
 // called before fork
 int fs_init_master_connection(const char *masterhostname,const char *masterportname,const char *bindhost,uint8_t meta,const char *info,const char *subfolder,const uint8_t passworddigest[16],uint8_t donotrememberpassword,uint8_t *flags,uint32_t *rootuid,uint32_t *rootgid,uint32_t *mapalluid,uint32_t *mapallgid);
+// called before fork (optional)
+void fs_init_follower(const char *flhostname,const char *flportname);
 // called after fork
 void fs_init_threads(uint32_t retries);
 void fs_term(void);
@@ -59,6 +59,8 @@ typedef struct _readrec {
 	uint32_t ip;			// this->locked
 	uint16_t port;			// this->locked
 	int fd;				// this->locked
+	uint8_t *xordata;		// this->locked (chunk without available copies is read as xor of other chunks from its xor group)
+	uint32_t xordatasize;		// this->locked
 	uint8_t refcnt;			// glock
 	uint8_t noaccesscnt;		// glock
 	uint8_t valid;			// glock
@@ -139,6 +141,8 @@ void* read_data_new(uint32_t inode) {
 	rrec->chunkid = 0;
 	rrec->version = 0;
 	rrec->fd = -1;
+	rrec->xordata = NULL;
+	rrec->xordatasize = 0;
 	rrec->ip = 0;
 	rrec->port = 0;
 	rrec->refcnt = 0;
@@ -179,6 +183,9 @@ void read_data_end(void* rr) {
 	if (rrec->rbuff!=NULL) {
 		free(rrec->rbuff);
 	}
+	if (rrec->xordata!=NULL) {
+		free(rrec->xordata);
+	}
 
 	pthread_mutex_lock(&glock);
 	if (rrec->waiting) {
@@ -222,12 +229,53 @@ void read_data_term(void) {
 			if (rr->rbuff) {
 				free(rr->rbuff);
 			}
+			if (rr->xordata) {
+				free(rr->xordata);
+			}
 			pthread_cond_destroy(&(rr->cond));
 			free(rr);
 		}
 	}
 }
 
+static int read_data_connect(uint32_t ip,uint16_t port) {
+	uint32_t srcip;
+	uint32_t cnt;
+	int fd;
+
+	srcip = fs_getsrcip();
+	fd = -1;
+	cnt=5;
+	while (cnt>0) {
+		fd = tcpsocket();
+		if (fd<0) {
+			syslog(LOG_WARNING,"can't create tcp socket: %s",strerr(errno));
+			return -1;
+		}
+		if (srcip) {
+			if (tcpnumbind(fd,srcip,0)<0) {
+				syslog(LOG_WARNING,"can't bind to given ip: %s",strerr(errno));
+				tcpclose(fd);
+				return -1;
+			}
+		}
+		if (tcpnumtoconnect(fd,ip,port,200)<0) {
+			cnt--;
+			if (cnt==0) {
+				syslog(LOG_WARNING,"can't connect to (%08"PRIX32":%"PRIu16"): %s",ip,port,strerr(errno));
+			}
+			tcpclose(fd);
+			fd=-1;
+		} else {
+			cnt=0;
+		}
+	}
+	if (fd>=0 && tcpnodelay(fd)<0) {
+		syslog(LOG_WARNING,"can't set TCP_NODELAY: %s",strerr(errno));
+	}
+	return fd;
+}
+
 static int read_data_refresh_connection(readrec *rrec) {
 	uint32_t ip,tmpip;
 	uint16_t port,tmpport;
@@ -235,7 +283,6 @@ static int read_data_refresh_connection(readrec *rrec) {
 	const uint8_t *csdata;
 	uint32_t csdatasize;
 	uint8_t status;
-	uint32_t srcip;
 
 //	fprintf(stderr,"read_data_refresh_connection (%p)\n",rrec);
 	if (rrec->fd>=0) {
@@ -243,6 +290,11 @@ static int read_data_refresh_connection(readrec *rrec) {
 		tcpclose(rrec->fd);
 		rrec->fd = -1;
 	}
+	if (rrec->xordata!=NULL) {
+		free(rrec->xordata);
+		rrec->xordata = NULL;
+		rrec->xordatasize = 0;
+	}
 	status = fs_readchunk(rrec->inode,rrec->indx,&(rrec->fleng),&(rrec->chunkid),&(rrec->version),&csdata,&csdatasize);
 	if (status!=0) {
 		syslog(LOG_WARNING,"file: %"PRIu32", index: %"PRIu32", chunk: %"PRIu64", version: %"PRIu32" - fs_readchunk returns status %"PRIu8,rrec->inode,rrec->indx,rrec->chunkid,rrec->version,status);
@@ -281,42 +333,11 @@ static int read_data_refresh_connection(readrec *rrec) {
 	rrec->ip = ip;
 	rrec->port = port;
 
-	srcip = fs_getsrcip();
-	cnt=5;
-	while (cnt>0) {
-		rrec->fd = tcpsocket();
-		if (rrec->fd<0) {
-			syslog(LOG_WARNING,"can't create tcp socket: %s",strerr(errno));
-			cnt=0;
-		}
-		if (srcip) {
-			if (tcpnumbind(rrec->fd,srcip,0)<0) {
-				syslog(LOG_WARNING,"can't bind to given ip: %s",strerr(errno));
-				tcpclose(rrec->fd);
-				rrec->fd=-1;
-				cnt=0;
-				break;
-			}
-		}
-		if (tcpnumtoconnect(rrec->fd,ip,port,200)<0) {
-			cnt--;
-			if (cnt==0) {
-				syslog(LOG_WARNING,"can't connect to (%08"PRIX32":%"PRIu16"): %s",ip,port,strerr(errno));
-			}
-			tcpclose(rrec->fd);
-			rrec->fd=-1;
-		} else {
-			cnt=0;
-		}
-	}
+	rrec->fd = read_data_connect(ip,port);
 	if (rrec->fd<0) {
 		return EIO;
 	}
 
-	if (tcpnodelay(rrec->fd)<0) {
-		syslog(LOG_WARNING,"can't set TCP_NODELAY: %s",strerr(errno));
-	}
-
 	csdb_readinc(rrec->ip,rrec->port);
 	pthread_mutex_lock(&glock);
 	rrec->refcnt = 0;
@@ -324,6 +345,94 @@ static int read_data_refresh_connection(readrec *rrec) {
 	return 0;
 }
 
+// chunk has no available copies - get other chunks from its xor group (if any)
+static int read_data_xor_refresh(readrec *rrec) {
+	uint64_t chunkid;
+	const uint8_t *xordata;
+	uint32_t xordatasize;
+	uint8_t status;
+
+	if (rrec->chunkid==0) {
+		return -1;
+	}
+	status = fs_readxorchunks(rrec->inode,rrec->indx,&chunkid,&xordata,&xordatasize);
+	if (status!=STATUS_OK || chunkid!=rrec->chunkid || xordatasize<13) {
+		return -1;
+	}
+	rrec->xordata = malloc(xordatasize);
+	if (rrec->xordata==NULL) {
+		return -1;
+	}
+	memcpy(rrec->xordata,xordata,xordatasize);
+	rrec->xordatasize = xordatasize;
+	syslog(LOG_NOTICE,"file: %"PRIu32", index: %"PRIu32", chunk: %"PRIu64", version: %"PRIu32" - no available copies, reading from xor group",rrec->inode,rrec->indx,rrec->chunkid,rrec->version);
+	pthread_mutex_lock(&glock);
+	rrec->refcnt = 0;
+	pthread_mutex_unlock(&glock);
+	return 0;
+}
+
+// degraded read - data = xor of the same range read from all other chunks of xor group (parity included)
+static int read_data_xor(readrec *rrec,uint32_t offset,uint32_t size,uint8_t *buff) {
+	const uint8_t *rptr;
+	uint32_t leftsize;
+	uint64_t chunkid;
+	uint32_t version;
+	uint32_t ip;
+	uint16_t port;
+	uint8_t cnt;
+	uint8_t first;
+	uint8_t *xbuff;
+	uint32_t i;
+	int fd,r;
+
+	xbuff = malloc(size);
+	if (xbuff==NULL) {
+		return -1;
+	}
+	rptr = rrec->xordata;
+	leftsize = rrec->xordatasize;
+	first = 1;
+	while (leftsize>=13) {
+		chunkid = get64bit(&rptr);
+		version = get32bit(&rptr);
+		cnt = get8bit(&rptr);
+		leftsize -= 13;
+		if (leftsize<cnt*6U) {
+			break;
+		}
+		leftsize -= cnt*6U;
+		r = -1;
+		while (cnt>0 && r<0) {
+			ip = get32bit(&rptr);
+			port = get16bit(&rptr);
+			cnt--;
+			fd = read_data_connect(ip,port);
+			if (fd>=0) {
+				csdb_readinc(ip,port);
+				r = cs_readblock(fd,chunkid,version,offset,size,first?buff:xbuff);
+				csdb_readdec(ip,port);
+				tcpclose(fd);
+			}
+		}
+		rptr += cnt*6U;
+		if (r<0) {
+			syslog(LOG_WARNING,"file: %"PRIu32", index: %"PRIu32", chunk: %"PRIu64" - can't read xor group chunk: %"PRIu64", version: %"PRIu32,rrec->inode,rrec->indx,rrec->chunkid,chunkid,version);
+			free(xbuff);
+			return -1;
+		}
+		if (first) {
+			first = 0;
+		} else {
+			for (i=0 ; i<size ; i++) {
+				buff[i] ^= xbuff[i];
+			}
+		}
+	}
+	free(xbuff);
+	return (first || leftsize>0)?-1:0;
+}
+
 void read_inode_ops(uint32_t inode) {	// attributes of inode have been changed - force reconnect
 	readrec *rrec;
 	pthread_mutex_lock(&glock);
@@ -358,13 +467,20 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 	}
 	rrec->waiting--;
 	rrec->locked=1;
-	forcereconnect = (rrec->fd>=0 && rrec->refcnt==REFRESHTICKS)?1:0;
+	forcereconnect = ((rrec->fd>=0 || rrec->xordata!=NULL) && rrec->refcnt==REFRESHTICKS)?1:0;
 	pthread_mutex_unlock(&glock);
 
 	if (forcereconnect) {
-		csdb_readdec(rrec->ip,rrec->port);
-		tcpclose(rrec->fd);
-		rrec->fd=-1;
+		if (rrec->fd>=0) {
+			csdb_readdec(rrec->ip,rrec->port);
+			tcpclose(rrec->fd);
+			rrec->fd=-1;
+		}
+		if (rrec->xordata!=NULL) {	// check if chunk has been rebuilt
+			free(rrec->xordata);
+			rrec->xordata = NULL;
+			rrec->xordatasize = 0;
+		}
 	}
 
 	if (*size==0) {
@@ -399,7 +515,7 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 	currsize = *size;
 	while (currsize>0) {
 		indx = (curroff>>26);
-		if (rrec->fd<0 || rrec->indx != indx) {
+		if ((rrec->fd<0 && rrec->xordata==NULL) || rrec->indx != indx) {
 			rrec->indx = indx;
 			while (cnt<maxretries) {
 				cnt++;
@@ -407,6 +523,10 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 				if (err==0) {
 					break;
 				}
+				if ((err==ENXIO || err==EIO) && read_data_xor_refresh(rrec)==0) {
+					err = 0;
+					break;
+				}
 				syslog(LOG_WARNING,"file: %"PRIu32", index: %"PRIu32" - can't connect to proper chunkserver (try counter: %"PRIu32")",rrec->inode,rrec->indx,cnt);
 				if (err==EBADF) {	// no such inode - it's unrecoverable error
 					if (eb) {
@@ -452,7 +572,19 @@ int read_data(void *rr, uint64_t offset, uint32_t *size, uint8_t **buff) {
 		} else {
 			chunksize = currsize;
 		}
-		if (rrec->chunkid>0) {
+		if (rrec->chunkid>0 && rrec->fd<0) {
+			if (read_data_xor(rrec,chunkoffset,chunksize,buffptr)<0) {
+				syslog(LOG_WARNING,"file: %"PRIu32", index: %"PRIu32", chunk: %"PRIu64", version: %"PRIu32" - xor group read error (try counter: %"PRIu32")",rrec->inode,rrec->indx,rrec->chunkid,rrec->version,cnt);
+				free(rrec->xordata);
+				rrec->xordata = NULL;
+				rrec->xordatasize = 0;
+				sleep(1+(cnt<30)?(cnt/3):10);
+			} else {
+				curroff+=chunksize;
+				currsize-=chunksize;
+				buffptr+=chunksize;
+			}
+		} else if (rrec->chunkid>0) {
 			// fprintf(stderr,"(%d,%"PRIu64",%"PRIu32",%"PRIu32",%"PRIu32",%p)\n",rrec->fd,rrec->chunkid,rrec->version,chunkoffset,chunksize,buffptr);
 			if (cs_readblock(rrec->fd,rrec->chunkid,rrec->version,chunkoffset,chunksize,buffptr)<0) {
 				syslog(LOG_WARNING,"file: %"PRIu32", index: %"PRIu32", chunk: %"PRIu64", version: %"PRIu32", cs: %08"PRIX32":%"PRIu16" - readblock error (try counter: %"PRIu32")",rrec->inode,rrec->indx,rrec->chunkid,rrec->version,rrec->ip,rrec->port,cnt);